@@ -0,0 +1,451 @@
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/rbtree.h>
+#include <linux/buffer_head.h>
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#include "balloc.h"
+#include "journal.h"
+#include "discard.h"
+#endif
+
+/*
+ * 数据区空闲空间：每个数据块在位图里占一位，位图块走块设备的 buffer cache。
+ * 分配都在 alloc_lock 下进行，块号是相对 data_start 的数据区块号。
+ * 分配本来就靠 alloc_lock 串行，free_blocks 不必按 CPU 拆开，statfs 用 READ_ONCE 读即可。
+ *
+ * 释放的块在位图里马上清掉，但在释放所在的事务检查点之前不再分出去，按段记在 busy_tree 里：
+ * 目录子项日志块和 extent 溢出块在日志里还有记录，重放会把旧记录写回这些块；
+ * 释放的事务没提交就崩溃时，块也还属于原来的文件。分配时跳过这些段，
+ * 日志尾推过它们的事务以后下一次分配顺手清掉。
+ */
+
+struct balloc_busy
+{
+	struct rb_node node;
+	uint32_t start;                     /* 数据区块号 */
+	uint32_t len;
+	uint64_t tid;                       /* 释放所在的事务 */
+};
+
+static inline uint32_t balloc_group_bits(struct himfs_sb_info *himfs_sb, uint32_t group)
+{
+	uint32_t start = group * HIMFS_BITS_PER_BITMAP;
+
+	return min_t(uint32_t, HIMFS_BITS_PER_BITMAP, himfs_sb->data_blocks - start);
+}
+
+/* 挂载时调用：上次没有正常卸载时按位图重新统计空闲块数 */
+int himfs_balloc_init(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct buffer_head *bh;
+	uint64_t free = 0;
+	uint32_t group;
+
+	mutex_init(&himfs_sb->alloc_lock);
+	himfs_sb->alloc_rotor = 1;
+	himfs_sb->busy_tree = RB_ROOT;
+	himfs_sb->free_blocks = himfs_sb->hsb->s_free_blocks;
+
+	if (!himfs_sb->unclean)
+	{
+		return 0;
+	}
+
+	for (group = 0; group < himfs_sb->bitmap_blocks; ++group)
+	{
+		bh = sb_bread(sb, himfs_sb->bitmap_start + group);
+		if (unlikely(!bh))
+		{
+			printk(KERN_ERR "himfs: read bitmap block %u fail\n", group);
+			return -EIO;
+		}
+
+		/* 最后一个位图块超出数据区的位由 mkfs 置 1，整块统计即可 */
+		free += HIMFS_BITS_PER_BITMAP - memweight(bh->b_data, 1 << BLOCK_SHIFT);
+		brelse(bh);
+	}
+
+	WRITE_ONCE(himfs_sb->free_blocks, free);
+	printk(KERN_INFO "himfs: recounted %llu free data blocks\n", himfs_sb->free_blocks);
+
+	return 0;
+}
+
+void himfs_balloc_exit(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct balloc_busy *r, *tmp;
+
+	rbtree_postorder_for_each_entry_safe(r, tmp, &himfs_sb->busy_tree, node)
+	{
+		kfree(r);
+	}
+	himfs_sb->busy_tree = RB_ROOT;
+	himfs_sb->busy_blocks = 0;
+}
+
+/* 和 [start, end) 重叠的第一段 */
+static struct balloc_busy *busy_first(struct himfs_sb_info *himfs_sb, uint32_t start, uint32_t end)
+{
+	struct rb_node *n = himfs_sb->busy_tree.rb_node;
+	struct balloc_busy *r, *found = NULL;
+
+	while (n)
+	{
+		r = rb_entry(n, struct balloc_busy, node);
+		if (r->start + r->len <= start)
+		{
+			n = n->rb_right;
+		}
+		else
+		{
+			found = r;
+			n = n->rb_left;
+		}
+	}
+
+	return found && found->start < end ? found : NULL;
+}
+
+static void busy_link(struct himfs_sb_info *himfs_sb, struct balloc_busy *new)
+{
+	struct rb_node **p = &himfs_sb->busy_tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p)
+	{
+		parent = *p;
+		if (new->start < rb_entry(parent, struct balloc_busy, node)->start)
+		{
+			p = &parent->rb_left;
+		}
+		else
+		{
+			p = &parent->rb_right;
+		}
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &himfs_sb->busy_tree);
+}
+
+/* 记下刚释放的 [start, start + len)，和同一个事务里释放的相邻段合并 */
+static void busy_add(struct himfs_sb_info *himfs_sb, uint32_t start, uint32_t len, uint64_t tid)
+{
+	struct balloc_busy *prev, *next, *new;
+
+	/* 重复释放，balloc 已经报过错，不再记 */
+	if (busy_first(himfs_sb, start, start + len))
+	{
+		return;
+	}
+
+	prev = start ? busy_first(himfs_sb, start - 1, start) : NULL;
+	next = busy_first(himfs_sb, start + len, start + len + 1);
+	if (prev && prev->tid != tid)
+	{
+		prev = NULL;
+	}
+	if (next && next->tid != tid)
+	{
+		next = NULL;
+	}
+
+	if (prev)
+	{
+		prev->len += len;
+		if (next)
+		{
+			prev->len += next->len;
+			rb_erase(&next->node, &himfs_sb->busy_tree);
+			kfree(next);
+		}
+	}
+	else if (next)
+	{
+		next->start = start;
+		next->len += len;
+	}
+	else
+	{
+		new = kmalloc(sizeof(*new), GFP_NOFS | __GFP_NOFAIL);
+		new->start = start;
+		new->len = len;
+		new->tid = tid;
+		busy_link(himfs_sb, new);
+	}
+	himfs_sb->busy_blocks += len;
+}
+
+/* 日志尾推过之后，它之前的事务释放的段可以再分配了 */
+static void busy_prune(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	uint64_t tail = himfs_journal_checkpointed(sb);
+	struct rb_node *n, *next;
+	struct balloc_busy *r;
+
+	if (!himfs_sb->busy_blocks || tail == himfs_sb->busy_tail)
+	{
+		return;
+	}
+	himfs_sb->busy_tail = tail;
+
+	for (n = rb_first(&himfs_sb->busy_tree); n; n = next)
+	{
+		next = rb_next(n);
+		r = rb_entry(n, struct balloc_busy, node);
+		if (r->tid < tail)
+		{
+			rb_erase(n, &himfs_sb->busy_tree);
+			himfs_sb->busy_blocks -= r->len;
+			kfree(r);
+		}
+	}
+}
+
+/* 从 pblk 起的 *run 个空闲块开头还压着时返回要跳过的块数，否则把 *run 截到下一段之前 */
+static uint32_t busy_clip(struct himfs_sb_info *himfs_sb, uint32_t pblk, uint32_t *run)
+{
+	struct balloc_busy *r;
+
+	if (!himfs_sb->busy_blocks)
+	{
+		return 0;
+	}
+
+	r = busy_first(himfs_sb, pblk, pblk + *run);
+	if (!r)
+	{
+		return 0;
+	}
+	if (r->start <= pblk)
+	{
+		return r->start + r->len - pblk;
+	}
+	*run = r->start - pblk;
+
+	return 0;
+}
+
+/* 分配失败时调用者据此决定要不要等一次检查点再试 */
+bool himfs_balloc_busy(struct super_block *sb)
+{
+	return READ_ONCE(HIMFS_SB(sb)->busy_blocks) != 0;
+}
+
+/* 在位图块 bh 中从 start 起找第一段空闲位，返回段首，*run 为段长（不超过 limit） */
+static uint32_t balloc_find_run(struct buffer_head *bh, uint32_t bits, uint32_t start,
+				uint32_t limit, uint32_t *run)
+{
+	uint32_t first, end;
+
+	first = find_next_zero_bit_le(bh->b_data, bits, start);
+	if (first >= bits)
+	{
+		*run = 0;
+		return bits;
+	}
+
+	end = find_next_bit_le(bh->b_data, min_t(uint32_t, bits, first + limit), first);
+	*run = end - first;
+
+	return first;
+}
+
+/* 只把改到的那几个字节记进日志 */
+static void balloc_log(struct buffer_head *bh, uint32_t first, uint32_t n)
+{
+	himfs_journal_dirty(bh, first / 8, (first + n - 1) / 8 - first / 8 + 1);
+}
+
+static void balloc_take(struct super_block *sb, struct buffer_head *bh, uint32_t first, uint32_t run)
+{
+	uint32_t i;
+
+	for (i = first; i < first + run; ++i)
+	{
+		__set_bit_le(i, bh->b_data);
+	}
+	balloc_log(bh, first, run);
+	WRITE_ONCE(HIMFS_SB(sb)->free_blocks, HIMFS_SB(sb)->free_blocks - run);
+}
+
+/*
+ * 分配最多 *len 个连续块，*pblk 返回起始块号，*len 返回实际分到的块数，goal 为 0 表示不指定。
+ * 先试 goal 处能否接着放；不行就从 goal 往后找一段不短于 *len 的空闲段，
+ * 扫描 HIMFS_ALLOC_SCAN 个位图块还找不到时退而取其中最长的一段，都没有再继续往后找任意空闲块。
+ */
+int himfs_new_blocks(struct super_block *sb, uint32_t goal, uint32_t *len, uint32_t *pblk)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct buffer_head *bh, *best_bh = NULL;
+	uint32_t want = *len, best_run = 0, best_first = 0;
+	uint32_t group, start, bits, first, run, scanned, skip;
+	bool rotor;
+	int err = -ENOSPC;
+
+	mutex_lock(&himfs_sb->alloc_lock);
+	busy_prune(sb);
+
+	if (himfs_sb->free_blocks == 0)
+	{
+		goto out;
+	}
+
+	/* 没有上一段可接的新文件从 alloc_rotor 开始，依次往后放 */
+	rotor = goal == 0;
+	if (rotor)
+	{
+		goal = himfs_sb->alloc_rotor;
+	}
+	if (goal >= himfs_sb->data_blocks)
+	{
+		goal = 1;
+	}
+
+	group = goal / HIMFS_BITS_PER_BITMAP;
+	start = goal % HIMFS_BITS_PER_BITMAP;
+
+	for (scanned = 0; scanned <= himfs_sb->bitmap_blocks; ++scanned)
+	{
+		bh = sb_bread(sb, himfs_sb->bitmap_start + group);
+		if (unlikely(!bh))
+		{
+			brelse(best_bh);
+			err = -EIO;
+			goto out;
+		}
+
+		bits = balloc_group_bits(himfs_sb, group);
+		while (start < bits)
+		{
+			first = balloc_find_run(bh, bits, start, want, &run);
+			if (!run)
+			{
+				break;
+			}
+			skip = busy_clip(himfs_sb, group * HIMFS_BITS_PER_BITMAP + first, &run);
+			if (skip)
+			{
+				start = first + skip;
+				continue;
+			}
+
+			/* 正好接在 goal 上，或者够长，直接用 */
+			if ((scanned == 0 && first == goal % HIMFS_BITS_PER_BITMAP) || run == want)
+			{
+				brelse(best_bh);
+				best_bh = bh;
+				best_first = first;
+				best_run = run;
+				goto found;
+			}
+
+			if (run > best_run)
+			{
+				if (best_bh != bh)
+				{
+					brelse(best_bh);
+					get_bh(bh);
+					best_bh = bh;
+				}
+				best_first = first;
+				best_run = run;
+			}
+			start = first + run;
+		}
+
+		if (best_run && scanned + 1 >= HIMFS_ALLOC_SCAN)
+		{
+			brelse(bh);
+			bh = best_bh;
+			goto found;
+		}
+
+		brelse(bh);
+		start = 0;
+		if (++group == himfs_sb->bitmap_blocks)
+		{
+			group = 0;
+		}
+	}
+
+	if (!best_run)
+	{
+		if (!himfs_sb->busy_blocks)
+		{
+			printk(KERN_ERR "himfs: free count %llu but bitmap is full\n", himfs_sb->free_blocks);
+		}
+		goto out;
+	}
+	bh = best_bh;
+
+found:
+	balloc_take(sb, bh, best_first, best_run);
+	*pblk = (bh->b_blocknr - himfs_sb->bitmap_start) * HIMFS_BITS_PER_BITMAP + best_first;
+	*len = best_run;
+	himfs_discard_claim(sb, *pblk, best_run);
+	if (rotor)
+	{
+		himfs_sb->alloc_rotor = *pblk + best_run;
+	}
+	brelse(bh);
+	err = 0;
+
+out:
+	mutex_unlock(&himfs_sb->alloc_lock);
+	return err;
+}
+
+void himfs_free_blocks(struct super_block *sb, uint32_t pblk, uint32_t len)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct buffer_head *bh;
+	uint32_t group, bit, i, n, freed;
+
+	if (pblk == 0 || pblk + len > himfs_sb->data_blocks || pblk + len < pblk)
+	{
+		printk(KERN_ERR "himfs: free bad range %u+%u\n", pblk, len);
+		return;
+	}
+
+	mutex_lock(&himfs_sb->alloc_lock);
+	while (len)
+	{
+		group = pblk / HIMFS_BITS_PER_BITMAP;
+		bit = pblk % HIMFS_BITS_PER_BITMAP;
+		n = min_t(uint32_t, len, HIMFS_BITS_PER_BITMAP - bit);
+
+		bh = sb_bread(sb, himfs_sb->bitmap_start + group);
+		if (unlikely(!bh))
+		{
+			printk(KERN_ERR "himfs: read bitmap block %u fail, leaking %u blocks\n", group, n);
+		}
+		else
+		{
+			for (i = bit, freed = 0; i < bit + n; ++i)
+			{
+				freed += __test_and_clear_bit_le(i, bh->b_data) ? 1 : 0;
+			}
+			if (freed != n)
+			{
+				printk(KERN_ERR "himfs: double free in %u+%u\n", pblk, n);
+			}
+			WRITE_ONCE(himfs_sb->free_blocks, himfs_sb->free_blocks + freed);
+			balloc_log(bh, bit, n);
+			brelse(bh);
+			busy_add(himfs_sb, pblk, n, himfs_journal_tid());
+			himfs_discard_free(sb, pblk, n);
+		}
+
+		pblk += n;
+		len -= n;
+	}
+	mutex_unlock(&himfs_sb->alloc_lock);
+}
@@ -0,0 +1,10 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#endif
+
+int himfs_balloc_init(struct super_block *sb);
+void himfs_balloc_exit(struct super_block *sb);
+bool himfs_balloc_busy(struct super_block *sb);
+int himfs_new_blocks(struct super_block *sb, uint32_t goal, uint32_t *len, uint32_t *pblk);
+void himfs_free_blocks(struct super_block *sb, uint32_t pblk, uint32_t len);
@@ -0,0 +1,445 @@
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/rculist.h>
+#include <linux/shrinker.h>
+#include <linux/seq_file.h>
+#include <linux/proc_fs.h>
+#include <linux/buffer_head.h>
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#include "hash.h"
+#include "stats.h"
+#include "bcache.h"
+#endif
+
+/*
+ * DRAM 桶缓存：查找用的桶解析成紧凑副本，只留占用槽的核心和名字，不带空槽、名字堆空洞和内联数据，
+ * 按桶 LBA 放进每个挂载一张的哈希表。读者在 RCU 下查表比对，不碰 buffer_head，也不拿任何锁；
+ * 插入、删除和 LRU 由一把自旋锁保护，副本用 kfree_rcu 释放。
+ *
+ * 桶的权威内容仍在块设备的缓冲里：所有改桶的地方都在桶锁下调 himfs_journal_dirty()，
+ * 那里顺带作废这个桶的副本；缓存不到的桶由查找在同一把桶锁下读盘解析后放进来，
+ * 所以副本要么是最新的，要么不存在。写回仍走日志和缓冲，缓存里没有脏副本。
+ * 热的查找不再摸缓冲页，这些页在页缓存 LRU 上自然老化回收，常驻的只剩紧凑副本。
+ *
+ * 内存预算由 bcache_mb 挂载参数决定，超了从 LRU 头淘汰；读者命中只设访问位，
+ * 淘汰时给访问过的副本第二次机会。另外注册 shrinker，内存紧张时也一起回收。
+ */
+
+#define BCACHE_MIN_BITS 10
+#define BCACHE_MAX_BITS 20
+#define BCACHE_AVG_BYTES 1024           /* 估算表大小用的平均副本大小 */
+
+struct himfs_bcache
+{
+	struct super_block *sb;
+	unsigned int bits;
+	struct hlist_head *table;
+	spinlock_t lock;                    /* 保护表的修改、LRU 和下面的计数 */
+	struct list_head lru;
+	unsigned long nr;                   /* 副本数 */
+	unsigned long slots;                /* 副本里的占用槽数 */
+	size_t bytes;
+	size_t budget;
+	struct shrinker shrinker;
+};
+
+static inline struct himfs_bcache *BCACHE(struct super_block *sb)
+{
+	return HIMFS_SB(sb)->bcache;
+}
+
+static inline struct hlist_head *bcache_chain(struct himfs_bcache *bc, lba_t lba)
+{
+	return &bc->table[hash_64(lba, bc->bits)];
+}
+
+static inline char *cbucket_names(struct himfs_cbucket *cb)
+{
+	return (char *)&cb->c_cores[cb->c_nr];
+}
+
+bool himfs_bcache_enabled(struct super_block *sb)
+{
+	return BCACHE(sb) != NULL;
+}
+
+static struct himfs_cbucket *bcache_find(struct himfs_bcache *bc, lba_t lba)
+{
+	struct himfs_cbucket *cb;
+
+	hlist_for_each_entry_rcu(cb, bcache_chain(bc, lba), c_hash, lockdep_is_held(&bc->lock))
+	{
+		if (cb->c_lba == lba)
+		{
+			return cb;
+		}
+	}
+
+	return NULL;
+}
+
+/* 调用者持有 rcu_read_lock */
+struct himfs_cbucket *himfs_bcache_lookup(struct super_block *sb, lba_t lba)
+{
+	struct himfs_cbucket *cb = bcache_find(BCACHE(sb), lba);
+
+	if (cb && !READ_ONCE(cb->c_referenced))
+	{
+		WRITE_ONCE(cb->c_referenced, true);
+	}
+
+	return cb;
+}
+
+/* 在 cand 里 tag 相同的槽上比对名字，命中时拷出核心并返回槽号 */
+int himfs_cbucket_match(struct himfs_cbucket *cb, unsigned long dir, const struct qstr *name,
+			uint16_t tag, unsigned long cand, int *cmps, struct himfs_inode *core)
+{
+	struct himfs_inode *c;
+	int slot;
+
+	cand &= cb->c_bitmap;
+	for_each_set_bit(slot, &cand, HASH_SLOT_NUM)
+	{
+		if (cb->c_tags[slot] != tag)
+		{
+			continue;
+		}
+		++*cmps;
+		c = &cb->c_cores[cb->c_index[slot]];
+		if (c->i_pid == dir && c->i_name_len == name->len &&
+		    memcmp(cbucket_names(cb) + cb->c_name_off[slot], name->name, name->len) == 0)
+		{
+			*core = *c;
+			return slot;
+		}
+	}
+
+	return -1;
+}
+
+bool himfs_bcache_cached(struct super_block *sb, lba_t lba)
+{
+	bool cached;
+
+	if (!BCACHE(sb))
+	{
+		return false;
+	}
+
+	rcu_read_lock();
+	cached = bcache_find(BCACHE(sb), lba) != NULL;
+	rcu_read_unlock();
+
+	return cached;
+}
+
+/* ino 所在的桶在缓存里时拷出它的核心 */
+bool himfs_bcache_core(struct super_block *sb, himfs_ino_t ino, struct himfs_inode *core)
+{
+	struct himfs_cbucket *cb;
+	int slot = ino & (HASH_SLOT_NUM - 1);
+	bool found = false;
+
+	if (!BCACHE(sb))
+	{
+		return false;
+	}
+
+	rcu_read_lock();
+	cb = himfs_bcache_lookup(sb, ino >> HASH_SLOT_BITS);
+	if (cb && (cb->c_bitmap & (1U << slot)))
+	{
+		*core = cb->c_cores[cb->c_index[slot]];
+		found = true;
+	}
+	rcu_read_unlock();
+
+	return found;
+}
+
+/* 副本已经占满预算，再放就要淘汰别的；预热用它判断什么时候该停 */
+bool himfs_bcache_full(struct super_block *sb)
+{
+	struct himfs_bcache *bc = BCACHE(sb);
+
+	return bc && READ_ONCE(bc->bytes) >= bc->budget;
+}
+
+/*
+ * 把 bh 里的桶解析成紧凑副本，调用者持有桶锁。无效的桶（没初始化过或属于上一次格式化）
+ * 解析成没有槽的空副本，查找同样可以在缓存里判定未命中。
+ */
+struct himfs_cbucket *himfs_bcache_build(struct super_block *sb, struct buffer_head *bh)
+{
+	struct himfs_meta_block *meta_block = (struct himfs_meta_block *)bh->b_data;
+	struct himfs_inode *him_inode;
+	struct himfs_cbucket *cb;
+	unsigned long bitmap = 0;
+	bool valid = hash_bucket_valid(sb, meta_block);
+	size_t size;
+	int names = 0;
+	int nr = 0;
+	int slot;
+	char *p;
+
+	if (valid)
+	{
+		bitmap = meta_block->slot_bitmap[0] & ((1UL << HASH_SLOT_NUM) - 1);
+	}
+	for_each_set_bit(slot, &bitmap, HASH_SLOT_NUM)
+	{
+		names += meta_block->himfs_inode[slot].i_name_len;
+		++nr;
+	}
+
+	size = sizeof(*cb) + nr * sizeof(struct himfs_inode) + names;
+	cb = kmalloc(size, GFP_NOFS);
+	if (!cb)
+	{
+		return NULL;
+	}
+
+	cb->c_lba = bh->b_blocknr;
+	cb->c_size = ksize(cb);
+	cb->c_overflow = valid ? meta_block->overflow : 0;
+	cb->c_bitmap = bitmap;
+	cb->c_nr = nr;
+	cb->c_referenced = false;
+
+	nr = 0;
+	p = cbucket_names(cb);
+	for_each_set_bit(slot, &bitmap, HASH_SLOT_NUM)
+	{
+		him_inode = &meta_block->himfs_inode[slot];
+		cb->c_index[slot] = nr;
+		cb->c_tags[slot] = (meta_block->tags[slot / HASH_TAGS_PER_WORD] >> ((slot % HASH_TAGS_PER_WORD) * 16)) & 0xFFFF;
+		cb->c_name_off[slot] = p - cbucket_names(cb);
+		cb->c_cores[nr++] = *him_inode;
+		memcpy(p, himfs_inode_name(meta_block, him_inode), him_inode->i_name_len);
+		p += him_inode->i_name_len;
+	}
+
+	return cb;
+}
+
+/* 调用者持有 bc->lock */
+static void bcache_unlink(struct himfs_bcache *bc, struct himfs_cbucket *cb)
+{
+	hlist_del_rcu(&cb->c_hash);
+	list_del(&cb->c_lru);
+	--bc->nr;
+	bc->slots -= cb->c_nr;
+	bc->bytes -= cb->c_size;
+	kfree_rcu(cb, c_rcu);
+}
+
+/* 从 LRU 头淘汰至多 nr 个副本，访问过的挪到尾部再给一次机会；调用者持有 bc->lock */
+static unsigned long bcache_evict(struct himfs_bcache *bc, unsigned long nr, bool over_budget)
+{
+	struct himfs_cbucket *cb;
+	unsigned long scanned = 0;
+	unsigned long freed = 0;
+
+	while (!list_empty(&bc->lru) && scanned++ < 2 * nr + 1)
+	{
+		if (over_budget ? bc->bytes <= bc->budget : freed >= nr)
+		{
+			break;
+		}
+		cb = list_first_entry(&bc->lru, struct himfs_cbucket, c_lru);
+		if (READ_ONCE(cb->c_referenced))
+		{
+			WRITE_ONCE(cb->c_referenced, false);
+			list_move_tail(&cb->c_lru, &bc->lru);
+			continue;
+		}
+		bcache_unlink(bc, cb);
+		++freed;
+	}
+
+	return freed;
+}
+
+/* 放进 build 出来的副本，同一个桶已有副本时替换掉；调用者持有桶锁 */
+void himfs_bcache_insert(struct super_block *sb, struct himfs_cbucket *cb)
+{
+	struct himfs_bcache *bc = BCACHE(sb);
+	struct hlist_head *chain = bcache_chain(bc, cb->c_lba);
+	struct himfs_cbucket *old;
+	unsigned long freed;
+
+	spin_lock(&bc->lock);
+	old = bcache_find(bc, cb->c_lba);
+	if (old)
+	{
+		bcache_unlink(bc, old);
+	}
+	hlist_add_head_rcu(&cb->c_hash, chain);
+	list_add_tail(&cb->c_lru, &bc->lru);
+	++bc->nr;
+	bc->slots += cb->c_nr;
+	bc->bytes += cb->c_size;
+	freed = bc->bytes > bc->budget ? bcache_evict(bc, bc->nr, true) : 0;
+	spin_unlock(&bc->lock);
+
+	himfs_stat_inc(sb, HIMFS_STAT_BCACHE_FILL);
+	himfs_stat_add(sb, HIMFS_STAT_BCACHE_EVICT, freed);
+}
+
+/* 桶内容变了，作废它的副本；调用者持有桶锁，所以不会和 insert 交错 */
+void himfs_bcache_invalidate(struct super_block *sb, lba_t lba)
+{
+	struct himfs_bcache *bc = BCACHE(sb);
+	struct himfs_cbucket *cb;
+	bool cached;
+
+	if (!bc)
+	{
+		return;
+	}
+
+	rcu_read_lock();
+	cached = bcache_find(bc, lba) != NULL;
+	rcu_read_unlock();
+	if (!cached)
+	{
+		return;
+	}
+
+	spin_lock(&bc->lock);
+	cb = bcache_find(bc, lba);
+	if (cb)
+	{
+		bcache_unlink(bc, cb);
+	}
+	spin_unlock(&bc->lock);
+}
+
+static unsigned long bcache_count(struct shrinker *shrink, struct shrink_control *sc)
+{
+	struct himfs_bcache *bc = container_of(shrink, struct himfs_bcache, shrinker);
+
+	return READ_ONCE(bc->nr) ? READ_ONCE(bc->nr) : SHRINK_EMPTY;
+}
+
+static unsigned long bcache_scan(struct shrinker *shrink, struct shrink_control *sc)
+{
+	struct himfs_bcache *bc = container_of(shrink, struct himfs_bcache, shrinker);
+	unsigned long freed;
+
+	spin_lock(&bc->lock);
+	freed = bcache_evict(bc, sc->nr_to_scan, false);
+	spin_unlock(&bc->lock);
+	himfs_stat_add(bc->sb, HIMFS_STAT_BCACHE_EVICT, freed);
+
+	return freed;
+}
+
+/* 同样多的桶放在缓冲里要占的内存：整页加 buffer_head 和 struct page */
+static int bcache_show(struct seq_file *m, void *v)
+{
+	struct himfs_bcache *bc = m->private;
+	unsigned long nr, slots;
+	size_t bytes, bh_bytes;
+
+	spin_lock(&bc->lock);
+	nr = bc->nr;
+	slots = bc->slots;
+	bytes = bc->bytes;
+	spin_unlock(&bc->lock);
+	bh_bytes = nr * ((1 << BLOCK_SHIFT) + sizeof(struct buffer_head) + sizeof(struct page));
+
+	seq_printf(m, "%-16s %lu\n", "buckets", nr);
+	seq_printf(m, "%-16s %lu\n", "slots", slots);
+	seq_printf(m, "%-16s %zu\n", "bytes", bytes);
+	seq_printf(m, "%-16s %zu\n", "budget", bc->budget);
+	seq_printf(m, "%-16s %lu\n", "bytes_per_slot", slots ? (unsigned long)(bytes / slots) : 0);
+	seq_printf(m, "%-16s %lu\n", "bh_bytes_per_slot", slots ? (unsigned long)(bh_bytes / slots) : 0);
+
+	return 0;
+}
+
+int himfs_bcache_init(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_bcache *bc;
+	unsigned long est;
+	int err;
+
+	if (!himfs_sb->bcache_mb)
+	{
+		return 0;
+	}
+
+	bc = kzalloc(sizeof(*bc), GFP_KERNEL);
+	if (!bc)
+	{
+		return -ENOMEM;
+	}
+	bc->sb = sb;
+	bc->budget = (size_t)himfs_sb->bcache_mb << 20;
+	est = min_t(unsigned long, bc->budget / BCACHE_AVG_BYTES, himfs_sb->meta_blocks);
+	bc->bits = clamp_t(unsigned int, order_base_2(est), BCACHE_MIN_BITS, BCACHE_MAX_BITS);
+	bc->table = kvcalloc(1UL << bc->bits, sizeof(*bc->table), GFP_KERNEL);
+	if (!bc->table)
+	{
+		kfree(bc);
+		return -ENOMEM;
+	}
+	spin_lock_init(&bc->lock);
+	INIT_LIST_HEAD(&bc->lru);
+
+	bc->shrinker.count_objects = bcache_count;
+	bc->shrinker.scan_objects = bcache_scan;
+	bc->shrinker.seeks = DEFAULT_SEEKS;
+	err = register_shrinker(&bc->shrinker);
+	if (err)
+	{
+		kvfree(bc->table);
+		kfree(bc);
+		return err;
+	}
+
+	if (himfs_sb->stats && himfs_sb->stats->dir)
+	{
+		proc_create_single_data("bcache", 0444, himfs_sb->stats->dir, bcache_show, bc);
+	}
+
+	himfs_sb->bcache = bc;
+	return 0;
+}
+
+/* 卸载时已经没有读者，副本直接释放 */
+void himfs_bcache_exit(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_bcache *bc = himfs_sb->bcache;
+	struct himfs_cbucket *cb, *next;
+
+	if (!bc)
+	{
+		return;
+	}
+
+	if (himfs_sb->stats && himfs_sb->stats->dir)
+	{
+		remove_proc_entry("bcache", himfs_sb->stats->dir);
+	}
+	unregister_shrinker(&bc->shrinker);
+	himfs_sb->bcache = NULL;
+
+	list_for_each_entry_safe(cb, next, &bc->lru, c_lru)
+	{
+		list_del(&cb->c_lru);
+		kfree(cb);
+	}
+	kvfree(bc->table);
+	kfree(bc);
+}
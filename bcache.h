@@ -0,0 +1,37 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#endif
+
+struct himfs_bcache;
+
+/* 一个桶的紧凑副本，发布之后只读，见 bcache.c */
+struct himfs_cbucket
+{
+	struct hlist_node c_hash;
+	struct list_head c_lru;
+	struct rcu_head c_rcu;
+	lba_t c_lba;
+	unsigned int c_size;                    /* 实际分配的字节数，计入内存预算 */
+	uint16_t c_overflow;
+	uint16_t c_bitmap;                      /* 占用槽 */
+	uint8_t c_nr;                           /* 占用槽数，即 c_cores 的项数 */
+	bool c_referenced;                      /* 淘汰前被访问过 */
+	uint8_t c_index[HASH_SLOT_NUM];         /* 槽号 -> c_cores 下标 */
+	uint16_t c_tags[HASH_SLOT_NUM];
+	uint16_t c_name_off[HASH_SLOT_NUM];     /* 名字在 c_cores 之后的名字区里的偏移 */
+	struct himfs_inode c_cores[];           /* 后面紧跟名字区 */
+};
+
+int himfs_bcache_init(struct super_block *sb);
+void himfs_bcache_exit(struct super_block *sb);
+bool himfs_bcache_enabled(struct super_block *sb);
+struct himfs_cbucket *himfs_bcache_lookup(struct super_block *sb, lba_t lba);
+struct himfs_cbucket *himfs_bcache_build(struct super_block *sb, struct buffer_head *bh);
+void himfs_bcache_insert(struct super_block *sb, struct himfs_cbucket *cb);
+void himfs_bcache_invalidate(struct super_block *sb, lba_t lba);
+bool himfs_bcache_cached(struct super_block *sb, lba_t lba);
+bool himfs_bcache_full(struct super_block *sb);
+bool himfs_bcache_core(struct super_block *sb, himfs_ino_t ino, struct himfs_inode *core);
+int himfs_cbucket_match(struct himfs_cbucket *cb, unsigned long dir, const struct qstr *name,
+			uint16_t tag, unsigned long cand, int *cmps, struct himfs_inode *core);
@@ -0,0 +1,219 @@
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/buffer_head.h>
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#include "dir.h"
+#include "journal.h"
+#include "grave.h"
+#endif
+
+#define DLOG_BLOCK_SIZE (1 << BLOCK_SHIFT)
+
+static inline int dlog_rec_len(int name_len)
+{
+	return ALIGN(sizeof(struct himfs_dirent) + name_len, 8);
+}
+
+/* 目录子项日志的第 iblock 块映射到的 LBA，和普通文件走同一个块映射 */
+static lba_t dlog_map(struct inode *dir, sector_t iblock, int create)
+{
+	struct buffer_head map;
+
+	memset(&map, 0, sizeof(map));
+	map.b_size = DLOG_BLOCK_SIZE;
+
+	if (himfs_get_block_prep(dir, iblock, &map, create) || !buffer_mapped(&map))
+	{
+		return 0;
+	}
+
+	return map.b_blocknr;
+}
+
+/*
+ * 读子项日志的第 iblock 块。只有追加时 create 为 1；readdir 和删除只读 i_dlog_end 以内的块，
+ * 那里没有映射说明目录坏了，返回 NULL，不会顺手分配。
+ */
+struct buffer_head *himfs_dlog_bread(struct inode *dir, sector_t iblock, int create)
+{
+	lba_t lba = dlog_map(dir, iblock, create);
+
+	if (!lba)
+	{
+		if (!create)
+		{
+			printk(KERN_ERR "himfs: dir log block %llu of %lu is not mapped\n",
+				(unsigned long long)iblock, dir->i_ino);
+		}
+		return NULL;
+	}
+
+	return sb_bread(dir->i_sb, lba);
+}
+
+/* 新块整块都会被日志覆盖，不必先读 */
+static struct buffer_head *dlog_new_block(struct inode *dir, sector_t iblock)
+{
+	struct buffer_head *bh;
+	lba_t lba = dlog_map(dir, iblock, 1);
+
+	if (!lba)
+	{
+		return NULL;
+	}
+
+	bh = sb_getblk(dir->i_sb, lba);
+	if (unlikely(!bh))
+	{
+		return NULL;
+	}
+
+	lock_buffer(bh);
+	memset(bh->b_data, 0, DLOG_BLOCK_SIZE);
+	set_buffer_uptodate(bh);
+	unlock_buffer(bh);
+
+	return bh;
+}
+
+/*
+ * 在目录 dir 的子项日志末尾追加一条记录，*pos 返回记录偏移，供删除时直接定位。
+ * 调用者持有 dir 的 i_rwsem，同一目录的追加是串行的。
+ */
+int himfs_dlog_add(struct inode *dir, const struct qstr *name, himfs_ino_t ino, umode_t mode, uint32_t *pos)
+{
+	struct himfs_inode_info *dii = HIMFS_I(dir);
+	struct buffer_head *bh;
+	struct himfs_dirent *de;
+	uint32_t end = dii->i_dlog_end;
+	uint32_t off = end & (DLOG_BLOCK_SIZE - 1);
+	int rec_len = dlog_rec_len(name->len);
+
+	/* 记录不跨块，后面还要留出结尾的记录头：本块剩下的空间放不下时用一条空记录填满 */
+	if (off && off + rec_len + sizeof(struct himfs_dirent) > DLOG_BLOCK_SIZE)
+	{
+		bh = himfs_dlog_bread(dir, end >> BLOCK_SHIFT, 1);
+		if (unlikely(!bh))
+		{
+			return -EIO;
+		}
+
+		de = (struct himfs_dirent *)(bh->b_data + off);
+		de->d_ino = 0;
+		de->d_rec_len = DLOG_BLOCK_SIZE - off;
+		de->d_name_len = 0;
+		de->d_type = DT_UNKNOWN;
+		himfs_journal_dirty(bh, off, sizeof(struct himfs_dirent));
+		brelse(bh);
+
+		end += DLOG_BLOCK_SIZE - off;
+		off = 0;
+	}
+
+	bh = off ? himfs_dlog_bread(dir, end >> BLOCK_SHIFT, 1) : dlog_new_block(dir, end >> BLOCK_SHIFT);
+	if (unlikely(!bh))
+	{
+		return -ENOSPC;
+	}
+
+	de = (struct himfs_dirent *)(bh->b_data + off);
+	de->d_ino = ino;
+	de->d_rec_len = rec_len;
+	de->d_name_len = name->len;
+	de->d_type = fs_umode_to_dtype(mode);
+	memcpy(de->d_name, name->name, name->len);
+	memset(bh->b_data + off + rec_len, 0, sizeof(struct himfs_dirent));
+	himfs_journal_dirty(bh, off, rec_len + sizeof(struct himfs_dirent));
+	brelse(bh);
+
+	*pos = end;
+	dii->i_dlog_end = end + rec_len;
+	himfs_grave_add(dir);
+
+	return 0;
+}
+
+/* 把偏移 pos 处的记录标成墓碑，偏移不变，正在进行的 readdir 不受影响 */
+void himfs_dlog_remove(struct inode *dir, uint32_t pos, himfs_ino_t ino)
+{
+	struct buffer_head *bh;
+	struct himfs_dirent *de;
+
+	if (pos >= HIMFS_I(dir)->i_dlog_end)
+	{
+		return;
+	}
+
+	bh = himfs_dlog_bread(dir, pos >> BLOCK_SHIFT, 0);
+	if (unlikely(!bh))
+	{
+		printk(KERN_ERR "himfs: read dir log of %lu fail\n", dir->i_ino);
+		return;
+	}
+
+	de = (struct himfs_dirent *)(bh->b_data + (pos & (DLOG_BLOCK_SIZE - 1)));
+	if (de->d_ino == ino)
+	{
+		de->d_ino = 0;
+		himfs_journal_dirty(bh, pos & (DLOG_BLOCK_SIZE - 1), sizeof(de->d_ino));
+	}
+	brelse(bh);
+}
+
+/*
+ * 盘上的日志末尾可能落后于实际内容（延迟的父目录更新没来得及写回）：
+ * 从头扫一遍子项日志，按结尾的记录头找到末尾，顺便数出活着的子项。
+ * 遇到不合法的记录也当作末尾。
+ */
+int himfs_dlog_recover(struct inode *dir, uint32_t *endp, uint64_t *countp)
+{
+	struct buffer_head *bh;
+	struct himfs_dirent *de;
+	uint32_t end = 0, off;
+	uint64_t count = 0;
+	lba_t lba;
+
+	for (;;)
+	{
+		lba = dlog_map(dir, end >> BLOCK_SHIFT, 0);
+		if (!lba)
+		{
+			break;
+		}
+		bh = sb_bread(dir->i_sb, lba);
+		if (unlikely(!bh))
+		{
+			printk(KERN_ERR "himfs: read dir log of %lu fail\n", dir->i_ino);
+			return -EIO;
+		}
+
+		for (off = 0; off + sizeof(struct himfs_dirent) <= DLOG_BLOCK_SIZE; off += de->d_rec_len)
+		{
+			de = (struct himfs_dirent *)(bh->b_data + off);
+			if (de->d_rec_len < sizeof(struct himfs_dirent) || (de->d_rec_len & 7) ||
+				off + de->d_rec_len > DLOG_BLOCK_SIZE ||
+				(de->d_ino && de->d_rec_len != dlog_rec_len(de->d_name_len)))
+			{
+				break;
+			}
+			if (de->d_ino)
+			{
+				++count;
+			}
+		}
+		brelse(bh);
+
+		end += off;
+		if (off < DLOG_BLOCK_SIZE)
+		{
+			break;
+		}
+	}
+
+	*endp = end;
+	*countp = count;
+	return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#endif
+
+struct buffer_head *himfs_dlog_bread(struct inode *dir, sector_t iblock, int create);
+int himfs_dlog_add(struct inode *dir, const struct qstr *name, himfs_ino_t ino, umode_t mode, uint32_t *pos);
+void himfs_dlog_remove(struct inode *dir, uint32_t pos, himfs_ino_t ino);
+int himfs_dlog_recover(struct inode *dir, uint32_t *endp, uint64_t *countp);
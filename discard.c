@@ -0,0 +1,565 @@
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/rbtree.h>
+#include <linux/sched/signal.h>
+#include <linux/workqueue.h>
+#include <linux/buffer_head.h>
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#include "journal.h"
+#include "stats.h"
+#include "discard.h"
+#endif
+
+/*
+ * 释放块的 discard：截短和删除释放的数据块（包括 extent 溢出块）按数据区块号记进一棵红黑树，
+ * 相邻的段合并，每段记下释放所在的事务。释放要等事务提交才算数，在那之前 discard 掉，
+ * 崩溃后文件还指着这些块，内容却没了，所以后台每 HIMFS_DISCARD_DELAY 一轮，
+ * 只把已提交的段用一条 bio 链一次下发，每轮的量按 discard_mbps 限速。
+ * 桶里的槽释放后整块照样在用，元数据区没有可以 discard 的整块。
+ *
+ * 下发之前这些块在位图里已经是空闲的，分配器可能又把它们分出去。分配后调 himfs_discard_claim：
+ * 还没下发的段直接去掉，正在下发的段要等它完成，否则 discard 可能跑到新数据后面把它抹掉。
+ * 不开在线 discard 时也照样记，只是提交后直接丢掉，FITRIM 靠它避开还没提交的释放。
+ * 树由一把自旋锁保护；记录和认领都在 alloc_lock 下调用，和位图的改动顺序一致。
+ */
+
+#define TRIM_BATCH 64                   /* FITRIM 每次拿 alloc_lock 最多收集的空闲段 */
+
+struct discard_range
+{
+	struct rb_node node;
+	struct list_head batch;             /* 下发时挂在这一批的链表上 */
+	uint32_t start;                     /* 数据区块号 */
+	uint32_t len;
+	uint64_t tid;                       /* 释放所在的事务，提交之后才能 discard */
+	bool busy;                          /* 正在下发，分配到这里要等 */
+};
+
+struct himfs_discard
+{
+	struct super_block *sb;
+	spinlock_t lock;                    /* 保护 tree 和各段 */
+	struct rb_root tree;                /* 按 start 排序，互不重叠 */
+	unsigned long nr;
+	bool online;
+	bool stop;
+	wait_queue_head_t wait;             /* 等 busy 的段下发完 */
+	struct delayed_work work;
+};
+
+static inline struct himfs_discard *DISCARD(struct super_block *sb)
+{
+	return HIMFS_SB(sb)->discard;
+}
+
+/* 和 [start, end) 重叠的第一段，调用者持有 dc->lock */
+static struct discard_range *discard_first(struct himfs_discard *dc, uint32_t start, uint32_t end)
+{
+	struct rb_node *n = dc->tree.rb_node;
+	struct discard_range *r, *found = NULL;
+
+	while (n)
+	{
+		r = rb_entry(n, struct discard_range, node);
+		if (r->start + r->len <= start)
+		{
+			n = n->rb_right;
+		}
+		else
+		{
+			found = r;
+			n = n->rb_left;
+		}
+	}
+
+	return found && found->start < end ? found : NULL;
+}
+
+static struct discard_range *discard_next(struct discard_range *r)
+{
+	struct rb_node *n = rb_next(&r->node);
+
+	return n ? rb_entry(n, struct discard_range, node) : NULL;
+}
+
+static void discard_link(struct himfs_discard *dc, struct discard_range *new)
+{
+	struct rb_node **p = &dc->tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p)
+	{
+		parent = *p;
+		if (new->start < rb_entry(parent, struct discard_range, node)->start)
+		{
+			p = &parent->rb_left;
+		}
+		else
+		{
+			p = &parent->rb_right;
+		}
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &dc->tree);
+	++dc->nr;
+}
+
+static void discard_erase(struct himfs_discard *dc, struct discard_range *r)
+{
+	rb_erase(&r->node, &dc->tree);
+	--dc->nr;
+}
+
+static struct discard_range *discard_alloc(uint32_t start, uint32_t len, uint64_t tid)
+{
+	struct discard_range *r = kmalloc(sizeof(*r), GFP_NOFS | __GFP_NOFAIL);
+
+	r->start = start;
+	r->len = len;
+	r->tid = tid;
+	r->busy = false;
+	return r;
+}
+
+/* himfs_free_blocks 清掉位图之后调用，持有 alloc_lock */
+void himfs_discard_free(struct super_block *sb, uint32_t start, uint32_t len)
+{
+	struct himfs_discard *dc = DISCARD(sb);
+	struct discard_range *new, *r, *prev = NULL, *next = NULL;
+	uint64_t tid = himfs_journal_tid();
+
+	if (!dc)
+	{
+		return;
+	}
+
+	new = discard_alloc(start, len, tid);
+	spin_lock(&dc->lock);
+	for (r = discard_first(dc, start ? start - 1 : 0, start + len + 1); r && r->start <= start + len;
+	     r = discard_next(r))
+	{
+		if (r->start + r->len == start)
+		{
+			prev = r;
+		}
+		else if (r->start == start + len)
+		{
+			next = r;
+		}
+		else
+		{
+			/* 重复释放，balloc 已经报过错，不再记 */
+			spin_unlock(&dc->lock);
+			kfree(new);
+			return;
+		}
+	}
+
+	if (prev && !prev->busy && prev->len + len <= HIMFS_DISCARD_MAX)
+	{
+		prev->len += len;
+		prev->tid = max(prev->tid, tid);
+		r = prev;
+	}
+	else
+	{
+		discard_link(dc, new);
+		r = new;
+		new = NULL;
+	}
+	if (next && !next->busy && r->len + next->len <= HIMFS_DISCARD_MAX)
+	{
+		r->len += next->len;
+		r->tid = max(r->tid, next->tid);
+		discard_erase(dc, next);
+	}
+	else
+	{
+		next = NULL;
+	}
+	spin_unlock(&dc->lock);
+
+	kfree(new);
+	kfree(next);
+	if (!READ_ONCE(dc->stop))
+	{
+		queue_delayed_work(system_unbound_wq, &dc->work, HIMFS_DISCARD_DELAY);
+	}
+}
+
+static bool discard_busy(struct himfs_discard *dc, uint32_t start, uint32_t end)
+{
+	struct discard_range *r;
+	bool busy = false;
+
+	spin_lock(&dc->lock);
+	for (r = discard_first(dc, start, end); r && r->start < end; r = discard_next(r))
+	{
+		busy |= r->busy;
+	}
+	spin_unlock(&dc->lock);
+
+	return busy;
+}
+
+/* 刚分配出去的块不能再 discard，持有 alloc_lock */
+void himfs_discard_claim(struct super_block *sb, uint32_t start, uint32_t len)
+{
+	struct himfs_discard *dc = DISCARD(sb);
+	struct discard_range *r, *next, *spare = NULL;
+	uint32_t end = start + len;
+	uint32_t rend;
+
+	if (!dc)
+	{
+		return;
+	}
+
+again:
+	spin_lock(&dc->lock);
+	for (r = discard_first(dc, start, end); r && r->start < end; r = next)
+	{
+		next = discard_next(r);
+		rend = r->start + r->len;
+		if (r->busy)
+		{
+			spin_unlock(&dc->lock);
+			wait_event(dc->wait, !discard_busy(dc, start, end));
+			goto again;
+		}
+
+		if (r->start < start && rend > end)
+		{
+			/* 从中间挖掉，右边剩下的一段要新的节点 */
+			if (!spare)
+			{
+				spin_unlock(&dc->lock);
+				spare = discard_alloc(0, 0, 0);
+				goto again;
+			}
+			r->len = start - r->start;
+			spare->start = end;
+			spare->len = rend - end;
+			spare->tid = r->tid;
+			discard_link(dc, spare);
+			spare = NULL;
+		}
+		else if (r->start < start)
+		{
+			r->len = start - r->start;
+		}
+		else if (rend > end)
+		{
+			r->len = rend - end;
+			r->start = end;
+		}
+		else
+		{
+			discard_erase(dc, r);
+			kfree(r);
+		}
+	}
+	spin_unlock(&dc->lock);
+	kfree(spare);
+}
+
+/* 一条 bio 链下发整批并等它完成，然后把这些段从树里去掉；*blocks 返回下发的块数 */
+static int discard_issue(struct himfs_discard *dc, struct list_head *batch, uint64_t *blocks)
+{
+	struct super_block *sb = dc->sb;
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct discard_range *r, *tmp;
+	struct bio *bio = NULL;
+	struct blk_plug plug;
+	unsigned long ranges = 0;
+	int err = 0;
+
+	*blocks = 0;
+	if (list_empty(batch))
+	{
+		return 0;
+	}
+
+	blk_start_plug(&plug);
+	list_for_each_entry(r, batch, batch)
+	{
+		err = __blkdev_issue_discard(sb->s_bdev,
+			(sector_t)(himfs_sb->data_start + r->start) << (BLOCK_SHIFT - 9),
+			(sector_t)r->len << (BLOCK_SHIFT - 9), GFP_NOFS, 0, &bio);
+		if (err)
+		{
+			break;
+		}
+		++ranges;
+		*blocks += r->len;
+	}
+	if (bio)
+	{
+		if (!err)
+		{
+			err = submit_bio_wait(bio);
+		}
+		else
+		{
+			submit_bio_wait(bio);
+		}
+		bio_put(bio);
+	}
+	blk_finish_plug(&plug);
+
+	spin_lock(&dc->lock);
+	list_for_each_entry_safe(r, tmp, batch, batch)
+	{
+		discard_erase(dc, r);
+		kfree(r);
+	}
+	spin_unlock(&dc->lock);
+	wake_up_all(&dc->wait);
+
+	himfs_stat_add(sb, HIMFS_STAT_DISCARD_RANGE, ranges);
+	himfs_stat_add(sb, HIMFS_STAT_DISCARD_BLOCK, *blocks);
+	return err;
+}
+
+/*
+ * 挑出已提交的段，至多 budget 块，标成 busy 挂到 batch 上；不开在线 discard 时直接丢掉。
+ * 返回树里是否还有要下一轮处理的段。
+ */
+static bool discard_collect(struct himfs_discard *dc, uint64_t committed, uint64_t budget,
+			    struct list_head *batch)
+{
+	struct discard_range *r, *next;
+	uint64_t taken = 0;
+	bool more = false;
+
+	spin_lock(&dc->lock);
+	for (r = dc->nr ? rb_entry(rb_first(&dc->tree), struct discard_range, node) : NULL; r; r = next)
+	{
+		next = discard_next(r);
+		if (r->busy)
+		{
+			continue;
+		}
+		if (r->tid > committed)
+		{
+			more = true;
+			continue;
+		}
+		if (!dc->online)
+		{
+			discard_erase(dc, r);
+			kfree(r);
+			continue;
+		}
+		if (taken >= budget)
+		{
+			more = true;
+			break;
+		}
+		r->busy = true;
+		list_add_tail(&r->batch, batch);
+		taken += r->len;
+	}
+	spin_unlock(&dc->lock);
+
+	return more;
+}
+
+static void discard_work(struct work_struct *work)
+{
+	struct himfs_discard *dc = container_of(to_delayed_work(work), struct himfs_discard, work);
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(dc->sb);
+	uint64_t budget = U64_MAX;
+	uint64_t blocks;
+	LIST_HEAD(batch);
+	bool more;
+	int err;
+
+	if (himfs_sb->discard_mbps)
+	{
+		budget = ((uint64_t)himfs_sb->discard_mbps << (20 - BLOCK_SHIFT)) * HIMFS_DISCARD_DELAY / HZ;
+	}
+
+	more = discard_collect(dc, himfs_journal_committed(dc->sb), budget, &batch);
+	err = discard_issue(dc, &batch, &blocks);
+	if (err == -EOPNOTSUPP)
+	{
+		printk(KERN_WARNING "himfs: device rejected discard, online discard disabled\n");
+		WRITE_ONCE(dc->online, false);
+	}
+	else if (err)
+	{
+		printk(KERN_ERR "himfs: discard of %llu blocks failed: %d\n", blocks, err);
+	}
+
+	if (more && !READ_ONCE(dc->stop))
+	{
+		queue_delayed_work(system_unbound_wq, &dc->work, HIMFS_DISCARD_DELAY);
+	}
+}
+
+/* [start, start + len) 目前空闲且不在树里时标成 busy 挂到 batch 上，持有 alloc_lock */
+static bool discard_reserve(struct himfs_discard *dc, uint32_t start, uint32_t len, struct list_head *batch)
+{
+	struct discard_range *r = discard_alloc(start, len, 0);
+
+	r->busy = true;
+	spin_lock(&dc->lock);
+	if (discard_first(dc, start, start + len))
+	{
+		spin_unlock(&dc->lock);
+		kfree(r);
+		return false;
+	}
+	discard_link(dc, r);
+	spin_unlock(&dc->lock);
+
+	list_add_tail(&r->batch, batch);
+	return true;
+}
+
+/*
+ * FITRIM：按位图找出范围内不短于 minlen 的空闲段 discard 掉。range 是设备上的字节范围，
+ * 只看其中的数据区；返回时 range->len 改成实际 discard 的字节数。
+ * 每次在 alloc_lock 下收集一批并标成 busy，放锁以后再下发，分配器照常工作，碰到这些段才等。
+ */
+int himfs_discard_trim(struct super_block *sb, struct fstrim_range *range)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_discard *dc = DISCARD(sb);
+	struct buffer_head *bh;
+	uint64_t first_lba, last_lba, trimmed = 0, blocks;
+	uint32_t pos, end, group, base, limit, bit, first, run, minlen, n;
+	LIST_HEAD(batch);
+	int err = 0;
+
+	first_lba = range->start >> BLOCK_SHIFT;
+	last_lba = range->len >= U64_MAX - range->start ? U64_MAX : (range->start + range->len) >> BLOCK_SHIFT;
+	if (!dc || first_lba >= himfs_sb->data_end)
+	{
+		return -EINVAL;
+	}
+	if (last_lba <= himfs_sb->data_start)
+	{
+		range->len = 0;
+		return 0;
+	}
+	pos = max_t(uint64_t, first_lba, himfs_sb->data_start) - himfs_sb->data_start;
+	end = min_t(uint64_t, last_lba, himfs_sb->data_end) - himfs_sb->data_start;
+	minlen = max_t(uint64_t, 1, DIV_ROUND_UP_ULL(range->minlen, 1 << BLOCK_SHIFT));
+
+	while (pos < end)
+	{
+		if (fatal_signal_pending(current))
+		{
+			err = -EINTR;
+			break;
+		}
+
+		group = pos / HIMFS_BITS_PER_BITMAP;
+		base = group * HIMFS_BITS_PER_BITMAP;
+		limit = min_t(uint32_t, end - base, HIMFS_BITS_PER_BITMAP);
+		bit = pos - base;
+
+		mutex_lock(&himfs_sb->alloc_lock);
+		bh = sb_bread(sb, himfs_sb->bitmap_start + group);
+		if (unlikely(!bh))
+		{
+			mutex_unlock(&himfs_sb->alloc_lock);
+			err = -EIO;
+			break;
+		}
+		for (n = 0; bit < limit && n < TRIM_BATCH; )
+		{
+			first = find_next_zero_bit_le(bh->b_data, limit, bit);
+			if (first >= limit)
+			{
+				bit = limit;
+				break;
+			}
+			run = min_t(uint32_t, find_next_bit_le(bh->b_data, limit, first) - first, HIMFS_DISCARD_MAX);
+			bit = first + run;
+			if (run >= minlen && discard_reserve(dc, base + first, run, &batch))
+			{
+				++n;
+			}
+		}
+		brelse(bh);
+		mutex_unlock(&himfs_sb->alloc_lock);
+
+		err = discard_issue(dc, &batch, &blocks);
+		INIT_LIST_HEAD(&batch);
+		trimmed += blocks;
+		if (err)
+		{
+			break;
+		}
+		pos = base + bit;
+		cond_resched();
+	}
+
+	range->len = trimmed << BLOCK_SHIFT;
+	return err;
+}
+
+int himfs_discard_init(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_discard *dc;
+
+	if (himfs_sb->online_discard && !blk_queue_discard(bdev_get_queue(sb->s_bdev)))
+	{
+		printk(KERN_WARNING "himfs: device does not support discard, online discard disabled\n");
+		himfs_sb->online_discard = false;
+	}
+
+	dc = kzalloc(sizeof(*dc), GFP_KERNEL);
+	if (!dc)
+	{
+		return -ENOMEM;
+	}
+	dc->sb = sb;
+	spin_lock_init(&dc->lock);
+	dc->tree = RB_ROOT;
+	dc->online = himfs_sb->online_discard;
+	init_waitqueue_head(&dc->wait);
+	INIT_DELAYED_WORK(&dc->work, discard_work);
+
+	himfs_sb->discard = dc;
+	return 0;
+}
+
+/* 在日志关掉之前调用：先把运行事务提交，剩下的段就都能下发了 */
+void himfs_discard_exit(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_discard *dc = himfs_sb->discard;
+	struct discard_range *r, *tmp;
+	uint64_t blocks;
+	LIST_HEAD(batch);
+
+	if (!dc)
+	{
+		return;
+	}
+
+	WRITE_ONCE(dc->stop, true);
+	cancel_delayed_work_sync(&dc->work);
+	if (dc->nr && dc->online && himfs_sb->journal && !himfs_journal_sync(sb))
+	{
+		discard_collect(dc, U64_MAX, U64_MAX, &batch);
+		discard_issue(dc, &batch, &blocks);
+	}
+
+	himfs_sb->discard = NULL;
+	rbtree_postorder_for_each_entry_safe(r, tmp, &dc->tree, node)
+	{
+		kfree(r);
+	}
+	kfree(dc);
+}
@@ -0,0 +1,12 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#endif
+
+struct fstrim_range;
+
+int himfs_discard_init(struct super_block *sb);
+void himfs_discard_exit(struct super_block *sb);
+void himfs_discard_free(struct super_block *sb, uint32_t start, uint32_t len);
+void himfs_discard_claim(struct super_block *sb, uint32_t start, uint32_t len);
+int himfs_discard_trim(struct super_block *sb, struct fstrim_range *range);
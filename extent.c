@@ -0,0 +1,732 @@
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/buffer_head.h>
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#include "balloc.h"
+#include "extent.h"
+#include "journal.h"
+#include "stats.h"
+#endif
+
+/*
+ * 文件块映射：每个 inode 一张 extent 表，前 HIMFS_INLINE_EXTENTS 项放在 inode 核心里，
+ * 其余放在一个溢出块里。表项无序，查找时顺序扫描；追加写总是优先接在上一段后面，
+ * 并按已有大小成倍预分配，让大文件拿到长的连续段。超出文件末尾的预分配块在
+ * 最后一个写者关闭文件或 inode 回收时还回去。
+ * fallocate 分出来的段带 HIMFS_EXTENT_UNWRITTEN，映射时报成未写，读出来是零、不发 I/O；
+ * 写进去的数据落盘之后再把那一截转成已写。打洞、清零和这种转换都要切段，
+ * 统一在 ext_modify 里把整张表读成数组改完、排序合并后整张写回。
+ */
+
+#define EXT_NONE ((uint32_t)~0U)
+
+struct ext_scan
+{
+	int hit;                /* 包含目标块的表项下标，-1 表示空洞 */
+	int prev;               /* 目标块之前最近的表项 */
+	uint32_t next_lblk;     /* 目标块之后最近的表项起点 */
+	uint64_t mapped;        /* 已映射块数 */
+};
+
+static inline lba_t ext_lba(struct super_block *sb, uint32_t pblk)
+{
+	return HIMFS_SB(sb)->data_start + pblk;
+}
+
+static inline uint32_t ext_len(struct himfs_extent *e)
+{
+	return e->e_len & HIMFS_EXTENT_MAX_LEN;
+}
+
+static inline bool ext_unwritten(struct himfs_extent *e)
+{
+	return e->e_len & HIMFS_EXTENT_UNWRITTEN;
+}
+
+static inline uint32_t ext_end(struct himfs_extent *e)
+{
+	return e->e_lblk + ext_len(e);
+}
+
+static struct himfs_extent *ext_at(struct inode *inode, struct buffer_head *xbh, int idx)
+{
+	if (idx < HIMFS_INLINE_EXTENTS)
+	{
+		return &HIMFS_I(inode)->i_extents[idx];
+	}
+
+	return &((struct himfs_xblock *)xbh->b_data)->x_extents[idx - HIMFS_INLINE_EXTENTS];
+}
+
+/* 有溢出项时读出溢出块，*xbh 为 NULL 表示没有溢出块；nowait 时不在缓存里就返回 -EAGAIN */
+static int ext_read_xblock(struct inode *inode, struct buffer_head **xbh, bool nowait)
+{
+	struct himfs_inode_info *hii = HIMFS_I(inode);
+	struct himfs_xblock *xb;
+	lba_t lba;
+
+	*xbh = NULL;
+	if (!hii->i_xblock)
+	{
+		return 0;
+	}
+
+	lba = ext_lba(inode->i_sb, hii->i_xblock);
+	if (nowait)
+	{
+		*xbh = sb_find_get_block(inode->i_sb, lba);
+		if (!*xbh || !buffer_uptodate(*xbh))
+		{
+			brelse(*xbh);
+			*xbh = NULL;
+			return -EAGAIN;
+		}
+	}
+	else
+	{
+		*xbh = sb_bread(inode->i_sb, lba);
+		if (unlikely(!*xbh))
+		{
+			return -EIO;
+		}
+	}
+
+	xb = (struct himfs_xblock *)(*xbh)->b_data;
+	if (xb->x_magic != HIMFS_XBLOCK_MAGIC || xb->x_ino != inode->i_ino ||
+		xb->x_count != max_t(int, hii->i_nr_extents - HIMFS_INLINE_EXTENTS, 0))
+	{
+		printk(KERN_ERR "himfs: bad extent block %u of %lu\n", hii->i_xblock, inode->i_ino);
+		brelse(*xbh);
+		*xbh = NULL;
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static void ext_scan(struct inode *inode, struct buffer_head *xbh, uint32_t lblk, struct ext_scan *scan)
+{
+	struct himfs_extent *e;
+	int i;
+
+	scan->hit = -1;
+	scan->prev = -1;
+	scan->next_lblk = EXT_NONE;
+	scan->mapped = 0;
+
+	for (i = 0; i < HIMFS_I(inode)->i_nr_extents; ++i)
+	{
+		e = ext_at(inode, xbh, i);
+		scan->mapped += ext_len(e);
+
+		if (lblk >= e->e_lblk && lblk < ext_end(e))
+		{
+			scan->hit = i;
+		}
+		else if (e->e_lblk > lblk)
+		{
+			scan->next_lblk = min(scan->next_lblk, e->e_lblk);
+		}
+		else if (scan->prev < 0 || e->e_lblk > ext_at(inode, xbh, scan->prev)->e_lblk)
+		{
+			scan->prev = i;
+		}
+	}
+}
+
+/* 块号 0 由 mkfs 占住，不会分出来，所以 0 可以表示“没有溢出块” */
+static int ext_new_xblock(struct inode *inode, uint32_t goal, struct buffer_head **xbh)
+{
+	struct super_block *sb = inode->i_sb;
+	struct himfs_xblock *xb;
+	uint32_t pblk, len = 1;
+	int err;
+
+	err = himfs_new_blocks(sb, goal, &len, &pblk);
+	if (err)
+	{
+		return err;
+	}
+
+	*xbh = sb_getblk(sb, ext_lba(sb, pblk));
+	if (unlikely(!*xbh))
+	{
+		himfs_free_blocks(sb, pblk, 1);
+		return -ENOMEM;
+	}
+
+	lock_buffer(*xbh);
+	memset((*xbh)->b_data, 0, 1 << BLOCK_SHIFT);
+	xb = (struct himfs_xblock *)(*xbh)->b_data;
+	xb->x_magic = HIMFS_XBLOCK_MAGIC;
+	xb->x_generation = HIMFS_SB(sb)->generation;
+	xb->x_ino = inode->i_ino;
+	set_buffer_uptodate(*xbh);
+	unlock_buffer(*xbh);
+	himfs_journal_dirty(*xbh, 0, offsetof(struct himfs_xblock, x_extents));
+
+	HIMFS_I(inode)->i_xblock = pblk;
+	inode_add_bytes(inode, 1 << BLOCK_SHIFT);
+
+	return 0;
+}
+
+/* 释放块之前丢掉块设备缓存里的旧内容，避免以后把它写回到别的文件的数据上 */
+static void ext_forget(struct super_block *sb, uint32_t pblk, uint32_t len)
+{
+	struct buffer_head *bh;
+
+	while (len--)
+	{
+		bh = sb_find_get_block(sb, ext_lba(sb, pblk++));
+		if (bh)
+		{
+			bforget(bh);
+		}
+	}
+}
+
+void himfs_ext_init(struct inode *inode)
+{
+	struct himfs_inode_info *hii = HIMFS_I(inode);
+
+	init_rwsem(&hii->i_extent_sem);
+	hii->i_nr_extents = 0;
+	hii->i_xblock = 0;
+	memset(hii->i_extents, 0, sizeof(hii->i_extents));
+}
+
+/* 从盘上核心读入 extent 表，顺带算出 i_blocks */
+void himfs_ext_load(struct inode *inode, struct himfs_inode *him_inode)
+{
+	struct himfs_inode_info *hii = HIMFS_I(inode);
+	struct buffer_head *xbh;
+	struct ext_scan scan;
+
+	hii->i_nr_extents = him_inode->i_nr_extents;
+	hii->i_xblock = him_inode->i_xblock;
+	memcpy(hii->i_extents, him_inode->i_extents, sizeof(hii->i_extents));
+
+	inode->i_blocks = 0;
+	if (ext_read_xblock(inode, &xbh, false))
+	{
+		/* 溢出块坏了只保留核心里的部分，映射不到的块读出来是空洞 */
+		hii->i_nr_extents = min_t(uint16_t, hii->i_nr_extents, HIMFS_INLINE_EXTENTS);
+		hii->i_xblock = 0;
+	}
+
+	ext_scan(inode, xbh, 0, &scan);
+	inode_add_bytes(inode, (scan.mapped + (hii->i_xblock ? 1 : 0)) << BLOCK_SHIFT);
+	brelse(xbh);
+}
+
+void himfs_ext_store(struct inode *inode, struct himfs_inode *him_inode)
+{
+	struct himfs_inode_info *hii = HIMFS_I(inode);
+
+	down_read(&hii->i_extent_sem);
+	him_inode->i_nr_extents = hii->i_nr_extents;
+	him_inode->i_xblock = hii->i_xblock;
+	memcpy(him_inode->i_extents, hii->i_extents, sizeof(hii->i_extents));
+	up_read(&hii->i_extent_sem);
+}
+
+/* 命中 e 时把 map 截成从 m_lblk 起在 e 里连续的部分 */
+static void ext_fill_map(struct himfs_map *map, struct himfs_extent *e)
+{
+	uint32_t off = map->m_lblk - e->e_lblk;
+
+	map->m_pblk = e->e_pblk + off;
+	map->m_len = min(ext_len(e) - off, map->m_len);
+	if (ext_unwritten(e))
+	{
+		map->m_flags |= HIMFS_MAP_UNWRITTEN;
+	}
+}
+
+/* 已映射时只持读锁；要分配时换成写锁重新查一遍 */
+static int ext_lookup(struct inode *inode, struct himfs_map *map, bool nowait)
+{
+	struct buffer_head *xbh;
+	struct ext_scan scan;
+	int err;
+
+	err = ext_read_xblock(inode, &xbh, nowait);
+	if (err)
+	{
+		return err;
+	}
+
+	ext_scan(inode, xbh, map->m_lblk, &scan);
+	if (scan.hit >= 0)
+	{
+		ext_fill_map(map, ext_at(inode, xbh, scan.hit));
+	}
+	else
+	{
+		/* 空洞一直延伸到下一段的起点 */
+		map->m_len = min(map->m_len, scan.next_lblk - map->m_lblk);
+	}
+	brelse(xbh);
+
+	return 0;
+}
+
+/* unwritten 时是 fallocate：只分请求的长度，不做追加的成倍预分配，新段标成未写 */
+static int ext_alloc(struct inode *inode, struct himfs_map *map, bool unwritten)
+{
+	struct super_block *sb = inode->i_sb;
+	struct himfs_inode_info *hii = HIMFS_I(inode);
+	struct buffer_head *xbh;
+	struct himfs_extent *prev = NULL, *e;
+	struct ext_scan scan;
+	uint32_t lblk = map->m_lblk;
+	uint32_t want, goal = 0, pblk, got;
+	int err;
+
+	err = ext_read_xblock(inode, &xbh, false);
+	if (err)
+	{
+		return err;
+	}
+
+	ext_scan(inode, xbh, lblk, &scan);
+	if (scan.hit >= 0)
+	{
+		ext_fill_map(map, ext_at(inode, xbh, scan.hit));
+		goto out;
+	}
+
+	/* 写在末尾之后时按已有大小成倍预分配，写进空洞时不越过后面的段 */
+	want = map->m_len;
+	if (scan.next_lblk == EXT_NONE && !unwritten)
+	{
+		want = max_t(uint32_t, want, clamp_t(uint64_t, scan.mapped, 1, HIMFS_PREALLOC_MAX));
+	}
+	want = min3(want, scan.next_lblk - lblk, (uint32_t)HIMFS_EXTENT_MAX_LEN);
+
+	if (scan.prev >= 0)
+	{
+		prev = ext_at(inode, xbh, scan.prev);
+		goal = prev->e_pblk + ext_len(prev) + (lblk - ext_end(prev));
+	}
+
+	err = himfs_new_blocks(sb, goal, &want, &pblk);
+	if (err)
+	{
+		goto out;
+	}
+	got = want;
+
+	if (prev && ext_end(prev) == lblk && prev->e_pblk + ext_len(prev) == pblk &&
+		ext_unwritten(prev) == unwritten && ext_len(prev) + got <= HIMFS_EXTENT_MAX_LEN)
+	{
+		prev->e_len += got;
+		e = prev;
+	}
+	else
+	{
+		if (hii->i_nr_extents >= HIMFS_INLINE_EXTENTS + HIMFS_XBLOCK_EXTENTS)
+		{
+			printk(KERN_ERR "himfs: inode %lu has too many extents\n", inode->i_ino);
+			himfs_free_blocks(sb, pblk, got);
+			err = -ENOSPC;
+			goto out;
+		}
+
+		if (hii->i_nr_extents == HIMFS_INLINE_EXTENTS && !xbh)
+		{
+			err = ext_new_xblock(inode, pblk + got, &xbh);
+			if (err)
+			{
+				himfs_free_blocks(sb, pblk, got);
+				goto out;
+			}
+		}
+
+		e = ext_at(inode, xbh, hii->i_nr_extents);
+		e->e_lblk = lblk;
+		e->e_len = got | (unwritten ? HIMFS_EXTENT_UNWRITTEN : 0);
+		e->e_pblk = pblk;
+		if (++hii->i_nr_extents > HIMFS_INLINE_EXTENTS)
+		{
+			++((struct himfs_xblock *)xbh->b_data)->x_count;
+		}
+	}
+
+	/* 改到的表项在溢出块里，新加的表项还改了 x_count */
+	if (e == prev ? scan.prev >= HIMFS_INLINE_EXTENTS : hii->i_nr_extents > HIMFS_INLINE_EXTENTS)
+	{
+		if (e != prev)
+		{
+			himfs_journal_dirty(xbh, 0, offsetof(struct himfs_xblock, x_extents));
+		}
+		himfs_journal_dirty(xbh, (char *)e - xbh->b_data, sizeof(*e));
+	}
+
+	inode_add_bytes(inode, (loff_t)got << BLOCK_SHIFT);
+	ext_fill_map(map, e);
+	map->m_flags |= HIMFS_MAP_NEW;
+	err = 1;
+
+out:
+	brelse(xbh);
+	return err;
+}
+
+/*
+ * 映射 m_lblk 起最多 m_len 块，返回时 m_len 是实际连续的长度，m_pblk 为 0 表示空洞。
+ * HIMFS_GET_CREATE 时在空洞里分配，新分配的块带 HIMFS_MAP_NEW，调用者负责清零；
+ * 再带 HIMFS_GET_UNWRITTEN 时分出来的是未写段，不用清零。命中未写段时带 HIMFS_MAP_UNWRITTEN。
+ * HIMFS_GET_NOWAIT 时任何可能睡眠的步骤（等锁、读溢出块、分配）都改成返回 -EAGAIN。
+ */
+int himfs_ext_map_blocks(struct inode *inode, struct himfs_map *map, int flags)
+{
+	struct himfs_inode_info *hii = HIMFS_I(inode);
+	struct himfs_handle handle;
+	bool nowait = flags & HIMFS_GET_NOWAIT;
+	bool retried = false;
+	int err;
+
+	map->m_pblk = 0;
+	map->m_flags = 0;
+	map->m_len = max_t(uint32_t, map->m_len, 1);
+	if (map->m_lblk >= EXT_NONE)
+	{
+		return -EFBIG;
+	}
+	map->m_len = min(map->m_len, EXT_NONE - map->m_lblk);
+
+	if (nowait)
+	{
+		if (!down_read_trylock(&hii->i_extent_sem))
+		{
+			return -EAGAIN;
+		}
+	}
+	else
+	{
+		down_read(&hii->i_extent_sem);
+	}
+	err = ext_lookup(inode, map, nowait);
+	up_read(&hii->i_extent_sem);
+
+	if (err || map->m_pblk || !(flags & HIMFS_GET_CREATE))
+	{
+		return err;
+	}
+	if (nowait)
+	{
+		return -EAGAIN;
+	}
+
+again:
+	himfs_journal_start(inode->i_sb, HIMFS_JOP_WRITE, &handle);
+	down_write(&hii->i_extent_sem);
+	err = ext_alloc(inode, map, flags & HIMFS_GET_UNWRITTEN);
+	up_write(&hii->i_extent_sem);
+
+	/* 表变了才写回核心，dirty_inode 要拿读锁，所以放在锁外 */
+	if (err > 0)
+	{
+		mark_inode_dirty(inode);
+		err = 0;
+	}
+	himfs_journal_stop(&handle);
+
+	/* 剩下的空闲块都是还没检查点的释放，不在别的句柄里时等一次检查点再试 */
+	if (err == -ENOSPC && !retried && !current->journal_info && himfs_balloc_busy(inode->i_sb))
+	{
+		retried = true;
+		if (!himfs_journal_flush(inode->i_sb))
+		{
+			goto again;
+		}
+	}
+
+	return err;
+}
+
+/*
+ * get_block 的实现：映射 iblock 起最多 bh_result->b_size 字节，没有映射且 create 为 0 时
+ * 保持 unmapped（空洞）。新分配的块会标 new，调用者负责清零。
+ */
+int himfs_ext_map(struct inode *inode, sector_t iblock, struct buffer_head *bh_result, int create)
+{
+	struct himfs_map map;
+	int err;
+
+	if (iblock >= EXT_NONE)
+	{
+		return -EFBIG;
+	}
+
+	map.m_lblk = iblock;
+	map.m_len = bh_result->b_size >> BLOCK_SHIFT;
+	err = himfs_ext_map_blocks(inode, &map, create ? HIMFS_GET_CREATE : 0);
+	if (err || !map.m_pblk)
+	{
+		return err;
+	}
+
+	map_bh(bh_result, inode->i_sb, ext_lba(inode->i_sb, map.m_pblk));
+	bh_result->b_size = (size_t)map.m_len << BLOCK_SHIFT;
+	if (map.m_flags & HIMFS_MAP_NEW)
+	{
+		set_buffer_new(bh_result);
+	}
+
+	return 0;
+}
+
+/* 对 [lblk, end) 里的映射做的改动 */
+#define EXT_PUNCH       1       /* 释放 */
+#define EXT_TRIM        2       /* 只释放已写的段，fallocate 留下的未写段保留 */
+#define EXT_CONVERT     3       /* 未写转成已写 */
+#define EXT_UNWRITE     4       /* 已写转成未写 */
+
+static bool ext_applies(struct himfs_extent *e, int op)
+{
+	switch (op)
+	{
+	case EXT_TRIM:
+	case EXT_UNWRITE:
+		return !ext_unwritten(e);
+	case EXT_CONVERT:
+		return ext_unwritten(e);
+	default:
+		return true;
+	}
+}
+
+/* 取 e 里 [from, to) 这一截 */
+static void ext_piece(struct himfs_extent *dst, struct himfs_extent *e, uint32_t from, uint32_t to, bool unwritten)
+{
+	dst->e_lblk = from;
+	dst->e_pblk = e->e_pblk + (from - e->e_lblk);
+	dst->e_len = (to - from) | (unwritten ? HIMFS_EXTENT_UNWRITTEN : 0);
+}
+
+static int ext_cmp(const void *a, const void *b)
+{
+	const struct himfs_extent *x = a, *y = b;
+
+	return x->e_lblk < y->e_lblk ? -1 : x->e_lblk > y->e_lblk;
+}
+
+/* 按 e_lblk 排序，把首尾相接、物理连续、状态相同的相邻项并起来，返回剩下的项数 */
+static int ext_merge(struct himfs_extent *exts, int nr)
+{
+	struct himfs_extent *p;
+	int i, n = 0;
+
+	sort(exts, nr, sizeof(*exts), ext_cmp, NULL);
+	for (i = 0; i < nr; ++i)
+	{
+		p = n ? &exts[n - 1] : NULL;
+		if (p && ext_end(p) == exts[i].e_lblk && p->e_pblk + ext_len(p) == exts[i].e_pblk &&
+			ext_unwritten(p) == ext_unwritten(&exts[i]) &&
+			ext_len(p) + ext_len(&exts[i]) <= HIMFS_EXTENT_MAX_LEN)
+		{
+			p->e_len += ext_len(&exts[i]);
+			continue;
+		}
+		exts[n++] = exts[i];
+	}
+
+	return n;
+}
+
+/* 用 exts 替换整张表：核心里放不下的写进溢出块，没有就新分配一个，用不上了就释放 */
+static int ext_put(struct inode *inode, struct buffer_head **xbh, struct himfs_extent *exts, int nr)
+{
+	struct super_block *sb = inode->i_sb;
+	struct himfs_inode_info *hii = HIMFS_I(inode);
+	struct himfs_xblock *xb;
+	int err;
+
+	if (nr > HIMFS_INLINE_EXTENTS && !*xbh)
+	{
+		err = ext_new_xblock(inode, exts[0].e_pblk, xbh);
+		if (err)
+		{
+			return err;
+		}
+	}
+
+	memcpy(hii->i_extents, exts, min(nr, HIMFS_INLINE_EXTENTS) * sizeof(*exts));
+	hii->i_nr_extents = nr;
+	if (nr > HIMFS_INLINE_EXTENTS)
+	{
+		xb = (struct himfs_xblock *)(*xbh)->b_data;
+		xb->x_count = nr - HIMFS_INLINE_EXTENTS;
+		memcpy(xb->x_extents, exts + HIMFS_INLINE_EXTENTS, xb->x_count * sizeof(*exts));
+		himfs_journal_dirty(*xbh, 0, offsetof(struct himfs_xblock, x_extents) + xb->x_count * sizeof(*exts));
+	}
+	else if (*xbh)
+	{
+		bforget(*xbh);
+		*xbh = NULL;
+		himfs_free_blocks(sb, hii->i_xblock, 1);
+		hii->i_xblock = 0;
+		inode_sub_bytes(inode, 1 << BLOCK_SHIFT);
+	}
+
+	return 0;
+}
+
+/*
+ * 在一个句柄里对 [lblk, end) 做 op。跨在两头的段切开，只改范围里的那一截；
+ * 一段最多切成三截，而且只有跨在 lblk 和 end 上的两段会切，新表最多多出两项。
+ * 表放不下时什么都不改，返回 -ENOSPC；要释放的块等新表确定之后才还回去。
+ */
+static int ext_modify(struct inode *inode, uint32_t lblk, uint32_t end, int op)
+{
+	struct super_block *sb = inode->i_sb;
+	struct himfs_inode_info *hii = HIMFS_I(inode);
+	struct himfs_extent *exts, *gone, *e;
+	struct buffer_head *xbh;
+	struct himfs_handle handle;
+	uint32_t from, to;
+	uint64_t freed = 0;
+	int i, nr, n = 0, ngone = 0, err;
+	bool changed = false;
+
+	if (lblk >= end)
+	{
+		return 0;
+	}
+
+	himfs_journal_start(sb, (op == EXT_PUNCH || op == EXT_TRIM) ? HIMFS_JOP_TRUNCATE : HIMFS_JOP_WRITE, &handle);
+	down_write(&hii->i_extent_sem);
+
+	err = ext_read_xblock(inode, &xbh, false);
+	if (err)
+	{
+		goto unlock;
+	}
+
+	nr = hii->i_nr_extents;
+	exts = kmalloc_array(2 * nr + 2, sizeof(*exts), GFP_NOFS);
+	if (!exts)
+	{
+		err = -ENOMEM;
+		goto out;
+	}
+	gone = exts + nr + 2;
+
+	for (i = 0; i < nr; ++i)
+	{
+		e = ext_at(inode, xbh, i);
+		from = max(e->e_lblk, lblk);
+		to = min(ext_end(e), end);
+		if (from >= to || !ext_applies(e, op))
+		{
+			exts[n++] = *e;
+			continue;
+		}
+
+		if (from > e->e_lblk)
+		{
+			ext_piece(&exts[n++], e, e->e_lblk, from, ext_unwritten(e));
+		}
+		if (to < ext_end(e))
+		{
+			ext_piece(&exts[n++], e, to, ext_end(e), ext_unwritten(e));
+		}
+		if (op == EXT_PUNCH || op == EXT_TRIM)
+		{
+			ext_piece(&gone[ngone++], e, from, to, false);
+		}
+		else
+		{
+			ext_piece(&exts[n++], e, from, to, op == EXT_UNWRITE);
+		}
+		changed = true;
+	}
+
+	if (!changed)
+	{
+		goto free;
+	}
+
+	n = ext_merge(exts, n);
+	if (n > HIMFS_INLINE_EXTENTS + HIMFS_XBLOCK_EXTENTS)
+	{
+		printk(KERN_ERR "himfs: inode %lu has too many extents\n", inode->i_ino);
+		err = -ENOSPC;
+		goto free;
+	}
+	err = ext_put(inode, &xbh, exts, n);
+	if (err)
+	{
+		goto free;
+	}
+
+	for (i = 0; i < ngone; ++i)
+	{
+		if (S_ISDIR(inode->i_mode))
+		{
+			ext_forget(sb, gone[i].e_pblk, ext_len(&gone[i]));
+		}
+		himfs_free_blocks(sb, gone[i].e_pblk, ext_len(&gone[i]));
+		freed += ext_len(&gone[i]);
+	}
+	inode_sub_bytes(inode, (loff_t)freed << BLOCK_SHIFT);
+
+free:
+	kfree(exts);
+out:
+	brelse(xbh);
+unlock:
+	up_write(&hii->i_extent_sem);
+	/* 核心里的表项和 i_blocks 都变了，随这个句柄一起写 */
+	if (changed && !err)
+	{
+		mark_inode_dirty(inode);
+	}
+	himfs_journal_stop(&handle);
+
+	return err;
+}
+
+static inline uint32_t ext_range_end(uint32_t lblk, uint64_t len)
+{
+	return min_t(uint64_t, (uint64_t)lblk + len, EXT_NONE);
+}
+
+/* 释放 from 块及之后的所有映射，from 为 0 时连溢出块一起释放 */
+void himfs_ext_truncate(struct inode *inode, sector_t from)
+{
+	ext_modify(inode, min_t(sector_t, from, EXT_NONE), EXT_NONE, EXT_PUNCH);
+}
+
+/* 还回 from 块之后追加时多分的块，fallocate 带 KEEP_SIZE 预留在末尾之后的未写段留着 */
+void himfs_ext_trim(struct inode *inode, sector_t from)
+{
+	ext_modify(inode, min_t(sector_t, from, EXT_NONE), EXT_NONE, EXT_TRIM);
+}
+
+/* 打洞：释放 [lblk, lblk + len) 里的块 */
+int himfs_ext_punch(struct inode *inode, uint32_t lblk, uint64_t len)
+{
+	return ext_modify(inode, lblk, ext_range_end(lblk, len), EXT_PUNCH);
+}
+
+/* 数据已经落盘，把 [lblk, lblk + len) 里的未写段转成已写 */
+int himfs_ext_convert(struct inode *inode, uint32_t lblk, uint64_t len)
+{
+	himfs_stat_inc(inode->i_sb, HIMFS_STAT_UNWRITTEN_CONV);
+	return ext_modify(inode, lblk, ext_range_end(lblk, len), EXT_CONVERT);
+}
+
+/* 清零：块留着，已写段标回未写，之后读出来是零 */
+int himfs_ext_unwrite(struct inode *inode, uint32_t lblk, uint64_t len)
+{
+	return ext_modify(inode, lblk, ext_range_end(lblk, len), EXT_UNWRITE);
+}
@@ -0,0 +1,31 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#endif
+
+/* 一次块映射的输入输出，m_pblk 为 0 表示空洞（0 号数据块不会分出来） */
+struct himfs_map
+{
+	uint32_t m_lblk;
+	uint32_t m_len;
+	uint32_t m_pblk;
+	unsigned int m_flags;
+};
+
+#define HIMFS_MAP_NEW           0x1     /* 这次新分配的块 */
+#define HIMFS_MAP_UNWRITTEN     0x2     /* 预分配还没写过，读出来是零 */
+
+#define HIMFS_GET_CREATE        0x1
+#define HIMFS_GET_NOWAIT        0x2
+#define HIMFS_GET_UNWRITTEN     0x4     /* 和 CREATE 一起用，分出来的是未写段 */
+
+void himfs_ext_init(struct inode *inode);
+void himfs_ext_load(struct inode *inode, struct himfs_inode *him_inode);
+void himfs_ext_store(struct inode *inode, struct himfs_inode *him_inode);
+int himfs_ext_map_blocks(struct inode *inode, struct himfs_map *map, int flags);
+int himfs_ext_map(struct inode *inode, sector_t iblock, struct buffer_head *bh_result, int create);
+void himfs_ext_truncate(struct inode *inode, sector_t from);
+void himfs_ext_trim(struct inode *inode, sector_t from);
+int himfs_ext_punch(struct inode *inode, uint32_t lblk, uint64_t len);
+int himfs_ext_convert(struct inode *inode, uint32_t lblk, uint64_t len);
+int himfs_ext_unwrite(struct inode *inode, uint32_t lblk, uint64_t len);
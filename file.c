@@ -31,62 +31,59 @@
 #include <linux/buffer_head.h>
 #include <linux/pagemap.h>
 #include <linux/mpage.h>
-#include <linux/mpage.h>
+#include <linux/iomap.h>
+#include <linux/uio.h>
+#include <linux/falloc.h>
+#include <linux/workqueue.h>
 #ifndef _TEST_H_
 #define _TEST_H_
 #include "himfs_d.h"
 #include "hash.h"
+#include "dir.h"
+#include "extent.h"
+#include "inline.h"
+#include "journal.h"
+#include "stats.h"
+#include "ioctl.h"
+#include "himfs_trace.h"
 #endif
 
 int himfs_get_block_prep(struct inode *inode, sector_t iblock,
 			   struct buffer_head *bh_result, int create)
 {
-	int ret = 0;
-	lba_t ino = inode->i_ino;
- 	lba_t lba = (DATA_REGIN_START_LBA + (ino << 9)) + iblock;
-	bool new = false, boundary = false;
-	
-	/* todo: if pblk is a new block or update */
-	if((iblock << BLOCK_SIZE_BITS) > inode->i_size)
+	int ret;
+
+	/* 内联文件没有块映射，调用者应先转换 */
+	if (himfs_is_inline(inode))
 	{
-		new = true;
+		ret = create ? -EIO : 0;
+		goto out;
 	}
-	if(iblock > FILE_MAX_SIZE) 
+	
+	ret = himfs_ext_map(inode, iblock, bh_result, create);
+	if (ret || !buffer_mapped(bh_result))
 	{
-		boundary = true;
+		goto out;
 	}
 
-	map_bh(bh_result, inode->i_sb, lba);//核心
-	if (new)
+	/* 文件末尾之后的块可能是预分配的，盘上内容没意义，当作新块让调用者清零 */
+	if (((loff_t)iblock << BLOCK_SHIFT) >= himfs_data_size(inode))
 	{
 		set_buffer_new(bh_result);
 	}
 
-	if (boundary)
-	{
-		set_buffer_boundary(bh_result);
-	}
-	
+out:
+	trace_himfs_get_block_prep(inode, iblock, bh_result, create, ret);
 	return ret;
 }
 
+/* 目录和慢速符号链接仍按 buffer_head 映射，数据量小，也不会是内联的 */
 static int himfs_write_begin(struct file *file, struct address_space *mapping,
                  loff_t pos, unsigned len, unsigned flags,
                  struct page **pagep, void **fsdata)
 {	
-	int ret;
 	//("write begin\n");
-	ret = block_write_begin(mapping, pos, len, flags, pagep, himfs_get_block_prep);
-	struct inode *inode = mapping->host;
-	struct himfs_inode_info *fi = HIMFS_I(inode);
-
-	/* update himfs_inode size */
-	loff_t end = pos + len;
-	if (end >= mapping->host->i_size) {
-		inode->i_size = end;
-	}
-	
-	return ret;
+	return block_write_begin(mapping, pos, len, flags, pagep, himfs_get_block_prep);
 }
 
 static sector_t himfs_bmap(struct address_space *mapping, sector_t block)
@@ -123,23 +120,6 @@ himfs_readpages(struct file *file, struct address_space *mapping,
 	return mpage_readpages(mapping, pages, nr_pages, himfs_get_block_prep);
 }
 
-static ssize_t
-himfs_direct_IO(struct kiocb *iocb, struct iov_iter *iter)
-{
-	struct file *file = iocb->ki_filp;
-	struct address_space *mapping = file->f_mapping;
-	struct inode *inode = mapping->host;
-	//printk(KERN_INFO "himfs_direct_IO\n");
-	return blockdev_direct_IO(iocb, inode, iter, himfs_get_block_prep);
-}
-
-
-int himfs_fsync(struct file *file, loff_t start, loff_t end, int datasync)
-{
-	//printk(KERN_INFO "himfs file fsync");
-	return  generic_file_fsync(file, start, end, datasync);
-}
-
 struct address_space_operations himfs_aops = {// page cache访问接口,未自定义的接口会调用vfs的generic方法
 	.readpages	     = himfs_readpages,
 	.readpage	     = himfs_readpage,
@@ -149,9 +129,798 @@ struct address_space_operations himfs_aops = {// page cache访问接口,未自
 	.set_page_dirty	 = __set_page_dirty_nobuffers,
 	.writepages      = himfs_writepages,
 	.writepage       = himfs_writepage,
-	.direct_IO       = himfs_direct_IO,
 };
 
+/*
+ * 普通文件走 iomap：一次返回整段连续的 extent，读、回写和直接 I/O 都按段拼成大 bio，
+ * 不再逐块调 get_block，页上也不挂 buffer_head。
+ * 文件末尾之后的块可能是预分配的，标成 IOMAP_F_NEW 让 iomap 清零没写到的部分。
+ * fallocate 的未写段报成 IOMAP_UNWRITTEN：读的时候 iomap 直接填零，写的时候清零没写到的部分，
+ * 数据落盘后由回写的 ioend 或直接写的 end_io 转成已写。
+ */
+static int __himfs_iomap_begin(struct inode *inode, loff_t offset, loff_t length,
+			       unsigned flags, struct iomap *iomap)
+{
+	struct himfs_map map;
+	uint32_t size_blocks;
+	int err;
+
+	/* 内联文件在进 iomap 之前就分流或转换掉了 */
+	if (WARN_ON_ONCE(himfs_is_inline(inode)))
+	{
+		return -EIO;
+	}
+
+	map.m_lblk = min_t(loff_t, offset >> BLOCK_SHIFT, U32_MAX);
+	map.m_len = min_t(loff_t, ((offset + length - 1) >> BLOCK_SHIFT) - map.m_lblk + 1, HIMFS_EXTENT_MAX_LEN);
+	err = himfs_ext_map_blocks(inode, &map, ((flags & IOMAP_WRITE) ? HIMFS_GET_CREATE : 0) |
+		((flags & IOMAP_NOWAIT) ? HIMFS_GET_NOWAIT : 0));
+	if (err)
+	{
+		return err;
+	}
+
+	iomap->bdev = inode->i_sb->s_bdev;
+	iomap->offset = (loff_t)map.m_lblk << BLOCK_SHIFT;
+	iomap->flags = 0;
+
+	if (!map.m_pblk)
+	{
+		iomap->type = IOMAP_HOLE;
+		iomap->addr = IOMAP_NULL_ADDR;
+		iomap->length = (u64)map.m_len << BLOCK_SHIFT;
+		return 0;
+	}
+
+	/* 跨过文件末尾的段在末尾处切开，后半段按新块处理 */
+	size_blocks = min_t(loff_t, DIV_ROUND_UP(i_size_read(inode), 1 << BLOCK_SHIFT), U32_MAX);
+	if (map.m_lblk >= size_blocks)
+	{
+		iomap->flags |= IOMAP_F_NEW;
+	}
+	else if (map.m_lblk + map.m_len > size_blocks)
+	{
+		map.m_len = size_blocks - map.m_lblk;
+	}
+
+	/* 新分配改了 extent 表，O_DSYNC 的直接写不能只靠 FUA */
+	if (map.m_flags & HIMFS_MAP_NEW)
+	{
+		iomap->flags |= IOMAP_F_NEW | IOMAP_F_DIRTY;
+	}
+
+	/* 写完之后还要转换，O_DSYNC 的直接写同样不能只靠 FUA */
+	if (map.m_flags & HIMFS_MAP_UNWRITTEN)
+	{
+		iomap->type = IOMAP_UNWRITTEN;
+		if (flags & IOMAP_WRITE)
+		{
+			iomap->flags |= IOMAP_F_DIRTY;
+		}
+	}
+	else
+	{
+		iomap->type = IOMAP_MAPPED;
+	}
+	iomap->addr = (u64)(HIMFS_SB(inode->i_sb)->data_start + map.m_pblk) << BLOCK_SHIFT;
+	iomap->length = (u64)map.m_len << BLOCK_SHIFT;
+
+	return 0;
+}
+
+static int himfs_iomap_begin(struct inode *inode, loff_t offset, loff_t length,
+			     unsigned flags, struct iomap *iomap, struct iomap *srcmap)
+{
+	int ret;
+
+	ret = __himfs_iomap_begin(inode, offset, length, flags, iomap);
+	trace_himfs_iomap_begin(inode, offset, length, flags, iomap, ret);
+
+	return ret;
+}
+
+const struct iomap_ops himfs_iomap_ops = {
+	.iomap_begin	= himfs_iomap_begin,
+};
+
+/* 上一次映射还盖得住就直接用，mmap 写脏的空洞页在这里才分配 */
+static int himfs_map_blocks(struct iomap_writepage_ctx *wpc, struct inode *inode, loff_t offset)
+{
+	if (offset >= wpc->iomap.offset && offset < wpc->iomap.offset + wpc->iomap.length)
+	{
+		return 0;
+	}
+
+	return himfs_iomap_begin(inode, offset, max_t(loff_t, i_size_read(inode) - offset, 1 << BLOCK_SHIFT),
+		IOMAP_WRITE, &wpc->iomap, NULL);
+}
+
+/*
+ * 写进未写段的 ioend 要在数据落盘之后转换 extent，bio 完成时在中断里，不能开句柄，
+ * 挂到挂载的链表上交给工作队列；转换完再结束页的回写，fsync 等到回写结束时转换已经进了日志。
+ */
+static void himfs_end_bio(struct bio *bio)
+{
+	struct iomap_ioend *ioend = bio->bi_private;
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(ioend->io_inode->i_sb);
+	unsigned long flags;
+
+	spin_lock_irqsave(&himfs_sb->ioend_lock, flags);
+	list_add_tail(&ioend->io_list, &himfs_sb->ioend_list);
+	spin_unlock_irqrestore(&himfs_sb->ioend_lock, flags);
+	queue_work(himfs_sb->ioend_wq, &himfs_sb->ioend_work);
+}
+
+static void himfs_ioend_work(struct work_struct *work)
+{
+	struct himfs_sb_info *himfs_sb = container_of(work, struct himfs_sb_info, ioend_work);
+	struct iomap_ioend *ioend;
+	uint32_t lblk;
+	LIST_HEAD(list);
+	int err;
+
+	spin_lock_irq(&himfs_sb->ioend_lock);
+	list_splice_init(&himfs_sb->ioend_list, &list);
+	spin_unlock_irq(&himfs_sb->ioend_lock);
+
+	while (!list_empty(&list))
+	{
+		ioend = list_first_entry(&list, struct iomap_ioend, io_list);
+		list_del_init(&ioend->io_list);
+
+		err = blk_status_to_errno(ioend->io_bio->bi_status);
+		if (!err)
+		{
+			lblk = ioend->io_offset >> BLOCK_SHIFT;
+			err = himfs_ext_convert(ioend->io_inode, lblk,
+				DIV_ROUND_UP(ioend->io_offset + ioend->io_size, 1 << BLOCK_SHIFT) - lblk);
+		}
+		iomap_finish_ioends(ioend, err);
+	}
+}
+
+static int himfs_prepare_ioend(struct iomap_ioend *ioend, int status)
+{
+	if (!status && ioend->io_type == IOMAP_UNWRITTEN)
+	{
+		ioend->io_bio->bi_end_io = himfs_end_bio;
+	}
+
+	return status;
+}
+
+static const struct iomap_writeback_ops himfs_writeback_ops = {
+	.map_blocks	= himfs_map_blocks,
+	.prepare_ioend	= himfs_prepare_ioend,
+};
+
+/* 回写完成要分配内存和等日志，放在带救援线程的队列里，内存紧张时回写也能结束 */
+int himfs_ioend_init(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+
+	spin_lock_init(&himfs_sb->ioend_lock);
+	INIT_LIST_HEAD(&himfs_sb->ioend_list);
+	INIT_WORK(&himfs_sb->ioend_work, himfs_ioend_work);
+	himfs_sb->ioend_wq = alloc_workqueue("himfs-ioend/%s", WQ_MEM_RECLAIM | WQ_FREEZABLE, 1, sb->s_id);
+
+	return himfs_sb->ioend_wq ? 0 : -ENOMEM;
+}
+
+/* 卸载时回写都已经结束，这里只等最后一次转换跑完 */
+void himfs_ioend_exit(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+
+	if (!himfs_sb->ioend_wq)
+	{
+		return;
+	}
+
+	destroy_workqueue(himfs_sb->ioend_wq);
+	himfs_sb->ioend_wq = NULL;
+}
+
+/*
+ * 只有 write_iter 判定写完仍能内联时才会走到这里。回写时可能刚因为桶满转成了块映射，
+ * 这时第 0 页照常从块上读回来，写完由 iomap 回写。
+ */
+static int himfs_file_write_begin(struct file *file, struct address_space *mapping,
+				  loff_t pos, unsigned len, unsigned flags,
+				  struct page **pagep, void **fsdata)
+{
+	struct page *page;
+	int err;
+
+retry:
+	if (himfs_is_inline(mapping->host))
+	{
+		return himfs_inline_write_begin(mapping, pos, len, flags, pagep);
+	}
+
+	page = grab_cache_page_write_begin(mapping, pos >> PAGE_SHIFT, flags);
+	if (!page)
+	{
+		return -ENOMEM;
+	}
+
+	if (!PageUptodate(page))
+	{
+		err = iomap_readpage(page, &himfs_iomap_ops);
+		put_page(page);
+		if (err)
+		{
+			return err;
+		}
+		goto retry;
+	}
+
+	*pagep = page;
+	return 0;
+}
+
+static sector_t himfs_file_bmap(struct address_space *mapping, sector_t block)
+{
+	if (himfs_is_inline(mapping->host))
+	{
+		return 0;
+	}
+
+	return iomap_bmap(mapping, block, &himfs_iomap_ops);
+}
+
+static int himfs_file_writepage(struct page *page, struct writeback_control *wbc)
+{
+	struct iomap_writepage_ctx wpc = { };
+	int ret;
+
+	if (himfs_is_inline(page->mapping->host))
+	{
+		ret = himfs_inline_writepage(page, wbc);
+		if (ret <= 0)
+		{
+			return ret;
+		}
+	}
+
+	return iomap_writepage(page, wbc, &wpc, &himfs_writeback_ops);
+}
+
+static int himfs_file_writepages(struct address_space *mapping, struct writeback_control *wbc)
+{
+	struct iomap_writepage_ctx wpc = { };
+
+	/* 内联文件只有第 0 页，逐页走 writepage 决定写回桶里还是转换 */
+	if (himfs_is_inline(mapping->host))
+	{
+		return generic_writepages(mapping, wbc);
+	}
+
+	return iomap_writepages(mapping, wbc, &wpc, &himfs_writeback_ops);
+}
+
+static int himfs_file_readpage(struct file *file, struct page *page)
+{
+	if (himfs_is_inline(page->mapping->host))
+	{
+		return himfs_inline_readpage(page->mapping->host, page);
+	}
+
+	return iomap_readpage(page, &himfs_iomap_ops);
+}
+
+static int himfs_file_readpages(struct file *file, struct address_space *mapping,
+				struct list_head *pages, unsigned nr_pages)
+{
+	/* 内联文件不做预读，缺页时逐页走 readpage */
+	if (himfs_is_inline(mapping->host))
+	{
+		return 0;
+	}
+
+	return iomap_readpages(mapping, pages, nr_pages, &himfs_iomap_ops);
+}
+
+struct address_space_operations himfs_file_aops = {
+	.readpages		= himfs_file_readpages,
+	.readpage		= himfs_file_readpage,
+	.write_begin		= himfs_file_write_begin,
+	.write_end		= simple_write_end,
+	.bmap			= himfs_file_bmap,
+	.set_page_dirty		= iomap_set_page_dirty,
+	.writepages		= himfs_file_writepages,
+	.writepage		= himfs_file_writepage,
+	.releasepage		= iomap_releasepage,
+	.invalidatepage		= iomap_invalidatepage,
+	.migratepage		= iomap_migrate_page,
+	.is_partially_uptodate	= iomap_is_partially_uptodate,
+	.error_remove_page	= generic_error_remove_page,
+	/* 直接 I/O 在 read_iter/write_iter 里走 iomap_dio_rw，这里只让 O_DIRECT 能打开 */
+	.direct_IO		= noop_direct_IO,
+};
+
+/*
+ * 扩展文件的直接写总是同步完成，这时仍持有 i_rwsem，可以直接改 i_size。
+ * 写进了未写段时先转换；异步写的完成由 iomap 放到 s_dio_done_wq 里，可以开句柄。
+ */
+static int himfs_dio_write_end_io(struct kiocb *iocb, ssize_t size, int error, unsigned flags)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	uint32_t lblk;
+
+	if (error)
+	{
+		return error;
+	}
+
+	if (size && (flags & IOMAP_DIO_UNWRITTEN))
+	{
+		lblk = iocb->ki_pos >> BLOCK_SHIFT;
+		error = himfs_ext_convert(inode, lblk, DIV_ROUND_UP(iocb->ki_pos + size, 1 << BLOCK_SHIFT) - lblk);
+		if (error)
+		{
+			return error;
+		}
+	}
+
+	if (size && iocb->ki_pos + size > i_size_read(inode))
+	{
+		i_size_write(inode, iocb->ki_pos + size);
+		mark_inode_dirty(inode);
+	}
+
+	return 0;
+}
+
+static const struct iomap_dio_ops himfs_dio_write_ops = {
+	.end_io		= himfs_dio_write_end_io,
+};
+
+static ssize_t himfs_do_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	ssize_t ret;
+
+	if (!(iocb->ki_flags & IOCB_DIRECT))
+	{
+		return generic_file_read_iter(iocb, to);
+	}
+	if (!iov_iter_count(to))
+	{
+		return 0;
+	}
+
+	if (iocb->ki_flags & IOCB_NOWAIT)
+	{
+		if (!inode_trylock_shared(inode))
+		{
+			return -EAGAIN;
+		}
+	}
+	else
+	{
+		inode_lock_shared(inode);
+	}
+
+	if (himfs_is_inline(inode))
+	{
+		/* 内联文件没有数据块，O_DIRECT 退回缓存读 */
+		iocb->ki_flags &= ~IOCB_DIRECT;
+		ret = generic_file_read_iter(iocb, to);
+	}
+	else
+	{
+		ret = iomap_dio_rw(iocb, to, &himfs_iomap_ops, NULL, is_sync_kiocb(iocb));
+	}
+
+	inode_unlock_shared(inode);
+	file_accessed(iocb->ki_filp);
+
+	return ret;
+}
+
+/*
+ * 不扩展文件的直接写在映射已存在时全程不睡眠，IOCB_NOWAIT 下要分配块、扩展文件或
+ * 拿不到锁都返回 -EAGAIN，交给 io_uring 的工作线程重试。
+ */
+static ssize_t himfs_do_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *file = iocb->ki_filp;
+	struct inode *inode = file_inode(file);
+	bool extend;
+	ssize_t ret;
+
+	if (iocb->ki_flags & IOCB_NOWAIT)
+	{
+		if (!inode_trylock(inode))
+		{
+			return -EAGAIN;
+		}
+	}
+	else
+	{
+		inode_lock(inode);
+	}
+
+	ret = generic_write_checks(iocb, from);
+	if (ret <= 0)
+	{
+		goto out;
+	}
+	ret = file_remove_privs(file);
+	if (ret)
+	{
+		goto out;
+	}
+	ret = file_update_time(file);
+	if (ret)
+	{
+		goto out;
+	}
+
+	if (himfs_is_inline(inode))
+	{
+		if (iocb->ki_pos + iov_iter_count(from) <= HIMFS_INLINE_MAX)
+		{
+			/* 写完仍能内联，O_DIRECT 也按缓存写 */
+			current->backing_dev_info = inode_to_bdi(inode);
+			ret = generic_perform_write(file, from, iocb->ki_pos);
+			current->backing_dev_info = NULL;
+			if (ret > 0)
+			{
+				iocb->ki_pos += ret;
+			}
+			goto out;
+		}
+
+		if (iocb->ki_flags & IOCB_NOWAIT)
+		{
+			ret = -EAGAIN;
+			goto out;
+		}
+		ret = himfs_inline_convert(inode, NULL);
+		if (ret)
+		{
+			goto out;
+		}
+	}
+
+	if (iocb->ki_flags & IOCB_DIRECT)
+	{
+		extend = iocb->ki_pos + iov_iter_count(from) > i_size_read(inode);
+		if (extend && (iocb->ki_flags & IOCB_NOWAIT))
+		{
+			ret = -EAGAIN;
+			goto out;
+		}
+		if (extend)
+		{
+			inode_dio_wait(inode);
+		}
+
+		ret = iomap_dio_rw(iocb, from, &himfs_iomap_ops, &himfs_dio_write_ops,
+			is_sync_kiocb(iocb) || extend);
+	}
+	else
+	{
+		current->backing_dev_info = inode_to_bdi(inode);
+		ret = iomap_file_buffered_write(iocb, from, &himfs_iomap_ops);
+		current->backing_dev_info = NULL;
+		if (ret > 0)
+		{
+			iocb->ki_pos += ret;
+		}
+	}
+
+out:
+	inode_unlock(inode);
+	if (ret > 0)
+	{
+		ret = generic_write_sync(iocb, ret);
+	}
+
+	return ret;
+}
+
+/* mmap 写缺页时就把块分配好，空间不够在缺页时报错而不是回写时丢数据 */
+static vm_fault_t himfs_page_mkwrite(struct vm_fault *vmf)
+{
+	struct inode *inode = file_inode(vmf->vma->vm_file);
+	vm_fault_t ret;
+
+	if (himfs_is_inline(inode))
+	{
+		return filemap_page_mkwrite(vmf);
+	}
+
+	sb_start_pagefault(inode->i_sb);
+	file_update_time(vmf->vma->vm_file);
+	ret = iomap_page_mkwrite(vmf, &himfs_iomap_ops);
+	sb_end_pagefault(inode->i_sb);
+
+	return ret;
+}
+
+static const struct vm_operations_struct himfs_file_vm_ops = {
+	.fault		= filemap_fault,
+	.map_pages	= filemap_map_pages,
+	.page_mkwrite	= himfs_page_mkwrite,
+};
+
+static int himfs_file_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	file_accessed(file);
+	vma->vm_ops = &himfs_file_vm_ops;
+
+	return 0;
+}
+
+static int himfs_file_open(struct inode *inode, struct file *file)
+{
+	file->f_mode |= FMODE_NOWAIT;
+
+	return generic_file_open(inode, file);
+}
+
+/* 最后一个写者关闭时把末尾之后追加多分的块还回去，fallocate 预留的留着 */
+static int himfs_file_release(struct inode *inode, struct file *file)
+{
+	if ((file->f_mode & FMODE_WRITE) && atomic_read(&inode->i_writecount) == 1)
+	{
+		inode_lock(inode);
+		if (!himfs_is_inline(inode))
+		{
+			inode_dio_wait(inode);
+			himfs_ext_trim(inode, DIV_ROUND_UP(i_size_read(inode), 1 << BLOCK_SHIFT));
+		}
+		inode_unlock(inode);
+	}
+
+	return 0;
+}
+
+/* [start, end) 两头不满一块的部分经页缓存清零，文件末尾之后的部分本来就读不到 */
+static int himfs_zero_edges(struct inode *inode, loff_t start, loff_t end)
+{
+	loff_t size = i_size_read(inode);
+	loff_t first = round_up(start, 1 << BLOCK_SHIFT);
+	loff_t last = round_down(end, 1 << BLOCK_SHIFT);
+	int err = 0;
+
+	if (first > last)
+	{
+		/* 头尾落在同一块里 */
+		return start < size ? iomap_zero_range(inode, start, min(end, size) - start, NULL, &himfs_iomap_ops) : 0;
+	}
+
+	if (start < first && start < size)
+	{
+		err = iomap_zero_range(inode, start, min(first, size) - start, NULL, &himfs_iomap_ops);
+	}
+	if (!err && last < end && last < size)
+	{
+		err = iomap_zero_range(inode, last, min(end, size) - last, NULL, &himfs_iomap_ops);
+	}
+
+	return err;
+}
+
+/* 整块的部分先丢掉页缓存（正在回写的等它写完、转换完），再改 extent 表 */
+static int himfs_punch_hole(struct inode *inode, loff_t start, loff_t end)
+{
+	loff_t first = round_up(start, 1 << BLOCK_SHIFT);
+	loff_t last = round_down(end, 1 << BLOCK_SHIFT);
+	int err;
+
+	err = himfs_zero_edges(inode, start, end);
+	if (err || first >= last)
+	{
+		return err;
+	}
+
+	truncate_pagecache_range(inode, first, last - 1);
+	return himfs_ext_punch(inode, first >> BLOCK_SHIFT, (last - first) >> BLOCK_SHIFT);
+}
+
+/* 清零不还块，已写段标回未写，空洞留给后面的预分配填上 */
+static int himfs_zero_range(struct inode *inode, loff_t start, loff_t end)
+{
+	loff_t first = round_up(start, 1 << BLOCK_SHIFT);
+	loff_t last = round_down(end, 1 << BLOCK_SHIFT);
+	int err;
+
+	err = himfs_zero_edges(inode, start, end);
+	if (err || first >= last)
+	{
+		return err;
+	}
+
+	truncate_pagecache_range(inode, first, last - 1);
+	return himfs_ext_unwrite(inode, first >> BLOCK_SHIFT, (last - first) >> BLOCK_SHIFT);
+}
+
+/* 把 [lblk, end) 里的空洞填成未写段，已经映射的部分不动 */
+static int himfs_prealloc(struct inode *inode, uint32_t lblk, uint32_t end)
+{
+	struct himfs_map map;
+	int err;
+
+	while (lblk < end)
+	{
+		if (fatal_signal_pending(current))
+		{
+			return -EINTR;
+		}
+
+		map.m_lblk = lblk;
+		map.m_len = min_t(uint32_t, end - lblk, HIMFS_EXTENT_MAX_LEN);
+		err = himfs_ext_map_blocks(inode, &map, HIMFS_GET_CREATE | HIMFS_GET_UNWRITTEN);
+		if (err)
+		{
+			return err;
+		}
+		if (map.m_flags & HIMFS_MAP_NEW)
+		{
+			himfs_stat_add(inode->i_sb, HIMFS_STAT_PREALLOC_BLOCK, map.m_len);
+		}
+		lblk += map.m_len;
+	}
+
+	return 0;
+}
+
+/*
+ * 预分配（可带 KEEP_SIZE）、打洞和清零。整块的部分只改 extent 表：预分配把空洞填成未写段，
+ * 清零把已写段标回未写，打洞释放块；两头不满一块的部分走页缓存清零。
+ * 预分配过的文件追加时 iomap_begin 直接命中整段映射，不用每次写都开句柄分配。
+ */
+static long himfs_fallocate(struct file *file, int mode, loff_t offset, loff_t len)
+{
+	struct inode *inode = file_inode(file);
+	struct himfs_handle handle;
+	loff_t end = offset + len, size;
+	long ret;
+
+	if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE))
+	{
+		return -EOPNOTSUPP;
+	}
+	if (end > ((loff_t)U32_MAX << BLOCK_SHIFT))
+	{
+		return -EFBIG;
+	}
+
+	inode_lock(inode);
+	size = i_size_read(inode);
+	if (!(mode & FALLOC_FL_KEEP_SIZE) && end > size)
+	{
+		ret = inode_newsize_ok(inode, end);
+		if (ret)
+		{
+			goto out;
+		}
+	}
+
+	if (himfs_is_inline(inode))
+	{
+		ret = himfs_inline_convert(inode, NULL);
+		if (ret)
+		{
+			goto out;
+		}
+	}
+	inode_dio_wait(inode);
+
+	if (mode & FALLOC_FL_PUNCH_HOLE)
+	{
+		ret = himfs_punch_hole(inode, offset, end);
+		if (ret)
+		{
+			goto out;
+		}
+	}
+	else
+	{
+		ret = himfs_set_incompat(inode->i_sb, HIMFS_FEATURE_INCOMPAT_UNWRITTEN);
+		if (ret)
+		{
+			goto out;
+		}
+		/* 越过末尾时，末尾之后追加多分的块盘上是旧内容，先还回去再按空洞预分配 */
+		if (end > size)
+		{
+			himfs_ext_trim(inode, DIV_ROUND_UP(size, 1 << BLOCK_SHIFT));
+		}
+		if (mode & FALLOC_FL_ZERO_RANGE)
+		{
+			ret = himfs_zero_range(inode, offset, end);
+			if (ret)
+			{
+				goto out;
+			}
+		}
+		ret = himfs_prealloc(inode, offset >> BLOCK_SHIFT, DIV_ROUND_UP(end, 1 << BLOCK_SHIFT));
+		if (ret)
+		{
+			goto out;
+		}
+	}
+
+	/* 只预留空间不改内容，也不变长时不动属性 */
+	if ((mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE)) ||
+		(!(mode & FALLOC_FL_KEEP_SIZE) && end > size))
+	{
+		himfs_journal_start(inode->i_sb, HIMFS_JOP_ATTR, &handle);
+		if (!(mode & FALLOC_FL_KEEP_SIZE) && end > size)
+		{
+			i_size_write(inode, end);
+		}
+		inode->i_mtime = inode->i_ctime = current_time(inode);
+		mark_inode_dirty(inode);
+		himfs_journal_stop(&handle);
+	}
+
+out:
+	inode_unlock(inode);
+	return ret;
+}
+
+static ssize_t himfs_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct super_block *sb = file_inode(iocb->ki_filp)->i_sb;
+	u64 t0 = himfs_lat_start();
+	ssize_t ret;
+
+	ret = himfs_do_read_iter(iocb, to);
+	if (ret > 0)
+	{
+		himfs_stat_add(sb, HIMFS_STAT_READ_BYTES, ret);
+	}
+	himfs_lat_end(sb, HIMFS_LAT_READ, t0);
+
+	return ret;
+}
+
+static ssize_t himfs_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct super_block *sb = file_inode(iocb->ki_filp)->i_sb;
+	u64 t0 = himfs_lat_start();
+	ssize_t ret;
+
+	ret = himfs_do_write_iter(iocb, from);
+	if (ret > 0)
+	{
+		himfs_stat_add(sb, HIMFS_STAT_WRITE_BYTES, ret);
+	}
+	himfs_lat_end(sb, HIMFS_LAT_WRITE, t0);
+
+	return ret;
+}
+
+/* 先写完数据，再等记着这个 inode 最近改动的事务提交，不再逐块同步元数据 */
+int himfs_fsync(struct file *file, loff_t start, loff_t end, int datasync)
+{
+	struct inode *inode = file_inode(file);
+	u64 t0 = himfs_lat_start();
+	int err;
+
+	//printk(KERN_INFO "himfs file fsync");
+	himfs_stat_inc(inode->i_sb, HIMFS_STAT_FSYNC);
+	err = file_write_and_wait_range(file, start, end);
+	/* 句柄外改的属性还在内存里，先写进日志；fdatasync 不管只改了时间戳的情况 */
+	if (!err && (!datasync || (inode->i_state & I_DIRTY_DATASYNC)))
+	{
+		err = sync_inode_metadata(inode, 1);
+	}
+	if (!err)
+	{
+		err = himfs_journal_sync_inode(inode);
+	}
+	himfs_lat_end(inode->i_sb, HIMFS_LAT_FSYNC, t0);
+
+	return err;
+}
+
 static unsigned long himfs_mmu_get_unmapped_area(struct file *file,
 		unsigned long addr, unsigned long len, unsigned long pgoff,
 		unsigned long flags)
@@ -159,29 +928,93 @@ static unsigned long himfs_mmu_get_unmapped_area(struct file *file,
 	return current->mm->get_unmapped_area(file, addr, len, pgoff, flags);
 }
 struct file_operations himfs_file_file_ops = {
-	.read_iter		= generic_file_read_iter,
-	.write_iter		= generic_file_write_iter,
-	.mmap           = generic_file_mmap,
+	.read_iter		= himfs_file_read_iter,
+	.write_iter		= himfs_file_write_iter,
+	.mmap           = himfs_file_mmap,
+	.open			= himfs_file_open,
 	.fsync			= himfs_fsync,
 	.llseek         = generic_file_llseek,
+	.release		= himfs_file_release,
+	.fallocate		= himfs_fallocate,
+	.splice_read	= generic_file_splice_read,
+	.splice_write	= iter_file_splice_write,
 };
 
+/*
+ * 按目录子项日志顺序列出子项，代价与子项数成正比。ctx->pos 是日志偏移加 HIMFS_DIR_POS_BASE，
+ * 日志只追加、删除只留墓碑，所以 cookie 在目录被修改后依然有效。
+ * 调用时持有共享的 i_rwsem，追加和删除持有独占锁，不会并发修改日志。
+ */
 static int himfs_readdir(struct file *file, struct dir_context *ctx)
 {
 	//printk(KERN_INFO "himfs read dir");
+	struct inode *dir = file_inode(file);
+	uint32_t end = READ_ONCE(HIMFS_I(dir)->i_dlog_end);
+	struct buffer_head *bh;
+	struct himfs_dirent *de;
 	loff_t pos;/*文件的偏移*/
-	struct inode *ino = file_inode(file);
-	struct super_block *sb = ino->i_sb;
-	struct himfs_ino himfs_ino;
-	struct himfs_sb_info *himfs_sb = sb->s_fs_info;
+	uint32_t off;
+
+	if (!dir_emit_dots(file, ctx))
+	{
+		return 0;
+	}
+
+	pos = ctx->pos - HIMFS_DIR_POS_BASE;
+
+	while (pos < end)
+	{
+		bh = himfs_dlog_bread(dir, pos >> BLOCK_SHIFT, 0);
+		if (unlikely(!bh))
+		{
+			return -EIO;
+		}
+
+		/* 从块首顺着 rec_len 走，随便给的 cookie 也会落到记录边界上 */
+		for (off = 0; off < (1 << BLOCK_SHIFT); off += de->d_rec_len)
+		{
+			loff_t cur = (pos & ~((loff_t)(1 << BLOCK_SHIFT) - 1)) + off;
+
+			de = (struct himfs_dirent *)(bh->b_data + off);
+			if (cur >= end)
+			{
+				break;
+			}
+
+			if (de->d_rec_len < sizeof(struct himfs_dirent) || off + de->d_rec_len > (1 << BLOCK_SHIFT))
+			{
+				printk(KERN_ERR "himfs: bad dir log record in %lu at %lld\n", dir->i_ino, cur);
+				brelse(bh);
+				return -EIO;
+			}
+
+			if (cur < pos || de->d_ino == 0)
+			{
+				continue;
+			}
+
+			ctx->pos = cur + HIMFS_DIR_POS_BASE;
+			if (!dir_emit(ctx, de->d_name, de->d_name_len, de->d_ino, de->d_type))
+			{
+				brelse(bh);
+				return 0;
+			}
+		}
+
+		brelse(bh);
+		pos = (pos | ((1 << BLOCK_SHIFT) - 1)) + 1;
+		ctx->pos = min_t(loff_t, pos, end) + HIMFS_DIR_POS_BASE;
+	}
 
 	return 0;
 }
 
 struct file_operations himfs_dir_operations = {
 	.read			= generic_read_dir,
-	.iterate		= himfs_readdir,//ls
-	.iterate_shared = himfs_readdir,
-	//.fsync			= himfs_fsync,
+	.iterate_shared = himfs_readdir,//ls
+	.llseek			= generic_file_llseek,
+	.fsync			= himfs_fsync,
+	.unlocked_ioctl	= himfs_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
 	//.release		= lightfs_dir_release,
-};
\ No newline at end of file
+};
@@ -0,0 +1,18 @@
+# 用 fio 在 brd 内存盘上比较 I/O 路径：缓存顺序读写、io_uring 直接随机读写（覆盖写，不分配）。
+# 比较旧路径时先 git checkout 到上一个版本重新编译 himfs.ko，再跑一遍同样的脚本。
+# 用法: sh fio_iomap.sh [设备] [挂载点]
+DEV=${1:-/dev/ram0}
+MNT=${2:-/mnt/bbssd}
+[ -b $DEV ] || sudo modprobe brd rd_nr=1 rd_size=8388608
+sudo umount $MNT
+sudo rmmod himfs
+sudo insmod himfs.ko
+[ -x ./mkfs.himfs ] || gcc -O2 -o mkfs.himfs mkfs_himfs.c
+sudo ./mkfs.himfs $DEV
+sudo mount -t himfs $DEV $MNT
+COMMON="--directory=$MNT --filename=fio.dat --size=2g --runtime=30 --time_based --group_reporting"
+sudo fio $COMMON --name=seqwrite --rw=write --bs=1m --ioengine=psync --end_fsync=1
+sudo fio $COMMON --name=seqread --rw=read --bs=1m --ioengine=psync --invalidate=1
+sudo fio $COMMON --name=randread --rw=randread --bs=4k --direct=1 --ioengine=io_uring --iodepth=32
+sudo fio $COMMON --name=randwrite --rw=randwrite --bs=4k --direct=1 --ioengine=io_uring --iodepth=32
+sudo rm -f $MNT/fio.dat
@@ -0,0 +1,241 @@
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/hash.h>
+#include <linux/bitmap.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/buffer_head.h>
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#include "hash.h"
+#include "fpindex.h"
+#endif
+
+/* 指纹取哈希中与选桶无关的高位，保证非 0 */
+uint8_t himfs_fp(uint32_t hash)
+{
+	return 1 + hash_32(hash, 8) % 255;
+}
+
+bool himfs_fpindex_ready(struct super_block *sb)
+{
+	struct himfs_fpindex *fpi = HIMFS_SB(sb)->fpindex;
+
+	return fpi && smp_load_acquire(&fpi->ready);
+}
+
+static inline uint32_t fpindex_nr(struct himfs_fpindex *fpi, lba_t lba)
+{
+	return lba - HIMFS_SB(fpi->sb)->meta_start;
+}
+
+static inline uint8_t *fpindex_bucket(struct himfs_fpindex *fpi, lba_t lba)
+{
+	return &fpi->fp[fpindex_nr(fpi, lba) * HASH_SLOT_NUM];
+}
+
+/* 返回指纹等于 fp 的槽位掩码，只有这些槽需要读盘比对 */
+unsigned long himfs_fpindex_match(struct super_block *sb, lba_t lba, uint8_t fp)
+{
+	uint8_t *bucket = fpindex_bucket(HIMFS_SB(sb)->fpindex, lba);
+	unsigned long mask = 0;
+	int i;
+
+	for (i = 0; i < HASH_SLOT_NUM; ++i)
+	{
+		if (READ_ONCE(bucket[i]) == fp)
+		{
+			mask |= 1UL << i;
+		}
+	}
+
+	return mask;
+}
+
+/* 返回空槽掩码 */
+unsigned long himfs_fpindex_free(struct super_block *sb, lba_t lba)
+{
+	return himfs_fpindex_match(sb, lba, 0);
+}
+
+bool himfs_fpindex_overflow(struct super_block *sb, lba_t lba)
+{
+	struct himfs_fpindex *fpi = HIMFS_SB(sb)->fpindex;
+
+	return test_bit(fpindex_nr(fpi, lba), fpi->overflow);
+}
+
+void himfs_fpindex_set(struct super_block *sb, lba_t lba, int slot, uint8_t fp)
+{
+	struct himfs_fpindex *fpi = HIMFS_SB(sb)->fpindex;
+
+	if (!fpi)
+	{
+		return;
+	}
+
+	spin_lock(&fpi->lock);
+	WRITE_ONCE(fpindex_bucket(fpi, lba)[slot], fp);
+	spin_unlock(&fpi->lock);
+}
+
+void himfs_fpindex_set_overflow(struct super_block *sb, lba_t lba, bool overflow)
+{
+	struct himfs_fpindex *fpi = HIMFS_SB(sb)->fpindex;
+
+	if (!fpi)
+	{
+		return;
+	}
+
+	if (overflow)
+	{
+		set_bit(fpindex_nr(fpi, lba), fpi->overflow);
+	}
+	else
+	{
+		clear_bit(fpindex_nr(fpi, lba), fpi->overflow);
+	}
+}
+
+/*
+ * 用盘上桶的内容重建该桶的指纹。先拿桶锁，插入时整理名字堆、改写槽位不会和这里读名字撞上，
+ * 否则读到撕裂的名字会给没人再碰的槽记下错的指纹，查找就一直跳过这个桶；
+ * 再持有 fpi->lock，与插入/删除对索引的更新互斥：插入/删除总是先改桶再改索引，
+ * 所以扫描读到旧桶时后到的更新会覆盖它，读到新桶时两者一致。
+ */
+static void fpindex_fill_bucket(struct himfs_fpindex *fpi, lba_t lba, struct himfs_meta_block *meta_block)
+{
+	uint8_t *bucket = fpindex_bucket(fpi, lba);
+	struct himfs_inode *him_inode;
+	int i;
+
+	hash_lock_bucket(fpi->sb, lba);
+	spin_lock(&fpi->lock);
+	for (i = 0; i < HASH_SLOT_NUM; ++i)
+	{
+		if (!hash_bucket_valid(fpi->sb, meta_block) || !test_bit(i, meta_block->slot_bitmap))
+		{
+			WRITE_ONCE(bucket[i], 0);
+			continue;
+		}
+
+		him_inode = &meta_block->himfs_inode[i];
+		WRITE_ONCE(bucket[i], himfs_fp(himfs_name_hash(fpi->sb, him_inode->i_pid,
+			himfs_inode_name(meta_block, him_inode), him_inode->i_name_len)));
+	}
+	spin_unlock(&fpi->lock);
+
+	if (hash_bucket_valid(fpi->sb, meta_block) && meta_block->overflow)
+	{
+		set_bit(fpindex_nr(fpi, lba), fpi->overflow);
+	}
+	hash_unlock_bucket(fpi->sb, lba);
+}
+
+/* 后台顺序扫描整个元数据区，分批预读以获得大块顺序 I/O */
+static void fpindex_build(struct work_struct *work)
+{
+	struct himfs_fpindex *fpi = container_of(work, struct himfs_fpindex, build_work);
+	struct super_block *sb = fpi->sb;
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct buffer_head *buffer;
+	lba_t lba;
+	lba_t ra;
+
+	for (lba = himfs_sb->meta_start; lba < himfs_sb->meta_end; ++lba)
+	{
+		if (READ_ONCE(fpi->stop))
+		{
+			return;
+		}
+
+		if (fpindex_nr(fpi, lba) % HIMFS_INDEX_READAHEAD == 0)
+		{
+			for (ra = lba; ra < lba + HIMFS_INDEX_READAHEAD && ra < himfs_sb->meta_end; ++ra)
+			{
+				sb_breadahead(sb, ra);
+			}
+			cond_resched();
+		}
+
+		buffer = sb_bread(sb, lba);
+		if (unlikely(!buffer))
+		{
+			printk(KERN_ERR "himfs: fpindex read bucket %llu fail, index disabled\n", lba);
+			return;
+		}
+
+		fpindex_fill_bucket(fpi, lba, (struct himfs_meta_block*)buffer->b_data);
+		brelse(buffer);
+	}
+
+	smp_store_release(&fpi->ready, true);
+	printk(KERN_INFO "himfs: fpindex ready, %u buckets\n", fpi->nr_buckets);
+}
+
+int himfs_fpindex_init(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_fpindex *fpi;
+	uint32_t nr_buckets = himfs_sb->meta_blocks;
+	size_t need;
+
+	need = (size_t)nr_buckets * HASH_SLOT_NUM + BITS_TO_LONGS(nr_buckets) * sizeof(unsigned long);
+	if (need > ((size_t)himfs_sb->index_mb << 20))
+	{
+		printk(KERN_INFO "himfs: fpindex needs %zu bytes, over budget %u MB, disabled\n",
+			need, himfs_sb->index_mb);
+		return 0;
+	}
+
+	fpi = kzalloc(sizeof(struct himfs_fpindex), GFP_KERNEL);
+	if (!fpi)
+	{
+		return -ENOMEM;
+	}
+
+	fpi->fp = vzalloc((size_t)nr_buckets * HASH_SLOT_NUM);
+	fpi->overflow = vzalloc(BITS_TO_LONGS(nr_buckets) * sizeof(unsigned long));
+	if (!fpi->fp || !fpi->overflow)
+	{
+		/* 内存不够就不用索引，所有查找照旧读盘 */
+		printk(KERN_INFO "himfs: fpindex allocation fail, disabled\n");
+		vfree(fpi->fp);
+		vfree(fpi->overflow);
+		kfree(fpi);
+		return 0;
+	}
+
+	fpi->nr_buckets = nr_buckets;
+	fpi->sb = sb;
+	spin_lock_init(&fpi->lock);
+	INIT_WORK(&fpi->build_work, fpindex_build);
+	himfs_sb->fpindex = fpi;
+
+	queue_work(system_unbound_wq, &fpi->build_work);
+	return 0;
+}
+
+void himfs_fpindex_exit(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_fpindex *fpi = himfs_sb->fpindex;
+
+	if (!fpi)
+	{
+		return;
+	}
+
+	WRITE_ONCE(fpi->stop, true);
+	flush_work(&fpi->build_work);
+
+	himfs_sb->fpindex = NULL;
+	vfree(fpi->fp);
+	vfree(fpi->overflow);
+	kfree(fpi);
+}
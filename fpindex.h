@@ -0,0 +1,14 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#endif
+
+int himfs_fpindex_init(struct super_block *sb);
+void himfs_fpindex_exit(struct super_block *sb);
+bool himfs_fpindex_ready(struct super_block *sb);
+uint8_t himfs_fp(uint32_t hash);
+unsigned long himfs_fpindex_match(struct super_block *sb, lba_t lba, uint8_t fp);
+unsigned long himfs_fpindex_free(struct super_block *sb, lba_t lba);
+bool himfs_fpindex_overflow(struct super_block *sb, lba_t lba);
+void himfs_fpindex_set(struct super_block *sb, lba_t lba, int slot, uint8_t fp);
+void himfs_fpindex_set_overflow(struct super_block *sb, lba_t lba, bool overflow);
@@ -0,0 +1,194 @@
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#include "dir.h"
+#include "journal.h"
+#include "grave.h"
+#endif
+
+/*
+ * 延迟的父目录更新（grave）：在目录里建删子项时只改内存里的子项数、时间戳和子项日志末尾，
+ * 不再每次都写父目录 inode 所在的桶。目录第一次有改动时给盘上 inode 打上 HIMFS_INODE_GRAVE，
+ * 随这次操作一起进日志；之后的改动只计数。后台每隔 HIMFS_GRAVE_DELAY、或者一个目录
+ * 攒够 HIMFS_GRAVE_BATCH 次改动时，把内存里的值一次写回桶里并清掉标记。
+ * 崩溃后读到带标记的目录，扫描子项日志重算子项数和日志末尾，时间戳取当前时间。
+ * 挂在链表上的目录持有一个引用，sync_fs 时全部折叠并放掉，卸载时不会留下忙的 inode。
+ */
+
+struct himfs_grave
+{
+	spinlock_t lock;                    /* 保护 dirs 和各目录的 i_grave_nr */
+	struct list_head dirs;              /* 有未折叠改动的目录 */
+	struct delayed_work work;
+	struct super_block *sb;
+};
+
+static inline struct himfs_grave *GRAVE(struct super_block *sb)
+{
+	return HIMFS_SB(sb)->grave;
+}
+
+/* 调用者持有 dir 的 i_rwsem，返回 true 表示这是第一次改动 */
+static bool grave_hold(struct himfs_grave *gr, struct inode *dir, bool *full)
+{
+	struct himfs_inode_info *hii = HIMFS_I(dir);
+	bool first;
+
+	spin_lock(&gr->lock);
+	first = hii->i_grave_nr++ == 0;
+	if (first)
+	{
+		ihold(dir);
+		list_add_tail(&hii->i_grave_list, &gr->dirs);
+	}
+	*full = hii->i_grave_nr == HIMFS_GRAVE_BATCH;
+	spin_unlock(&gr->lock);
+
+	return first;
+}
+
+/* 在句柄里、持有 dir 的 i_rwsem 时调用，代替 mark_inode_dirty(dir) */
+void himfs_grave_add(struct inode *dir)
+{
+	struct himfs_grave *gr = GRAVE(dir->i_sb);
+	struct himfs_inode_info *hii = HIMFS_I(dir);
+	bool full;
+
+	himfs_journal_note(dir);
+	if (grave_hold(gr, dir, &full))
+	{
+		if (!(hii->i_flags & HIMFS_INODE_GRAVE))
+		{
+			hii->i_flags |= HIMFS_INODE_GRAVE;
+			mark_inode_dirty(dir);
+		}
+		queue_delayed_work(system_unbound_wq, &gr->work, HIMFS_GRAVE_DELAY);
+	}
+	if (full)
+	{
+		mod_delayed_work(system_unbound_wq, &gr->work, 0);
+	}
+}
+
+/* 把内存里的目录属性写回桶里并清掉标记，放掉挂链表时拿的引用 */
+static void grave_fold(struct himfs_grave *gr, struct himfs_inode_info *hii)
+{
+	struct inode *dir = &hii->vfs_inode;
+	struct himfs_handle handle;
+
+	inode_lock(dir);
+	himfs_journal_start(dir->i_sb, HIMFS_JOP_ATTR, &handle);
+	spin_lock(&gr->lock);
+	hii->i_grave_nr = 0;
+	spin_unlock(&gr->lock);
+	hii->i_flags &= ~HIMFS_INODE_GRAVE;
+	mark_inode_dirty(dir);
+	himfs_journal_stop(&handle);
+	inode_unlock(dir);
+
+	iput(dir);
+}
+
+/* 只处理开始时已经挂上的目录，一直有新改动的目录等下一轮 */
+static void grave_work(struct work_struct *work)
+{
+	struct himfs_grave *gr = container_of(to_delayed_work(work), struct himfs_grave, work);
+	struct himfs_inode_info *hii;
+	LIST_HEAD(batch);
+
+	spin_lock(&gr->lock);
+	list_splice_init(&gr->dirs, &batch);
+	spin_unlock(&gr->lock);
+
+	while (!list_empty(&batch))
+	{
+		hii = list_first_entry(&batch, struct himfs_inode_info, i_grave_list);
+		/* i_grave_nr 还不为 0，grave_hold 不会碰这个链表节点 */
+		spin_lock(&gr->lock);
+		list_del_init(&hii->i_grave_list);
+		spin_unlock(&gr->lock);
+		grave_fold(gr, hii);
+	}
+}
+
+void himfs_grave_flush(struct super_block *sb)
+{
+	struct himfs_grave *gr = GRAVE(sb);
+
+	if (gr)
+	{
+		mod_delayed_work(system_unbound_wq, &gr->work, 0);
+		flush_delayed_work(&gr->work);
+	}
+}
+
+/*
+ * 读入带 HIMFS_INODE_GRAVE 的目录时调用：上次没来得及折叠，从子项日志重算，
+ * 再挂到链表上，由后台写回并清掉标记。inode 还没解锁，没有别人能看到它。
+ */
+int himfs_grave_recover(struct inode *dir)
+{
+	uint32_t end;
+	uint64_t count;
+	bool full;
+	int err;
+
+	err = himfs_dlog_recover(dir, &end, &count);
+	if (err)
+	{
+		return err;
+	}
+
+	printk(KERN_INFO "himfs: dir %lu recovered, %llu entries, log end %u\n",
+		dir->i_ino, count, end);
+	HIMFS_I(dir)->i_dlog_end = end;
+	i_size_write(dir, count);
+	dir->i_mtime = dir->i_ctime = current_time(dir);
+
+	if (!sb_rdonly(dir->i_sb) && grave_hold(GRAVE(dir->i_sb), dir, &full))
+	{
+		queue_delayed_work(system_unbound_wq, &GRAVE(dir->i_sb)->work, HIMFS_GRAVE_DELAY);
+	}
+
+	return 0;
+}
+
+int himfs_grave_init(struct super_block *sb)
+{
+	struct himfs_grave *gr;
+
+	gr = kzalloc(sizeof(*gr), GFP_KERNEL);
+	if (!gr)
+	{
+		return -ENOMEM;
+	}
+	spin_lock_init(&gr->lock);
+	INIT_LIST_HEAD(&gr->dirs);
+	INIT_DELAYED_WORK(&gr->work, grave_work);
+	gr->sb = sb;
+	HIMFS_SB(sb)->grave = gr;
+
+	return 0;
+}
+
+/* sync_fs 已经折叠过一遍，这里只是兜底，必须在日志关闭之前 */
+void himfs_grave_exit(struct super_block *sb)
+{
+	struct himfs_grave *gr = GRAVE(sb);
+
+	if (!gr)
+	{
+		return;
+	}
+
+	cancel_delayed_work_sync(&gr->work);
+	grave_work(&gr->work.work);
+	HIMFS_SB(sb)->grave = NULL;
+	kfree(gr);
+}
@@ -0,0 +1,10 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#endif
+
+int himfs_grave_init(struct super_block *sb);
+void himfs_grave_exit(struct super_block *sb);
+void himfs_grave_add(struct inode *dir);
+void himfs_grave_flush(struct super_block *sb);
+int himfs_grave_recover(struct inode *dir);
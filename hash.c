@@ -17,173 +17,1035 @@
 #include <linux/namei.h>
 #include <linux/buffer_head.h>
 #include <linux/vmalloc.h>
+#include <linux/hash.h>
+#include <linux/mutex.h>
+#include <linux/cpumask.h>
+#include <linux/siphash.h>
+#include <linux/xxhash.h>
+#include <asm/unaligned.h>
 #ifndef _TEST_H_
 #define _TEST_H_
 #include "himfs_d.h"
 #include "hash.h"
+#include "fpindex.h"
+#include "dir.h"
+#include "journal.h"
+#include "stats.h"
+#include "bcache.h"
+#include "extent.h"
+#include "himfs_trace.h"
 #endif
 
-// BKDR Hash Function
-unsigned int BKDRHash(char *str, int len)
+/*
+ * murmur3_x86_32，把父目录 ino 当作第一个 4 字节块，等于对 (ino, 名字) 整体求哈希。
+ * 按小端读，结果和在哪种 CPU 上格式化无关。
+ */
+static uint32_t murmurHash3(uint32_t seed, uint32_t key1, const char *key2, int len)
 {
-	unsigned int seed = 10;
-	unsigned int hash = 0;
+	const uint8_t *data = (const uint8_t *)key2;
+	const uint8_t *tail = data + (len & ~3);
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	uint32_t h1 = seed;
+	uint32_t k1 = key1;
 
-	while (len > 0)
+	for (;;)
 	{
-		hash = hash * seed + *str - '0';
-		str++;
-		len--;
+		k1 *= c1;
+		k1 = rol32(k1, 15);
+		k1 *= c2;
+
+		h1 ^= k1;
+		h1 = rol32(h1, 13);
+		h1 = h1 * 5 + 0xe6546b64;
+
+		if (data == tail)
+		{
+			break;
+		}
+		k1 = get_unaligned_le32(data);
+		data += 4;
+	}
+
+	// 处理剩余的字节
+	k1 = 0;
+	switch (len & 3)
+	{
+	case 3:
+		k1 ^= tail[2] << 16;
+		fallthrough;
+	case 2:
+		k1 ^= tail[1] << 8;
+		fallthrough;
+	case 1:
+		k1 ^= tail[0];
+		k1 *= c1;
+		k1 = rol32(k1, 15);
+		k1 *= c2;
+		h1 ^= k1;
 	}
 
-	return (hash & 0x7FFFFFFF);
+	// 最终混合
+	h1 ^= len + 4;
+	h1 ^= h1 >> 16;
+	h1 *= 0x85ebca6b;
+	h1 ^= h1 >> 13;
+	h1 *= 0xc2b2ae35;
+	h1 ^= h1 >> 16;
+
+	return h1;
 }
 
-uint32_t murmurHash3(uint32_t key1, const char* key2, int len) 
+/*
+ * (父目录 ino, 文件名) 的 32 位哈希，决定候选桶、tag 和指纹。
+ * siphash 和 xxh64 都没有分段接口，短名字直接拼到栈上的缓冲里一次算完。
+ */
+uint32_t himfs_name_hash(struct super_block *sb, uint32_t dir, const char *name, int len)
 {
-    const uint8_t *data = (const uint8_t *)key2;
-    const int nblocks = len / 4;
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	u8 buf[sizeof(__le32) + HIMFS_MAX_FILENAME_LEN];
+	u64 h;
 
-	uint32_t seed = 4397;
-    uint32_t h1 = seed;
+	if (himfs_sb->hash_alg == HIMFS_HASH_MURMUR3)
+	{
+		return murmurHash3((uint32_t)himfs_sb->hash_key.key[0], dir, name, len);
+	}
 
-    const uint32_t c1 = 0xcc9e2d51;
-    const uint32_t c2 = 0x1b873593;
-	int i;
+	len = min(len, HIMFS_MAX_FILENAME_LEN);
+	put_unaligned_le32(dir, buf);
+	memcpy(buf + sizeof(__le32), name, len);
+	if (himfs_sb->hash_alg == HIMFS_HASH_XXH64)
+	{
+		h = xxh64(buf, sizeof(__le32) + len, himfs_sb->hash_key.key[0]);
+	}
+	else
+	{
+		h = siphash(buf, sizeof(__le32) + len, &himfs_sb->hash_key);
+	}
+
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+/*
+ * 多选放置：每个 (父目录 ino, 文件名) 有 HASH_PROBE_NUM 个候选桶，第 0 个是家桶，
+ * 其余按双重哈希依次排列。插入放进第一个有空槽的候选桶，并把途经的满桶的
+ * overflow 计数加一；查找在某个候选桶未命中且其 overflow 为 0 时即可停止，
+ * 所以未命中一般只读一个桶，命中最多读 HASH_PROBE_NUM 个桶。
+ * ino 编码了桶号和槽号，条目一旦放下就不能再搬动，因此不做 cuckoo 式的踢出。
+ */
+static inline lba_t hash_probe_lba(struct super_block *sb, uint32_t hash, int probe)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	uint32_t nr = himfs_sb->meta_blocks;
+	uint32_t step = 1 + (((hash >> 16) | (hash << 16)) % (nr - 1));
+
+	return himfs_sb->meta_start + ((hash % nr) + (uint64_t)probe * step) % nr;
+}
+
+/* 名字的家桶，批量创建按它排序和预读 */
+lba_t hash_home_lba(struct inode *dir, const char *name, int len)
+{
+	return hash_probe_lba(dir->i_sb, himfs_name_hash(dir->i_sb, dir->i_ino, name, len), 0);
+}
+
+/*
+ * 桶锁：按桶 LBA 哈希到一张分段互斥锁表，不同的桶基本不会争同一把锁。
+ * 改动桶内容（槽位图、名字堆、tag、inode 核心）和比对名字时持有；
+ * 持锁时只做内存操作和记日志，不读盘、不拿其他锁，所以同一时间最多持有一把。
+ * 同一目录里的建删由目录的 i_rwsem 串行，槽在两次持锁之间不会被别人拿走或删掉。
+ */
+int hash_locks_init(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	unsigned int nr = roundup_pow_of_two(num_possible_cpus() * 16);
+	unsigned int i;
+
+	nr = clamp_t(unsigned int, nr, 64, 4096);
+	himfs_sb->bucket_locks = kvmalloc_array(nr, sizeof(struct mutex), GFP_KERNEL);
+	if (!himfs_sb->bucket_locks)
+	{
+		return -ENOMEM;
+	}
+	for (i = 0; i < nr; ++i)
+	{
+		mutex_init(&himfs_sb->bucket_locks[i]);
+	}
+	himfs_sb->bucket_lock_bits = ilog2(nr);
 
-    // 处理每4字节块
-    for (i = 0; i < nblocks; i++) {
-        uint32_t k1 = *(uint32_t *)(data + i * 4);
+	return 0;
+}
 
-        k1 *= c1;
-        k1 = (k1 << 15) | (k1 >> (32 - 15));
-        k1 *= c2;
+void hash_locks_exit(struct super_block *sb)
+{
+	kvfree(HIMFS_SB(sb)->bucket_locks);
+	HIMFS_SB(sb)->bucket_locks = NULL;
+}
 
-        h1 ^= k1;
-        h1 = (h1 << 13) | (h1 >> (32 - 13));
-        h1 = h1 * 5 + 0xe6546b64;
-    }
+static inline struct mutex *hash_bucket_mutex(struct super_block *sb, lba_t lba)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
 
-    // 处理剩余的字节
-    const uint8_t *tail = data + nblocks * 4;
-    uint32_t k1 = 0;
+	return &himfs_sb->bucket_locks[hash_64(lba, himfs_sb->bucket_lock_bits)];
+}
 
-    switch (len & 3) {
-        case 3: k1 ^= tail[2] << 16;
-        case 2: k1 ^= tail[1] << 8;
-        case 1: k1 ^= tail[0];
-                k1 *= c1;
-                k1 = (k1 << 15) | (k1 >> (32 - 15));
-                k1 *= c2;
-                h1 ^= k1;
-    }
+void hash_lock_bucket(struct super_block *sb, lba_t lba)
+{
+	mutex_lock(hash_bucket_mutex(sb, lba));
+}
 
-    // 最终混合
-    h1 ^= len;
-    h1 ^= h1 >> 16;
-    h1 *= 0x85ebca6b;
-    h1 ^= h1 >> 13;
-    h1 *= 0xc2b2ae35;
-    h1 ^= h1 >> 16;
+void hash_unlock_bucket(struct super_block *sb, lba_t lba)
+{
+	mutex_unlock(hash_bucket_mutex(sb, lba));
+}
 
-    // 将第一个uint32_t键值混入哈希值
-    h1 ^= key1;
+/*
+ * 已用 inode 数：建删在桶锁下按 CPU 加减，statfs 只读近似值，不和建删争同一个缓存行。
+ * 正常卸载时值写在超级块里；异常卸载后从 0 开始后台顺序重数，桶锁下数完一个桶才把
+ * 游标移过它，此后这个桶上的建删才计入，所以数完时正好精确，重数期间 statfs 看到的偏小。
+ */
+static inline void hash_icount_add(struct super_block *sb, lba_t lba, s64 delta)
+{
+	struct himfs_icount *ic = &HIMFS_SB(sb)->icount;
 
-    return h1;
+	if (lba < READ_ONCE(ic->cursor))
+	{
+		percpu_counter_add(&ic->used, delta);
+	}
 }
 
-struct buffer_head* hash_get(struct inode *dir, struct dentry *dentry, int *idx)
+/*
+ * 异常卸载前删掉了名字、还没等到最后一次 iput 的 inode：照盘上核心建一个只用来回收的
+ * 内存 inode，链接数清零后 iput，由 himfs_evict_inode 在一个句柄里释放数据块和槽。
+ * ino 已经在内存里说明是这次挂载后才删的，留给它自己回收。
+ */
+static void hash_orphan_reap(struct super_block *sb, himfs_ino_t ino)
 {
-	lba_t lba;
-	struct buffer_head *buffer;
-	struct himfs_meta_block *meta_block;
+	struct inode *inode;
+	struct buffer_head *bh;
 	struct himfs_inode *him_inode;
+	struct himfs_inode core;
+	int idx = ino & (HASH_SLOT_NUM - 1);
+	bool orphan;
 
-	lba = murmurHash3(dir->i_ino, dentry->d_name.name, dentry->d_name.len);
-	lba %= META_REGIN_END_LBA;
-	if (lba < META_REGIN_START_LBA) 
+	inode = iget_locked(sb, ino);
+	if (!inode)
 	{
-		lba = META_REGIN_START_LBA;
+		printk(KERN_ERR "himfs: no memory to reap orphan %u\n", ino);
+		return;
 	}
 
-	buffer = sb_bread(dir->i_sb, lba);
+	if (!(inode->i_state & I_NEW))
+	{
+		iput(inode);
+		return;
+	}
 
-	if (unlikely(!buffer))
+	bh = sb_bread(sb, ino >> HASH_SLOT_BITS);
+	if (unlikely(!bh))
 	{
-		printk(KERN_ERR "allocate bh for himfs_inode fail");
-		return NULL;
+		iget_failed(inode);
+		return;
 	}
 
-	meta_block = (struct himfs_meta_block*)buffer->b_data;
+	hash_lock_bucket(sb, bh->b_blocknr);
+	him_inode = &((struct himfs_meta_block *)bh->b_data)->himfs_inode[idx];
+	orphan = test_bit(idx, ((struct himfs_meta_block *)bh->b_data)->slot_bitmap) &&
+		 him_inode->i_ino == ino && (him_inode->i_flags & HIMFS_INODE_ORPHAN);
+	core = *him_inode;
+	hash_unlock_bucket(sb, bh->b_blocknr);
+	brelse(bh);
 
-	for (*idx = 0; *idx < HASH_SLOT_NUM; ++(*idx))
+	if (!orphan)
 	{
-		if (test_bit(*idx, meta_block->slot_bitmap))
+		iget_failed(inode);
+		return;
+	}
+
+	inode->i_mode = core.i_mode;
+	inode->i_size = core.i_size;
+	HIMFS_I(inode)->i_flags = core.i_flags;
+	himfs_ext_load(inode, &core);
+	clear_nlink(inode);
+	unlock_new_inode(inode);
+	iput(inode);
+}
+
+/* 重数时顺带收集孤儿槽，放开桶锁之后再回收，回收要开句柄、可能读溢出块 */
+static void hash_icount_scan(struct work_struct *work)
+{
+	struct himfs_icount *ic = container_of(work, struct himfs_icount, work);
+	struct super_block *sb = ic->sb;
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_meta_block *meta_block;
+	struct buffer_head *buffer;
+	himfs_ino_t orphans[HASH_SLOT_NUM];
+	bool reap = !sb_rdonly(sb);
+	int nr_orphans;
+	lba_t lba;
+	lba_t ra;
+	int i;
+
+	for (lba = himfs_sb->meta_start; lba < himfs_sb->meta_end; ++lba)
+	{
+		if (READ_ONCE(ic->stop))
+		{
+			return;
+		}
+
+		if ((lba - himfs_sb->meta_start) % HIMFS_INDEX_READAHEAD == 0)
 		{
-			him_inode = &meta_block->himfs_inode[*idx];
-			if (strcmp(him_inode->filename.name, dentry->d_name.name) == 0)
+			for (ra = lba; ra < lba + HIMFS_INDEX_READAHEAD && ra < himfs_sb->meta_end; ++ra)
 			{
-				break;
+				sb_breadahead(sb, ra);
+			}
+			cond_resched();
+		}
+
+		buffer = sb_bread(sb, lba);
+		if (unlikely(!buffer))
+		{
+			printk(KERN_ERR "himfs: read bucket %llu fail, inode count stays partial\n", lba);
+			return;
+		}
+
+		meta_block = (struct himfs_meta_block*)buffer->b_data;
+		nr_orphans = 0;
+		hash_lock_bucket(sb, lba);
+		if (hash_bucket_valid(sb, meta_block))
+		{
+			percpu_counter_add(&ic->used, bitmap_weight(meta_block->slot_bitmap, HASH_SLOT_NUM));
+			for_each_set_bit(i, meta_block->slot_bitmap, HASH_SLOT_NUM)
+			{
+				if (reap && (meta_block->himfs_inode[i].i_flags & HIMFS_INODE_ORPHAN))
+				{
+					orphans[nr_orphans++] = meta_block->himfs_inode[i].i_ino;
+				}
 			}
 		}
+		WRITE_ONCE(ic->cursor, lba + 1);
+		hash_unlock_bucket(sb, lba);
+		brelse(buffer);
+
+		for (i = 0; i < nr_orphans; ++i)
+		{
+			hash_orphan_reap(sb, orphans[i]);
+		}
 	}
 
-	if (*idx == HASH_SLOT_NUM)
+	printk(KERN_INFO "himfs: recounted %lld inodes\n", percpu_counter_sum(&ic->used));
+}
+
+int himfs_icount_init(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_icount *ic = &himfs_sb->icount;
+	int err;
+
+	err = percpu_counter_init(&ic->used, himfs_sb->unclean ? 0 : himfs_sb->hsb->s_inodes_used, GFP_KERNEL);
+	if (err)
+	{
+		return err;
+	}
+
+	ic->sb = sb;
+	INIT_WORK(&ic->work, hash_icount_scan);
+	ic->cursor = himfs_sb->unclean ? himfs_sb->meta_start : himfs_sb->meta_end;
+
+	return 0;
+}
+
+/* 挂载的最后一步才开始重数：顺带回收孤儿要用日志、块分配和 inode 缓存 */
+void himfs_icount_start(struct super_block *sb)
+{
+	struct himfs_icount *ic = &HIMFS_SB(sb)->icount;
+
+	if (ic->cursor != HIMFS_SB(sb)->meta_end)
+	{
+		queue_work(system_unbound_wq, &ic->work);
+	}
+}
+
+/* 停掉还没数完的重数，返回计数是否精确 */
+bool himfs_icount_stop(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_icount *ic = &himfs_sb->icount;
+
+	if (!ic->sb)
+	{
+		return true;
+	}
+
+	WRITE_ONCE(ic->stop, true);
+	flush_work(&ic->work);
+
+	return READ_ONCE(ic->cursor) == himfs_sb->meta_end;
+}
+
+void himfs_icount_exit(struct super_block *sb)
+{
+	struct himfs_icount *ic = &HIMFS_SB(sb)->icount;
+
+	if (!ic->sb)
+	{
+		return;
+	}
+
+	himfs_icount_stop(sb);
+	percpu_counter_destroy(&ic->used);
+	ic->sb = NULL;
+}
+
+static inline uint16_t hash_tag(uint32_t hash, int len)
+{
+	return (uint16_t)((((hash >> 8) & 0xff) << 8) | (len & 0xff));
+}
+
+static inline void hash_set_tag(struct himfs_meta_block *meta_block, int idx, uint16_t tag)
+{
+	uint64_t *word = &meta_block->tags[idx / HASH_TAGS_PER_WORD];
+	int shift = (idx % HASH_TAGS_PER_WORD) * 16;
+
+	*word = (*word & ~(0xFFFFULL << shift)) | ((uint64_t)tag << shift);
+}
+
+/*
+ * 每次异或比较 4 个槽的 tag，结果为 0 的 16 位通道即为候选槽。
+ * 借位可能让真匹配之上的通道误报，但候选槽还要比对名字，误报只多一次 memcmp。
+ */
+static inline unsigned long hash_tag_match(struct himfs_meta_block *meta_block, uint16_t tag)
+{
+	const uint64_t ones = 0x0001000100010001ULL;
+	const uint64_t highs = 0x8000800080008000ULL;
+	unsigned long mask = 0;
+	uint64_t x;
+	uint64_t z;
+	int w;
+
+	for (w = 0; w < HASH_SLOT_NUM / HASH_TAGS_PER_WORD; ++w)
+	{
+		x = meta_block->tags[w] ^ (tag * ones);
+		z = (x - ones) & ~x & highs;
+		while (z)
+		{
+			mask |= 1UL << (w * HASH_TAGS_PER_WORD + (__ffs64(z) >> 4));
+			z &= z - 1;
+		}
+	}
+
+	return mask;
+}
+
+static inline bool hash_match(struct himfs_meta_block *meta_block, struct himfs_inode *him_inode,
+			      struct inode *dir, const struct qstr *name)
+{
+	return him_inode->i_pid == dir->i_ino &&
+		him_inode->i_name_len == name->len &&
+		memcmp(himfs_inode_name(meta_block, him_inode), name->name, name->len) == 0;
+}
+
+/*
+ * mkfs 不清零元数据区，只换一个新的 generation。从未写过、属于上一次格式化或旧格式的桶
+ * 都按空桶处理，第一次往里放条目时初始化桶头。
+ */
+bool hash_bucket_valid(struct super_block *sb, struct himfs_meta_block *meta_block)
+{
+	return meta_block->version == HIMFS_FORMAT_VERSION &&
+		meta_block->generation == HIMFS_SB(sb)->generation;
+}
+
+void hash_bucket_init(struct super_block *sb, struct himfs_meta_block *meta_block)
+{
+	memset(meta_block, 0, HIMFS_META_HDR_SIZE);
+	meta_block->version = HIMFS_FORMAT_VERSION;
+	meta_block->generation = HIMFS_SB(sb)->generation;
+	meta_block->heap_low = HIMFS_HEAP_END;
+}
+
+static inline int hash_heap_room(struct himfs_meta_block *meta_block)
+{
+	return (meta_block->heap_low - HIMFS_HEAP_START) + meta_block->heap_hole;
+}
+
+/* 把存活的名字（连同内联数据）按原偏移从高到低依次挪到块尾，消除空洞 */
+static void hash_heap_compact(struct himfs_meta_block *meta_block)
+{
+	struct himfs_inode *him_inode;
+	int order[HASH_SLOT_NUM];
+	uint16_t top = HIMFS_HEAP_END;
+	int nr = 0;
+	int slot;
+	int i;
+
+	for_each_set_bit(slot, meta_block->slot_bitmap, HASH_SLOT_NUM)
+	{
+		for (i = nr; i > 0 && meta_block->himfs_inode[order[i - 1]].i_name_off <
+			meta_block->himfs_inode[slot].i_name_off; --i)
+		{
+			order[i] = order[i - 1];
+		}
+		order[i] = slot;
+		++nr;
+	}
+
+	for (i = 0; i < nr; ++i)
+	{
+		him_inode = &meta_block->himfs_inode[order[i]];
+		top -= himfs_heap_len(him_inode);
+		memmove((char *)meta_block + top, himfs_inode_name(meta_block, him_inode), himfs_heap_len(him_inode));
+		him_inode->i_name_off = top;
+	}
+
+	meta_block->heap_low = top;
+	meta_block->heap_hole = 0;
+}
+
+/* 从名字堆分配 len 字节，返回桶内偏移；调用时本槽在堆里不占空间（新槽或已释放） */
+static int hash_heap_alloc(struct himfs_meta_block *meta_block, int len)
+{
+	if (hash_heap_room(meta_block) < len)
+	{
+		return -ENOSPC;
+	}
+
+	if (meta_block->heap_low - HIMFS_HEAP_START < len)
+	{
+		hash_heap_compact(meta_block);
+	}
+
+	meta_block->heap_low -= len;
+
+	return meta_block->heap_low;
+}
+
+static void hash_heap_free(struct himfs_meta_block *meta_block, int off, int len)
+{
+	if (off == meta_block->heap_low)
+	{
+		meta_block->heap_low += len;
+	}
+	else
+	{
+		meta_block->heap_hole += len;
+	}
+}
+
+/* 在名字堆中为 him_inode 分配并写入名字，调用时该槽在位图中尚未置位 */
+int hash_name_store(struct himfs_meta_block *meta_block, struct himfs_inode *him_inode,
+		    const char *name, int len)
+{
+	int off = hash_heap_alloc(meta_block, len);
+
+	if (off < 0)
+	{
+		return off;
+	}
+
+	memcpy((char *)meta_block + off, name, len);
+	him_inode->i_name_off = off;
+	him_inode->i_name_len = len;
+
+	return 0;
+}
+
+void hash_name_free(struct himfs_meta_block *meta_block, struct himfs_inode *him_inode)
+{
+	hash_heap_free(meta_block, him_inode->i_name_off, himfs_heap_len(him_inode));
+	him_inode->i_name_len = 0;
+	him_inode->i_inline_len = 0;
+}
+
+/*
+ * 把桶里 idx 槽的改动记进日志：桶头、该槽的核心和名字堆里 [off, off + len)。
+ * 分配时整理过名字堆（heap_hole 从非 0 变成 0），名字和其他槽的 i_name_off 都挪了，整块记下。
+ */
+static void hash_log_slot(struct buffer_head *bh, int idx, int off, int len, bool moved)
+{
+	if (moved)
+	{
+		himfs_journal_dirty(bh, 0, 1 << BLOCK_SHIFT);
+		return;
+	}
+
+	himfs_journal_dirty(bh, 0, HIMFS_META_HDR_SIZE);
+	himfs_journal_dirty(bh, HIMFS_META_HDR_SIZE + idx * sizeof(struct himfs_inode), sizeof(struct himfs_inode));
+	if (len)
+	{
+		himfs_journal_dirty(bh, off, len);
+	}
+}
+
+/* 读出 inode 所在的桶和槽并锁住桶，核实槽里还是这个 inode；用完调 hash_slot_put() */
+static struct buffer_head *hash_inode_slot(struct inode *inode, struct himfs_inode **him_inode)
+{
+	struct buffer_head *bh;
+	struct himfs_meta_block *meta_block;
+	int idx = inode->i_ino & (HASH_SLOT_NUM - 1);
+
+	bh = sb_bread(inode->i_sb, inode->i_ino >> HASH_SLOT_BITS);
+	if (unlikely(!bh))
 	{
 		return NULL;
 	}
 
-	return buffer;
+	hash_lock_bucket(inode->i_sb, bh->b_blocknr);
+	meta_block = (struct himfs_meta_block *)bh->b_data;
+	*him_inode = &meta_block->himfs_inode[idx];
+	if (!test_bit(idx, meta_block->slot_bitmap) || (*him_inode)->i_ino != inode->i_ino)
+	{
+		printk(KERN_ERR "himfs: slot of inode %lu is gone\n", inode->i_ino);
+		hash_unlock_bucket(inode->i_sb, bh->b_blocknr);
+		brelse(bh);
+		return NULL;
+	}
+
+	return bh;
 }
 
-unsigned int hash_insert(struct inode *inode, struct inode *dir, struct dentry *dentry, umode_t mode)
+static void hash_slot_put(struct inode *inode, struct buffer_head *bh)
 {
-	lba_t lba;
-	struct buffer_head *buffer;
+	hash_unlock_bucket(inode->i_sb, bh->b_blocknr);
+	brelse(bh);
+}
+
+/* 把内联数据拷到 buf（最多 size 字节），返回内联数据长度 */
+int hash_inline_read(struct inode *inode, void *buf, int size)
+{
+	struct buffer_head *bh;
+	struct himfs_inode *him_inode;
+	int len;
+
+	bh = hash_inode_slot(inode, &him_inode);
+	if (!bh)
+	{
+		return -EIO;
+	}
+
+	len = (him_inode->i_flags & HIMFS_INODE_INLINE) ? him_inode->i_inline_len : 0;
+	memcpy(buf, himfs_inode_name((struct himfs_meta_block *)bh->b_data, him_inode) + him_inode->i_name_len,
+		min(len, size));
+	hash_slot_put(inode, bh);
+
+	return len;
+}
+
+/*
+ * 用 data 替换内联数据，名字和数据重新分配成一段。堆里放不下时返回 -ENOSPC，桶不变。
+ * 桶块挂到 inode 的关联缓冲上，fsync 时和数据一起写回，小文件落盘只写这一个桶。
+ */
+int hash_inline_write(struct inode *inode, const void *data, int len)
+{
+	struct himfs_handle handle;
+	struct buffer_head *bh;
 	struct himfs_meta_block *meta_block;
 	struct himfs_inode *him_inode;
-	struct himfs_ino himfs_ino;
-	struct himfs_inode_info *hii = HIMFS_I(inode);
+	char name[HIMFS_MAX_FILENAME_LEN];
+	int name_len, off, hole;
+	int idx = inode->i_ino & (HASH_SLOT_NUM - 1);
+	int err = 0;
+
+	if (len > HIMFS_INLINE_MAX)
+	{
+		return -ENOSPC;
+	}
+
+	himfs_journal_start(inode->i_sb, HIMFS_JOP_WRITE, &handle);
+	bh = hash_inode_slot(inode, &him_inode);
+	if (!bh)
+	{
+		err = -EIO;
+		goto stop;
+	}
+
+	meta_block = (struct himfs_meta_block *)bh->b_data;
+	name_len = him_inode->i_name_len;
+	if (S_ISREG(inode->i_mode))
+	{
+		him_inode->i_size = i_size_read(inode);
+	}
+	if ((him_inode->i_flags & HIMFS_INODE_INLINE) && him_inode->i_inline_len == len)
+	{
+		memcpy(himfs_inode_name(meta_block, him_inode) + name_len, data, len);
+		hash_log_slot(bh, idx, him_inode->i_name_off + name_len, len, false);
+		goto out;
+	}
+
+	if (hash_heap_room(meta_block) + himfs_heap_len(him_inode) < name_len + len)
+	{
+		err = -ENOSPC;
+		goto out;
+	}
+
+	memcpy(name, himfs_inode_name(meta_block, him_inode), name_len);
+	hash_name_free(meta_block, him_inode);
+	hole = meta_block->heap_hole;
+	off = hash_heap_alloc(meta_block, name_len + len);
+	memcpy((char *)meta_block + off, name, name_len);
+	memcpy((char *)meta_block + off + name_len, data, len);
+	him_inode->i_name_off = off;
+	him_inode->i_name_len = name_len;
+	him_inode->i_inline_len = len;
+	him_inode->i_flags |= HIMFS_INODE_INLINE;
+	HIMFS_I(inode)->i_flags |= HIMFS_INODE_INLINE;
+	hash_log_slot(bh, idx, off, name_len + len, hole && !meta_block->heap_hole);
+
+out:
+	hash_slot_put(inode, bh);
+	himfs_journal_note(inode);
+stop:
+	himfs_journal_stop(&handle);
+
+	return err;
+}
+
+/* 转成块映射：丢掉名字后面的内联数据，留下的尾巴记为空洞 */
+int hash_inline_clear(struct inode *inode)
+{
+	struct himfs_handle handle;
+	struct buffer_head *bh;
+	struct himfs_meta_block *meta_block;
+	struct himfs_inode *him_inode;
+
+	himfs_journal_start(inode->i_sb, HIMFS_JOP_WRITE, &handle);
+	bh = hash_inode_slot(inode, &him_inode);
+	if (!bh)
+	{
+		himfs_journal_stop(&handle);
+		return -EIO;
+	}
+
+	meta_block = (struct himfs_meta_block *)bh->b_data;
+	if (him_inode->i_flags & HIMFS_INODE_INLINE)
+	{
+		hash_heap_free(meta_block, him_inode->i_name_off + him_inode->i_name_len, him_inode->i_inline_len);
+		him_inode->i_inline_len = 0;
+		him_inode->i_flags &= ~HIMFS_INODE_INLINE;
+		hash_log_slot(bh, inode->i_ino & (HASH_SLOT_NUM - 1), 0, 0, false);
+		himfs_journal_note(inode);
+	}
+	HIMFS_I(inode)->i_flags &= ~HIMFS_INODE_INLINE;
+	hash_slot_put(inode, bh);
+	himfs_journal_stop(&handle);
+
+	return 0;
+}
+
+/*
+ * 按探测序列查找，命中时返回所在桶的 bh（已放开桶锁），*probe 为候选桶序号，*idx 为槽号。
+ * 指纹索引可用时只读指纹匹配的桶，指纹全不匹配且没有 overflow 的未命中不做任何 I/O。
+ */
+/* ino 不为 0 时只认指向这个 inode 的槽：改名时新名字先放进别名槽，再删同名的旧目标 */
+static struct buffer_head *hash_find(struct inode *dir, const struct qstr *name, himfs_ino_t ino, int *probe, int *idx)
+{
+	struct super_block *sb = dir->i_sb;
+	uint32_t hash;
+	struct buffer_head *buffer;
+	struct himfs_meta_block *meta_block;
+	unsigned long cand;
+	bool indexed;
+	bool more;
+	uint8_t fp;
+	uint16_t tag;
+	lba_t lba = 0;
+	int reads = 0;
+	int cmps = 0;
+	int slot;
+	int p;
+
+	hash = himfs_name_hash(sb, dir->i_ino, name->name, name->len);
+	indexed = himfs_fpindex_ready(sb);
+	fp = himfs_fp(hash);
+	tag = hash_tag(hash, name->len);
+
+	for (p = 0; p < HASH_PROBE_NUM; ++p)
+	{
+		lba = hash_probe_lba(sb, hash, p);
+		cand = (1UL << HASH_SLOT_NUM) - 1;
+
+		if (indexed)
+		{
+			cand = himfs_fpindex_match(sb, lba, fp);
+			if (cand == 0)
+			{
+				himfs_stat_inc(sb, HIMFS_STAT_FP_SKIP);
+				if (!himfs_fpindex_overflow(sb, lba))
+				{
+					break;
+				}
+				continue;
+			}
+		}
+
+		buffer = sb_bread(sb, lba);
+		if (unlikely(!buffer))
+		{
+			printk(KERN_ERR "allocate bh for himfs_inode fail");
+			break;
+		}
+		himfs_stat_inc(sb, HIMFS_STAT_BUCKET_READ);
+		++reads;
+
+		meta_block = (struct himfs_meta_block*)buffer->b_data;
+		hash_lock_bucket(sb, lba);
+		if (!hash_bucket_valid(sb, meta_block))
+		{
+			hash_unlock_bucket(sb, lba);
+			brelse(buffer);
+			break;
+		}
+
+		cand &= hash_tag_match(meta_block, tag) & meta_block->slot_bitmap[0];
+
+		/* 只对 tag 命中的槽比对名字 */
+		for_each_set_bit(slot, &cand, HASH_SLOT_NUM)
+		{
+			himfs_stat_inc(sb, HIMFS_STAT_SLOT_CMP);
+			++cmps;
+			if (hash_match(meta_block, &meta_block->himfs_inode[slot], dir, name) &&
+				(!ino || meta_block->himfs_inode[slot].i_ino == ino))
+			{
+				hash_unlock_bucket(sb, lba);
+				trace_himfs_hash_get(dir, name, hash, p, lba, slot, reads, cmps);
+				*probe = p;
+				*idx = slot;
+				return buffer;
+			}
+			himfs_stat_inc(sb, HIMFS_STAT_TAG_FALSE);
+		}
+
+		more = meta_block->overflow != 0;
+		hash_unlock_bucket(sb, lba);
+		brelse(buffer);
+		if (!more)
+		{
+			break;
+		}
+	}
+
+	trace_himfs_hash_get(dir, name, hash, p, lba, -1, reads, cmps);
+	return NULL;
+}
+
+static bool hash_lookup_bh(struct inode *dir, const struct qstr *name, struct himfs_inode *core)
+{
+	struct buffer_head *bh;
+	int probe;
 	int idx;
-	int i;
 
-	lba = murmurHash3(dir->i_ino, dentry->d_name.name, dentry->d_name.len);
-	lba %= META_REGIN_END_LBA;
-	if (lba < META_REGIN_START_LBA) 
+	bh = hash_find(dir, name, 0, &probe, &idx);
+	if (!bh)
 	{
-		lba = META_REGIN_START_LBA;
+		return false;
 	}
 
-	buffer = sb_bread(dir->i_sb, lba);
+	hash_lock_bucket(dir->i_sb, bh->b_blocknr);
+	*core = ((struct himfs_meta_block *)bh->b_data)->himfs_inode[idx];
+	hash_unlock_bucket(dir->i_sb, bh->b_blocknr);
+	brelse(bh);
+	return true;
+}
+
+/*
+ * himfs_lookup 用的查找，命中时把槽里的核心拷到 *core。探测顺序和 hash_find 相同，
+ * 但候选桶先在 DRAM 桶缓存里找，RCU 下比对，不碰 buffer_head；不在缓存里的桶照常读进来，
+ * 在桶锁下解析成紧凑副本，先在副本上比对再放进缓存。没开缓存或内存不够时退回 hash_find。
+ */
+bool hash_lookup(struct inode *dir, const struct qstr *name, struct himfs_inode *core)
+{
+	struct super_block *sb = dir->i_sb;
+	struct himfs_cbucket *cb;
+	struct buffer_head *bh;
+	unsigned long cand;
+	uint32_t hash;
+	bool indexed;
+	bool more;
+	uint8_t fp;
+	uint16_t tag;
+	lba_t lba = 0;
+	int reads = 0;
+	int cmps = 0;
+	int slot = -1;
+	int p;
 
-	if (unlikely(!buffer))
+	if (!himfs_bcache_enabled(sb))
 	{
-		printk(KERN_ERR "allocate bh for himfs_inode fail");
-		return 0;
+		return hash_lookup_bh(dir, name, core);
 	}
 
-	meta_block = (struct himfs_meta_block*)buffer->b_data;
+	hash = himfs_name_hash(sb, dir->i_ino, name->name, name->len);
+	indexed = himfs_fpindex_ready(sb);
+	fp = himfs_fp(hash);
+	tag = hash_tag(hash, name->len);
 
-	for (idx = 0; idx < HASH_SLOT_NUM; ++idx)
+	for (p = 0; p < HASH_PROBE_NUM; ++p)
 	{
-		if (test_bit(idx, meta_block->slot_bitmap))
+		lba = hash_probe_lba(sb, hash, p);
+		cand = (1UL << HASH_SLOT_NUM) - 1;
+
+		if (indexed)
+		{
+			cand = himfs_fpindex_match(sb, lba, fp);
+			if (cand == 0)
+			{
+				himfs_stat_inc(sb, HIMFS_STAT_FP_SKIP);
+				if (!himfs_fpindex_overflow(sb, lba))
+				{
+					break;
+				}
+				continue;
+			}
+		}
+
+		rcu_read_lock();
+		cb = himfs_bcache_lookup(sb, lba);
+		if (cb)
+		{
+			himfs_stat_inc(sb, HIMFS_STAT_BCACHE_HIT);
+			slot = himfs_cbucket_match(cb, dir->i_ino, name, tag, cand, &cmps, core);
+			more = cb->c_overflow != 0;
+			rcu_read_unlock();
+		}
+		else
+		{
+			rcu_read_unlock();
+			bh = sb_bread(sb, lba);
+			if (unlikely(!bh))
+			{
+				printk(KERN_ERR "allocate bh for himfs_inode fail");
+				break;
+			}
+			himfs_stat_inc(sb, HIMFS_STAT_BUCKET_READ);
+			++reads;
+
+			hash_lock_bucket(sb, lba);
+			cb = himfs_bcache_build(sb, bh);
+			if (unlikely(!cb))
+			{
+				hash_unlock_bucket(sb, lba);
+				brelse(bh);
+				return hash_lookup_bh(dir, name, core);
+			}
+			slot = himfs_cbucket_match(cb, dir->i_ino, name, tag, cand, &cmps, core);
+			more = cb->c_overflow != 0;
+			himfs_bcache_insert(sb, cb);
+			hash_unlock_bucket(sb, lba);
+			brelse(bh);
+		}
+
+		if (slot >= 0)
+		{
+			break;
+		}
+		if (!more)
 		{
+			break;
+		}
+	}
+
+	himfs_stat_add(sb, HIMFS_STAT_SLOT_CMP, cmps);
+	himfs_stat_add(sb, HIMFS_STAT_TAG_FALSE, cmps - (slot >= 0));
+	trace_himfs_hash_get(dir, name, hash, p, lba, slot, reads, cmps);
+	return slot >= 0;
+}
+
+/* 撤销 hash_insert 第一步占下的槽，持有桶锁时调用 */
+static void hash_slot_release(struct super_block *sb, struct buffer_head *bh, int idx)
+{
+	struct himfs_meta_block *meta_block = (struct himfs_meta_block *)bh->b_data;
+
+	clear_bit(idx, meta_block->slot_bitmap);
+	hash_icount_add(sb, bh->b_blocknr, -1);
+	hash_name_free(meta_block, &meta_block->himfs_inode[idx]);
+	hash_set_tag(meta_block, idx, 0);
+	himfs_fpindex_set(sb, bh->b_blocknr, idx, 0);
+}
+
+/*
+ * 分两步：先在桶锁下占槽、写好核心和名字，再放开桶锁追加父目录的子项日志
+ * （可能分配块、读盘），最后回到桶锁下填上子项位置并记日志。
+ * 整个过程在同一个句柄里，别的操作在中途记下的桶内容和这次插入落在同一个事务。
+ */
+static unsigned int __hash_insert(struct inode *inode, struct inode *dir, const struct qstr *name, umode_t mode,
+				  himfs_ino_t target)
+{
+	uint32_t hash;
+	struct buffer_head *buffer[HASH_PROBE_NUM] = { NULL };
+	struct himfs_meta_block *meta_block;
+	struct himfs_inode *him_inode;
+	struct himfs_ino himfs_ino;
+	struct himfs_inode_info *hii = HIMFS_I(inode);
+	struct super_block *sb = dir->i_sb;
+	unsigned int ino = 0;
+	uint32_t dirent;
+	bool indexed;
+	bool moved = false;
+	int idx = HASH_SLOT_NUM;
+	int reads = 0;
+	int full = 0;
+	int hole;
+	int p;
+	int i;
+
+	hash = himfs_name_hash(sb, dir->i_ino, name->name, name->len);
+	indexed = himfs_fpindex_ready(sb);
+	himfs_stat_inc(sb, HIMFS_STAT_INSERT);
+
+	for (p = 0; p < HASH_PROBE_NUM; ++p)
+	{
+		/* 索引显示已满的候选桶不必读 */
+		if (indexed && himfs_fpindex_free(sb, hash_probe_lba(sb, hash, p)) == 0)
+		{
+			himfs_stat_inc(sb, HIMFS_STAT_FP_SKIP);
+			himfs_stat_inc(sb, HIMFS_STAT_BUCKET_FULL);
+			++full;
 			continue;
 		}
 
-		break;
+		buffer[p] = sb_bread(sb, hash_probe_lba(sb, hash, p));
+		if (unlikely(!buffer[p]))
+		{
+			printk(KERN_ERR "allocate bh for himfs_inode fail");
+			goto out;
+		}
+		himfs_stat_inc(sb, HIMFS_STAT_BUCKET_READ);
+		++reads;
+
+		meta_block = (struct himfs_meta_block*)buffer[p]->b_data;
+		hash_lock_bucket(sb, buffer[p]->b_blocknr);
+		if (!hash_bucket_valid(sb, meta_block))
+		{
+			hash_bucket_init(sb, meta_block);
+		}
+
+		/* 既要有空槽，名字堆也要放得下名字 */
+		idx = find_first_zero_bit(meta_block->slot_bitmap, HASH_SLOT_NUM);
+		if (idx < HASH_SLOT_NUM && hash_heap_room(meta_block) >= name->len)
+		{
+			break;
+		}
+		hash_unlock_bucket(sb, buffer[p]->b_blocknr);
+		himfs_stat_inc(sb, HIMFS_STAT_BUCKET_FULL);
+		++full;
 	}
 
-	if (idx == HASH_SLOT_NUM)
+	/* 所有候选桶都满了 */
+	if (p == HASH_PROBE_NUM)
 	{
-		return 0;
+		himfs_stat_inc(sb, HIMFS_STAT_INSERT_NOSPC);
+		goto out;
 	}
 
+	himfs_ino.raw_ino = 0;
+	himfs_ino.ino.slot = idx;
+	himfs_ino.ino.hash_key = buffer[p]->b_blocknr;
+
 	him_inode = &meta_block->himfs_inode[idx];
+	memset(him_inode, 0, sizeof(struct himfs_inode));
+	hole = meta_block->heap_hole;
+	hash_name_store(meta_block, him_inode, name->name, name->len);
+	moved = hole && !meta_block->heap_hole;
 	him_inode->i_mode = mode;
-	himfs_ino.ino.slot = idx;
-    himfs_ino.ino.hash_key = lba;
-    him_inode->i_ino = himfs_ino.raw_ino;	 
+    him_inode->i_ino = target ? target : himfs_ino.raw_ino;	 
     him_inode->i_uid = (uint16_t)__kuid_val(inode->i_uid);
     him_inode->i_gid = (uint16_t)__kgid_val(inode->i_gid);
     him_inode->i_size = 0;
@@ -191,129 +1053,263 @@ unsigned int hash_insert(struct inode *inode, struct inode *dir, struct dentry *
     // him_inode->i_mtime = inode->i_mtime;
     him_inode->i_crtime = hii->i_crtime;
     him_inode->i_detime = 0;
-	him_inode->filename.name_len = dentry->d_name.len;
-	strncpy(him_inode->filename.name, dentry->d_name.name, dentry->d_name.len);
     him_inode->i_pid = dir->i_ino;
-	if (mode & S_IFREG)
+	/* 普通文件和符号链接先内联，写大了再转成块映射；别名槽只指向本体，不动内存 inode */
+	if (target)
 	{
-		for (i = 0; i < 16; ++i);
+		him_inode->i_flags = HIMFS_INODE_ALIAS;
+	}
+	else
+	{
+		if (S_ISREG(mode) || S_ISLNK(mode))
 		{
-			him_inode->i_block[i] = 0;
+			him_inode->i_flags = HIMFS_INODE_INLINE;
 		}
+		hii->i_flags = him_inode->i_flags;
 	}
+	hash_set_tag(meta_block, idx, hash_tag(hash, name->len));
 	set_bit(idx, meta_block->slot_bitmap);
+	hash_icount_add(sb, buffer[p]->b_blocknr, 1);
+	himfs_fpindex_set(sb, buffer[p]->b_blocknr, idx, himfs_fp(hash));
+	hash_unlock_bucket(sb, buffer[p]->b_blocknr);
 
-	set_buffer_uptodate(buffer);//表示可以回写
-	mark_buffer_dirty(buffer);
-	brelse(buffer);
+	/* 追加父目录的子项日志，失败时把占下的槽还回去 */
+	if (himfs_dlog_add(dir, name, him_inode->i_ino, mode, &dirent))
+	{
+		hash_lock_bucket(sb, buffer[p]->b_blocknr);
+		hash_slot_release(sb, buffer[p], idx);
+		/* 中途别的操作可能已经把占槽的桶头记进了本事务，这里也要记下撤销 */
+		hash_log_slot(buffer[p], idx, 0, 0, moved);
+		hash_unlock_bucket(sb, buffer[p]->b_blocknr);
+		goto out;
+	}
+
+	hash_lock_bucket(sb, buffer[p]->b_blocknr);
+	him_inode->i_dirent = dirent;
+	ino = him_inode->i_ino;
+	set_buffer_uptodate(buffer[p]);//表示可以回写
+	hash_log_slot(buffer[p], idx, him_inode->i_name_off, him_inode->i_name_len, moved);
+	hash_unlock_bucket(sb, buffer[p]->b_blocknr);
+
+	/* 记录途经的满桶，查找据此决定是否继续探测 */
+	for (i = 0; i < p; ++i)
+	{
+		if (!buffer[i])
+		{
+			buffer[i] = sb_bread(sb, hash_probe_lba(sb, hash, i));
+			if (unlikely(!buffer[i]))
+			{
+				continue;
+			}
+		}
+
+		meta_block = (struct himfs_meta_block*)buffer[i]->b_data;
+		hash_lock_bucket(sb, buffer[i]->b_blocknr);
+		if (meta_block->overflow != HASH_OVERFLOW_MAX)
+		{
+			++meta_block->overflow;
+			himfs_journal_dirty(buffer[i], 0, HIMFS_META_HDR_SIZE);
+		}
+		himfs_fpindex_set_overflow(sb, buffer[i]->b_blocknr, true);
+		hash_unlock_bucket(sb, buffer[i]->b_blocknr);
+	}
 
-	return him_inode->i_ino;
+out:
+	trace_himfs_hash_insert(dir, hash, p, p < HASH_PROBE_NUM && buffer[p] ? buffer[p]->b_blocknr : 0,
+		ino ? idx : -1, reads, full, ino);
+	for (i = 0; i < HASH_PROBE_NUM; ++i)
+	{
+		brelse(buffer[i]);
+	}
+
+	return ino;
 }
 
-static void grave_sync(struct super_block *sb, struct grave *grave)
+unsigned int hash_insert(struct inode *inode, struct inode *dir, struct dentry *dentry, umode_t mode)
 {
-	lba_t lba;
-	int idx;
-	struct buffer_head *buffer;
+	return __hash_insert(inode, dir, &dentry->d_name, mode, 0);
+}
+
+/*
+ * 改名：在 (dir, 新名字) 处放一个别名槽，i_ino 指向 inode 原来的槽（本体），
+ * 本体原地不动，ino、数据和以它为父目录的子项都不受影响。
+ */
+bool hash_alias(struct inode *inode, struct inode *dir, struct dentry *dentry)
+{
+	return __hash_insert(inode, dir, &dentry->d_name, inode->i_mode, inode->i_ino) != 0;
+}
+
+/* 撤销插入时在途经满桶上记下的 overflow */
+static void hash_unwind_overflow(struct super_block *sb, uint32_t hash, int probe)
+{
+	struct buffer_head *passed;
 	struct himfs_meta_block *meta_block;
-	struct himfs_inode *him_inode;
-	struct himfs_ino himfs_ino;
-	uint32_t detime;
 	int i;
 
-	for (i = 0; i < GRAVE_NUM; ++i)
+	for (i = 0; i < probe; ++i)
 	{
-		himfs_ino.raw_ino = him_inode->i_pid;
-		lba = himfs_ino.ino.hash_key;
-		buffer = sb_bread(sb, lba);
-	
-		meta_block = (struct himfs_meta_block*)buffer->b_data;
-		idx = himfs_ino.ino.slot;
-		him_inode = &meta_block->himfs_inode[idx];
-
-		detime = him_inode->i_grave[i].detime;
-		him_inode->i_ctime = him_inode->i_mtime = detime;
-		--him_inode->i_size;
+		passed = sb_bread(sb, hash_probe_lba(sb, hash, i));
+		if (unlikely(!passed))
+		{
+			continue;
+		}
 
-		mark_buffer_dirty(buffer);
-		sync_dirty_buffer(buffer);
-		brelse(buffer);
+		meta_block = (struct himfs_meta_block*)passed->b_data;
+		hash_lock_bucket(sb, passed->b_blocknr);
+		if (meta_block->overflow != 0 && meta_block->overflow != HASH_OVERFLOW_MAX)
+		{
+			--meta_block->overflow;
+			himfs_journal_dirty(passed, 0, HIMFS_META_HDR_SIZE);
+		}
+		himfs_fpindex_set_overflow(sb, passed->b_blocknr, meta_block->overflow != 0);
+		hash_unlock_bucket(sb, passed->b_blocknr);
+		brelse(passed);
 	}
 }
 
-bool hash_update(struct inode *dir, struct dentry *dentry, struct inode_context *ctx)
+/* 名字已经摘掉的本体槽：tag 清零不再被查找命中，槽留给还打开着的 inode */
+static void hash_make_orphan(struct himfs_meta_block *meta_block, int idx)
 {
-	lba_t lba;
-	struct buffer_head *buffer;
+	hash_set_tag(meta_block, idx, 0);
+	meta_block->himfs_inode[idx].i_flags |= HIMFS_INODE_ORPHAN;
+	meta_block->himfs_inode[idx].i_dirent = 0;
+}
+
+/* 改过名的 inode 的别名删掉了，把本体槽标成孤儿 */
+static void hash_home_orphan(struct super_block *sb, himfs_ino_t ino)
+{
+	struct buffer_head *bh;
 	struct himfs_meta_block *meta_block;
-	struct himfs_inode *him_inode;
-	int idx;
-	int i;
+	int idx = ino & (HASH_SLOT_NUM - 1);
+
+	bh = sb_bread(sb, ino >> HASH_SLOT_BITS);
+	if (unlikely(!bh))
+	{
+		printk(KERN_ERR "himfs: read home bucket of %u fail, slot leaked\n", ino);
+		return;
+	}
 
-	lba = murmurHash3(dir->i_ino, dentry->d_name.name, dentry->d_name.len);
-	lba %= META_REGIN_END_LBA;
-	if (lba < META_REGIN_START_LBA) 
+	meta_block = (struct himfs_meta_block*)bh->b_data;
+	hash_lock_bucket(sb, bh->b_blocknr);
+	if (test_bit(idx, meta_block->slot_bitmap) && meta_block->himfs_inode[idx].i_ino == ino)
 	{
-		lba = META_REGIN_START_LBA;
+		hash_make_orphan(meta_block, idx);
+		set_buffer_uptodate(bh);
+		hash_log_slot(bh, idx, 0, 0, false);
 	}
+	hash_unlock_bucket(sb, bh->b_blocknr);
+	brelse(bh);
+}
 
-	buffer = sb_bread(dir->i_sb, lba);
+/* 最后一次 iput 回收已删除的 inode 时释放它的孤儿槽，和释放数据块在同一个句柄里 */
+void hash_orphan_release(struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+	struct buffer_head *bh;
+	struct himfs_meta_block *meta_block;
+	struct himfs_inode *him_inode;
+	int idx = inode->i_ino & (HASH_SLOT_NUM - 1);
 
-	if (unlikely(!buffer))
+	if (!inode->i_ino)
 	{
-		printk(KERN_ERR "allocate bh for himfs_inode fail");
-		return false;
+		return;
 	}
 
-	meta_block = (struct himfs_meta_block*)buffer->b_data;
+	bh = sb_bread(sb, inode->i_ino >> HASH_SLOT_BITS);
+	if (unlikely(!bh))
+	{
+		printk(KERN_ERR "himfs: read bucket of orphan %lu fail, slot leaked\n", inode->i_ino);
+		return;
+	}
 
-	for (idx = 0; idx < HASH_SLOT_NUM; ++idx)
+	meta_block = (struct himfs_meta_block*)bh->b_data;
+	him_inode = &meta_block->himfs_inode[idx];
+	hash_lock_bucket(sb, bh->b_blocknr);
+	if (test_bit(idx, meta_block->slot_bitmap) && him_inode->i_ino == inode->i_ino &&
+	    (him_inode->i_flags & HIMFS_INODE_ORPHAN))
 	{
-		if (test_bit(idx, meta_block->slot_bitmap))
-		{
-			him_inode = &meta_block->himfs_inode[idx];
-			if (strcmp(him_inode->filename.name, dentry->d_name.name) == 0)
-			{
-				break;
-			}
-		}
+		hash_slot_release(sb, bh, idx);
+		set_buffer_uptodate(bh);
+		hash_log_slot(bh, idx, 0, 0, false);
 	}
+	hash_unlock_bucket(sb, bh->b_blocknr);
+	brelse(bh);
+}
+
+/*
+ * 从 dir 里摘掉名字：删子项日志、撤销 overflow。名字在别名槽里就释放别名槽，
+ * 不保留 inode（删除）时本体槽标成孤儿；名字在本体槽里时，keep 为真（改名）
+ * 只清掉 tag 并标 RENAMED，让它不再参与查找，否则标成孤儿，等最后一次 iput 再释放。
+ * 只摘指向 ino 的那个槽，改名途中同一个名字会短暂地有两个槽。
+ */
+static bool hash_drop_name(struct inode *dir, const struct qstr *name, himfs_ino_t ino, bool keep)
+{
+	struct super_block *sb = dir->i_sb;
+	struct buffer_head *buffer;
+	struct himfs_meta_block *meta_block;
+	struct himfs_inode *him_inode;
+	himfs_ino_t home = 0;
+	int probe;
+	int idx;
 
-	if (idx == HASH_SLOT_NUM)
+	buffer = hash_find(dir, name, ino, &probe, &idx);
+	if (buffer == NULL)
 	{
 		printk(KERN_ERR "hash_update not find\n");
+		trace_himfs_hash_update(dir, 0, -1, 0, !keep, 0);
 		return false;
 	}
 
-	if (ctx->is_delete)
-	{
-		for (i = 0; i < GRAVE_NUM; ++i)
-		{
-			if (him_inode->i_grave[i].pid == 0)
-			{
-				him_inode->i_grave[i].pid = him_inode->i_pid;
-				// ctx->inode->i_detime = him_inode->i_detime = him_inode->i_grave[i].detime = current_time(ctx->inode);
-			}
-		}
+	meta_block = (struct himfs_meta_block*)buffer->b_data;
+	him_inode = &meta_block->himfs_inode[idx];
 
-		if (i >= GRAVE_NUM - 1)
-		{
-			// grave_sync(dir->i_sb, &him_inode->i_grave);
-			for (i = 0; i < GRAVE_NUM; ++i)
-			{
-				him_inode->i_grave[i].pid = 0;
-			}
-		}
-		
-		clear_bit(idx, meta_block->slot_bitmap);
-		set_buffer_uptodate(buffer);//表示可以回写
-		mark_buffer_dirty(buffer);
+	/* 槽里的 i_dirent 和 i_ino 只有同一目录的建删会改，持有目录锁时不用桶锁 */
+	himfs_dlog_remove(dir, him_inode->i_dirent, him_inode->i_ino);
+	hash_lock_bucket(sb, buffer->b_blocknr);
+	if (him_inode->i_flags & HIMFS_INODE_ALIAS)
+	{
+		home = keep ? 0 : him_inode->i_ino;
+		hash_slot_release(sb, buffer, idx);
+	}
+	else if (!keep)
+	{
+		hash_make_orphan(meta_block, idx);
 	}
 	else
 	{
-		// TODU
+		/* 名字留在堆里（内联数据紧跟其后），tag 为 0 的槽不会被任何查找命中 */
+		hash_set_tag(meta_block, idx, 0);
+		him_inode->i_flags |= HIMFS_INODE_RENAMED;
+		him_inode->i_dirent = 0;
+	}
+	set_buffer_uptodate(buffer);//表示可以回写
+	hash_log_slot(buffer, idx, 0, 0, false);
+	hash_unlock_bucket(sb, buffer->b_blocknr);
+
+	hash_unwind_overflow(sb, himfs_name_hash(sb, dir->i_ino, name->name, name->len), probe);
+	if (home)
+	{
+		hash_home_orphan(sb, home);
 	}
 
+	trace_himfs_hash_update(dir, buffer->b_blocknr, idx, probe, !keep, probe);
 	brelse(buffer);
 	return true;
-}
\ No newline at end of file
+}
+
+/* 改名时摘掉旧名字，inode 本体留在原处 */
+bool hash_rename_away(struct inode *dir, struct dentry *dentry)
+{
+	return hash_drop_name(dir, &dentry->d_name, d_inode(dentry)->i_ino, true);
+}
+
+bool hash_update(struct inode *dir, struct dentry *dentry, struct inode_context *ctx)
+{
+	if (ctx->is_delete)
+	{
+		return hash_drop_name(dir, &dentry->d_name, ctx->inode->i_ino, false);
+	}
+
+	// TODU
+	return true;
+}
@@ -3,9 +3,27 @@
 #include "himfs_d.h"
 #endif
 
-unsigned int BKDRHash(char *str, int len);
-uint32_t murmurHash3(uint32_t key1, const char* key2, int len);
+int hash_locks_init(struct super_block *sb);
+void hash_locks_exit(struct super_block *sb);
+void hash_lock_bucket(struct super_block *sb, lba_t lba);
+void hash_unlock_bucket(struct super_block *sb, lba_t lba);
+int himfs_icount_init(struct super_block *sb);
+void himfs_icount_start(struct super_block *sb);
+bool himfs_icount_stop(struct super_block *sb);
+void himfs_icount_exit(struct super_block *sb);
+uint32_t himfs_name_hash(struct super_block *sb, uint32_t dir, const char *name, int len);
+lba_t hash_home_lba(struct inode *dir, const char *name, int len);
 
-struct buffer_head* hash_get(struct inode *dir, struct dentry *dentry, int *idx);
+bool hash_lookup(struct inode *dir, const struct qstr *name, struct himfs_inode *core);
 unsigned int hash_insert(struct inode *inode, struct inode *dir, struct dentry *dentry, umode_t mode);
-bool hash_update(struct inode *dir, struct dentry *dentry, struct inode_context *ctx);
\ No newline at end of file
+bool hash_update(struct inode *dir, struct dentry *dentry, struct inode_context *ctx);
+bool hash_alias(struct inode *inode, struct inode *dir, struct dentry *dentry);
+bool hash_rename_away(struct inode *dir, struct dentry *dentry);
+void hash_orphan_release(struct inode *inode);
+bool hash_bucket_valid(struct super_block *sb, struct himfs_meta_block *meta_block);
+void hash_bucket_init(struct super_block *sb, struct himfs_meta_block *meta_block);
+int hash_name_store(struct himfs_meta_block *meta_block, struct himfs_inode *him_inode, const char *name, int len);
+void hash_name_free(struct himfs_meta_block *meta_block, struct himfs_inode *him_inode);
+int hash_inline_read(struct inode *inode, void *buf, int size);
+int hash_inline_write(struct inode *inode, const void *data, int len);
+int hash_inline_clear(struct inode *inode);
@@ -2,6 +2,7 @@
 #include <linux/list.h>
 #include <linux/fs.h>
 #include <linux/rwsem.h>
+#include <linux/mutex.h>
 #include <linux/fscache.h>
 #include <linux/list_sort.h>
 #include <linux/slab.h>
@@ -14,65 +15,63 @@
 #include <linux/bitmap.h>
 #include <linux/uidgid.h>
 #include <linux/types.h>
+#include <linux/siphash.h>
+#include <linux/percpu_counter.h>
+#include <linux/workqueue.h>
+#include "himfs_format.h"
 
 typedef __u64 lba_t;
-typedef __u32 himfs_ino_t;
 
 
 /* helpful if this is different than other fs */
 #define MAX_FILE_TYPE_NAME 256
-#define HIMFS_MAGIC 0x73616d70 /* "HIMFS" */
 #define PAGE_SHIFT 12
-#define BLOCK_SHIFT 12
 #define BLOCK_SIZE 1 << BLOCK_SHIFT
-#define FILE_MAX_SIZE (1 << 30)
 #define HIMFS_BSTORE_BLOCKSIZE BLOCK_SIZE
 #define HIMFS_BSTORE_BLOCKSIZE_BITS BLOCK_SHIFT
 
-#define HIMFS_ROOT_INO 8
 #define INVALID_INO 0U
 #define INIT_SPACE 10
 
 
-#define HIMFS_MAX_FILENAME_LEN 126
+/* 元数据区、数据区的位置和大小由 mkfs.himfs 决定，挂载时从超级块读进 himfs_sb_info */
+#define HASH_PROBE_NUM 4     /* 每个名字的候选桶数，也是一次查找最多读的桶数 */
+#define HASH_OVERFLOW_MAX 0xFFFF
 
-/* block refers to file ohimfset */
-#define META_REGIN_START_LBA 1
-#define META_REGIN_BITS  22
-#define META_REGIN_END_LBA (1 << META_REGIN_BITS)
-#define HASH_SLOT_BITS 3
-#define HASH_SLOT_NUM (1 << HASH_SLOT_BITS)
+#define HIMFS_PREALLOC_MAX 2048     /* 文件末尾一次最多预分配的块数 (8 MiB) */
+#define HIMFS_ALLOC_SCAN 8          /* 找足够长的连续空闲段时最多扫描的位图块数 */
 
-#define DATA_REGIN_BITS (META_REGIN_BITS + 5)
-#define DATA_REGIN_START_LBA (META_REGIN_END_LBA + 1)
-#define DATA_REGIN_END_LBA (1 << DATA_REGIN_BITS)
+#define HIMFS_GRAVE_BATCH 256      /* 一个目录攒够这么多次改动就马上折叠 */
+#define HIMFS_GRAVE_DELAY HZ        /* 否则最多延迟这么久 */
 
-#define GRAVE_NUM 4
+#define HIMFS_DEFAULT_INDEX_MB 64   /* 指纹索引默认内存上限 */
+#define HIMFS_INDEX_READAHEAD 64    /* 建索引时每批预读的桶数 */
+
+#define HIMFS_DEFAULT_PREFETCH_DEPTH 8  /* 路径预取默认往下猜的级数 */
+#define HIMFS_PREFETCH_DEPTH_MAX 32
+#define HIMFS_HINT_BITS 15              /* 提示表 2^15 项，共 768 KiB */
+
+#define HIMFS_DEFAULT_BCACHE_MB 64      /* DRAM 桶缓存默认内存上限 */
+
+#define HIMFS_WARMUP_CHUNK 256          /* 预热每次顺序读的桶数 (1 MiB) */
+#define HIMFS_DEFAULT_WARMUP_THREADS 4
+#define HIMFS_WARMUP_THREADS_MAX 32
+
+#define HIMFS_DEFAULT_DISCARD_MBPS 1024 /* 在线 discard 每秒最多下发的空间 */
+#define HIMFS_DISCARD_DELAY HZ          /* 攒这么久下发一轮 */
+#define HIMFS_DISCARD_MAX 32768         /* 合并后一段最多的块数 (128 MiB) */
 
 struct himfs_ino 
 {
     union {
         struct {
             uint32_t slot : HASH_SLOT_BITS;        /* 哈希槽位 */
-            uint32_t hash_key : META_REGIN_BITS;   /* 哈希键 */
-            uint32_t padding : 32 - HASH_SLOT_BITS - META_REGIN_BITS; /* 填充位 */
+            uint32_t hash_key : HIMFS_MAX_META_BITS;   /* 哈希键，即桶的 LBA */
         } ino;
         himfs_ino_t raw_ino;  /* 原始的inode编号 */
     };
 };
 
-struct himfs_name 
-{
-	__u16	name_len;		/* Name length */
-	char	name[HIMFS_MAX_FILENAME_LEN];			/* Dir name */
-};
-
-struct grave
-{
-    uint32_t pid;
-    uint32_t detime;
-};
-
 struct inode_context
 {
     bool is_delete;
@@ -80,31 +79,6 @@ struct inode_context
 };
 
 
-struct himfs_inode         // 磁盘inode
-{		 
-    uint16_t i_mode;
-    himfs_ino_t i_ino;	 
-    uint16_t i_uid;
-    uint16_t i_gid;
-    uint32_t i_size;
-    uint32_t i_ctime;
-    uint32_t i_mtime;
-    uint32_t i_crtime;
-    uint32_t i_detime;
-    struct himfs_name filename;
-    uint32_t i_pid;
-    struct grave i_grave[GRAVE_NUM];
-    uint32_t i_block[16];
-    char rsv[253];
-};
-
-struct himfs_meta_block
-{
-    DECLARE_BITMAP(slot_bitmap, HASH_SLOT_NUM);
-    struct himfs_inode himfs_inode[HASH_SLOT_NUM];
-    char rsv[7];
-};
-
 struct himfs_inode_info   // 内存文件系统特化inode
 {					   
     struct inode vfs_inode;
@@ -114,8 +88,20 @@ struct himfs_inode_info   // 内存文件系统特化inode
     // bool is_create_op;
     uint32_t i_crtime;
     uint32_t i_detime;
+    uint32_t i_dlog_end;
+    uint8_t i_flags;                    /* 盘上 i_flags 的副本，HIMFS_INODE_INLINE 在 i_rwsem 下修改 */
+    struct rw_semaphore i_extent_sem;   /* 保护下面的 extent 表和溢出块 */
+    uint16_t i_nr_extents;
+    uint32_t i_xblock;
+    struct himfs_extent i_extents[HIMFS_INLINE_EXTENTS];
+    uint64_t i_sync_tid;                /* 最近一次改动所在的日志事务，fsync 等它提交 */
+    unsigned int i_core_dirty;          /* 属性比桶里的新，等 himfs_write_inode 写回 */
+    uint32_t i_grave_nr;                /* 目录还没折叠的改动次数，非 0 时挂在 grave 链表上 */
+    struct list_head i_grave_list;
 };
 
+#define HIMFS_DIR_POS_BASE 2    /* ctx->pos 0、1 留给 . 和 .. */
+
 static inline struct himfs_sb_info *HIMFS_SB(struct super_block *sb)
 {
 	return sb->s_fs_info; //文件系统特殊信息
@@ -126,11 +112,114 @@ static inline struct himfs_inode_info *HIMFS_I(struct inode *inode)
 	return container_of(inode, struct himfs_inode_info, vfs_inode);
 }
 
+/*
+ * 内存槽位指纹索引：元数据区每个桶的每个槽一个字节，0 表示空槽，
+ * 非 0 为 (父目录 ino, 文件名) 哈希的 8 位指纹；另外每桶一位记录 overflow 是否非 0。
+ * 挂载时后台顺序扫描元数据区建立，建好之前以及内存超出上限时都退回读盘。
+ */
+struct himfs_fpindex
+{
+    uint8_t *fp;
+    unsigned long *overflow;
+    uint32_t nr_buckets;
+    bool ready;
+    bool stop;
+    spinlock_t lock;
+    struct work_struct build_work;
+    struct super_block *sb;
+};
+
+/*
+ * 已用 inode 槽计数，见 hash.c 的 himfs_icount_*。异常卸载后从 0 开始后台重数，
+ * 只有 cursor 之前（已经数过）的桶上的建删才计入 used。
+ */
+struct himfs_icount
+{
+    struct percpu_counter used;
+    lba_t cursor;
+    bool stop;
+    struct work_struct work;
+    struct super_block *sb;
+};
+
+struct himfs_journal;
+struct himfs_grave;
+struct himfs_stats;
+struct himfs_hint;
+struct himfs_bcache;
+struct himfs_warmup;
+struct himfs_discard;
+
 struct himfs_sb_info
 {
     char fs_name[MAX_FILE_TYPE_NAME];
+    struct buffer_head *sbh;            /* 超级块所在块，挂载期间一直持有 */
+    struct himfs_super_block *hsb;
+    uint32_t generation;
+    uint32_t hash_alg;                  /* HIMFS_HASH_*，见 himfs_name_hash */
+    siphash_key_t hash_key;             /* s_hash_seed，murmur3 和 xxh64 只用前几个字 */
+    lba_t meta_start;                   /* 元数据区 [meta_start, meta_end) */
+    lba_t meta_end;
+    uint32_t meta_blocks;
+    lba_t data_start;                   /* 数据区 [data_start, data_end) */
+    lba_t data_end;
+    lba_t bitmap_start;                 /* 数据区空闲位图 */
+    uint32_t bitmap_blocks;
+    uint32_t data_blocks;
+    struct mutex alloc_lock;            /* 保护位图、free_blocks 和 alloc_rotor */
+    uint64_t free_blocks;               /* 只在 alloc_lock 下改，statfs 不加锁直接读 */
+    struct himfs_icount icount;
+    uint32_t alloc_rotor;               /* 新文件第一次分配的起点，顺着往后放 */
+    struct rb_root busy_tree;           /* 释放了但还没检查点的段，alloc_lock 保护，见 balloc.c */
+    uint64_t busy_blocks;
+    uint64_t busy_tail;                 /* 上次清理 busy_tree 时的日志尾 */
+    bool unclean;                       /* 上次没有正常卸载 */
+    unsigned int index_mb;              /* 指纹索引内存上限，0 表示不建索引 */
+    struct himfs_fpindex *fpindex;
+    struct himfs_journal *journal;
+    struct himfs_grave *grave;
+    struct mutex *bucket_locks;         /* 分段桶锁，按桶 LBA 哈希，见 hash.c */
+    unsigned int bucket_lock_bits;
+    struct himfs_stats *stats;          /* /proc/fs/himfs/<设备>/ 下的统计 */
+    unsigned int prefetch_depth;        /* 路径预取往下猜的级数，0 表示不预取 */
+    struct himfs_hint *hint;            /* 路径预取的提示表，见 hint.c */
+    unsigned int bcache_mb;             /* DRAM 桶缓存内存上限，0 表示不用 */
+    struct himfs_bcache *bcache;        /* 见 bcache.c */
+    bool warmup_at_mount;               /* 挂载后马上开始预热 */
+    unsigned int warmup_threads;
+    unsigned int warmup_mbps;           /* 预热读带宽上限，0 表示不限 */
+    struct himfs_warmup *warmup;        /* 见 warmup.c */
+    bool online_discard;                /* 释放的块提交后在后台 discard */
+    unsigned int discard_mbps;
+    struct himfs_discard *discard;      /* 见 discard.c */
+    struct workqueue_struct *ioend_wq;  /* 写进未写段的回写完成后在这里转换，见 file.c */
+    spinlock_t ioend_lock;
+    struct list_head ioend_list;
+    struct work_struct ioend_work;
 };
 
+/* 目录的 i_size 记的是子项数，数据实际长度是子项日志的末尾 */
+static inline loff_t himfs_data_size(struct inode *inode)
+{
+	return S_ISDIR(inode->i_mode) ? HIMFS_I(inode)->i_dlog_end : i_size_read(inode);
+}
+
+static inline bool himfs_is_inline(struct inode *inode)
+{
+	return HIMFS_I(inode)->i_flags & HIMFS_INODE_INLINE;
+}
+
+/* 名字堆中该槽占的字节数：名字加内联数据 */
+static inline int himfs_heap_len(struct himfs_inode *him_inode)
+{
+	return him_inode->i_name_len + ((him_inode->i_flags & HIMFS_INODE_INLINE) ? him_inode->i_inline_len : 0);
+}
+
+static inline char *himfs_inode_name(struct himfs_meta_block *meta_block, struct himfs_inode *him_inode)
+{
+	return (char *)meta_block + him_inode->i_name_off;
+}
+
 static inline int my_strlen(char *name)
 {
     int len = 0;
@@ -143,7 +232,13 @@ extern struct inode_operations himfs_dir_inode_ops;
 extern struct inode_operations himfs_file_inode_ops;
 extern struct file_operations himfs_file_file_ops;
 extern struct address_space_operations himfs_aops;
+extern struct address_space_operations himfs_file_aops;
+extern const struct iomap_ops himfs_iomap_ops;
 extern struct file_operations himfs_dir_operations;
+extern int himfs_get_block_prep(struct inode *inode, sector_t iblock, struct buffer_head *bh_result, int create);
+extern int himfs_ioend_init(struct super_block *sb);
+extern void himfs_ioend_exit(struct super_block *sb);
+extern int himfs_set_incompat(struct super_block *sb, uint32_t feature);
 static inline struct buffer_head *sb_bread(struct super_block *sb, sector_t block);
 extern void brelse(struct buffer_head *bh);
 extern void set_buffer_uptodate(struct buffer_head *bh);
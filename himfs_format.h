@@ -0,0 +1,238 @@
+#ifndef _HIMFS_FORMAT_H_
+#define _HIMFS_FORMAT_H_
+
+/* 盘上格式，内核模块和 mkfs.himfs 共用 */
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/bitmap.h>
+#else
+#include <stdint.h>
+#define DECLARE_BITMAP(name, bits) unsigned long name[((bits) + 8 * sizeof(long) - 1) / (8 * sizeof(long))]
+#endif
+
+typedef uint32_t himfs_ino_t;
+
+#define HIMFS_MAGIC 0x73616d70 /* "HIMFS" */
+#define BLOCK_SHIFT 12
+#define HIMFS_FORMAT_VERSION 9   /* 1 为定长 512 字节 inode，2 为紧凑 inode + 名字堆，3 增加超级块和桶 generation，4 数据区位图 + extent，5 元数据日志，6 延迟的父目录更新，7 可选的名字哈希和随机种子，8 超级块记录已用 inode 数，9 改名用的别名槽 */
+#define HIMFS_MAX_FILENAME_LEN 255
+
+#define HASH_SLOT_BITS 4
+#define HASH_SLOT_NUM (1 << HASH_SLOT_BITS)
+#define HASH_TAGS_PER_WORD 4 /* 一个 64 位字放 4 个槽的 16 位 tag */
+
+/* block refers to file ohimfset */
+#define HIMFS_SB_LBA 0
+#define META_REGIN_START_LBA 1
+#define HIMFS_MAX_META_BITS (32 - HASH_SLOT_BITS)  /* ino = 桶 LBA << HASH_SLOT_BITS | 槽号 */
+#define HIMFS_MIN_META_BLOCKS 16
+#define HIMFS_ROOT_INO (META_REGIN_START_LBA << HASH_SLOT_BITS)
+
+#define HIMFS_STATE_CLEAN 1
+#define HIMFS_STATE_DIRTY 2
+
+#define HIMFS_FEATURE_COMPAT_LAZY_INIT 0x1      /* 元数据区没有清零，靠 generation 区分 */
+#define HIMFS_FEATURE_COMPAT_SUPP (HIMFS_FEATURE_COMPAT_LAZY_INIT)
+#define HIMFS_FEATURE_INCOMPAT_UNWRITTEN 0x1  /* extent 的 e_len 带未写标记，第一次 fallocate 时打上 */
+#define HIMFS_FEATURE_INCOMPAT_SUPP (HIMFS_FEATURE_INCOMPAT_UNWRITTEN)
+
+/*
+ * 名字哈希决定 (父目录 ino, 文件名) 落在哪个桶，mkfs 时选定并连同随机种子写进超级块。
+ * 种子不公开，别人就没法专门造一批名字挤爆同一个桶；siphash 是带密钥的 PRF，
+ * 知道算法也构造不出碰撞，其余两种只防随手撞上，换来更低的计算开销。
+ */
+#define HIMFS_HASH_MURMUR3 1    /* murmur3_x86_32，种子取 s_hash_seed[0] */
+#define HIMFS_HASH_XXH64 2      /* xxh64，种子取 s_hash_seed[0..1]，结果折成 32 位 */
+#define HIMFS_HASH_SIPHASH 3    /* siphash-2-4，s_hash_seed 整个作 128 位密钥 */
+#define HIMFS_HASH_DEFAULT HIMFS_HASH_SIPHASH
+
+struct himfs_super_block
+{
+    uint32_t s_magic;
+    uint32_t s_version;
+    uint32_t s_feature_compat;
+    uint32_t s_feature_incompat;    /* 有不认识的位就拒绝挂载 */
+    uint32_t s_state;               /* HIMFS_STATE_* */
+    uint32_t s_generation;          /* mkfs 时随机生成 */
+    uint64_t s_blocks_count;
+    uint64_t s_meta_start;
+    uint64_t s_meta_blocks;
+    uint64_t s_data_start;
+    uint64_t s_data_blocks;
+    uint64_t s_inodes_expected;
+    uint32_t s_mkfs_time;
+    uint32_t s_mount_time;
+    uint32_t s_write_time;
+    uint32_t s_mount_count;
+    uint8_t s_uuid[16];
+    uint64_t s_bitmap_start;        /* 数据区空闲位图，每位对应数据区一个块 */
+    uint64_t s_bitmap_blocks;
+    uint64_t s_free_blocks;         /* 正常卸载和 sync 时写回，异常卸载后挂载时按位图重算 */
+    uint64_t s_journal_start;       /* 元数据日志区，紧跟元数据区，第一块是日志超级块 */
+    uint64_t s_journal_blocks;
+    uint32_t s_hash_alg;            /* HIMFS_HASH_* */
+    uint32_t s_hash_seed[4];        /* mkfs 时随机生成 */
+    uint64_t s_inodes_used;         /* 已占用的 inode 槽数，同 s_free_blocks，异常卸载后后台重数 */
+};
+
+/*
+ * 元数据日志：记录的是元数据块（桶、子项日志块、位图块、extent 溢出块）里改动的字节段，
+ * 而不是整块。一个事务由若干操作的记录组成，连同事务头一次顺序写入日志区，
+ * 用 tid、generation 和 crc32c 判断事务是否完整。日志区按块循环使用，
+ * 放不下时从第 1 块重新开始；日志超级块记录最早一个还没检查点的事务的位置。
+ */
+#define HIMFS_JOURNAL_MAGIC 0x6c6e726a /* "jrnl" */
+#define HIMFS_MIN_JOURNAL_BLOCKS 1024
+#define HIMFS_DEFAULT_JOURNAL_BLOCKS 8192
+
+struct himfs_journal_super
+{
+    uint32_t j_magic;
+    uint32_t j_generation;          /* 同超级块 s_generation */
+    uint64_t j_tail_tid;            /* 重放从这个 tid 开始 */
+    uint32_t j_tail_blk;            /* 它在日志区内的块号 */
+    uint32_t j_blocks;
+};
+
+struct himfs_journal_header
+{
+    uint32_t h_magic;
+    uint32_t h_generation;
+    uint64_t h_tid;
+    uint32_t h_blocks;              /* 含事务头所在块 */
+    uint32_t h_len;                 /* 含事务头的有效字节数 */
+    uint32_t h_crc;                 /* 按 h_crc 为 0 算的 crc32c */
+    uint32_t h_nr_recs;
+};
+
+/* 操作类型只用于统计和调试，重放时所有记录一视同仁 */
+#define HIMFS_JOP_CREATE    1
+#define HIMFS_JOP_UNLINK    2
+#define HIMFS_JOP_ATTR      3
+#define HIMFS_JOP_WRITE     4       /* 块分配、内联数据 */
+#define HIMFS_JOP_TRUNCATE  5
+#define HIMFS_JOP_RENAME    6
+
+/* 一条记录：把 r_data 拷到 r_lba 块的 r_off 处，整条 8 字节对齐 */
+struct himfs_jrec
+{
+    uint64_t r_lba;
+    uint16_t r_off;
+    uint16_t r_len;
+    uint8_t r_op;
+    uint8_t r_pad[3];
+    char r_data[];
+};
+
+/*
+ * 数据区块号都是相对 s_data_start 的 32 位偏移，数据区 0 号块由 mkfs 占住，
+ * 所以块号 0 可以当作“没有”。
+ */
+#define HIMFS_BITS_PER_BITMAP (1 << (BLOCK_SHIFT + 3))
+
+struct himfs_extent
+{
+    uint32_t e_lblk;        /* 文件内起始块号 */
+    uint32_t e_len;         /* 最高位是 HIMFS_EXTENT_UNWRITTEN */
+    uint32_t e_pblk;        /* 数据区内起始块号 */
+};
+
+#define HIMFS_INLINE_EXTENTS 5
+#define HIMFS_EXTENT_MAX_LEN 0x7FFFFFFF
+#define HIMFS_EXTENT_UNWRITTEN 0x80000000  /* fallocate 预分配、还没写过的段，读出来是零 */
+
+/* 溢出 extent 块：inode 核心里放不下的 extent 接着存在这里 */
+#define HIMFS_XBLOCK_MAGIC 0x78746e65 /* "enxt" */
+#define HIMFS_XBLOCK_EXTENTS (((1 << BLOCK_SHIFT) - 16) / sizeof(struct himfs_extent))
+
+struct himfs_xblock
+{
+    uint32_t x_magic;
+    uint32_t x_generation;
+    himfs_ino_t x_ino;
+    uint16_t x_count;
+    uint16_t x_pad;
+    struct himfs_extent x_extents[HIMFS_XBLOCK_EXTENTS];
+};
+
+struct himfs_inode         // 磁盘inode，定长 128 字节，名字放在桶尾的名字堆里
+{		 
+    uint16_t i_mode;
+    uint8_t i_name_len;
+    uint8_t i_flags;
+    himfs_ino_t i_ino;	 
+    uint16_t i_uid;
+    uint16_t i_gid;
+    uint16_t i_name_off;    /* 名字在桶内的字节偏移 */
+    uint16_t i_pad;
+    uint64_t i_size;
+    uint32_t i_ctime;
+    uint32_t i_mtime;
+    uint32_t i_crtime;
+    uint32_t i_detime;
+    uint32_t i_pid;
+    uint32_t i_dlog_end;    /* 目录：子项日志的末尾偏移 */
+    uint32_t i_dirent;      /* 本项在父目录子项日志中的偏移 */
+    uint16_t i_nr_extents;  /* extent 总数，超过 HIMFS_INLINE_EXTENTS 的部分在溢出块里 */
+    uint16_t i_xpad;
+    uint32_t i_xblock;      /* 溢出 extent 块的数据区块号，0 表示没有 */
+    struct himfs_extent i_extents[HIMFS_INLINE_EXTENTS];
+    uint16_t i_inline_len;  /* HIMFS_INODE_INLINE 时紧跟名字存放的数据长度 */
+    char rsv[6];
+};
+
+/* i_flags */
+#define HIMFS_INODE_INLINE 0x1  /* 数据（或符号链接目标）存在名字堆里，紧跟在名字后面 */
+#define HIMFS_INODE_GRAVE 0x2   /* 目录有还没写回的子项数/时间戳/日志末尾，读入时扫描子项日志重算 */
+/*
+ * 改名不搬 inode：新名字放进一个别名槽，只有名字、i_pid、i_mode、i_dirent 有效，
+ * i_ino 是本体槽的 ino；本体槽留在原处继续存属性、extent 和内联数据，
+ * 旧名字的 tag 清零、标 RENAMED，不再被查找命中。删除别名时本体槽标成孤儿。
+ */
+#define HIMFS_INODE_ALIAS 0x4
+#define HIMFS_INODE_RENAMED 0x8
+/*
+ * 删掉了名字但还有人打开着：槽（连同内联数据）留到最后一次 iput 才释放，
+ * ino 在这之前不会被新建的文件重用。异常卸载时留下的孤儿由挂载后的 inode 重数回收。
+ */
+#define HIMFS_INODE_ORPHAN 0x10
+#define HIMFS_INLINE_MAX 384
+
+#define HIMFS_META_HDR_SIZE 64
+#define HIMFS_HEAP_START ((int)(HIMFS_META_HDR_SIZE + HASH_SLOT_NUM * sizeof(struct himfs_inode)))
+#define HIMFS_HEAP_END (1 << BLOCK_SHIFT)
+
+/*
+ * 桶布局：64 字节桶头，16 个 inode 核心，剩下的空间是名字堆。
+ * 名字（内联文件还有紧跟其后的数据）从块尾向前分配，删除只记空洞字节数，空间不够时再整理。
+ */
+struct himfs_meta_block
+{
+    DECLARE_BITMAP(slot_bitmap, HASH_SLOT_NUM);
+    uint16_t overflow;      /* 探测时经过本桶（本桶已满）而放到后续候选桶的条目数 */
+    uint8_t version;        /* HIMFS_FORMAT_VERSION，不等则视为空桶 */
+    uint8_t hdr_pad;
+    uint16_t heap_low;      /* 名字堆当前最低偏移 */
+    uint16_t heap_hole;     /* 名字堆中已删除名字占的字节数 */
+    uint64_t tags[HASH_SLOT_NUM / HASH_TAGS_PER_WORD]; /* 每槽 16 位：高 8 位哈希片段，低 8 位名字长度，0 为空槽 */
+    uint32_t generation;    /* 与超级块 s_generation 不等则视为未初始化的空桶 */
+    char hdr_rsv[12];
+    struct himfs_inode himfs_inode[HASH_SLOT_NUM];
+    char heap[HIMFS_HEAP_END - HIMFS_HEAP_START];
+};
+
+/*
+ * 目录子项日志：每个目录在自己的数据块里顺序追加子项记录，readdir 只需扫这些块。
+ * 记录 8 字节对齐且不跨块，删除时把 d_ino 清 0 留作墓碑，所以偏移可以直接当 readdir 的 cookie。
+ * 最后一条记录后面总留一个 d_rec_len 为 0 的记录头作结尾，崩溃后据此找到日志末尾。
+ */
+struct himfs_dirent
+{
+    himfs_ino_t d_ino;      /* 0 表示已删除或块尾填充 */
+    uint16_t d_rec_len;
+    uint8_t d_name_len;
+    uint8_t d_type;
+    char d_name[];
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef _HIMFS_IOCTL_H_
+#define _HIMFS_IOCTL_H_
+
+/* ioctl 接口，内核模块和用户态工具共用 */
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+#endif
+
+#define HIMFS_IOC_MAGIC 'h'
+
+/*
+ * 批量创建：在目录 fd 上一次建一批普通文件或目录。内核先算出每个名字的家桶，
+ * 按桶号排序后用一次 plug 把要用的桶全部预读进来，再按桶的顺序逐个创建，
+ * 同一个桶上的创建挨在一起，日志记录和回写都合并。
+ * 单项失败只填该项的 status，不影响其余项；整个调用失败时返回负的 errno。
+ */
+#define HIMFS_BULK_MAX 16384    /* 每次调用最多的项数 */
+
+struct himfs_bulk_entry
+{
+    uint32_t name_off;      /* 名字在 names 缓冲里的偏移，不需要 '\0' 结尾 */
+    uint16_t name_len;
+    uint16_t mode;          /* S_IFREG 或 S_IFDIR 加权限位，类型为 0 时按普通文件，同样受 umask 影响 */
+    int32_t status;         /* 出参：0 或负的 errno，重名是 -EEXIST */
+    uint32_t ino;           /* 出参 */
+};
+
+struct himfs_bulk_create
+{
+    uint64_t entries;       /* struct himfs_bulk_entry 数组的用户态地址 */
+    uint64_t names;         /* 名字缓冲的用户态地址 */
+    uint32_t count;
+    uint32_t names_len;
+    uint32_t created;       /* 出参：建成的项数 */
+    uint32_t flags;         /* 保留，必须为 0 */
+};
+
+#define HIMFS_IOC_BULK_CREATE _IOWR(HIMFS_IOC_MAGIC, 1, struct himfs_bulk_create)
+
+/*
+ * 元数据预热：后台用一组工作线程大块顺序读元数据区，把用到的桶放进缓存，
+ * 文件系统照常服务。可以在挂载的任意目录上调用；启动和停止需要 CAP_SYS_ADMIN。
+ * 每次调用都在同一个结构里返回当前进度，进度也可以从 /proc/fs/himfs/<设备>/warmup 读。
+ */
+enum
+{
+    HIMFS_WARMUP_STATUS,    /* 只查进度 */
+    HIMFS_WARMUP_START,     /* 已经在跑时返回 -EBUSY，跑完过的从头再来一遍 */
+    HIMFS_WARMUP_STOP,      /* 停下并等工作线程退出，没在跑时什么也不做 */
+};
+
+enum
+{
+    HIMFS_WARMUP_IDLE,      /* 从没跑过 */
+    HIMFS_WARMUP_RUNNING,
+    HIMFS_WARMUP_DONE,      /* 扫完了整个元数据区 */
+    HIMFS_WARMUP_STOPPED,   /* 被停下、卸载或者读盘出错 */
+    HIMFS_WARMUP_FULL,      /* 桶缓存已经占满预算，再读只会互相淘汰 */
+};
+
+struct himfs_warmup_ctl
+{
+    uint32_t op;            /* HIMFS_WARMUP_* */
+    uint32_t threads;       /* START 用，0 取挂载参数 warmup_threads；返回时是实际用的值 */
+    uint32_t mbps;          /* START 用，读带宽上限 MB/s，0 取挂载参数 warmup_mbps，同上 */
+    uint32_t state;         /* 出参：HIMFS_WARMUP_IDLE 等 */
+    uint64_t done;          /* 出参：已经扫过的桶数 */
+    uint64_t total;         /* 出参：元数据区的桶数 */
+    uint64_t cached;        /* 出参：放进缓存的桶数 */
+    uint64_t elapsed_ns;    /* 出参：本次预热已用或总共用的时间 */
+};
+
+#define HIMFS_IOC_WARMUP _IOWR(HIMFS_IOC_MAGIC, 2, struct himfs_warmup_ctl)
+
+#endif
@@ -0,0 +1,264 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM himfs
+
+#if !defined(_HIMFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _HIMFS_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/buffer_head.h>
+#include <linux/iomap.h>
+
+/*
+ * 哈希、桶 I/O 和块映射热路径上的静态跟踪点，没打开时只是一条 nop 跳转。
+ * 桶 LBA 和块设备扇区同单位（4K 块号），可以和 block:block_rq_issue 的 sector/8 对上。
+ * 用法: echo 1 > /sys/kernel/tracing/events/himfs/enable，或 perf record -e 'himfs:*'
+ */
+
+/* hash_lookup 和 hash_update 的查找每次一条，hash_lookup 在桶缓存里命中的桶不计入 reads */
+TRACE_EVENT(himfs_hash_get,
+	TP_PROTO(struct inode *dir, const struct qstr *name, uint32_t hash, int probe,
+		 lba_t lba, int slot, int reads, int cmps),
+
+	TP_ARGS(dir, name, hash, probe, lba, slot, reads, cmps),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, dir)
+		__field(uint32_t, hash)
+		__field(int, probe)
+		__field(u64, lba)
+		__field(int, slot)
+		__field(int, reads)
+		__field(int, cmps)
+		__string(name, name->name)
+	),
+
+	TP_fast_assign(
+		__entry->dev = dir->i_sb->s_dev;
+		__entry->dir = dir->i_ino;
+		__entry->hash = hash;
+		__entry->probe = probe;
+		__entry->lba = lba;
+		__entry->slot = slot;
+		__entry->reads = reads;
+		__entry->cmps = cmps;
+		__assign_str(name, name->name);
+	),
+
+	TP_printk("dev %d:%d dir %lu name %s hash 0x%08x %s probe %d lba %llu slot %d reads %d cmps %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->dir, __get_str(name),
+		  __entry->hash, __entry->slot >= 0 ? "hit" : "miss", __entry->probe,
+		  __entry->lba, __entry->slot, __entry->reads, __entry->cmps)
+);
+
+/* ino 为 0 表示插入失败；full 是途经的满桶数 */
+TRACE_EVENT(himfs_hash_insert,
+	TP_PROTO(struct inode *dir, uint32_t hash, int probe, lba_t lba, int slot,
+		 int reads, int full, unsigned int ino),
+
+	TP_ARGS(dir, hash, probe, lba, slot, reads, full, ino),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, dir)
+		__field(uint32_t, hash)
+		__field(int, probe)
+		__field(u64, lba)
+		__field(int, slot)
+		__field(int, reads)
+		__field(int, full)
+		__field(unsigned int, ino)
+	),
+
+	TP_fast_assign(
+		__entry->dev = dir->i_sb->s_dev;
+		__entry->dir = dir->i_ino;
+		__entry->hash = hash;
+		__entry->probe = probe;
+		__entry->lba = lba;
+		__entry->slot = slot;
+		__entry->reads = reads;
+		__entry->full = full;
+		__entry->ino = ino;
+	),
+
+	TP_printk("dev %d:%d dir %lu hash 0x%08x probe %d lba %llu slot %d reads %d full %d ino %u",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->dir, __entry->hash,
+		  __entry->probe, __entry->lba, __entry->slot, __entry->reads, __entry->full,
+		  __entry->ino)
+);
+
+/* passed 是删除时回头修正 overflow 读的满桶数 */
+TRACE_EVENT(himfs_hash_update,
+	TP_PROTO(struct inode *dir, lba_t lba, int slot, int probe, bool is_delete, int passed),
+
+	TP_ARGS(dir, lba, slot, probe, is_delete, passed),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, dir)
+		__field(u64, lba)
+		__field(int, slot)
+		__field(int, probe)
+		__field(bool, is_delete)
+		__field(int, passed)
+	),
+
+	TP_fast_assign(
+		__entry->dev = dir->i_sb->s_dev;
+		__entry->dir = dir->i_ino;
+		__entry->lba = lba;
+		__entry->slot = slot;
+		__entry->probe = probe;
+		__entry->is_delete = is_delete;
+		__entry->passed = passed;
+	),
+
+	TP_printk("dev %d:%d dir %lu %s lba %llu slot %d probe %d passed %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->dir,
+		  __entry->slot < 0 ? "notfound" : (__entry->is_delete ? "delete" : "update"),
+		  __entry->lba, __entry->slot, __entry->probe, __entry->passed)
+);
+
+/* 目录和慢速符号链接的 get_block 映射，lba 为 0 表示空洞 */
+TRACE_EVENT(himfs_get_block_prep,
+	TP_PROTO(struct inode *inode, sector_t iblock, struct buffer_head *bh, int create, int ret),
+
+	TP_ARGS(inode, iblock, bh, create, ret),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(u64, iblock)
+		__field(u64, lba)
+		__field(size_t, size)
+		__field(int, create)
+		__field(bool, new)
+		__field(bool, boundary)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->iblock = iblock;
+		__entry->lba = buffer_mapped(bh) ? bh->b_blocknr : 0;
+		__entry->size = bh->b_size;
+		__entry->create = create;
+		__entry->new = buffer_new(bh);
+		__entry->boundary = buffer_boundary(bh);
+		__entry->ret = ret;
+	),
+
+	TP_printk("dev %d:%d ino %lu iblock %llu -> lba %llu size %zu create %d new %d boundary %d ret %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino, __entry->iblock,
+		  __entry->lba, __entry->size, __entry->create, __entry->new,
+		  __entry->boundary, __entry->ret)
+);
+
+/* 普通文件的映射走 iomap，和 get_block_prep 对应 */
+TRACE_EVENT(himfs_iomap_begin,
+	TP_PROTO(struct inode *inode, loff_t offset, loff_t length, unsigned flags,
+		 struct iomap *iomap, int ret),
+
+	TP_ARGS(inode, offset, length, flags, iomap, ret),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(loff_t, offset)
+		__field(loff_t, length)
+		__field(unsigned, flags)
+		__field(u16, type)
+		__field(u16, mflags)
+		__field(u64, addr)
+		__field(u64, mlength)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->offset = offset;
+		__entry->length = length;
+		__entry->flags = flags;
+		__entry->type = ret ? 0 : iomap->type;
+		__entry->mflags = ret ? 0 : iomap->flags;
+		__entry->addr = ret ? 0 : iomap->addr;
+		__entry->mlength = ret ? 0 : iomap->length;
+		__entry->ret = ret;
+	),
+
+	TP_printk("dev %d:%d ino %lu pos %lld len %lld flags 0x%x -> type %u addr %llu len %llu mflags 0x%x ret %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino, __entry->offset,
+		  __entry->length, __entry->flags, __entry->type, __entry->addr,
+		  __entry->mlength, __entry->mflags, __entry->ret)
+);
+
+/* 每次写回一个核心：桶 LBA 和槽号由 ino 拆出 */
+TRACE_EVENT(himfs_dirty_inode,
+	TP_PROTO(struct inode *inode, int flags),
+
+	TP_ARGS(inode, flags),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(int, flags)
+		__field(loff_t, size)
+		__field(unsigned int, nlink)
+		__field(u32, hflags)
+	),
+
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->flags = flags;
+		__entry->size = inode->i_size;
+		__entry->nlink = inode->i_nlink;
+		__entry->hflags = HIMFS_I(inode)->i_flags;
+	),
+
+	TP_printk("dev %d:%d ino %lu lba %lu slot %lu flags 0x%x size %lld nlink %u hflags 0x%x",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->ino >> HASH_SLOT_BITS, __entry->ino & (HASH_SLOT_NUM - 1),
+		  __entry->flags, __entry->size, __entry->nlink, __entry->hflags)
+);
+
+/* 建删时父目录的大小和时间戳变化，父目录的桶交给 grave 之后批量写回 */
+TRACE_EVENT(himfs_update_dir,
+	TP_PROTO(struct inode *inode, struct inode *dir, bool is_create),
+
+	TP_ARGS(inode, dir, is_create),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(unsigned long, dir)
+		__field(bool, is_create)
+		__field(loff_t, dir_size)
+		__field(unsigned int, grave_nr)
+	),
+
+	TP_fast_assign(
+		__entry->dev = dir->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->dir = dir->i_ino;
+		__entry->is_create = is_create;
+		__entry->dir_size = dir->i_size;
+		__entry->grave_nr = HIMFS_I(dir)->i_grave_nr;
+	),
+
+	TP_printk("dev %d:%d dir %lu %s ino %lu dir_size %lld grave_nr %u",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->dir,
+		  __entry->is_create ? "create" : "delete", __entry->ino,
+		  __entry->dir_size, __entry->grave_nr)
+);
+
+#endif /* _HIMFS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE himfs_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,217 @@
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/blkdev.h>
+#include <linux/buffer_head.h>
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#include "hash.h"
+#include "stats.h"
+#include "bcache.h"
+#include "hint.h"
+#endif
+
+/*
+ * 路径预取：VFS 逐个分量调 himfs_lookup，每一级都同步读一个随机的桶，冷缓存下
+ * 解析一条深路径要付出 深度 × 设备延迟。这里记两张表，查的时候顺着它们猜出后面几级
+ * 分量所在的桶，在读当前分量之前一起发出异步读，让它们和当前这次读重叠：
+ *   names: (父目录 ino, 名字哈希) -> ino，最近解析或创建过的名字
+ *   kids:  目录 ino -> 最近一次在它下面解析出的子项 ino
+ * 当前分量由 names 得到 ino，ino 里就编码了所在桶；再沿着 kids 往下走 depth 级。
+ * 两张表都是直接映射、无锁、后写覆盖，撕裂或过期的表项只会多读一个桶，
+ * 查找本身仍然完全按哈希走，不依赖这里的结果。表放在 himfs_sb_info 里，
+ * drop_caches 清掉 dentry、inode 和桶缓存之后还在，正好用来把冷路径重新拉起来。
+ */
+
+struct hint_name
+{
+	u64 key;                /* 父目录 ino << 32 | 名字哈希 */
+	u32 ino;
+	u32 pad;
+};
+
+struct himfs_hint
+{
+	unsigned int bits;
+	unsigned int depth;
+	struct hint_name *names;
+	u64 *kids;              /* 父目录 ino << 32 | 子项 ino */
+};
+
+static inline u64 hint_key(u32 parent, u32 hash)
+{
+	return (u64)parent << 32 | hash;
+}
+
+static inline bool hint_lba_ok(struct himfs_sb_info *himfs_sb, lba_t lba)
+{
+	return lba >= himfs_sb->meta_start && lba < himfs_sb->meta_end;
+}
+
+static himfs_ino_t hint_name_get(struct himfs_hint *hint, u32 parent, u32 hash)
+{
+	struct hint_name *n = &hint->names[hash_64(hint_key(parent, hash), hint->bits)];
+
+	if (READ_ONCE(n->key) != hint_key(parent, hash))
+	{
+		return 0;
+	}
+	return READ_ONCE(n->ino);
+}
+
+static himfs_ino_t hint_kid_get(struct himfs_hint *hint, u32 parent)
+{
+	u64 v = READ_ONCE(hint->kids[hash_32(parent, hint->bits)]);
+
+	return (v >> 32) == parent ? (u32)v : 0;
+}
+
+/* 桶已经在 DRAM 桶缓存或缓冲里就不再发读 */
+static bool hint_readahead(struct super_block *sb, lba_t lba)
+{
+	struct buffer_head *bh;
+	bool cached;
+
+	if (himfs_bcache_cached(sb, lba))
+	{
+		return false;
+	}
+	bh = sb_find_get_block(sb, lba);
+	cached = bh && buffer_uptodate(bh);
+	brelse(bh);
+	if (cached)
+	{
+		return false;
+	}
+	sb_breadahead(sb, lba);
+	return true;
+}
+
+/*
+ * 在 hash_lookup 之前调用：把猜到的当前分量及其下 depth 级的桶一次发出去，
+ * 返回名字哈希给 himfs_hint_add 用；没有开预取时返回 0。
+ */
+uint32_t himfs_hint_prefetch(struct inode *dir, const struct qstr *name)
+{
+	struct super_block *sb = dir->i_sb;
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_hint *hint = himfs_sb->hint;
+	struct blk_plug plug;
+	himfs_ino_t ino;
+	uint32_t hash;
+	lba_t lba;
+	int level;
+
+	if (!hint)
+	{
+		return 0;
+	}
+
+	hash = himfs_name_hash(sb, dir->i_ino, name->name, name->len);
+	ino = hint_name_get(hint, dir->i_ino, hash);
+	if (!ino)
+	{
+		return hash;
+	}
+	himfs_stat_inc(sb, HIMFS_STAT_HINT_HIT);
+
+	blk_start_plug(&plug);
+	for (level = 0; ino && level <= hint->depth; ++level)
+	{
+		lba = ino >> HASH_SLOT_BITS;
+		if (!hint_lba_ok(himfs_sb, lba))
+		{
+			break;
+		}
+		if (hint_readahead(sb, lba))
+		{
+			himfs_stat_inc(sb, HIMFS_STAT_PATH_PREFETCH);
+		}
+		ino = hint_kid_get(hint, ino);
+	}
+	blk_finish_plug(&plug);
+
+	return hash;
+}
+
+/* 查找或创建成功后记下 (dir, 名字) -> ino，并把它当作 dir 下最近的子项 */
+void himfs_hint_add(struct inode *dir, uint32_t hash, himfs_ino_t ino)
+{
+	struct himfs_hint *hint = HIMFS_SB(dir->i_sb)->hint;
+	struct hint_name *n;
+
+	if (!hint || !ino)
+	{
+		return;
+	}
+
+	n = &hint->names[hash_64(hint_key(dir->i_ino, hash), hint->bits)];
+	if (READ_ONCE(n->key) != hint_key(dir->i_ino, hash) || READ_ONCE(n->ino) != ino)
+	{
+		WRITE_ONCE(n->key, hint_key(dir->i_ino, hash));
+		WRITE_ONCE(n->ino, ino);
+	}
+	if (hint_kid_get(hint, dir->i_ino) != ino)
+	{
+		WRITE_ONCE(hint->kids[hash_32(dir->i_ino, hint->bits)], hint_key(dir->i_ino, ino));
+	}
+}
+
+/* 新建的文件和目录也记下，建完马上按路径访问时同样能预取 */
+void himfs_hint_create(struct inode *dir, const struct qstr *name, himfs_ino_t ino)
+{
+	if (HIMFS_SB(dir->i_sb)->hint)
+	{
+		himfs_hint_add(dir, himfs_name_hash(dir->i_sb, dir->i_ino, name->name, name->len), ino);
+	}
+}
+
+int himfs_hint_init(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_hint *hint;
+
+	if (!himfs_sb->prefetch_depth)
+	{
+		return 0;
+	}
+
+	hint = kzalloc(sizeof(*hint), GFP_KERNEL);
+	if (!hint)
+	{
+		return -ENOMEM;
+	}
+	hint->bits = HIMFS_HINT_BITS;
+	hint->depth = himfs_sb->prefetch_depth;
+	hint->names = kvcalloc(1UL << hint->bits, sizeof(*hint->names), GFP_KERNEL);
+	hint->kids = kvcalloc(1UL << hint->bits, sizeof(*hint->kids), GFP_KERNEL);
+	if (!hint->names || !hint->kids)
+	{
+		kvfree(hint->names);
+		kvfree(hint->kids);
+		kfree(hint);
+		return -ENOMEM;
+	}
+
+	himfs_sb->hint = hint;
+	return 0;
+}
+
+void himfs_hint_exit(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_hint *hint = himfs_sb->hint;
+
+	if (!hint)
+	{
+		return;
+	}
+
+	himfs_sb->hint = NULL;
+	kvfree(hint->names);
+	kvfree(hint->kids);
+	kfree(hint);
+}
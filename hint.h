@@ -0,0 +1,10 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#endif
+
+int himfs_hint_init(struct super_block *sb);
+void himfs_hint_exit(struct super_block *sb);
+uint32_t himfs_hint_prefetch(struct inode *dir, const struct qstr *name);
+void himfs_hint_add(struct inode *dir, uint32_t hash, himfs_ino_t ino);
+void himfs_hint_create(struct inode *dir, const struct qstr *name, himfs_ino_t ino);
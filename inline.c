@@ -0,0 +1,203 @@
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/writeback.h>
+#include <linux/buffer_head.h>
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#include "hash.h"
+#include "inline.h"
+#endif
+
+/*
+ * 内联文件：不超过 HIMFS_INLINE_MAX 字节的普通文件把数据存在桶的名字堆里，紧跟名字。
+ * page cache 里照常只有第 0 页，读页从桶拷出来，回写时拷回桶里，不经过块映射；
+ * 写到超过上限或堆里放不下时转成块映射，之后和普通文件一样。
+ * HIMFS_INODE_INLINE 只在持有 i_rwsem 或页锁时改变。
+ */
+
+/* 用桶里的内联数据填满一页，超出部分补 0 */
+static int inline_fill_page(struct inode *inode, struct page *page)
+{
+	void *kaddr;
+	int len = 0;
+
+	kaddr = kmap(page);
+	if (page->index == 0)
+	{
+		len = hash_inline_read(inode, kaddr, PAGE_SIZE);
+		if (len < 0)
+		{
+			kunmap(page);
+			return len;
+		}
+	}
+	memset(kaddr + len, 0, PAGE_SIZE - len);
+	kunmap(page);
+
+	flush_dcache_page(page);
+	SetPageUptodate(page);
+
+	return 0;
+}
+
+int himfs_inline_readpage(struct inode *inode, struct page *page)
+{
+	int err = inline_fill_page(inode, page);
+
+	if (err)
+	{
+		SetPageError(page);
+	}
+	unlock_page(page);
+
+	return err;
+}
+
+/* 写完仍在上限以内时只准备好页，数据在回写时整段拷进桶 */
+int himfs_inline_write_begin(struct address_space *mapping, loff_t pos, unsigned len,
+			     unsigned flags, struct page **pagep)
+{
+	struct page *page;
+	int err;
+
+	page = grab_cache_page_write_begin(mapping, pos >> PAGE_SHIFT, flags);
+	if (!page)
+	{
+		return -ENOMEM;
+	}
+
+	if (!PageUptodate(page))
+	{
+		err = inline_fill_page(mapping->host, page);
+		if (err)
+		{
+			unlock_page(page);
+			put_page(page);
+			return err;
+		}
+	}
+
+	*pagep = page;
+	return 0;
+}
+
+/*
+ * 转成块映射：保证第 0 页里有完整数据并标脏，再清掉桶里的内联数据，
+ * 之后这一页由块映射回写分配数据块。locked_page 是回写时已锁住的第 0 页，其他调用者传 NULL。
+ */
+int himfs_inline_convert(struct inode *inode, struct page *locked_page)
+{
+	struct page *page = locked_page;
+	int err = 0;
+
+	if (!himfs_is_inline(inode))
+	{
+		return 0;
+	}
+
+	if (!page)
+	{
+		page = find_or_create_page(inode->i_mapping, 0, mapping_gfp_mask(inode->i_mapping) & ~__GFP_FS);
+		if (!page)
+		{
+			return -ENOMEM;
+		}
+	}
+
+	if (!PageUptodate(page))
+	{
+		err = inline_fill_page(inode, page);
+		if (err)
+		{
+			goto out;
+		}
+	}
+
+	/* 从回写路径进来时这一页马上就按块映射写出去，不用再标脏 */
+	err = hash_inline_clear(inode);
+	if (!err && !locked_page && i_size_read(inode))
+	{
+		set_page_dirty(page);
+	}
+
+out:
+	if (!locked_page)
+	{
+		unlock_page(page);
+		put_page(page);
+	}
+	return err;
+}
+
+int himfs_inline_writepage(struct page *page, struct writeback_control *wbc)
+{
+	struct inode *inode = page->mapping->host;
+	loff_t size = i_size_read(inode);
+	void *kaddr;
+	int err;
+
+	if (page->index != 0 || size > HIMFS_INLINE_MAX)
+	{
+		goto convert;
+	}
+
+	kaddr = kmap(page);
+	err = hash_inline_write(inode, kaddr, size);
+	kunmap(page);
+
+	if (err == -ENOSPC)
+	{
+		goto convert;
+	}
+	if (err)
+	{
+		redirty_page_for_writepage(wbc, page);
+		unlock_page(page);
+		return err;
+	}
+
+	set_page_writeback(page);
+	unlock_page(page);
+	end_page_writeback(page);
+	return 0;
+
+convert:
+	/* 桶里放不下了，交回调用者走块映射回写 */
+	err = himfs_inline_convert(inode, page);
+	if (err)
+	{
+		redirty_page_for_writepage(wbc, page);
+		unlock_page(page);
+		return err;
+	}
+
+	return 1;
+}
+
+/* 截短内联文件：新长度之后的数据丢掉；变长时不用改桶，读出时超出部分补 0 */
+int himfs_inline_truncate(struct inode *inode, loff_t size)
+{
+	char *buf;
+	int len, err;
+
+	buf = kmalloc(HIMFS_INLINE_MAX, GFP_NOFS);
+	if (!buf)
+	{
+		return -ENOMEM;
+	}
+
+	len = hash_inline_read(inode, buf, HIMFS_INLINE_MAX);
+	err = len < 0 ? len : 0;
+	if (len > size)
+	{
+		err = hash_inline_write(inode, buf, size);
+	}
+	kfree(buf);
+
+	return err;
+}
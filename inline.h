@@ -0,0 +1,11 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#endif
+
+int himfs_inline_readpage(struct inode *inode, struct page *page);
+int himfs_inline_write_begin(struct address_space *mapping, loff_t pos, unsigned len,
+			     unsigned flags, struct page **pagep);
+int himfs_inline_writepage(struct page *page, struct writeback_control *wbc);
+int himfs_inline_convert(struct inode *inode, struct page *locked_page);
+int himfs_inline_truncate(struct inode *inode, loff_t size);
@@ -4,11 +4,20 @@
 #include <linux/blk_types.h>
 #include <linux/namei.h>
 #include <linux/backing-dev.h>
+#include <linux/iomap.h>
 
 #ifndef _TEST_H_
 #define _TEST_H_
 #include "himfs_d.h"
 #include "hash.h"
+#include "extent.h"
+#include "inline.h"
+#include "journal.h"
+#include "grave.h"
+#include "stats.h"
+#include "hint.h"
+#include "bcache.h"
+#include "himfs_trace.h"
 #endif
 
 extern struct inode *himfs_get_inode(struct super_block *sb, int mode, dev_t dev);
@@ -16,12 +25,11 @@ extern struct inode *himfs_get_inode(struct super_block *sb, int mode, dev_t dev
 #include <linux/atomic.h>
 #include <linux/time.h>
 
-static void update_dir(struct inode *inode, struct inode *dir, bool is_create)
+/* 父目录子项数加减一，时间戳推进到 atomic_update（秒） */
+static void __update_dir(struct inode *inode, struct inode *dir, bool is_create, uint64_t atomic_update)
 {
     uint64_t atomic_cur;
-    uint64_t atomic_update;
     bool success;
-    struct himfs_inode_info *hii = HIMFS_I(inode);
     atomic_t *dir_size = (atomic_t *)&(dir->i_size);
 
     // 更新目录大小
@@ -34,9 +42,6 @@ static void update_dir(struct inode *inode, struct inode *dir, bool is_create)
         atomic_dec(dir_size);
     }
 
-    // 设置更新时间
-    atomic_update = is_create ? hii->i_crtime : hii->i_detime;
-
     // 更新 i_ctime
     do {
         atomic64_t *atomic_ptr = (atomic64_t *)&(dir->i_ctime.tv_sec);
@@ -66,10 +71,18 @@ static void update_dir(struct inode *inode, struct inode *dir, bool is_create)
         success = atomic64_cmpxchg(atomic_ptr, atomic_cur, atomic_update) == atomic_cur;
     } while (!success);
 
-    // 标记 inode 为脏
-    mark_inode_dirty(dir);
 out:
-    return;
+    // 目录大小总是变了，时间戳没前进也要记下；父目录的桶由 grave 批量写回
+    himfs_grave_add(dir);
+    trace_himfs_update_dir(inode, dir, is_create);
+}
+
+static void update_dir(struct inode *inode, struct inode *dir, bool is_create)
+{
+    struct himfs_inode_info *hii = HIMFS_I(inode);
+
+    // 设置更新时间
+    __update_dir(inode, dir, is_create, is_create ? hii->i_crtime : hii->i_detime);
 }
 
 //调用具体文件系统的lookup函数找到当前分量的inode，并将inode与传进来的dentry关联（通过d_splice_alias()->__d_add）
@@ -81,30 +94,32 @@ static struct dentry *himfs_lookup(struct inode *dir, struct dentry *dentry, uns
 	struct inode *inode;
 	unsigned long ino = 0;
 	struct buffer_head *bh;
-	struct himfs_meta_block* meta_block;
-	struct himfs_inode *him_inode;
-	struct himfs_inode_info *hii = HIMFS_I(inode);
-	struct himfs_sb_info *himfs_sb = dir->i_sb->s_fs_info;
-	int idx;
+	struct himfs_inode core;
+	struct himfs_inode *him_inode = &core;
+	struct himfs_inode_info *hii;
+	u64 t0 = himfs_lat_start();
+	uint32_t hash;
+	char *link;
+	int len;
 
 	if (dentry->d_name.len > HIMFS_MAX_FILENAME_LEN)
 	{
-		goto out;
+		return ERR_PTR(-ENAMETOOLONG);
 	}
 
-	bh = hash_get(dir, dentry, &idx);
-		
+	himfs_stat_inc(dir->i_sb, HIMFS_STAT_LOOKUP);
+	/* 冷路径上把猜到的后面几级分量的桶先发出去，和下面这次读重叠 */
+	hash = himfs_hint_prefetch(dir, &dentry->d_name);
+
 	/* 子目录树和子文件中均没找到，说明没有这个子文件/目录 */
-	if(bh == NULL) 
+	if (!hash_lookup(dir, &dentry->d_name, &core))
 	{ 
+		himfs_stat_inc(dir->i_sb, HIMFS_STAT_LOOKUP_MISS);
 		inode = NULL;
 		//printk(KERN_INFO "inode is NULL\n");
 		goto out;
 	}
 
-	meta_block = (struct himfs_meta_block*)bh->b_data;
-	him_inode = &(meta_block->himfs_inode[idx]);
-
 	inode = iget_locked(dir->i_sb, him_inode->i_ino);
 	if (!inode)
 	{
@@ -117,6 +132,34 @@ static struct dentry *himfs_lookup(struct inode *dir, struct dentry *dentry, uns
 		//printk(KERN_INFO "himfs: new inode OK\n");
 		goto out;
 	}
+
+	/* 改过名的 inode：找到的是别名槽，属性、extent 和内联数据都在本体槽里 */
+	if (him_inode->i_flags & HIMFS_INODE_ALIAS)
+	{
+		ino = him_inode->i_ino;
+		if (!himfs_bcache_core(dir->i_sb, ino, &core))
+		{
+			bh = sb_bread(dir->i_sb, ino >> HASH_SLOT_BITS);
+			if (unlikely(!bh))
+			{
+				iget_failed(inode);
+				return ERR_PTR(-EIO);
+			}
+			hash_lock_bucket(dir->i_sb, bh->b_blocknr);
+			core = ((struct himfs_meta_block *)bh->b_data)->himfs_inode[ino & (HASH_SLOT_NUM - 1)];
+			hash_unlock_bucket(dir->i_sb, bh->b_blocknr);
+			brelse(bh);
+		}
+
+		if (him_inode->i_ino != ino || (him_inode->i_flags & HIMFS_INODE_ALIAS))
+		{
+			printk(KERN_ERR "himfs: alias in dir %lu points to stale slot %lu\n", dir->i_ino, ino);
+			iget_failed(inode);
+			return ERR_PTR(-EIO);
+		}
+	}
+
+	hii = HIMFS_I(inode);
 	
 	// 用盘内inode赋值inode操作
 	inode->i_sb = dir->i_sb;
@@ -126,6 +169,9 @@ static struct dentry *himfs_lookup(struct inode *dir, struct dentry *dentry, uns
 	inode->i_gid = make_kgid(&init_user_ns, him_inode->i_gid);													/* Low 16 bits of Group Id */
 	inode->i_size = him_inode->i_size;												//文件的大小（byte）
 	hii->i_crtime = him_inode->i_crtime;		
+	hii->i_dlog_end = him_inode->i_dlog_end;
+	hii->i_flags = him_inode->i_flags;
+	himfs_ext_load(inode, him_inode);
 	struct timespec64 mtime, ctime;
 	mtime.tv_sec = him_inode->i_mtime;
 	mtime.tv_nsec = 0;  // 纳秒部分设为 0
@@ -144,54 +190,180 @@ static struct dentry *himfs_lookup(struct inode *dir, struct dentry *dentry, uns
 		//printk(KERN_INFO "file inode\n");
 		inode->i_op = &himfs_file_inode_ops;
 		inode->i_fop = &himfs_file_file_ops;
-		inode->i_mapping->a_ops = &himfs_aops;
+		inode->i_mapping->a_ops = &himfs_file_aops;
 		break;
 	case S_IFDIR: /* directory 目录文件*/
 
 		inode->i_op = &himfs_dir_inode_ops;
 		inode->i_fop = &himfs_dir_operations;
 		inode->i_mapping->a_ops = &himfs_aops;
-		inc_nlink(inode); // i_nlink是文件硬链接数,目录是由至少2个dentry指向的：./和../，所以是2；这里只加1，外层再加1
+		break;
+	case S_IFLNK:
+		if (hii->i_flags & HIMFS_INODE_INLINE)
+		{
+			/* 快速符号链接：目标在桶的名字堆里，桶缓存的副本不带内联数据，从桶里读 */
+			link = kmalloc(HIMFS_INLINE_MAX + 1, GFP_NOFS);
+			len = link ? hash_inline_read(inode, link, HIMFS_INLINE_MAX) : -ENOMEM;
+			if (len < 0)
+			{
+				kfree(link);
+				iget_failed(inode);
+				return ERR_PTR(len);
+			}
+			link[len] = '\0';
+			inode->i_link = link;
+			inode->i_op = &simple_symlink_inode_operations;
+		}
+		else
+		{
+			inode->i_op = &page_symlink_inode_operations;
+			inode_nohighmem(inode);
+		}
 		break;
 	default:
 		break;
 	}
 
-	inc_nlink(inode);		
+	/* 没有硬链接计数，目录 2 个（. 和父目录里的项），其他 1 个；回收时据此判断是否已删除 */
+	set_nlink(inode, S_ISDIR(inode->i_mode) ? 2 : 1);
+
+	if (S_ISDIR(inode->i_mode) && (hii->i_flags & HIMFS_INODE_GRAVE) && himfs_grave_recover(inode))
+	{
+		iget_failed(inode);
+		return ERR_PTR(-EIO);
+	}
 	unlock_new_inode(inode);
-	brelse(bh);
 out:
+	if (inode)
+	{
+		himfs_hint_add(dir, hash, inode->i_ino);
+	}
+	himfs_lat_end(dir->i_sb, HIMFS_LAT_LOOKUP, t0);
 	return d_splice_alias(inode, dentry);//将inode与dentry绑定
 }
 
-static int himfs_mknod(struct inode *dir, struct dentry *dentry, umode_t mode, dev_t dev)
+/* 分配 inode 并放进父目录，还没有和 dentry 关联 */
+static int himfs_new_node(struct inode *dir, struct dentry *dentry, umode_t mode, dev_t dev,
+			  struct inode **inodep)
 {
-	struct inode *inode = himfs_get_inode(dir->i_sb, mode, dev); //分配VFS inode
-	int error = -ENOSPC;
+	struct inode *inode;
+	struct inode_context ctx;
 
-	if (dentry->d_name.len >= HIMFS_MAX_FILENAME_LEN) 
+	if (dentry->d_name.len > HIMFS_MAX_FILENAME_LEN) 
 	{
 		printk("file name len error\n");
-		return error;
+		return -ENAMETOOLONG;
 	}
 
+	inode = himfs_get_inode(dir->i_sb, mode, dev); //分配VFS inode
+
 	inode->i_ino = 0;
 	inode->i_ino = hash_insert(inode, dir, dentry, mode);
 
-	if (inode->i_ino != 0)
+	if (inode->i_ino == 0)
+	{
+		iput(inode);
+		return -ENOSPC;
+	}
+
+	/* 槽在最后一次 iput 前不会释放，同一个 ino 还在内存里说明桶坏了，不能再挂一个进去 */
+	if (insert_inode_locked(inode))
+	{
+		printk(KERN_ERR "himfs: inode %lu is still in use, bucket corrupted?\n", inode->i_ino);
+		ctx.is_delete = true;
+		ctx.inode = inode;
+		hash_update(dir, dentry, &ctx);
+		clear_nlink(inode);
+		iput(inode);
+		return -EIO;
+	}
+	unlock_new_inode(inode);
+	*inodep = inode;
+
+	return 0;
+}
+
+static int himfs_mknod(struct inode *dir, struct dentry *dentry, umode_t mode, dev_t dev)
+{
+	struct inode *inode;
+	struct himfs_handle handle;
+	u64 t0 = himfs_lat_start();
+	int error;
+
+	himfs_journal_start(dir->i_sb, HIMFS_JOP_CREATE, &handle);
+	error = himfs_new_node(dir, dentry, mode, dev, &inode);
+	if (!error)
 	{
-		error = 0;
-		insert_inode_locked(inode);//将inode添加到inode hash表中，并标记为I_NEW
-		unlock_new_inode(inode);
 		d_instantiate(dentry, inode);//将dentry和新创建的inode进行关联
 		update_dir(inode, dir, true);
+		himfs_journal_note(inode);
+		himfs_hint_create(dir, &dentry->d_name, inode->i_ino);
+	}
+	himfs_journal_stop(&handle);
+	himfs_lat_end(dir->i_sb, HIMFS_LAT_MKNOD, t0);
+
+	return error;
+}
+
+/* 短的目标直接存在桶里（快速符号链接），长的走 page cache 和数据块 */
+static int himfs_symlink(struct inode *dir, struct dentry *dentry, const char *symname)
+{
+	struct inode *inode;
+	struct inode_context ctx;
+	struct himfs_handle handle;
+	int len = strlen(symname);
+	char *link = NULL;
+	int err;
+
+	if (len + 1 > PAGE_SIZE)
+	{
+		return -ENAMETOOLONG;
+	}
+
+	himfs_journal_start(dir->i_sb, HIMFS_JOP_CREATE, &handle);
+	err = himfs_new_node(dir, dentry, S_IFLNK | S_IRWXUGO, 0, &inode);
+	if (err)
+	{
+		goto out;
+	}
+
+	if (len <= HIMFS_INLINE_MAX)
+	{
+		link = kmemdup(symname, len + 1, GFP_KERNEL);
+	}
+
+	if (link && !hash_inline_write(inode, symname, len))
+	{
+		inode->i_link = link;
+		inode->i_op = &simple_symlink_inode_operations;
+		i_size_write(inode, len);
 	}
 	else
 	{
-		iput(inode);
+		kfree(link);
+		err = hash_inline_clear(inode);
+		if (!err)
+		{
+			err = page_symlink(inode, symname, len + 1);
+		}
+		if (err)
+		{
+			ctx.is_delete = true;
+			ctx.inode = inode;
+			hash_update(dir, dentry, &ctx);
+			clear_nlink(inode);
+			iput(inode);
+			goto out;
+		}
 	}
 
-	return error;
+	mark_inode_dirty(inode);
+	d_instantiate(dentry, inode);
+	update_dir(inode, dir, true);
+
+out:
+	himfs_journal_stop(&handle);
+	return err;
 }
 
 static int himfs_create(struct inode *dir, struct dentry *dentry, umode_t mode, bool excl)
@@ -221,20 +393,29 @@ static int himfs_unlink(struct inode *dir, struct dentry *dentry)
 {
 	struct inode *inode = dentry->d_inode;
 	struct inode_context ctx;
+	struct himfs_handle handle;
+	u64 t0 = himfs_lat_start();
 	int err = 0;
 
+	himfs_stat_inc(dir->i_sb, HIMFS_STAT_UNLINK);
 	ctx.is_delete = true;
 	ctx.inode = inode;
-	err = hash_update(dir, dentry, &ctx);
-	if (err) 
+	himfs_journal_start(dir->i_sb, HIMFS_JOP_UNLINK, &handle);
+	if (!hash_update(dir, dentry, &ctx)) 
 	{
 		printk("unlink failed\n");
+		himfs_journal_stop(&handle);
+		return -ENOENT;
 	}
 
+	/* 名字摘掉了，槽标成孤儿；链接数归零后，最后一次 iput 回收 inode 时释放数据块和槽 */
+	drop_nlink(inode);
 	update_dir(inode, dir, false);
-	iput(inode);
+	himfs_journal_note(inode);
+	himfs_journal_stop(&handle);
+	himfs_lat_end(dir->i_sb, HIMFS_LAT_UNLINK, t0);
 
-	return -1;
+	return err;
 }
 
 static int himfs_rmdir(struct inode *dir, struct dentry *dentry)
@@ -243,35 +424,159 @@ static int himfs_rmdir(struct inode *dir, struct dentry *dentry)
 	// struct inode * pinode = d_inode(dentry->d_parent);
 	int err = -ENOTEMPTY;
 	struct himfs_sb_info *himfs_sb_i = HIMFS_SB(dir->i_sb);
+	struct himfs_handle handle;
 	//sector_t meta_start, meta_size, data_start, data_size;
 	
 	if(!i_size_read(inode))
 	{
+		himfs_journal_start(dir->i_sb, HIMFS_JOP_UNLINK, &handle);
 		err = himfs_unlink(dir, dentry);
 		if(!err)
 		{
 			inode->i_size = 0;
-			inode_dec_link_count(inode);
-			inode_dec_link_count(dir);
+			clear_nlink(inode);
+			drop_nlink(dir);    /* 链接数不落盘，不用标脏 */
 		}
-		return 0;
+		himfs_journal_stop(&handle);
+		return err;
 	}
 	return err;
 }
 
+/*
+ * 改名只动名字：新名字放进一个指向本体的别名槽，旧名字摘掉（旧名字在本体槽里时只标 RENAMED），
+ * ino 不变，数据和子目录里的子项都不用动，不管文件多大、目录多少子项都只写两三个桶。
+ * 先放新名字，放不下就直接失败，已存在的目标这时还没动；放好之后才删目标、摘旧名字，
+ * 删目标按 ino 找槽，不会摘到刚放的别名。整个过程在一个句柄里。
+ */
 static int himfs_rename(struct inode * old_dir, struct dentry * old_dentry,
 			struct inode * new_dir,	struct dentry * new_dentry,
 			unsigned int flags)
 {
 	struct inode * old_inode = d_inode(old_dentry);
 	struct inode * new_inode = d_inode(new_dentry);
+	struct himfs_handle handle;
+	uint64_t now;
 	int err = 0;
 
+	if (flags & ~RENAME_NOREPLACE)
+	{
+		return -EINVAL;
+	}
+
+	if (new_dentry->d_name.len > HIMFS_MAX_FILENAME_LEN)
+	{
+		return -ENAMETOOLONG;
+	}
+
+	/* 目标是目录时要求为空，在改动任何东西之前查 */
+	if (new_inode && S_ISDIR(new_inode->i_mode) && i_size_read(new_inode))
+	{
+		return -ENOTEMPTY;
+	}
+
+	himfs_journal_start(old_dir->i_sb, HIMFS_JOP_RENAME, &handle);
+
+	if (!hash_alias(old_inode, new_dir, new_dentry))
+	{
+		err = -ENOSPC;
+		goto out;
+	}
+
+	if (new_inode)
+	{
+		err = S_ISDIR(new_inode->i_mode) ? himfs_rmdir(new_dir, new_dentry) :
+			himfs_unlink(new_dir, new_dentry);
+		if (err)
+		{
+			printk(KERN_ERR "himfs: rename could not remove target %lu\n", new_inode->i_ino);
+			goto out;
+		}
+	}
+
+	if (!hash_rename_away(old_dir, old_dentry))
+	{
+		printk(KERN_ERR "himfs: rename lost old name of %lu\n", old_inode->i_ino);
+		err = -EIO;
+		goto out;
+	}
+
+	if (S_ISDIR(old_inode->i_mode) && old_dir != new_dir)
+	{
+		drop_nlink(old_dir);    /* 链接数不落盘，不用标脏 */
+		inc_nlink(new_dir);
+	}
+
+	now = ktime_get_real_seconds();
+	__update_dir(old_inode, old_dir, false, now);
+	__update_dir(old_inode, new_dir, true, now);
+	old_inode->i_ctime = current_time(old_inode);
+	mark_inode_dirty(old_inode);
+	himfs_journal_note(old_inode);
+
+out:
+	himfs_journal_stop(&handle);
 	return err;
 }
 
+/* 截短时释放新末尾之后的块，其余属性交给通用实现 */
+static int himfs_setattr(struct dentry *dentry, struct iattr *attr)
+{
+	struct inode *inode = d_inode(dentry);
+	struct himfs_handle handle;
+	int err;
+
+	err = setattr_prepare(dentry, attr);
+	if (err)
+	{
+		return err;
+	}
+
+	/* 内联文件变长到放不下时先转成块映射，否则只需截掉桶里多余的数据 */
+	if ((attr->ia_valid & ATTR_SIZE) && himfs_is_inline(inode))
+	{
+		err = attr->ia_size > HIMFS_INLINE_MAX ? himfs_inline_convert(inode, NULL) :
+			himfs_inline_truncate(inode, attr->ia_size);
+		if (err)
+		{
+			return err;
+		}
+		if (himfs_is_inline(inode))
+		{
+			truncate_setsize(inode, attr->ia_size);
+		}
+	}
+
+	if ((attr->ia_valid & ATTR_SIZE) && attr->ia_size != i_size_read(inode))
+	{
+		loff_t old_size = i_size_read(inode);
+
+		inode_dio_wait(inode);
+		err = iomap_truncate_page(inode, attr->ia_size, NULL, &himfs_iomap_ops);
+		if (err)
+		{
+			return err;
+		}
+		truncate_setsize(inode, attr->ia_size);
+		/* 变长时原来末尾之后追加多分的块会落进文件里，盘上是旧内容，先还回去 */
+		if (attr->ia_size > old_size)
+		{
+			himfs_ext_trim(inode, DIV_ROUND_UP(old_size, 1 << BLOCK_SHIFT));
+		}
+		himfs_ext_truncate(inode, DIV_ROUND_UP(attr->ia_size, 1 << BLOCK_SHIFT));
+	}
+
+	/* 显式改属性不留给回写，和 truncate 一样马上进日志 */
+	himfs_journal_start(inode->i_sb, HIMFS_JOP_ATTR, &handle);
+	setattr_copy(inode, attr);
+	mark_inode_dirty(inode);
+	himfs_journal_stop(&handle);
+
+	return 0;
+}
+
 struct inode_operations himfs_file_inode_ops = {
-    .setattr	= simple_setattr,
+    .setattr	= himfs_setattr,
 	.getattr	= simple_getattr,
 };
 
@@ -280,7 +585,7 @@ struct inode_operations himfs_dir_inode_ops = {
 	.lookup         = himfs_lookup,
 	.link			= simple_link,
 	.unlink         = himfs_unlink,
-	//.symlink		= himfs_symlik,
+	.symlink		= himfs_symlink,
 	.mkdir          = himfs_mkdir,
 	.rmdir          = himfs_rmdir,
 	.mknod          = himfs_mknod,	//该函数由系统调用mknod（）调用，创建特殊文件（设备文件、命名管道或套接字）。要创建的文件放在dir目录中，其目录项为dentry，关联的设备为rdev，初始权限由mode指定。
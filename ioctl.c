@@ -0,0 +1,333 @@
+#include <linux/fs.h>
+#include <linux/mount.h>
+#include <linux/namei.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
+#include <linux/capability.h>
+#include <linux/blkdev.h>
+#include <linux/buffer_head.h>
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#include "himfs_ioctl.h"
+#include "hash.h"
+#include "fpindex.h"
+#include "journal.h"
+#include "stats.h"
+#include "warmup.h"
+#include "discard.h"
+#include "ioctl.h"
+#endif
+
+struct bulk_item
+{
+	lba_t lba;              /* 家桶，0 表示这一项已经失败 */
+	uint32_t idx;           /* 在用户数组里的下标 */
+};
+
+static int bulk_cmp(const void *a, const void *b)
+{
+	const struct bulk_item *x = a, *y = b;
+
+	if (x->lba != y->lba)
+	{
+		return x->lba < y->lba ? -1 : 1;
+	}
+	return x->idx < y->idx ? -1 : (x->idx > y->idx);
+}
+
+static int bulk_check(struct himfs_bulk_entry *e, uint32_t names_len)
+{
+	umode_t type = e->mode & S_IFMT;
+
+	if (!e->name_len || e->name_len > HIMFS_MAX_FILENAME_LEN ||
+	    e->name_off > names_len || e->name_len > names_len - e->name_off)
+	{
+		return -EINVAL;
+	}
+	if (type && type != S_IFREG && type != S_IFDIR)
+	{
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* 名字的合法性、目录的写权限和重名都交给 lookup_one_len 和 vfs_create/vfs_mkdir 检查 */
+static int bulk_create_one(struct inode *dir, struct dentry *parent, const char *name, int len,
+			   umode_t mode, uint32_t *ino)
+{
+	struct dentry *dentry;
+	int err;
+
+	dentry = lookup_one_len(name, parent, len);
+	if (IS_ERR(dentry))
+	{
+		return PTR_ERR(dentry);
+	}
+
+	if (d_really_is_positive(dentry))
+	{
+		err = -EEXIST;
+	}
+	else if (S_ISDIR(mode))
+	{
+		err = vfs_mkdir(dir, dentry, mode);
+	}
+	else
+	{
+		err = vfs_create(dir, dentry, mode, true);
+	}
+
+	if (!err)
+	{
+		*ino = d_inode(dentry)->i_ino;
+	}
+	dput(dentry);
+
+	return err;
+}
+
+/*
+ * 逐个 creat 时每个文件都要同步读一次随机的家桶。这里先把整批名字的家桶算出来排好序，
+ * 在一个 plug 里全部发出预读，相邻的桶合并成大请求，设备上同时有很多读在飞；
+ * 之后按桶的顺序创建，查找和插入基本都命中缓存。同一个桶上的创建挨在一起，
+ * 落在同一个事务里，桶在内存里改多次，回写和检查点时只写一次。
+ */
+static long himfs_ioc_bulk_create(struct file *filp, struct himfs_bulk_create __user *uarg)
+{
+	struct inode *dir = file_inode(filp);
+	struct dentry *parent = filp->f_path.dentry;
+	struct super_block *sb = dir->i_sb;
+	struct himfs_bulk_create req;
+	struct himfs_bulk_entry *ents = NULL;
+	struct himfs_bulk_entry *e;
+	struct bulk_item *items = NULL;
+	struct blk_plug plug;
+	char *names = NULL;
+	bool indexed;
+	uint32_t created = 0;
+	uint32_t i, k;
+	lba_t prev;
+	long err;
+
+	if (copy_from_user(&req, uarg, sizeof(req)))
+	{
+		return -EFAULT;
+	}
+	if (req.flags || !req.count || req.count > HIMFS_BULK_MAX ||
+	    req.names_len > HIMFS_BULK_MAX * (HIMFS_MAX_FILENAME_LEN + 1))
+	{
+		return -EINVAL;
+	}
+
+	ents = kvmalloc_array(req.count, sizeof(*ents), GFP_KERNEL);
+	items = kvmalloc_array(req.count, sizeof(*items), GFP_KERNEL);
+	names = kvmalloc(req.names_len ? req.names_len : 1, GFP_KERNEL);
+	if (!ents || !items || !names)
+	{
+		err = -ENOMEM;
+		goto out_free;
+	}
+	if (copy_from_user(ents, u64_to_user_ptr(req.entries), req.count * sizeof(*ents)) ||
+	    copy_from_user(names, u64_to_user_ptr(req.names), req.names_len))
+	{
+		err = -EFAULT;
+		goto out_free;
+	}
+
+	err = mnt_want_write_file(filp);
+	if (err)
+	{
+		goto out_free;
+	}
+
+	for (i = 0; i < req.count; ++i)
+	{
+		e = &ents[i];
+		e->ino = 0;
+		e->status = bulk_check(e, req.names_len);
+		items[i].idx = i;
+		items[i].lba = e->status ? 0 : hash_home_lba(dir, names + e->name_off, e->name_len);
+	}
+	sort(items, req.count, sizeof(*items), bulk_cmp, NULL);
+
+	inode_lock_nested(dir, I_MUTEX_PARENT);
+
+	/* 索引显示已满的桶插入时会跳过，查找也多半被指纹挡掉，不必预读 */
+	indexed = himfs_fpindex_ready(sb);
+	prev = 0;
+	blk_start_plug(&plug);
+	for (i = 0; i < req.count; ++i)
+	{
+		if (!items[i].lba || items[i].lba == prev)
+		{
+			continue;
+		}
+		prev = items[i].lba;
+		if (indexed && himfs_fpindex_free(sb, prev) == 0)
+		{
+			continue;
+		}
+		sb_breadahead(sb, prev);
+		himfs_stat_inc(sb, HIMFS_STAT_BULK_PREFETCH);
+	}
+	blk_finish_plug(&plug);
+
+	/*
+	 * 每个创建在 himfs_mknod 自己的句柄里：插入整理名字堆时整个桶进日志，建目录还要记子项日志，
+	 * 几个创建合用一个句柄会超出 JNL_HANDLE_RESERVE。句柄都落在同一个运行中的事务里，
+	 * 同一个桶的多次修改照样在提交和检查点时只写一次。
+	 */
+	for (i = 0; i < req.count; ++i)
+	{
+		umode_t mode;
+
+		if (fatal_signal_pending(current))
+		{
+			for (k = i; k < req.count; ++k)
+			{
+				e = &ents[items[k].idx];
+				if (!e->status)
+				{
+					e->status = -EINTR;
+				}
+			}
+			break;
+		}
+
+		e = &ents[items[i].idx];
+		if (e->status)
+		{
+			continue;
+		}
+
+		mode = e->mode & ~S_IFMT;
+		if (!IS_POSIXACL(dir))
+		{
+			mode &= ~current_umask();
+		}
+		mode |= (e->mode & S_IFMT) ? (e->mode & S_IFMT) : S_IFREG;
+
+		e->status = bulk_create_one(dir, parent, names + e->name_off, e->name_len, mode, &e->ino);
+		if (!e->status)
+		{
+			++created;
+		}
+		cond_resched();
+	}
+
+	inode_unlock(dir);
+	mnt_drop_write_file(filp);
+	himfs_stat_add(sb, HIMFS_STAT_BULK_CREATE, created);
+
+	err = 0;
+	if (copy_to_user(u64_to_user_ptr(req.entries), ents, req.count * sizeof(*ents)) ||
+	    put_user(created, &uarg->created))
+	{
+		err = -EFAULT;
+	}
+
+out_free:
+	kvfree(names);
+	kvfree(items);
+	kvfree(ents);
+	return err;
+}
+
+/* 启动、停止或者查询预热，每次都把当前进度写回去 */
+static long himfs_ioc_warmup(struct file *filp, struct himfs_warmup_ctl __user *uarg)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct himfs_warmup_ctl ctl;
+	long err = 0;
+
+	if (copy_from_user(&ctl, uarg, sizeof(ctl)))
+	{
+		return -EFAULT;
+	}
+
+	switch (ctl.op)
+	{
+	case HIMFS_WARMUP_STATUS:
+		break;
+	case HIMFS_WARMUP_START:
+		if (!capable(CAP_SYS_ADMIN))
+		{
+			return -EPERM;
+		}
+		if (ctl.threads > HIMFS_WARMUP_THREADS_MAX)
+		{
+			return -EINVAL;
+		}
+		err = himfs_warmup_start(sb, ctl.threads, ctl.mbps);
+		break;
+	case HIMFS_WARMUP_STOP:
+		if (!capable(CAP_SYS_ADMIN))
+		{
+			return -EPERM;
+		}
+		himfs_warmup_stop(sb);
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (err)
+	{
+		return err;
+	}
+
+	himfs_warmup_status(sb, &ctl);
+	return copy_to_user(uarg, &ctl, sizeof(ctl)) ? -EFAULT : 0;
+}
+
+/* 批量 discard 数据区的空闲块，minlen 不小于设备的 discard 粒度 */
+static long himfs_ioc_fitrim(struct file *filp, struct fstrim_range __user *uarg)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct request_queue *q = bdev_get_queue(sb->s_bdev);
+	struct fstrim_range range;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+	{
+		return -EPERM;
+	}
+	if (!blk_queue_discard(q))
+	{
+		return -EOPNOTSUPP;
+	}
+	if (copy_from_user(&range, uarg, sizeof(range)))
+	{
+		return -EFAULT;
+	}
+
+	range.minlen = max_t(u64, range.minlen, q->limits.discard_granularity);
+	err = himfs_discard_trim(sb, &range);
+	if (err)
+	{
+		return err;
+	}
+
+	return copy_to_user(uarg, &range, sizeof(range)) ? -EFAULT : 0;
+}
+
+long himfs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	switch (cmd)
+	{
+	case HIMFS_IOC_BULK_CREATE:
+		if (!S_ISDIR(file_inode(filp)->i_mode))
+		{
+			return -ENOTDIR;
+		}
+		return himfs_ioc_bulk_create(filp, (struct himfs_bulk_create __user *)arg);
+	case HIMFS_IOC_WARMUP:
+		return himfs_ioc_warmup(filp, (struct himfs_warmup_ctl __user *)arg);
+	case FITRIM:
+		return himfs_ioc_fitrim(filp, (struct fstrim_range __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
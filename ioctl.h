@@ -0,0 +1,6 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#endif
+
+long himfs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
@@ -0,0 +1,1062 @@
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/crc32c.h>
+#include <linux/pagemap.h>
+#include <linux/sched/mm.h>
+#include <linux/workqueue.h>
+#include <linux/buffer_head.h>
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#include "journal.h"
+#include "bcache.h"
+#endif
+
+/*
+ * 元数据日志：改元数据块的地方调 himfs_journal_dirty() 把改动的字节段追加到运行事务。
+ * 块本身不标脏，块设备回写碰不到它：第一次记日志时给 bh 挂一个 himfs_jbuf 钉住，
+ * 并挂到运行事务的链表上。提交线程在 j_barrier 写锁下（没有句柄在改块）把事务里
+ * 每个块的内容拷进 jbuf 的冻结页，再换下运行事务，连同事务头一次顺序写入日志区
+ * （PREFLUSH|FUA），所以同一时间等待的多个 fsync 共用一次日志写和一次 flush。
+ * 日志区过半、钉住的块太多或隔一段时间就做检查点：只把冻结页写回原位，然后推进日志尾，
+ * 之后没再被改过的块就放开。原位上因此只会有已提交的内容。
+ * 挂载时从日志尾开始按 tid 顺序重放完整的事务。
+ */
+
+#define JNL_TXN_PAGES 256                   /* 一个事务最多 1 MiB，一个 bio 写完 */
+#define JNL_TXN_BYTES (JNL_TXN_PAGES << PAGE_SHIFT)
+#define JNL_HANDLE_RESERVE 8192             /* 每个句柄预留的事务空间，远大于一次创建或删除 */
+#define JNL_REC_START ALIGN(sizeof(struct himfs_journal_header), 8)
+#define JNL_COMMIT_INTERVAL (5 * HZ)
+#define JNL_CHECKPOINT_INTERVAL (30 * HZ)
+#define JNL_PINNED_MAX 8192                 /* 钉住的块超过这么多就催提交和检查点，每块多一页冻结副本 */
+
+/* 记过日志、还没检查点的元数据块，挂在 bh->b_private 上，持有 bh 的一个引用 */
+struct himfs_jbuf
+{
+	struct buffer_head *jb_bh;
+	struct page *jb_frozen;             /* 最近一次提交时的内容，检查点只写它 */
+	uint64_t jb_tid;                    /* 最后改它的事务 */
+	uint64_t jb_frozen_tid;             /* jb_frozen 对应的事务，0 表示还没冻结过 */
+	struct list_head jb_txn;            /* 挂在改它的运行事务的 t_bufs 上 */
+	struct list_head jb_ckpt;           /* 有冻结内容等检查点时挂在 j_ckpt 上 */
+};
+
+struct himfs_txn
+{
+	uint64_t t_tid;
+	struct page **t_pages;
+	uint32_t t_used;                /* 含事务头 */
+	uint32_t t_reserved;            /* 正在运行的句柄预留的字节数 */
+	uint32_t t_nr_recs;
+	bool t_overflow;                /* 记录放不下了，提交时改成整体检查点 */
+	struct list_head t_bufs;        /* 这个事务改过的块 */
+};
+
+struct himfs_journal
+{
+	struct super_block *j_sb;
+	lba_t j_start;
+	uint32_t j_blocks;
+	struct buffer_head *j_sbh;          /* 日志超级块，挂载期间一直持有 */
+	struct rw_semaphore j_barrier;      /* 句柄持读锁，换运行事务时持写锁 */
+	spinlock_t j_lock;                  /* 保护运行事务的空间分配 */
+	struct himfs_txn j_txn[2];
+	struct himfs_txn *j_running;
+	uint64_t j_committed;               /* 已经落盘的最大 tid */
+	uint64_t j_tail_tid;                /* 日志尾，之前的事务都已经检查点 */
+	bool j_ckpt_wanted;                 /* himfs_journal_flush 在等检查点 */
+	int j_err;
+	uint32_t j_head;                    /* 下一个事务写到日志区的块号 */
+	uint32_t j_used;                    /* 日志尾到头占用的块数，含绕回时跳过的 */
+	unsigned long j_checkpointed;
+	struct list_head j_ckpt;            /* 有冻结内容的 jbuf，只在提交线程里动 */
+	unsigned long j_nr_bufs;            /* 钉住的块数，j_lock 保护 */
+	atomic_t j_flush_started;           /* 已发出的 flush 序号 */
+	atomic_t j_flush_done;              /* 已完成的 flush 中最大的序号 */
+	wait_queue_head_t j_wait;
+	struct workqueue_struct *j_wq;
+	struct delayed_work j_work;
+};
+
+static inline struct himfs_journal *JNL(struct super_block *sb)
+{
+	return HIMFS_SB(sb)->journal;
+}
+
+static void txn_copy_to(struct himfs_txn *t, uint32_t pos, const void *src, uint32_t len)
+{
+	uint32_t off, n;
+
+	while (len)
+	{
+		off = pos & ~PAGE_MASK;
+		n = min_t(uint32_t, len, PAGE_SIZE - off);
+		memcpy(page_address(t->t_pages[pos >> PAGE_SHIFT]) + off, src, n);
+		src += n;
+		pos += n;
+		len -= n;
+	}
+}
+
+static void txn_copy_from(struct himfs_txn *t, uint32_t pos, void *dst, uint32_t len)
+{
+	uint32_t off, n;
+
+	while (len)
+	{
+		off = pos & ~PAGE_MASK;
+		n = min_t(uint32_t, len, PAGE_SIZE - off);
+		memcpy(dst, page_address(t->t_pages[pos >> PAGE_SHIFT]) + off, n);
+		dst += n;
+		pos += n;
+		len -= n;
+	}
+}
+
+static uint32_t txn_crc(struct himfs_txn *t, uint32_t len)
+{
+	uint32_t crc = ~0U, n;
+	int i;
+
+	for (i = 0; len; ++i, len -= n)
+	{
+		n = min_t(uint32_t, len, PAGE_SIZE);
+		crc = crc32c(crc, page_address(t->t_pages[i]), n);
+	}
+
+	return crc;
+}
+
+static void txn_reset(struct himfs_txn *t, uint64_t tid)
+{
+	t->t_tid = tid;
+	t->t_used = JNL_REC_START;
+	t->t_reserved = 0;
+	t->t_nr_recs = 0;
+	t->t_overflow = false;
+	INIT_LIST_HEAD(&t->t_bufs);
+}
+
+static void txn_free(struct himfs_txn *t)
+{
+	int i;
+
+	if (!t->t_pages)
+	{
+		return;
+	}
+
+	for (i = 0; i < JNL_TXN_PAGES; ++i)
+	{
+		if (t->t_pages[i])
+		{
+			__free_page(t->t_pages[i]);
+		}
+	}
+	kfree(t->t_pages);
+	t->t_pages = NULL;
+}
+
+static int txn_alloc(struct himfs_txn *t)
+{
+	int i;
+
+	t->t_pages = kcalloc(JNL_TXN_PAGES, sizeof(struct page *), GFP_KERNEL);
+	if (!t->t_pages)
+	{
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < JNL_TXN_PAGES; ++i)
+	{
+		t->t_pages[i] = alloc_page(GFP_KERNEL);
+		if (!t->t_pages[i])
+		{
+			txn_free(t);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static void journal_kick(struct himfs_journal *j)
+{
+	mod_delayed_work(j->j_wq, &j->j_work, 0);
+}
+
+static void journal_flush_done(struct himfs_journal *j, int seq)
+{
+	/* 并发完成时可能记小，只会让 fsync 多发一次 flush */
+	if (seq > atomic_read(&j->j_flush_done))
+	{
+		atomic_set(&j->j_flush_done, seq);
+	}
+}
+
+static int journal_issue_flush(struct himfs_journal *j)
+{
+	int seq = atomic_inc_return(&j->j_flush_started);
+	int err;
+
+	err = blkdev_issue_flush(j->j_sb->s_bdev, GFP_NOFS, NULL);
+	if (!err)
+	{
+		journal_flush_done(j, seq);
+	}
+
+	return err;
+}
+
+static int journal_write_super(struct himfs_journal *j, uint64_t tail_tid, uint32_t tail_blk)
+{
+	struct himfs_journal_super *jsb = (struct himfs_journal_super *)j->j_sbh->b_data;
+
+	lock_buffer(j->j_sbh);
+	jsb->j_tail_tid = tail_tid;
+	jsb->j_tail_blk = tail_blk;
+	unlock_buffer(j->j_sbh);
+	mark_buffer_dirty(j->j_sbh);
+
+	return __sync_dirty_buffer(j->j_sbh, REQ_SYNC | REQ_FUA);
+}
+
+static struct himfs_jbuf *jbuf_alloc(void)
+{
+	struct himfs_jbuf *jb = kmalloc(sizeof(*jb), GFP_NOFS | __GFP_NOFAIL);
+
+	jb->jb_frozen = alloc_page(GFP_NOFS | __GFP_NOFAIL);
+	jb->jb_tid = 0;
+	jb->jb_frozen_tid = 0;
+	INIT_LIST_HEAD(&jb->jb_txn);
+	INIT_LIST_HEAD(&jb->jb_ckpt);
+	return jb;
+}
+
+static void jbuf_free(struct himfs_jbuf *jb)
+{
+	__free_page(jb->jb_frozen);
+	kfree(jb);
+}
+
+/* 把 bh 挂到事务 t 上，第一次记日志时钉住它 */
+static void journal_pin(struct himfs_journal *j, struct himfs_txn *t, struct buffer_head *bh)
+{
+	struct himfs_jbuf *jb, *new = NULL;
+
+	for (;;)
+	{
+		spin_lock(&j->j_lock);
+		jb = bh->b_private;
+		if (jb || new)
+		{
+			break;
+		}
+		spin_unlock(&j->j_lock);
+		new = jbuf_alloc();
+	}
+
+	if (!jb)
+	{
+		jb = new;
+		new = NULL;
+		get_bh(bh);
+		jb->jb_bh = bh;
+		bh->b_private = jb;
+		++j->j_nr_bufs;
+	}
+	/* 上一个事务提交时已经把它从自己的链表上摘下来了 */
+	if (jb->jb_tid != t->t_tid)
+	{
+		jb->jb_tid = t->t_tid;
+		list_add_tail(&jb->jb_txn, &t->t_bufs);
+	}
+	spin_unlock(&j->j_lock);
+
+	if (new)
+	{
+		jbuf_free(new);
+	}
+}
+
+/* 持有 j_barrier 写锁调用，块里正好是到 t 为止的内容 */
+static void journal_freeze(struct himfs_journal *j, struct himfs_txn *t)
+{
+	struct himfs_jbuf *jb, *tmp;
+
+	list_for_each_entry_safe(jb, tmp, &t->t_bufs, jb_txn)
+	{
+		memcpy(page_address(jb->jb_frozen), jb->jb_bh->b_data, PAGE_SIZE);
+		jb->jb_frozen_tid = t->t_tid;
+		list_del_init(&jb->jb_txn);
+		if (list_empty(&jb->jb_ckpt))
+		{
+			list_add_tail(&jb->jb_ckpt, &j->j_ckpt);
+		}
+	}
+}
+
+/* 把 j_ckpt 上的冻结页写回原位，相邻的块并进同一个 bio，整条链写完才返回 */
+static int journal_write_frozen(struct himfs_journal *j)
+{
+	struct block_device *bdev = j->j_sb->s_bdev;
+	struct bio *bio = NULL, *new;
+	struct himfs_jbuf *jb;
+	struct blk_plug plug;
+	sector_t next = 0;
+	lba_t lba;
+	int err;
+
+	blk_start_plug(&plug);
+	list_for_each_entry(jb, &j->j_ckpt, jb_ckpt)
+	{
+		lba = jb->jb_bh->b_blocknr;
+		if (!bio || lba != next || !bio_add_page(bio, jb->jb_frozen, PAGE_SIZE, 0))
+		{
+			new = bio_alloc(GFP_NOFS, BIO_MAX_PAGES);
+			bio_set_dev(new, bdev);
+			new->bi_iter.bi_sector = (sector_t)lba << (BLOCK_SHIFT - 9);
+			new->bi_opf = REQ_OP_WRITE | REQ_META;
+			bio_add_page(new, jb->jb_frozen, PAGE_SIZE, 0);
+			if (bio)
+			{
+				bio_chain(bio, new);
+				submit_bio(bio);
+			}
+			bio = new;
+		}
+		next = lba + 1;
+	}
+
+	err = 0;
+	if (bio)
+	{
+		err = submit_bio_wait(bio);
+		bio_put(bio);
+	}
+	blk_finish_plug(&plug);
+
+	return err;
+}
+
+/*
+ * 已提交的内容写回原位，此后 next_tid 之前的事务都不用再重放。
+ * 只在提交线程里调用，next_tid 之前的事务都已经冻结过；运行事务的改动不会落到原位。
+ */
+static int journal_checkpoint(struct himfs_journal *j, uint64_t next_tid)
+{
+	struct himfs_jbuf *jb, *tmp;
+	LIST_HEAD(done);
+	int err = READ_ONCE(j->j_err);
+
+	/* 出过错的事务可能已经冻结却没提交，不能再往原位写 */
+	if (err)
+	{
+		return err;
+	}
+
+	err = journal_write_frozen(j);
+	if (!err)
+	{
+		err = journal_issue_flush(j);
+	}
+	if (!err)
+	{
+		err = journal_write_super(j, next_tid, j->j_head);
+	}
+	if (err)
+	{
+		return err;
+	}
+
+	/* 冻结之后没再改过的块原位已经是最新的，放开 */
+	spin_lock(&j->j_lock);
+	list_for_each_entry_safe(jb, tmp, &j->j_ckpt, jb_ckpt)
+	{
+		list_del_init(&jb->jb_ckpt);
+		if (jb->jb_tid == jb->jb_frozen_tid)
+		{
+			jb->jb_bh->b_private = NULL;
+			list_add(&jb->jb_ckpt, &done);
+			--j->j_nr_bufs;
+		}
+	}
+	spin_unlock(&j->j_lock);
+
+	list_for_each_entry_safe(jb, tmp, &done, jb_ckpt)
+	{
+		put_bh(jb->jb_bh);
+		jbuf_free(jb);
+	}
+
+	j->j_used = 0;
+	j->j_checkpointed = jiffies;
+	WRITE_ONCE(j->j_tail_tid, next_tid);
+	wake_up_all(&j->j_wait);
+
+	return 0;
+}
+
+/* 事务整体写到 j_head，空间由提交前的检查点保证；PREFLUSH 顺带让 fsync 之前写完的数据落盘 */
+static int journal_write(struct himfs_journal *j, struct himfs_txn *t)
+{
+	struct himfs_journal_header hdr;
+	uint32_t blocks = DIV_ROUND_UP(t->t_used, PAGE_SIZE);
+	uint32_t tail = t->t_used & ~PAGE_MASK;
+	bool wrap = j->j_head + blocks > j->j_blocks;
+	uint32_t skip = wrap ? j->j_blocks - j->j_head : 0;
+	struct bio *bio;
+	uint32_t i;
+	int seq, err;
+
+	if (WARN_ON_ONCE(j->j_used + skip + blocks > j->j_blocks - 1))
+	{
+		return -ENOSPC;
+	}
+	if (wrap)
+	{
+		j->j_head = 1;
+	}
+
+	if (tail)
+	{
+		memset(page_address(t->t_pages[blocks - 1]) + tail, 0, PAGE_SIZE - tail);
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.h_magic = HIMFS_JOURNAL_MAGIC;
+	hdr.h_generation = HIMFS_SB(j->j_sb)->generation;
+	hdr.h_tid = t->t_tid;
+	hdr.h_blocks = blocks;
+	hdr.h_len = t->t_used;
+	hdr.h_nr_recs = t->t_nr_recs;
+	txn_copy_to(t, 0, &hdr, sizeof(hdr));
+	hdr.h_crc = txn_crc(t, t->t_used);
+	txn_copy_to(t, 0, &hdr, sizeof(hdr));
+
+	bio = bio_alloc(GFP_NOFS, blocks);
+	bio_set_dev(bio, j->j_sb->s_bdev);
+	bio->bi_iter.bi_sector = (sector_t)(j->j_start + j->j_head) << (BLOCK_SHIFT - 9);
+	bio->bi_opf = REQ_OP_WRITE | REQ_SYNC | REQ_META | REQ_PREFLUSH | REQ_FUA;
+	for (i = 0; i < blocks; ++i)
+	{
+		bio_add_page(bio, t->t_pages[i], PAGE_SIZE, 0);
+	}
+
+	seq = atomic_inc_return(&j->j_flush_started);
+	err = submit_bio_wait(bio);
+	bio_put(bio);
+	if (err)
+	{
+		return err;
+	}
+	journal_flush_done(j, seq);
+
+	j->j_head += blocks;
+	j->j_used += skip + blocks;
+
+	return 0;
+}
+
+/*
+ * 换下运行事务并写出，等在这个 tid 上的 fsync 一起返回。
+ * 冻结以后冻结页里就有这个事务的内容，所以日志区可能放不下时要在冻结之前先检查点：
+ * 一个事务最多 JNL_TXN_PAGES 块，绕回时最多再跳过这么多。
+ */
+static void journal_commit(struct himfs_journal *j)
+{
+	struct himfs_txn *t, *next;
+	int err = 0;
+
+	if (j->j_used + 2 * JNL_TXN_PAGES > j->j_blocks - 1)
+	{
+		err = journal_checkpoint(j, j->j_committed + 1);
+	}
+
+	down_write(&j->j_barrier);
+	t = j->j_running;
+	journal_freeze(j, t);
+	next = t == &j->j_txn[0] ? &j->j_txn[1] : &j->j_txn[0];
+	txn_reset(next, t->t_tid + 1);
+	WRITE_ONCE(j->j_running, next);
+	up_write(&j->j_barrier);
+	wake_up_all(&j->j_wait);
+
+	/* 检查点失败时没腾出空间，这个事务也写不进日志 */
+	if (!err && t->t_overflow)
+	{
+		/* 记录没放下，只能把冻结的内容整体写回原位，这一步不是原子的 */
+		err = journal_checkpoint(j, t->t_tid + 1);
+	}
+	else if (!err && t->t_nr_recs)
+	{
+		err = journal_write(j, t);
+	}
+
+	if (err && !j->j_err)
+	{
+		printk(KERN_ERR "himfs: commit of transaction %llu failed (%d)\n", t->t_tid, err);
+		WRITE_ONCE(j->j_err, err);
+	}
+	smp_wmb();
+	WRITE_ONCE(j->j_committed, t->t_tid);
+	wake_up_all(&j->j_wait);
+}
+
+static void journal_work(struct work_struct *work)
+{
+	struct himfs_journal *j = container_of(to_delayed_work(work), struct himfs_journal, j_work);
+	int err;
+
+	journal_commit(j);
+
+	if (xchg(&j->j_ckpt_wanted, false) ||
+		j->j_used > j->j_blocks / 2 || READ_ONCE(j->j_nr_bufs) > JNL_PINNED_MAX / 2 ||
+		(j->j_used && time_after(jiffies, j->j_checkpointed + JNL_CHECKPOINT_INTERVAL)))
+	{
+		err = journal_checkpoint(j, j->j_committed + 1);
+		if (err && !j->j_err)
+		{
+			printk(KERN_ERR "himfs: journal checkpoint failed (%d)\n", err);
+			WRITE_ONCE(j->j_err, err);
+			wake_up_all(&j->j_wait);
+		}
+	}
+
+	/* 没有新操作时也要按时把日志检查点掉 */
+	if (j->j_used)
+	{
+		queue_delayed_work(j->j_wq, &j->j_work, JNL_CHECKPOINT_INTERVAL);
+	}
+}
+
+/* 最外层句柄在运行事务里预留空间，不够时催提交并等换出新事务 */
+void himfs_journal_start(struct super_block *sb, int op, struct himfs_handle *handle)
+{
+	struct himfs_journal *j = JNL(sb);
+	struct himfs_handle *outer = current->journal_info;
+	struct himfs_txn *t;
+	uint64_t tid;
+
+	handle->h_journal = j;
+	handle->h_op = op;
+	if (outer)
+	{
+		handle->h_nested = true;
+		handle->h_txn = outer->h_txn;
+		return;
+	}
+
+	handle->h_nested = false;
+	handle->h_nofs = memalloc_nofs_save();
+	for (;;)
+	{
+		down_read(&j->j_barrier);
+		spin_lock(&j->j_lock);
+		t = j->j_running;
+		if (t->t_used + t->t_reserved + JNL_HANDLE_RESERVE <= JNL_TXN_BYTES)
+		{
+			t->t_reserved += JNL_HANDLE_RESERVE;
+			spin_unlock(&j->j_lock);
+			break;
+		}
+		tid = t->t_tid;
+		spin_unlock(&j->j_lock);
+		up_read(&j->j_barrier);
+
+		journal_kick(j);
+		wait_event(j->j_wait, READ_ONCE(j->j_running)->t_tid != tid);
+	}
+
+	handle->h_txn = t;
+	current->journal_info = handle;
+}
+
+void himfs_journal_stop(struct himfs_handle *handle)
+{
+	struct himfs_journal *j = handle->h_journal;
+	struct himfs_txn *t = handle->h_txn;
+	bool kick;
+
+	if (handle->h_nested)
+	{
+		return;
+	}
+
+	spin_lock(&j->j_lock);
+	t->t_reserved -= JNL_HANDLE_RESERVE;
+	kick = t->t_used > JNL_TXN_BYTES / 2 || j->j_nr_bufs > JNL_PINNED_MAX;
+	spin_unlock(&j->j_lock);
+
+	current->journal_info = NULL;
+	up_read(&j->j_barrier);
+	memalloc_nofs_restore(handle->h_nofs);
+
+	if (kick)
+	{
+		journal_kick(j);
+	}
+}
+
+/*
+ * 把 bh 的 [off, off + len) 的新内容记进当前句柄的事务，bh 钉在事务上，提交之前不会写回原位。
+ * 改桶都在桶锁下走到这里，顺带作废 DRAM 桶缓存里这个桶的副本。
+ */
+void himfs_journal_dirty(struct buffer_head *bh, int off, int len)
+{
+	static const char zero[8];
+	struct himfs_handle *handle = current->journal_info;
+	struct himfs_sb_info *himfs_sb;
+	struct himfs_journal *j;
+	struct himfs_txn *t;
+	struct himfs_jrec rec;
+	uint32_t need, pos;
+	bool first;
+
+	if (WARN_ON_ONCE(!handle))
+	{
+		mark_buffer_dirty(bh);
+		return;
+	}
+
+	j = handle->h_journal;
+	himfs_sb = HIMFS_SB(j->j_sb);
+	if (bh->b_blocknr >= himfs_sb->meta_start && bh->b_blocknr < himfs_sb->meta_end)
+	{
+		himfs_bcache_invalidate(j->j_sb, bh->b_blocknr);
+	}
+
+	t = handle->h_txn;
+	journal_pin(j, t, bh);
+	need = ALIGN(sizeof(rec) + len, 8);
+
+	spin_lock(&j->j_lock);
+	if (t->t_used + need > JNL_TXN_BYTES)
+	{
+		t->t_overflow = true;
+		spin_unlock(&j->j_lock);
+		return;
+	}
+	pos = t->t_used;
+	t->t_used += need;
+	first = t->t_nr_recs++ == 0;
+	spin_unlock(&j->j_lock);
+
+	memset(&rec, 0, sizeof(rec));
+	rec.r_lba = bh->b_blocknr;
+	rec.r_off = off;
+	rec.r_len = len;
+	rec.r_op = handle->h_op;
+	txn_copy_to(t, pos, &rec, sizeof(rec));
+	txn_copy_to(t, pos + sizeof(rec), bh->b_data + off, len);
+	txn_copy_to(t, pos + sizeof(rec) + len, zero, need - sizeof(rec) - len);
+
+	if (first)
+	{
+		queue_delayed_work(j->j_wq, &j->j_work, JNL_COMMIT_INTERVAL);
+	}
+}
+
+/* 记下 inode 最近一次改动所在的事务，fsync 只需等到它提交 */
+void himfs_journal_note(struct inode *inode)
+{
+	struct himfs_handle *handle = current->journal_info;
+
+	if (handle)
+	{
+		WRITE_ONCE(HIMFS_I(inode)->i_sync_tid, handle->h_txn->t_tid);
+	}
+}
+
+/* 当前句柄所在事务的 tid，不在句柄里时返回 0 */
+uint64_t himfs_journal_tid(void)
+{
+	struct himfs_handle *handle = current->journal_info;
+
+	return handle ? handle->h_txn->t_tid : 0;
+}
+
+uint64_t himfs_journal_committed(struct super_block *sb)
+{
+	return READ_ONCE(JNL(sb)->j_committed);
+}
+
+int himfs_journal_force(struct super_block *sb, uint64_t tid)
+{
+	struct himfs_journal *j = JNL(sb);
+
+	if (READ_ONCE(j->j_committed) < tid)
+	{
+		journal_kick(j);
+		wait_event(j->j_wait, READ_ONCE(j->j_committed) >= tid);
+	}
+	smp_rmb();
+
+	return READ_ONCE(j->j_err);
+}
+
+/*
+ * 数据已经写完后调用。等 inode 的事务提交；如果没有一次在数据写完之后发出的 flush
+ * 已经完成（事务早就提交了，或者提交在数据写完之前就发出了），再补一次 flush。
+ */
+int himfs_journal_sync_inode(struct inode *inode)
+{
+	struct himfs_journal *j = JNL(inode->i_sb);
+	int seq = atomic_read(&j->j_flush_started);
+	int err;
+
+	err = himfs_journal_force(inode->i_sb, READ_ONCE(HIMFS_I(inode)->i_sync_tid));
+	if (!err && atomic_read(&j->j_flush_done) <= seq)
+	{
+		err = journal_issue_flush(j);
+	}
+
+	return err;
+}
+
+int himfs_journal_sync(struct super_block *sb)
+{
+	return himfs_journal_force(sb, READ_ONCE(JNL(sb)->j_running)->t_tid);
+}
+
+/* 日志尾的 tid，比它小的事务都已经写回原位 */
+uint64_t himfs_journal_checkpointed(struct super_block *sb)
+{
+	return READ_ONCE(JNL(sb)->j_tail_tid);
+}
+
+/* 提交运行事务并等一次检查点，不能在句柄里调用 */
+int himfs_journal_flush(struct super_block *sb)
+{
+	struct himfs_journal *j = JNL(sb);
+	uint64_t tid = READ_ONCE(j->j_running)->t_tid;
+
+	if (WARN_ON_ONCE(current->journal_info))
+	{
+		return -EDEADLK;
+	}
+
+	WRITE_ONCE(j->j_ckpt_wanted, true);
+	journal_kick(j);
+	wait_event(j->j_wait, READ_ONCE(j->j_tail_tid) > tid || READ_ONCE(j->j_err));
+
+	return READ_ONCE(j->j_err);
+}
+
+static bool journal_lba_ok(struct himfs_sb_info *himfs_sb, uint64_t lba)
+{
+	return (lba >= himfs_sb->meta_start && lba < himfs_sb->meta_end) ||
+		(lba >= himfs_sb->bitmap_start && lba < himfs_sb->data_end);
+}
+
+/* 读出 pos 处 tid 号事务到 t，返回它占的块数，不完整或不是这个事务时返回 0 */
+static uint32_t journal_read_txn(struct himfs_journal *j, struct himfs_txn *t, uint32_t pos, uint64_t tid)
+{
+	struct himfs_journal_header hdr;
+	struct buffer_head *bh;
+	uint32_t i, crc;
+
+	bh = sb_bread(j->j_sb, j->j_start + pos);
+	if (!bh)
+	{
+		return 0;
+	}
+	memcpy(&hdr, bh->b_data, sizeof(hdr));
+	memcpy(page_address(t->t_pages[0]), bh->b_data, PAGE_SIZE);
+	brelse(bh);
+
+	if (hdr.h_magic != HIMFS_JOURNAL_MAGIC || hdr.h_generation != HIMFS_SB(j->j_sb)->generation ||
+		hdr.h_tid != tid || hdr.h_blocks == 0 || hdr.h_blocks > JNL_TXN_PAGES ||
+		pos + hdr.h_blocks > j->j_blocks || hdr.h_len < JNL_REC_START ||
+		DIV_ROUND_UP(hdr.h_len, PAGE_SIZE) != hdr.h_blocks)
+	{
+		return 0;
+	}
+
+	for (i = 1; i < hdr.h_blocks; ++i)
+	{
+		bh = sb_bread(j->j_sb, j->j_start + pos + i);
+		if (!bh)
+		{
+			return 0;
+		}
+		memcpy(page_address(t->t_pages[i]), bh->b_data, PAGE_SIZE);
+		brelse(bh);
+	}
+
+	crc = hdr.h_crc;
+	hdr.h_crc = 0;
+	txn_copy_to(t, 0, &hdr, sizeof(hdr));
+	if (txn_crc(t, hdr.h_len) != crc)
+	{
+		return 0;
+	}
+
+	t->t_used = hdr.h_len;
+	t->t_nr_recs = hdr.h_nr_recs;
+
+	return hdr.h_blocks;
+}
+
+static int journal_apply(struct himfs_journal *j, struct himfs_txn *t, char *buf)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(j->j_sb);
+	struct buffer_head *bh;
+	struct himfs_jrec rec;
+	uint32_t pos = JNL_REC_START;
+	uint32_t i;
+
+	for (i = 0; i < t->t_nr_recs; ++i)
+	{
+		if (pos + sizeof(rec) > t->t_used)
+		{
+			return -EIO;
+		}
+		txn_copy_from(t, pos, &rec, sizeof(rec));
+		if (rec.r_off + rec.r_len > (1 << BLOCK_SHIFT) || pos + sizeof(rec) + rec.r_len > t->t_used ||
+			!journal_lba_ok(himfs_sb, rec.r_lba))
+		{
+			printk(KERN_ERR "himfs: bad journal record in %llu: lba %llu off %u len %u\n",
+				t->t_tid, rec.r_lba, rec.r_off, rec.r_len);
+			return -EIO;
+		}
+		txn_copy_from(t, pos + sizeof(rec), buf, rec.r_len);
+
+		bh = sb_bread(j->j_sb, rec.r_lba);
+		if (!bh)
+		{
+			return -EIO;
+		}
+		memcpy(bh->b_data + rec.r_off, buf, rec.r_len);
+		mark_buffer_dirty(bh);
+		brelse(bh);
+
+		pos += ALIGN(sizeof(rec) + rec.r_len, 8);
+	}
+
+	return 0;
+}
+
+/* 从日志尾开始按 tid 连续重放，写回原位后把日志清空 */
+static int journal_replay(struct himfs_journal *j)
+{
+	struct himfs_journal_super *jsb = (struct himfs_journal_super *)j->j_sbh->b_data;
+	struct block_device *bdev = j->j_sb->s_bdev;
+	struct himfs_txn *t = &j->j_txn[1];
+	uint64_t tid = jsb->j_tail_tid;
+	uint32_t pos = jsb->j_tail_blk;
+	uint32_t blocks, nr;
+	char *buf;
+	int err = 0;
+
+	buf = kmalloc(1 << BLOCK_SHIFT, GFP_KERNEL);
+	if (!buf)
+	{
+		return -ENOMEM;
+	}
+
+	for (nr = 0; nr < j->j_blocks; ++nr)
+	{
+		if (pos >= j->j_blocks)
+		{
+			pos = 1;
+		}
+
+		/* 上一个事务之后放不下时下一个从第 1 块开始 */
+		blocks = journal_read_txn(j, t, pos, tid);
+		if (!blocks && pos != 1)
+		{
+			blocks = journal_read_txn(j, t, 1, tid);
+			if (blocks)
+			{
+				pos = 1;
+			}
+		}
+		if (!blocks)
+		{
+			break;
+		}
+
+		err = journal_apply(j, t, buf);
+		if (err)
+		{
+			break;
+		}
+		pos += blocks;
+		++tid;
+	}
+	kfree(buf);
+
+	if (nr)
+	{
+		printk(KERN_INFO "himfs: replayed %u journal transactions\n", nr);
+		if (!err)
+		{
+			err = sync_blockdev(bdev);
+		}
+		if (!err)
+		{
+			err = journal_issue_flush(j);
+		}
+	}
+	invalidate_mapping_pages(bdev->bd_inode->i_mapping, j->j_start + 1, j->j_start + j->j_blocks - 1);
+	if (err)
+	{
+		return err;
+	}
+
+	j->j_head = pos >= j->j_blocks ? 1 : pos;
+	j->j_used = 0;
+	j->j_checkpointed = jiffies;
+	txn_reset(&j->j_txn[0], tid);
+	j->j_running = &j->j_txn[0];
+	j->j_committed = tid - 1;
+	j->j_tail_tid = tid;
+
+	return journal_write_super(j, tid, j->j_head);
+}
+
+/* 正常卸载时检查点已经放开了所有块，这里只收拾出错后留下的 */
+static void journal_unpin_all(struct himfs_journal *j)
+{
+	struct himfs_jbuf *jb, *tmp;
+	int i;
+
+	for (i = 0; i < 2; ++i)
+	{
+		list_for_each_entry_safe(jb, tmp, &j->j_txn[i].t_bufs, jb_txn)
+		{
+			list_del_init(&jb->jb_txn);
+			if (list_empty(&jb->jb_ckpt))
+			{
+				list_add_tail(&jb->jb_ckpt, &j->j_ckpt);
+			}
+		}
+	}
+	list_for_each_entry_safe(jb, tmp, &j->j_ckpt, jb_ckpt)
+	{
+		jb->jb_bh->b_private = NULL;
+		put_bh(jb->jb_bh);
+		jbuf_free(jb);
+	}
+	INIT_LIST_HEAD(&j->j_ckpt);
+	j->j_nr_bufs = 0;
+}
+
+static void journal_free(struct himfs_journal *j)
+{
+	journal_unpin_all(j);
+	if (j->j_wq)
+	{
+		destroy_workqueue(j->j_wq);
+	}
+	txn_free(&j->j_txn[0]);
+	txn_free(&j->j_txn[1]);
+	brelse(j->j_sbh);
+	kfree(j);
+}
+
+int himfs_journal_init(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_super_block *hsb = himfs_sb->hsb;
+	struct himfs_journal_super *jsb;
+	struct himfs_journal *j;
+	int err = -EINVAL;
+
+	BUILD_BUG_ON(PAGE_SIZE != (1 << BLOCK_SHIFT));
+
+	j = kzalloc(sizeof(*j), GFP_KERNEL);
+	if (!j)
+	{
+		return -ENOMEM;
+	}
+	j->j_sb = sb;
+	j->j_start = hsb->s_journal_start;
+	j->j_blocks = hsb->s_journal_blocks;
+	init_rwsem(&j->j_barrier);
+	spin_lock_init(&j->j_lock);
+	INIT_LIST_HEAD(&j->j_ckpt);
+	INIT_LIST_HEAD(&j->j_txn[0].t_bufs);
+	INIT_LIST_HEAD(&j->j_txn[1].t_bufs);
+	init_waitqueue_head(&j->j_wait);
+	atomic_set(&j->j_flush_started, 0);
+	atomic_set(&j->j_flush_done, 0);
+	INIT_DELAYED_WORK(&j->j_work, journal_work);
+
+	j->j_sbh = sb_bread(sb, j->j_start);
+	if (!j->j_sbh)
+	{
+		err = -EIO;
+		goto failed;
+	}
+
+	jsb = (struct himfs_journal_super *)j->j_sbh->b_data;
+	if (jsb->j_magic != HIMFS_JOURNAL_MAGIC || jsb->j_generation != himfs_sb->generation ||
+		jsb->j_blocks != j->j_blocks || jsb->j_tail_blk == 0 || jsb->j_tail_blk > j->j_blocks ||
+		jsb->j_tail_tid == 0)
+	{
+		printk(KERN_ERR "himfs: bad journal superblock\n");
+		goto failed;
+	}
+
+	err = txn_alloc(&j->j_txn[0]);
+	if (!err)
+	{
+		err = txn_alloc(&j->j_txn[1]);
+	}
+	if (err)
+	{
+		goto failed;
+	}
+
+	j->j_wq = alloc_ordered_workqueue("himfs-jnl/%s", WQ_MEM_RECLAIM, sb->s_id);
+	if (!j->j_wq)
+	{
+		err = -ENOMEM;
+		goto failed;
+	}
+
+	err = journal_replay(j);
+	if (err)
+	{
+		printk(KERN_ERR "himfs: journal replay failed (%d)\n", err);
+		goto failed;
+	}
+
+	himfs_sb->journal = j;
+	return 0;
+
+failed:
+	journal_free(j);
+	return err;
+}
+
+/* 卸载时提交最后的事务并做一次完整检查点，日志清空 */
+void himfs_journal_exit(struct super_block *sb)
+{
+	struct himfs_journal *j = JNL(sb);
+
+	if (!j)
+	{
+		return;
+	}
+
+	cancel_delayed_work_sync(&j->j_work);
+	if (!sb_rdonly(sb))
+	{
+		journal_commit(j);
+		if (journal_checkpoint(j, j->j_committed + 1))
+		{
+			printk(KERN_ERR "himfs: final journal checkpoint failed\n");
+		}
+	}
+
+	HIMFS_SB(sb)->journal = NULL;
+	journal_free(j);
+}
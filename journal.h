@@ -0,0 +1,34 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#endif
+
+struct himfs_txn;
+struct himfs_journal;
+
+/*
+ * 一个操作的句柄，放在调用者栈上。已经在句柄里时再 start 只是嵌套，
+ * 记录算在最外层句柄的事务里，保证一个操作的所有改动落在同一个事务。
+ */
+struct himfs_handle
+{
+	struct himfs_journal *h_journal;
+	struct himfs_txn *h_txn;
+	uint8_t h_op;
+	bool h_nested;
+	unsigned int h_nofs;
+};
+
+int himfs_journal_init(struct super_block *sb);
+void himfs_journal_exit(struct super_block *sb);
+void himfs_journal_start(struct super_block *sb, int op, struct himfs_handle *handle);
+void himfs_journal_stop(struct himfs_handle *handle);
+void himfs_journal_dirty(struct buffer_head *bh, int off, int len);
+void himfs_journal_note(struct inode *inode);
+uint64_t himfs_journal_tid(void);
+uint64_t himfs_journal_committed(struct super_block *sb);
+int himfs_journal_force(struct super_block *sb, uint64_t tid);
+int himfs_journal_sync_inode(struct inode *inode);
+int himfs_journal_sync(struct super_block *sb);
+uint64_t himfs_journal_checkpointed(struct super_block *sb);
+int himfs_journal_flush(struct super_block *sb);
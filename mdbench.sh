@@ -0,0 +1,24 @@
+# 在同一块设备上依次格式化成 himfs 和 ext4，跑同样的 test_mdtest 参数，输出按文件系统名加前缀。
+# 设备默认是 brd 内存盘；传一个普通文件路径时用 loop 设备挂它。
+# 用法: sh mdbench.sh [设备或镜像文件] [挂载点] [test_mdtest 参数...]
+# 例: sh mdbench.sh /dev/ram0 /mnt/bbssd -t 16 -n 100000 -s
+DEV=${1:-/dev/ram0}
+MNT=${2:-/mnt/bbssd}
+shift 2 2>/dev/null
+ARGS=${*:--t 8 -n 100000}
+if [ -f $DEV ]; then DEV=$(sudo losetup -f --show $DEV); LOOP=1; fi
+[ -b $DEV ] || sudo modprobe brd rd_nr=1 rd_size=16777216
+[ -x ./mkfs.himfs ] || gcc -O2 -o mkfs.himfs mkfs_himfs.c
+[ -x ./test_mdtest ] || gcc -O2 -o test_mdtest test_mdtest.c -lpthread
+sudo umount $MNT 2>/dev/null
+sudo rmmod himfs 2>/dev/null
+sudo insmod himfs.ko
+sudo ./mkfs.himfs $DEV
+sudo mount -t himfs $DEV $MNT
+sudo ./test_mdtest -d $MNT -l "himfs " $ARGS
+sudo umount $MNT
+sudo mkfs -t ext4 -F -q $DEV
+sudo mount -t ext4 $DEV $MNT
+sudo ./test_mdtest -d $MNT -l "ext4  " $ARGS
+sudo umount $MNT
+[ -z "$LOOP" ] || sudo losetup -d $DEV
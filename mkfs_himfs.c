@@ -0,0 +1,316 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <linux/fs.h>
+
+#include "himfs_format.h"
+
+/*
+ * mkfs.himfs：写超级块、数据区位图和根目录所在的桶，其余元数据区不清零。
+ * 每次格式化生成新的 generation，桶头 generation 不等的桶在挂载后视为空桶，
+ * 所以旧数据不需要抹掉；能 discard 的设备顺手 discard 一下元数据区。
+ * 元数据区按预期文件数和装载率定大小，后面是元数据日志区，剩下的都是数据区。
+ * 日志区只写第一块的日志超级块，旧的日志内容 generation 不等，重放时不认。
+ * 编译: gcc -O2 -o mkfs.himfs mkfs_himfs.c
+ * 名字哈希的种子每次格式化随机生成，和算法一起记在超级块里。
+ * 用法: ./mkfs.himfs [-N 预期文件数] [-l 装载率%] [-J 日志块数] [-H 哈希] [-n] <设备>
+ *   -J  日志区大小，默认 8192 块（32 MiB），小设备上自动缩小，不少于 1024 块
+ *   -H  名字哈希：siphash（默认）、xxh64 或 murmur3，test_hash.c 比较三者的开销和桶负载
+ *   -n  不做 discard
+ */
+
+#define BLOCK_BYTES (1 << BLOCK_SHIFT)
+#define DEFAULT_LOAD 70
+#define BYTES_PER_INODE 16384   /* 不指定 -N 时，按每 16 KiB 设备空间一个文件估算 */
+
+static uint64_t device_blocks(int fd)
+{
+    struct stat st;
+    uint64_t bytes = 0;
+
+    if (fstat(fd, &st))
+        return 0;
+    if (S_ISBLK(st.st_mode)) {
+        if (ioctl(fd, BLKGETSIZE64, &bytes))
+            return 0;
+    } else {
+        bytes = st.st_size;
+    }
+    return bytes >> BLOCK_SHIFT;
+}
+
+static void random_bytes(void *buf, size_t len)
+{
+    int fd = open("/dev/urandom", O_RDONLY);
+    size_t i;
+
+    if (fd >= 0 && read(fd, buf, len) == (ssize_t)len) {
+        close(fd);
+        return;
+    }
+    if (fd >= 0)
+        close(fd);
+    srand(time(NULL) ^ getpid());
+    for (i = 0; i < len; ++i)
+        ((uint8_t *)buf)[i] = rand();
+}
+
+/* 尽力而为：块设备用 BLKDISCARD，普通文件打洞，失败不影响格式化结果 */
+static void discard_range(int fd, uint64_t start, uint64_t blocks)
+{
+    uint64_t range[2] = { start << BLOCK_SHIFT, blocks << BLOCK_SHIFT };
+    struct stat st;
+
+    if (fstat(fd, &st))
+        return;
+    if (S_ISBLK(st.st_mode)) {
+        if (ioctl(fd, BLKDISCARD, range))
+            fprintf(stderr, "discard not supported (%s), skipped\n", strerror(errno));
+    } else {
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, range[0], range[1]))
+            fprintf(stderr, "punch hole failed (%s), skipped\n", strerror(errno));
+    }
+}
+
+static int write_block(int fd, uint64_t lba, const void *buf)
+{
+    if (pwrite(fd, buf, BLOCK_BYTES, lba << BLOCK_SHIFT) != BLOCK_BYTES) {
+        perror("pwrite");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * 位图必须清零，不过只有数据区的 1/32768 大。数据区 0 号块占住，用来表示“没有”；
+ * 最后一个位图块里超出数据区的位置 1，分配时不会越界。
+ */
+static int write_bitmap(int fd, struct himfs_super_block *hsb)
+{
+    static uint8_t buf[BLOCK_BYTES];
+    uint64_t i, bit, last = hsb->s_bitmap_blocks - 1;
+
+    for (i = 0; i < hsb->s_bitmap_blocks; ++i) {
+        memset(buf, 0, sizeof(buf));
+        if (i == 0)
+            buf[0] |= 1;
+        if (i == last) {
+            for (bit = hsb->s_data_blocks - last * HIMFS_BITS_PER_BITMAP; bit < HIMFS_BITS_PER_BITMAP; ++bit)
+                buf[bit >> 3] |= 1 << (bit & 7);
+        }
+        if (write_block(fd, hsb->s_bitmap_start + i, buf))
+            return -1;
+    }
+    return 0;
+}
+
+static int write_journal_super(int fd, struct himfs_super_block *hsb)
+{
+    static union {
+        struct himfs_journal_super jsb;
+        char raw[BLOCK_BYTES];
+    } buf;
+
+    buf.jsb.j_magic = HIMFS_JOURNAL_MAGIC;
+    buf.jsb.j_generation = hsb->s_generation;
+    buf.jsb.j_tail_tid = 1;
+    buf.jsb.j_tail_blk = 1;
+    buf.jsb.j_blocks = hsb->s_journal_blocks;
+    return write_block(fd, hsb->s_journal_start, &buf);
+}
+
+static const char *hash_names[] = {
+    [HIMFS_HASH_MURMUR3] = "murmur3",
+    [HIMFS_HASH_XXH64] = "xxh64",
+    [HIMFS_HASH_SIPHASH] = "siphash",
+};
+
+static int parse_hash(const char *name)
+{
+    int i;
+
+    for (i = HIMFS_HASH_MURMUR3; i <= HIMFS_HASH_SIPHASH; ++i) {
+        if (!strcmp(name, hash_names[i]))
+            return i;
+    }
+    return 0;
+}
+
+static void make_root(struct himfs_meta_block *mb, uint32_t generation, uint32_t now)
+{
+    struct himfs_inode *root = &mb->himfs_inode[0];
+
+    memset(mb, 0, sizeof(*mb));
+    mb->version = HIMFS_FORMAT_VERSION;
+    mb->generation = generation;
+    mb->heap_low = HIMFS_HEAP_END - 1;
+    ((char *)mb)[mb->heap_low] = '/';
+    mb->slot_bitmap[0] = 1UL;
+
+    root->i_mode = S_IFDIR | 0755;
+    root->i_name_len = 1;
+    root->i_name_off = mb->heap_low;
+    root->i_ino = HIMFS_ROOT_INO;
+    root->i_uid = getuid();
+    root->i_gid = getgid();
+    root->i_ctime = root->i_mtime = root->i_crtime = now;
+}
+
+int main(int argc, char *argv[])
+{
+    static union {
+        struct himfs_super_block hsb;
+        char raw[BLOCK_BYTES];
+    } sb_buf;
+    static union {
+        struct himfs_meta_block mb;
+        char raw[BLOCK_BYTES];
+    } root_buf;
+    struct himfs_super_block *hsb = &sb_buf.hsb;
+    uint64_t blocks, inodes = 0, meta_blocks, meta_max, data_blocks;
+    uint64_t journal_blocks = 0;
+    int load = DEFAULT_LOAD, discard = 1, hash_alg = HIMFS_HASH_DEFAULT, opt, fd;
+    uint32_t now = time(NULL);
+
+    _Static_assert(sizeof(struct himfs_meta_block) == BLOCK_BYTES, "bucket must fill one block");
+    _Static_assert(sizeof(struct himfs_inode) == 128, "inode core must be 128 bytes");
+    _Static_assert(sizeof(struct himfs_xblock) == BLOCK_BYTES, "extent block must fill one block");
+    _Static_assert(sizeof(struct himfs_journal_header) <= BLOCK_BYTES, "journal header must fit one block");
+
+    while ((opt = getopt(argc, argv, "N:l:J:H:n")) != -1) {
+        switch (opt) {
+        case 'N':
+            inodes = strtoull(optarg, NULL, 0);
+            break;
+        case 'l':
+            load = atoi(optarg);
+            break;
+        case 'J':
+            journal_blocks = strtoull(optarg, NULL, 0);
+            if (journal_blocks < HIMFS_MIN_JOURNAL_BLOCKS || journal_blocks > UINT32_MAX)
+                goto usage;
+            break;
+        case 'H':
+            hash_alg = parse_hash(optarg);
+            if (!hash_alg)
+                goto usage;
+            break;
+        case 'n':
+            discard = 0;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc - 1 || load < 10 || load > 100)
+        goto usage;
+
+    fd = open(argv[optind], O_RDWR);
+    if (fd < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    blocks = device_blocks(fd);
+    if (blocks < META_REGIN_START_LBA + 2 * HIMFS_MIN_META_BLOCKS) {
+        fprintf(stderr, "%s: device too small (%llu blocks)\n", argv[optind], (unsigned long long)blocks);
+        return 1;
+    }
+    if (!inodes)
+        inodes = (blocks << BLOCK_SHIFT) / BYTES_PER_INODE;
+
+    /* 元数据区不超过 ino 能编码的桶数，也不超过设备的一半 */
+    meta_blocks = (inodes * 100 + (uint64_t)HASH_SLOT_NUM * load - 1) / ((uint64_t)HASH_SLOT_NUM * load);
+    meta_max = (1ULL << HIMFS_MAX_META_BITS) - META_REGIN_START_LBA;
+    if (meta_max > (blocks - META_REGIN_START_LBA) / 2)
+        meta_max = (blocks - META_REGIN_START_LBA) / 2;
+    if (meta_blocks > meta_max)
+        meta_blocks = meta_max;
+    if (meta_blocks < HIMFS_MIN_META_BLOCKS)
+        meta_blocks = HIMFS_MIN_META_BLOCKS;
+
+    /* 没指定时日志区取默认值，但不超过元数据区之后剩余空间的 1/8 */
+    if (!journal_blocks) {
+        journal_blocks = (blocks - META_REGIN_START_LBA - meta_blocks) / 8;
+        if (journal_blocks > HIMFS_DEFAULT_JOURNAL_BLOCKS)
+            journal_blocks = HIMFS_DEFAULT_JOURNAL_BLOCKS;
+        if (journal_blocks < HIMFS_MIN_JOURNAL_BLOCKS)
+            journal_blocks = HIMFS_MIN_JOURNAL_BLOCKS;
+    }
+    if (META_REGIN_START_LBA + meta_blocks + journal_blocks + 2 > blocks) {
+        fprintf(stderr, "%s: device too small for a %llu block journal\n", argv[optind],
+                (unsigned long long)journal_blocks);
+        return 1;
+    }
+
+    hsb->s_magic = HIMFS_MAGIC;
+    hsb->s_version = HIMFS_FORMAT_VERSION;
+    hsb->s_feature_compat = HIMFS_FEATURE_COMPAT_LAZY_INIT;
+    hsb->s_feature_incompat = 0;
+    hsb->s_state = HIMFS_STATE_CLEAN;
+    hsb->s_blocks_count = blocks;
+    hsb->s_meta_start = META_REGIN_START_LBA;
+    hsb->s_meta_blocks = meta_blocks;
+    hsb->s_journal_start = META_REGIN_START_LBA + meta_blocks;
+    hsb->s_journal_blocks = journal_blocks;
+    /* 位图紧跟日志区，每个位图块管 32768 个数据块；数据区块号是 32 位的 */
+    hsb->s_bitmap_start = hsb->s_journal_start + journal_blocks;
+    data_blocks = blocks - hsb->s_bitmap_start;
+    hsb->s_bitmap_blocks = (data_blocks + HIMFS_BITS_PER_BITMAP) / (HIMFS_BITS_PER_BITMAP + 1);
+    data_blocks -= hsb->s_bitmap_blocks;
+    if (data_blocks > UINT32_MAX)
+        data_blocks = UINT32_MAX;
+    if (data_blocks > hsb->s_bitmap_blocks * HIMFS_BITS_PER_BITMAP)
+        data_blocks = hsb->s_bitmap_blocks * HIMFS_BITS_PER_BITMAP;
+    hsb->s_data_start = hsb->s_bitmap_start + hsb->s_bitmap_blocks;
+    hsb->s_data_blocks = data_blocks;
+    hsb->s_free_blocks = data_blocks - 1;
+    hsb->s_inodes_used = 1;     /* 根目录 */
+    hsb->s_inodes_expected = inodes;
+    hsb->s_mkfs_time = now;
+    hsb->s_write_time = now;
+    random_bytes(hsb->s_uuid, sizeof(hsb->s_uuid));
+    /* generation 为 0 时全零的桶会被当成有效桶，必须避开 */
+    do {
+        random_bytes(&hsb->s_generation, sizeof(hsb->s_generation));
+    } while (hsb->s_generation == 0);
+    hsb->s_hash_alg = hash_alg;
+    random_bytes(hsb->s_hash_seed, sizeof(hsb->s_hash_seed));
+
+    if (discard)
+        discard_range(fd, META_REGIN_START_LBA, meta_blocks);
+
+    make_root(&root_buf.mb, hsb->s_generation, now);
+    if (write_bitmap(fd, hsb) || write_journal_super(fd, hsb) ||
+        write_block(fd, META_REGIN_START_LBA, &root_buf) ||
+        write_block(fd, HIMFS_SB_LBA, &sb_buf) || fsync(fd)) {
+        close(fd);
+        return 1;
+    }
+    close(fd);
+
+    printf("himfs: %llu blocks, meta [%llu, +%llu) for %llu inodes at %d%% load, journal [%llu, +%llu), "
+           "bitmap %llu blocks, data [%llu, +%llu), %s names\n",
+           (unsigned long long)blocks,
+           (unsigned long long)hsb->s_meta_start, (unsigned long long)meta_blocks,
+           (unsigned long long)inodes, load,
+           (unsigned long long)hsb->s_journal_start, (unsigned long long)journal_blocks,
+           (unsigned long long)hsb->s_bitmap_blocks,
+           (unsigned long long)hsb->s_data_start, (unsigned long long)hsb->s_data_blocks,
+           hash_names[hash_alg]);
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-N inodes] [-l load%%] [-J journal-blocks] [-H siphash|xxh64|murmur3] [-n] <device>\n",
+            argv[0]);
+    return 1;
+}
@@ -1,6 +1,8 @@
 sudo umount /mnt/bbssd
 sudo rmmod himfs
 sudo insmod himfs.ko
+[ -x ./mkfs.himfs ] || gcc -O2 -o mkfs.himfs mkfs_himfs.c
+sudo ./mkfs.himfs /dev/nvme0n1
 sudo mount -t himfs /dev/nvme0n1 /mnt/bbssd
 cat /proc/mounts | grep himfs
 sudo bash -c "echo 0 > /proc/sys/kernel/randomize_va_space"
\ No newline at end of file
@@ -0,0 +1,218 @@
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#include "stats.h"
+#endif
+
+static struct proc_dir_entry *himfs_proc_root;  /* /proc/fs/himfs */
+
+static const char *const stat_names[HIMFS_STAT_NR] = {
+	[HIMFS_STAT_LOOKUP] = "lookup",
+	[HIMFS_STAT_LOOKUP_MISS] = "lookup_miss",
+	[HIMFS_STAT_BUCKET_READ] = "bucket_read",
+	[HIMFS_STAT_FP_SKIP] = "fpindex_skip",
+	[HIMFS_STAT_SLOT_CMP] = "slot_compare",
+	[HIMFS_STAT_TAG_FALSE] = "tag_false_match",
+	[HIMFS_STAT_INSERT] = "insert",
+	[HIMFS_STAT_BUCKET_FULL] = "bucket_full",
+	[HIMFS_STAT_INSERT_NOSPC] = "insert_nospc",
+	[HIMFS_STAT_UNLINK] = "unlink",
+	[HIMFS_STAT_BULK_CREATE] = "bulk_create",
+	[HIMFS_STAT_BULK_PREFETCH] = "bulk_prefetch",
+	[HIMFS_STAT_HINT_HIT] = "hint_hit",
+	[HIMFS_STAT_PATH_PREFETCH] = "path_prefetch",
+	[HIMFS_STAT_BCACHE_HIT] = "bcache_hit",
+	[HIMFS_STAT_BCACHE_FILL] = "bcache_fill",
+	[HIMFS_STAT_BCACHE_EVICT] = "bcache_evict",
+	[HIMFS_STAT_WARMUP_READ] = "warmup_read",
+	[HIMFS_STAT_INODE_DEFER] = "inode_defer",
+	[HIMFS_STAT_INODE_WRITE] = "inode_write",
+	[HIMFS_STAT_DISCARD_RANGE] = "discard_range",
+	[HIMFS_STAT_DISCARD_BLOCK] = "discard_block",
+	[HIMFS_STAT_PREALLOC_BLOCK] = "prealloc_block",
+	[HIMFS_STAT_UNWRITTEN_CONV] = "unwritten_conv",
+	[HIMFS_STAT_READ_BYTES] = "read_bytes",
+	[HIMFS_STAT_WRITE_BYTES] = "write_bytes",
+	[HIMFS_STAT_FSYNC] = "fsync",
+};
+
+static const char *const lat_names[HIMFS_LAT_NR] = {
+	[HIMFS_LAT_LOOKUP] = "lookup",
+	[HIMFS_LAT_MKNOD] = "mknod",
+	[HIMFS_LAT_UNLINK] = "unlink",
+	[HIMFS_LAT_READ] = "read",
+	[HIMFS_LAT_WRITE] = "write",
+	[HIMFS_LAT_FSYNC] = "fsync",
+};
+
+static int stats_show(struct seq_file *m, void *v)
+{
+	struct himfs_stats *st = m->private;
+	u64 sum;
+	int i, cpu;
+
+	for (i = 0; i < HIMFS_STAT_NR; ++i)
+	{
+		sum = 0;
+		for_each_possible_cpu(cpu)
+		{
+			sum += per_cpu_ptr(st->cpu, cpu)->count[i];
+		}
+		seq_printf(m, "%-16s %llu\n", stat_names[i], sum);
+	}
+
+	return 0;
+}
+
+/* 取直方图里第 pct/1000 分位所在档的上界 */
+static u64 lat_pct(u64 *hist, u64 total, int permille)
+{
+	u64 want = div_u64(total * permille, 1000), seen = 0;
+	int b;
+
+	for (b = 0; b < HIMFS_LAT_BUCKETS; ++b)
+	{
+		seen += hist[b];
+		if (seen > want)
+		{
+			break;
+		}
+	}
+
+	return 2ULL << min(b, HIMFS_LAT_BUCKETS - 1);
+}
+
+/* 每行一个操作：次数、p50/p99/p999（纳秒，所在档的上界），然后是各档计数 */
+static int latency_show(struct seq_file *m, void *v)
+{
+	struct himfs_stats *st = m->private;
+	u64 hist[HIMFS_LAT_BUCKETS];
+	u64 total;
+	int i, b, cpu;
+
+	seq_printf(m, "%-8s %12s %12s %12s %12s  buckets(2^i ns)\n", "op", "count", "p50", "p99", "p999");
+	for (i = 0; i < HIMFS_LAT_NR; ++i)
+	{
+		memset(hist, 0, sizeof(hist));
+		for_each_possible_cpu(cpu)
+		{
+			for (b = 0; b < HIMFS_LAT_BUCKETS; ++b)
+			{
+				hist[b] += per_cpu_ptr(st->cpu, cpu)->lat[i][b];
+			}
+		}
+		total = 0;
+		for (b = 0; b < HIMFS_LAT_BUCKETS; ++b)
+		{
+			total += hist[b];
+		}
+
+		seq_printf(m, "%-8s %12llu", lat_names[i], total);
+		if (total)
+		{
+			seq_printf(m, " %12llu %12llu %12llu ", lat_pct(hist, total, 500),
+				lat_pct(hist, total, 990), lat_pct(hist, total, 999));
+		}
+		else
+		{
+			seq_printf(m, " %12s %12s %12s ", "-", "-", "-");
+		}
+		for (b = 0; b < HIMFS_LAT_BUCKETS; ++b)
+		{
+			seq_printf(m, " %llu", hist[b]);
+		}
+		seq_putc(m, '\n');
+	}
+
+	return 0;
+}
+
+/* 清零不停其他 CPU，并发的加法可能有少量计入旧值，对统计无妨 */
+static ssize_t reset_write(struct file *file, const char __user *buf, size_t len, loff_t *ppos)
+{
+	struct himfs_stats *st = PDE_DATA(file_inode(file));
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		memset(per_cpu_ptr(st->cpu, cpu), 0, sizeof(struct himfs_stats_cpu));
+	}
+
+	return len;
+}
+
+static const struct proc_ops reset_proc_ops = {
+	.proc_write = reset_write,
+	.proc_lseek = noop_llseek,
+};
+
+int himfs_stats_init(struct super_block *sb)
+{
+	struct himfs_stats *st;
+
+	st = kzalloc(sizeof(*st), GFP_KERNEL);
+	if (!st)
+	{
+		return -ENOMEM;
+	}
+	st->cpu = alloc_percpu(struct himfs_stats_cpu);
+	if (!st->cpu)
+	{
+		kfree(st);
+		return -ENOMEM;
+	}
+
+	/* proc 目录建不出来不影响挂载，只是看不到统计 */
+	if (himfs_proc_root)
+	{
+		st->dir = proc_mkdir(sb->s_id, himfs_proc_root);
+	}
+	if (st->dir)
+	{
+		proc_create_single_data("stats", 0444, st->dir, stats_show, st);
+		proc_create_single_data("latency", 0444, st->dir, latency_show, st);
+		proc_create_data("reset", 0200, st->dir, &reset_proc_ops, st);
+	}
+
+	HIMFS_SB(sb)->stats = st;
+	return 0;
+}
+
+void himfs_stats_exit(struct super_block *sb)
+{
+	struct himfs_stats *st = HIMFS_SB(sb)->stats;
+
+	if (!st)
+	{
+		return;
+	}
+
+	HIMFS_SB(sb)->stats = NULL;
+	proc_remove(st->dir);
+	free_percpu(st->cpu);
+	kfree(st);
+}
+
+int himfs_stats_register(void)
+{
+	himfs_proc_root = proc_mkdir("fs/himfs", NULL);
+
+	return himfs_proc_root ? 0 : -ENOMEM;
+}
+
+void himfs_stats_unregister(void)
+{
+	if (himfs_proc_root)
+	{
+		remove_proc_entry("fs/himfs", NULL);
+		himfs_proc_root = NULL;
+	}
+}
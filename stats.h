@@ -0,0 +1,106 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#endif
+
+#include <linux/percpu.h>
+#include <linux/sched/clock.h>
+
+/*
+ * 每个挂载一份的计数器和延迟直方图，按 CPU 分开累加，读的时候再求和，
+ * 热路径上只有一次 this_cpu 加法。/proc/fs/himfs/<设备>/ 下的 stats、latency 只读，
+ * 往 reset 里写任何内容清零。
+ */
+enum himfs_stat
+{
+	HIMFS_STAT_LOOKUP,          /* himfs_lookup 次数 */
+	HIMFS_STAT_LOOKUP_MISS,     /* 其中没找到的 */
+	HIMFS_STAT_BUCKET_READ,     /* 查找、插入、删除读桶的次数 */
+	HIMFS_STAT_FP_SKIP,         /* 指纹索引省掉的读桶 */
+	HIMFS_STAT_SLOT_CMP,        /* tag 命中后比对名字的槽数 */
+	HIMFS_STAT_TAG_FALSE,       /* 其中名字不同的 */
+	HIMFS_STAT_INSERT,          /* hash_insert 次数 */
+	HIMFS_STAT_BUCKET_FULL,     /* 插入时遇到的满桶 */
+	HIMFS_STAT_INSERT_NOSPC,    /* 候选桶全满 */
+	HIMFS_STAT_UNLINK,
+	HIMFS_STAT_BULK_CREATE,     /* 批量创建 ioctl 建成的文件数 */
+	HIMFS_STAT_BULK_PREFETCH,   /* 批量创建预读的桶数 */
+	HIMFS_STAT_HINT_HIT,        /* 查找时提示表猜到了当前分量 */
+	HIMFS_STAT_PATH_PREFETCH,   /* 路径预取发出的桶读 */
+	HIMFS_STAT_BCACHE_HIT,      /* 查找在 DRAM 桶缓存里命中的桶 */
+	HIMFS_STAT_BCACHE_FILL,     /* 放进桶缓存的副本 */
+	HIMFS_STAT_BCACHE_EVICT,    /* 超预算或 shrinker 淘汰的副本 */
+	HIMFS_STAT_WARMUP_READ,     /* 预热读过的桶 */
+	HIMFS_STAT_INODE_DEFER,     /* 句柄外的标脏，留给回写 */
+	HIMFS_STAT_INODE_WRITE,     /* 写进桶的 inode 核心 */
+	HIMFS_STAT_DISCARD_RANGE,   /* 在线 discard 和 FITRIM 下发的段数，合并之后 */
+	HIMFS_STAT_DISCARD_BLOCK,   /* 其中的块数 */
+	HIMFS_STAT_PREALLOC_BLOCK,  /* fallocate 预分配的块 */
+	HIMFS_STAT_UNWRITTEN_CONV,  /* 写完后把未写段转成已写的次数 */
+	HIMFS_STAT_READ_BYTES,
+	HIMFS_STAT_WRITE_BYTES,
+	HIMFS_STAT_FSYNC,
+	HIMFS_STAT_NR,
+};
+
+enum himfs_lat
+{
+	HIMFS_LAT_LOOKUP,
+	HIMFS_LAT_MKNOD,
+	HIMFS_LAT_UNLINK,
+	HIMFS_LAT_READ,
+	HIMFS_LAT_WRITE,
+	HIMFS_LAT_FSYNC,
+	HIMFS_LAT_NR,
+};
+
+#define HIMFS_LAT_BUCKETS 32    /* 第 i 档是 [2^i, 2^(i+1)) 纳秒，最后一档包括更长的 */
+
+struct himfs_stats_cpu
+{
+	u64 count[HIMFS_STAT_NR];
+	u64 lat[HIMFS_LAT_NR][HIMFS_LAT_BUCKETS];
+};
+
+struct himfs_stats
+{
+	struct himfs_stats_cpu __percpu *cpu;
+	struct proc_dir_entry *dir;
+};
+
+int himfs_stats_init(struct super_block *sb);
+void himfs_stats_exit(struct super_block *sb);
+int himfs_stats_register(void);
+void himfs_stats_unregister(void);
+
+static inline void himfs_stat_add(struct super_block *sb, enum himfs_stat stat, u64 n)
+{
+	struct himfs_stats *st = HIMFS_SB(sb)->stats;
+
+	if (st)
+	{
+		this_cpu_add(st->cpu->count[stat], n);
+	}
+}
+
+static inline void himfs_stat_inc(struct super_block *sb, enum himfs_stat stat)
+{
+	himfs_stat_add(sb, stat, 1);
+}
+
+static inline u64 himfs_lat_start(void)
+{
+	return local_clock();
+}
+
+static inline void himfs_lat_end(struct super_block *sb, enum himfs_lat lat, u64 start)
+{
+	struct himfs_stats *st = HIMFS_SB(sb)->stats;
+	u64 ns = local_clock() - start;
+	int b = ns ? min_t(int, fls64(ns) - 1, HIMFS_LAT_BUCKETS - 1) : 0;
+
+	if (st)
+	{
+		this_cpu_inc(st->cpu->lat[lat][b]);
+	}
+}
@@ -24,13 +24,90 @@
 #define _TEST_H_
 #include "himfs_d.h"
 #include "hash.h"
+#include "fpindex.h"
+#include "balloc.h"
+#include "extent.h"
+#include "journal.h"
+#include "grave.h"
+#include "stats.h"
+#include "hint.h"
+#include "bcache.h"
+#include "warmup.h"
+#include "discard.h"
+#define CREATE_TRACE_POINTS
+#include "himfs_trace.h"
 #endif
 
+/* 只读两个计数，不拿锁，频繁轮询也不影响建删和分配 */
 static int himfs_super_statfs(struct dentry *d, struct kstatfs *buf)
 {
+	struct super_block *sb = d->d_sb;
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	u64 files = (u64)himfs_sb->meta_blocks * HASH_SLOT_NUM;
+	u64 used = percpu_counter_read_positive(&himfs_sb->icount.used);
+	u64 id = huge_encode_dev(sb->s_bdev->bd_dev);
+
+	buf->f_type = HIMFS_MAGIC;
+	buf->f_bsize = 1 << BLOCK_SHIFT;
+	buf->f_blocks = himfs_sb->data_blocks;
+	buf->f_bfree = READ_ONCE(himfs_sb->free_blocks);
+	buf->f_bavail = buf->f_bfree;
+	buf->f_files = files;
+	buf->f_ffree = files - min(used, files);
+	buf->f_namelen = HIMFS_MAX_FILENAME_LEN;
+	buf->f_fsid.val[0] = (u32)id;
+	buf->f_fsid.val[1] = (u32)(id >> 32);
+
 	return 0;
 }
 
+/* 把内存里的空闲块数和已用 inode 数折进超级块，只在 CLEAN 时才可信 */
+static void himfs_fold_super(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_super_block *hsb = himfs_sb->hsb;
+
+	lock_buffer(himfs_sb->sbh);
+	hsb->s_free_blocks = READ_ONCE(himfs_sb->free_blocks);
+	hsb->s_inodes_used = percpu_counter_sum_positive(&himfs_sb->icount.used);
+	unlock_buffer(himfs_sb->sbh);
+}
+
+/* 挂载时标记为 DIRTY，正常卸载时改回 CLEAN，据此判断上次是否异常退出 */
+static void himfs_commit_super(struct super_block *sb, uint32_t state)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_super_block *hsb = himfs_sb->hsb;
+
+	himfs_fold_super(sb);
+	lock_buffer(himfs_sb->sbh);
+	hsb->s_state = state;
+	hsb->s_write_time = ktime_get_real_seconds();
+	unlock_buffer(himfs_sb->sbh);
+
+	mark_buffer_dirty(himfs_sb->sbh);
+	sync_dirty_buffer(himfs_sb->sbh);
+}
+
+/* 第一次用到新的盘上格式时打上不兼容特性，赶在用到它的元数据之前落盘，旧模块就不会挂载 */
+int himfs_set_incompat(struct super_block *sb, uint32_t feature)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_super_block *hsb = himfs_sb->hsb;
+
+	if ((READ_ONCE(hsb->s_feature_incompat) & feature) == feature)
+	{
+		return 0;
+	}
+
+	lock_buffer(himfs_sb->sbh);
+	hsb->s_feature_incompat |= feature;
+	unlock_buffer(himfs_sb->sbh);
+	mark_buffer_dirty(himfs_sb->sbh);
+
+	return sync_dirty_buffer(himfs_sb->sbh);
+}
+
 static void himfs_put_super(struct super_block *sb)
 {
 	struct himfs_sb_info *himfs_sb;
@@ -43,11 +120,33 @@ static void himfs_put_super(struct super_block *sb)
 	}
 
 	/* FS-FILLIN your fs specific umount logic here */
+	/* 重数可能还在回收孤儿，要在日志和块分配关掉之前停下 */
+	himfs_icount_stop(sb);
+	himfs_warmup_exit(sb);
+	himfs_fpindex_exit(sb);
+	himfs_grave_exit(sb);
+	himfs_ioend_exit(sb);
+	himfs_discard_exit(sb);
+	himfs_journal_exit(sb);
+	himfs_balloc_exit(sb);
+	if (!sb_rdonly(sb))
+	{
+		/* inode 数还没重数完就保持 DIRTY，下次挂载再数 */
+		himfs_commit_super(sb, himfs_icount_stop(sb) ? HIMFS_STATE_CLEAN : HIMFS_STATE_DIRTY);
+	}
+	himfs_icount_exit(sb);
+	himfs_hint_exit(sb);
+	himfs_bcache_exit(sb);
+	hash_locks_exit(sb);
+	himfs_stats_exit(sb);
+	brelse(himfs_sb->sbh);
+	sb->s_fs_info = NULL;
 	kfree(himfs_sb);
 	return;
 }
 
-static void himfs_dirty_inode(struct inode *inode, int flags)
+/* 把内存里的属性写进 inode 所在的桶，在自己的句柄里；已经在句柄里时随那个操作一起提交 */
+static int himfs_write_core(struct inode *inode, int flags)
 {
 	struct buffer_head *bh;
 	struct super_block *sb = inode->i_sb;
@@ -57,35 +156,102 @@ static void himfs_dirty_inode(struct inode *inode, int flags)
 	struct block_device *bdev = sb->s_bdev;
 	struct inode *bdev_inode = bdev->bd_inode;
 	struct himfs_meta_block *meta_block;
+	struct himfs_handle handle;
 
 	if (bdev_inode == NULL) 
 	{
 		printk("bdev_inode error\n");
-		return ;
+		return -EIO;
+	}
+
+	/* 已经删除的 inode 不会再被读入，孤儿槽回收时直接释放，不用再写 */
+	if (inode->i_nlink == 0)
+	{
+		return 0;
 	}
 
 	//printk(KERN_INFO "sb->s_bdev = %d, fs type = %s, pblk = %lld\n", inode->i_sb->s_dev, sb->s_type->name, pblk);
-	lba = inode->i_ino >> 3;
+	trace_himfs_dirty_inode(inode, flags);
+	lba = inode->i_ino >> HASH_SLOT_BITS;
+	himfs_journal_start(sb, HIMFS_JOP_ATTR, &handle);
 	bh = sb_bread(sb, lba);
 	
  	if (unlikely(!bh))
 	{
 		printk(KERN_ERR "allocate bh for himfs_inode fail");
-		return;
+		himfs_journal_stop(&handle);
+		return -EIO;
 	}	
 
-	idx = inode->i_ino & 0x7;
+	meta_block = (struct himfs_meta_block*)bh->b_data;
+	idx = inode->i_ino & (HASH_SLOT_NUM - 1);
 	him_inode = &(meta_block->himfs_inode[idx]);
+	hash_lock_bucket(sb, lba);
     atomic64_t *atomic_ptr = (atomic64_t *)&inode->i_size;
-    him_inode->i_size = (uint32_t)atomic64_read(atomic_ptr);
+    him_inode->i_size = atomic64_read(atomic_ptr);
 	atomic_ptr = (atomic64_t *)&inode->i_mtime;
 	him_inode->i_mtime = (uint32_t)atomic64_read(atomic_ptr);
 	atomic_ptr = (atomic64_t *)&inode->i_ctime;
 	him_inode->i_ctime = (uint32_t)atomic64_read(atomic_ptr);
+	him_inode->i_dlog_end = HIMFS_I(inode)->i_dlog_end;
+	him_inode->i_flags = (him_inode->i_flags & ~HIMFS_INODE_GRAVE) | (HIMFS_I(inode)->i_flags & HIMFS_INODE_GRAVE);
+	himfs_ext_store(inode, him_inode);
 
 	set_buffer_uptodate(bh);//表示可以回写
-	mark_buffer_dirty(bh);
+	himfs_journal_dirty(bh, HIMFS_META_HDR_SIZE + idx * sizeof(struct himfs_inode), sizeof(struct himfs_inode));
+	hash_unlock_bucket(sb, lba);
+	himfs_journal_note(inode);
+	himfs_journal_stop(&handle);
 	brelse(bh); //put_bh, 对应getblk
+	himfs_stat_inc(sb, HIMFS_STAT_INODE_WRITE);
+	return 0;
+}
+
+/*
+ * 在操作的句柄里标脏（建删、分配和释放块、折叠目录）时，核心和这次操作的其他改动要落在
+ * 同一个事务里，马上写。句柄外的标脏只是 i_size 跟着追加涨、mtime 和 ctime 这类属性，
+ * 只记一下，VFS 会把 inode 挂到回写链表上，等回写时由 himfs_write_inode 一次写回，
+ * 顺序追加不再每页都读写一次桶。lazytime 挂载下只改了时间戳的标脏（I_DIRTY_TIME）
+ * 直接跳过，VFS 在时间戳过期、fsync 或 sync 时再按 I_DIRTY_SYNC 标一次。
+ */
+static void himfs_dirty_inode(struct inode *inode, int flags)
+{
+	struct himfs_inode_info *hii = HIMFS_I(inode);
+
+	if (!(flags & I_DIRTY_INODE))
+	{
+		return;
+	}
+
+	if (current->journal_info)
+	{
+		/* 先清标记再写，写的过程中句柄外的新改动会重新标上 */
+		WRITE_ONCE(hii->i_core_dirty, 0);
+		himfs_write_core(inode, flags);
+		return;
+	}
+
+	WRITE_ONCE(hii->i_core_dirty, 1);
+	himfs_stat_inc(inode->i_sb, HIMFS_STAT_INODE_DEFER);
+}
+
+/* 回写线程、sync 和 fsync 调用；等日志提交由 sync_fs 和 fsync 负责，这里不等 */
+static int himfs_write_inode(struct inode *inode, struct writeback_control *wbc)
+{
+	struct himfs_inode_info *hii = HIMFS_I(inode);
+	int err;
+
+	if (!xchg(&hii->i_core_dirty, 0))
+	{
+		return 0;
+	}
+
+	err = himfs_write_core(inode, 0);
+	if (err)
+	{
+		WRITE_ONCE(hii->i_core_dirty, 1);
+	}
+	return err;
 }
 
 static void himfs_i_callback(struct rcu_head *head)
@@ -93,6 +259,10 @@ static void himfs_i_callback(struct rcu_head *head)
 	struct inode *inode = container_of(head, struct inode, i_rcu);
 	struct himfs_inode_info *fi = HIMFS_I(inode);
 	// down_interruptible(&(fi->filename_sem));
+	if (S_ISLNK(inode->i_mode))
+	{
+		kfree(inode->i_link);   /* 快速符号链接的目标，其他符号链接为 NULL */
+	}
 	kmem_cache_free(himfs_inode_cachep, fi);
 	// up(&(fi->filename_sem));
 	//printk("inode->i_ino:%lld\n", inode->i_ino);	
@@ -111,6 +281,13 @@ static struct inode *himfs_alloc_inode(struct super_block *sb)
 	if (!fi)
 		return NULL;
 	atomic64_set(&fi->vfs_inode.i_version, 1);
+	fi->i_dlog_end = 0;
+	fi->i_flags = 0;
+	fi->i_sync_tid = 0;
+	fi->i_core_dirty = 0;
+	fi->i_grave_nr = 0;
+	INIT_LIST_HEAD(&fi->i_grave_list);
+	himfs_ext_init(&fi->vfs_inode);
 
 	return &fi->vfs_inode;
 }
@@ -124,11 +301,64 @@ static void himfs_free_in_core_inode(struct inode *inode)
 // 	up(&(fi->filename_sem));
 }
 
+/*
+ * 链接数为 0 时释放全部数据块和删除时留下的孤儿槽，两者在同一个句柄里；
+ * 否则只还回末尾之后追加时多分的块
+ */
+static void himfs_evict_inode(struct inode *inode)
+{
+	struct himfs_handle handle;
+
+	truncate_inode_pages_final(&inode->i_data);
+
+	if (!inode->i_nlink)
+	{
+		himfs_journal_start(inode->i_sb, HIMFS_JOP_UNLINK, &handle);
+		if (S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode))
+		{
+			himfs_ext_truncate(inode, 0);
+		}
+		hash_orphan_release(inode);
+		himfs_journal_stop(&handle);
+	}
+	else if (S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode))
+	{
+		himfs_ext_trim(inode, DIV_ROUND_UP(himfs_data_size(inode), 1 << BLOCK_SHIFT));
+	}
+
+	/* generic_delete_inode 不经回写直接驱逐，还没写回的属性在这里补上 */
+	if (inode->i_nlink && xchg(&HIMFS_I(inode)->i_core_dirty, 0))
+	{
+		himfs_write_core(inode, 0);
+	}
+
+	invalidate_inode_buffers(inode);
+	clear_inode(inode);
+}
+
+/*
+ * 先把延迟的父目录更新折叠进日志，再等日志提交。
+ * 顺便把计数折进超级块，由块设备的回写带下去，挂载期间盘上状态是 DIRTY，不影响恢复。
+ */
+static int himfs_sync_fs(struct super_block *sb, int wait)
+{
+	himfs_grave_flush(sb);
+	if (!sb_rdonly(sb))
+	{
+		himfs_fold_super(sb);
+		mark_buffer_dirty(HIMFS_SB(sb)->sbh);
+	}
+	return wait ? himfs_journal_sync(sb) : 0;
+}
+
 struct super_operations himfs_super_ops = {
 	.statfs = himfs_super_statfs,
 	.drop_inode = generic_delete_inode, /* VFS提供的通用函数，会判断是否定义具体文件系统的超级块操作函数delete_inode，若定义的就调用具体的inode删除函数(如ext3_delete_inode )，否则调用truncate_inode_pages和clear_inode函数(在具体文件系统的delete_inode函数中也必须调用这两个函数)。 */
 	.put_super = himfs_put_super,
 	.dirty_inode = himfs_dirty_inode,
+	.write_inode = himfs_write_inode,
+	.sync_fs = himfs_sync_fs,
+	.evict_inode = himfs_evict_inode,
 	.alloc_inode = himfs_alloc_inode,
 	//.free_inode	= himfs_free_in_core_inode,
 	.destroy_inode	= himfs_destroy_inode,
@@ -147,6 +377,10 @@ struct inode *himfs_iget(struct super_block *sb, int mode, dev_t dev)
 	
 	unsigned long root_ino = HIMFS_ROOT_INO;
 	inode = iget_locked(sb, root_ino);
+	if (!inode)
+	{
+		return NULL;
+	}
 	
 	if (inode)
 	{
@@ -173,7 +407,7 @@ struct inode *himfs_iget(struct super_block *sb, int mode, dev_t dev)
 			//printk(KERN_INFO "file inode\n");
 			inode->i_op = &himfs_file_inode_ops;
 			inode->i_fop = &himfs_file_file_ops;
-			inode->i_mapping->a_ops = &himfs_aops;
+			inode->i_mapping->a_ops = &himfs_file_aops;
 			break;
 		case S_IFDIR: /* directory 目录文件*/
 
@@ -190,31 +424,42 @@ struct inode *himfs_iget(struct super_block *sb, int mode, dev_t dev)
 	if (unlikely(!bh))
 	{
 		printk(KERN_ERR "allocate bh for himfs_inode fail");
-		return 0;
+		iget_failed(inode);
+		return NULL;
 	}
 
 	meta_block = (struct himfs_meta_block*)bh->b_data;
-
 	him_inode = &(meta_block->himfs_inode[0]);
-	him_inode->i_mode = mode;
-    him_inode->i_ino = himfs_ino.raw_ino;	 
-    him_inode->i_uid = (uint16_t)__kuid_val(inode->i_uid);
-    him_inode->i_gid = (uint16_t)__kgid_val(inode->i_gid);
-    him_inode->i_size = 0;
-    him_inode->i_ctime = inode->i_ctime.tv_sec;
-    him_inode->i_mtime = inode->i_mtime.tv_sec;
-    him_inode->i_crtime = hii->i_crtime;
-    him_inode->i_detime = 0;
-	him_inode->filename.name_len = strlen("/");
-	strncpy(him_inode->filename.name, "/", strlen("/"));
-    him_inode->i_pid = 0;
-
-	set_bit(0, meta_block->slot_bitmap);
 
-	set_buffer_uptodate(bh);//表示可以回写
-	mark_buffer_dirty(bh);
+	/* 根目录由 mkfs.himfs 建好，这里只读取盘上的属性和子项日志 */
+	if (!hash_bucket_valid(sb, meta_block) || !test_bit(0, meta_block->slot_bitmap))
+	{
+		printk(KERN_ERR "himfs: root inode missing, run mkfs.himfs first\n");
+		brelse(bh);
+		iget_failed(inode);
+		return NULL;
+	}
+
+	inode->i_mode = him_inode->i_mode;
+	inode->i_uid = make_kuid(&init_user_ns, him_inode->i_uid);
+	inode->i_gid = make_kgid(&init_user_ns, him_inode->i_gid);
+	inode->i_size = him_inode->i_size;
+	inode->i_mtime.tv_sec = him_inode->i_mtime;
+	inode->i_mtime.tv_nsec = 0;
+	inode->i_ctime.tv_sec = him_inode->i_ctime;
+	inode->i_ctime.tv_nsec = 0;
+	hii->i_crtime = him_inode->i_crtime;
+	hii->i_dlog_end = him_inode->i_dlog_end;
+	hii->i_flags = him_inode->i_flags;
+	himfs_ext_load(inode, him_inode);
 	brelse(bh);
 
+	if ((hii->i_flags & HIMFS_INODE_GRAVE) && himfs_grave_recover(inode))
+	{
+		iget_failed(inode);
+		return NULL;
+	}
+
 	return inode;
 }
 
@@ -248,7 +493,7 @@ struct inode *himfs_get_inode(struct super_block *sb, int mode, dev_t dev)
 			//printk(KERN_INFO "file inode\n");
 			inode->i_op = &himfs_file_inode_ops;
 			inode->i_fop = &himfs_file_file_ops;
-			inode->i_mapping->a_ops = &himfs_aops;
+			inode->i_mapping->a_ops = &himfs_file_aops;
 			break;
 		case S_IFDIR: /* directory 目录文件*/
 
@@ -268,86 +513,371 @@ struct inode *himfs_get_inode(struct super_block *sb, int mode, dev_t dev)
 	return inode;
 }
 
-int sb_set_blocksize(struct super_block *sb, int size)
+enum
 {
-	if (sb_set_blocksize(sb, size))
+	Opt_index_mb,
+	Opt_noindex,
+	Opt_prefetch_depth,
+	Opt_noprefetch,
+	Opt_bcache_mb,
+	Opt_warmup,
+	Opt_warmup_threads,
+	Opt_warmup_mbps,
+	Opt_discard,
+	Opt_nodiscard,
+	Opt_discard_mbps,
+	Opt_err
+};
+
+static const match_table_t himfs_tokens = {
+	{Opt_index_mb, "index_mb=%u"},
+	{Opt_noindex, "noindex"},
+	{Opt_prefetch_depth, "prefetch_depth=%u"},
+	{Opt_noprefetch, "noprefetch"},
+	{Opt_bcache_mb, "bcache_mb=%u"},
+	{Opt_warmup, "warmup"},
+	{Opt_warmup_threads, "warmup_threads=%u"},
+	{Opt_warmup_mbps, "warmup_mbps=%u"},
+	{Opt_discard, "discard"},
+	{Opt_nodiscard, "nodiscard"},
+	{Opt_discard_mbps, "discard_mbps=%u"},
+	{Opt_err, NULL}
+};
+
+static int himfs_parse_options(char *options, struct himfs_sb_info *himfs_sb)
+{
+	substring_t args[MAX_OPT_ARGS];
+	char *p;
+	int option;
+
+	himfs_sb->index_mb = HIMFS_DEFAULT_INDEX_MB;
+	himfs_sb->prefetch_depth = HIMFS_DEFAULT_PREFETCH_DEPTH;
+	himfs_sb->bcache_mb = HIMFS_DEFAULT_BCACHE_MB;
+	himfs_sb->warmup_threads = HIMFS_DEFAULT_WARMUP_THREADS;
+	himfs_sb->discard_mbps = HIMFS_DEFAULT_DISCARD_MBPS;
+
+	if (!options)
+	{
 		return 0;
-	
-	sb->s_blocksize = size;
-	int bits = 0;
-	while ((size & 1) == 0) 
+	}
+
+	while ((p = strsep(&options, ",")) != NULL)
 	{
-		size >>= 1;
-		bits++;
+		if (!*p)
+		{
+			continue;
+		}
+
+		switch (match_token(p, himfs_tokens, args))
+		{
+		case Opt_index_mb:
+			if (match_int(&args[0], &option) || option < 0)
+			{
+				return -EINVAL;
+			}
+			himfs_sb->index_mb = option;
+			break;
+		case Opt_noindex:
+			himfs_sb->index_mb = 0;
+			break;
+		case Opt_prefetch_depth:
+			if (match_int(&args[0], &option) || option < 0 || option > HIMFS_PREFETCH_DEPTH_MAX)
+			{
+				return -EINVAL;
+			}
+			himfs_sb->prefetch_depth = option;
+			break;
+		case Opt_noprefetch:
+			himfs_sb->prefetch_depth = 0;
+			break;
+		case Opt_bcache_mb:
+			if (match_int(&args[0], &option) || option < 0)
+			{
+				return -EINVAL;
+			}
+			himfs_sb->bcache_mb = option;
+			break;
+		case Opt_warmup:
+			himfs_sb->warmup_at_mount = true;
+			break;
+		case Opt_warmup_threads:
+			if (match_int(&args[0], &option) || option < 1 || option > HIMFS_WARMUP_THREADS_MAX)
+			{
+				return -EINVAL;
+			}
+			himfs_sb->warmup_threads = option;
+			break;
+		case Opt_warmup_mbps:
+			if (match_int(&args[0], &option) || option < 0)
+			{
+				return -EINVAL;
+			}
+			himfs_sb->warmup_mbps = option;
+			break;
+		case Opt_discard:
+			himfs_sb->online_discard = true;
+			break;
+		case Opt_nodiscard:
+			himfs_sb->online_discard = false;
+			break;
+		case Opt_discard_mbps:
+			if (match_int(&args[0], &option) || option < 0)
+			{
+				return -EINVAL;
+			}
+			himfs_sb->discard_mbps = option;
+			break;
+		default:
+			printk(KERN_ERR "himfs: unrecognized mount option \"%s\"\n", p);
+			return -EINVAL;
+		}
 	}
-	sb->s_blocksize_bits = bits;
-	return sb->s_blocksize;
+
+	return 0;
+}
+
+/* 校验超级块并把几何参数读进 himfs_sb */
+static int himfs_load_super(struct super_block *sb, struct himfs_sb_info *himfs_sb, int silent)
+{
+	struct himfs_super_block *hsb = himfs_sb->hsb;
+	uint64_t dev_blocks = i_size_read(sb->s_bdev->bd_inode) >> BLOCK_SHIFT;
+
+	if (hsb->s_magic != HIMFS_MAGIC)
+	{
+		if (!silent)
+		{
+			printk(KERN_ERR "himfs: bad magic, run mkfs.himfs first\n");
+		}
+		return -EINVAL;
+	}
+
+	if (hsb->s_version != HIMFS_FORMAT_VERSION)
+	{
+		printk(KERN_ERR "himfs: unsupported format version %u\n", hsb->s_version);
+		return -EINVAL;
+	}
+
+	if (hsb->s_feature_incompat & ~HIMFS_FEATURE_INCOMPAT_SUPP)
+	{
+		printk(KERN_ERR "himfs: unsupported incompat features 0x%x\n",
+			hsb->s_feature_incompat & ~HIMFS_FEATURE_INCOMPAT_SUPP);
+		return -EINVAL;
+	}
+
+	if (hsb->s_hash_alg < HIMFS_HASH_MURMUR3 || hsb->s_hash_alg > HIMFS_HASH_SIPHASH)
+	{
+		printk(KERN_ERR "himfs: unknown name hash %u\n", hsb->s_hash_alg);
+		return -EINVAL;
+	}
+
+	if (hsb->s_meta_start != META_REGIN_START_LBA ||
+		hsb->s_meta_blocks < HIMFS_MIN_META_BLOCKS ||
+		hsb->s_meta_blocks + META_REGIN_START_LBA > (1ULL << HIMFS_MAX_META_BITS) ||
+		hsb->s_journal_start < hsb->s_meta_start + hsb->s_meta_blocks ||
+		hsb->s_journal_blocks < HIMFS_MIN_JOURNAL_BLOCKS || hsb->s_journal_blocks > U32_MAX ||
+		hsb->s_bitmap_start < hsb->s_journal_start + hsb->s_journal_blocks ||
+		hsb->s_data_start < hsb->s_bitmap_start + hsb->s_bitmap_blocks ||
+		hsb->s_data_start + hsb->s_data_blocks > hsb->s_blocks_count ||
+		hsb->s_data_blocks > U32_MAX ||
+		hsb->s_bitmap_blocks * HIMFS_BITS_PER_BITMAP < hsb->s_data_blocks ||
+		hsb->s_blocks_count > dev_blocks)
+	{
+		printk(KERN_ERR "himfs: bad geometry or device smaller than filesystem\n");
+		return -EINVAL;
+	}
+
+	himfs_sb->generation = hsb->s_generation;
+	himfs_sb->hash_alg = hsb->s_hash_alg;
+	himfs_sb->hash_key.key[0] = (u64)hsb->s_hash_seed[1] << 32 | hsb->s_hash_seed[0];
+	himfs_sb->hash_key.key[1] = (u64)hsb->s_hash_seed[3] << 32 | hsb->s_hash_seed[2];
+	himfs_sb->meta_start = hsb->s_meta_start;
+	himfs_sb->meta_blocks = hsb->s_meta_blocks;
+	himfs_sb->meta_end = hsb->s_meta_start + hsb->s_meta_blocks;
+	himfs_sb->data_start = hsb->s_data_start;
+	himfs_sb->data_end = hsb->s_data_start + hsb->s_data_blocks;
+	himfs_sb->data_blocks = hsb->s_data_blocks;
+	himfs_sb->bitmap_start = hsb->s_bitmap_start;
+	himfs_sb->bitmap_blocks = hsb->s_bitmap_blocks;
+	himfs_sb->unclean = hsb->s_state != HIMFS_STATE_CLEAN;
+
+	if (himfs_sb->unclean)
+	{
+		printk(KERN_WARNING "himfs: filesystem was not cleanly unmounted\n");
+	}
+
+	return 0;
 }
 
 static int himfs_fill_super(struct super_block *sb, void *data, int silent) // mount时被调用，会创建一个sb
 {
 	struct inode *inode;
-	int blocksize = BLOCK_SIZE;
 	struct himfs_sb_info *himfs_sb;
-	unsigned long logic_sb_block = 0;
-	loff_t dir_size;
-
 	struct buffer_head *bh;
-	blocksize = sb_min_blocksize(sb, BLOCK_SIZE);
-	if (!(bh = sb_bread(sb, logic_sb_block))) 
+	int err;
+
+	if (!sb_set_blocksize(sb, 1 << BLOCK_SHIFT))
+	{
+		printk(KERN_ERR "himfs: device does not support %d byte blocks\n", 1 << BLOCK_SHIFT);
+		return -EINVAL;
+	}
+
+	if (!(bh = sb_bread(sb, HIMFS_SB_LBA))) 
 	{
-		printk( KERN_ERR, "error: unable to read superblock");
+		printk(KERN_ERR "himfs: unable to read superblock\n");
+		return -EIO;
 	}
 	
 	himfs_sb = kzalloc(sizeof(struct himfs_sb_info), GFP_NOIO);
+	if (!himfs_sb)
+	{
+		brelse(bh);
+		return -ENOMEM;
+	}
 	strcpy(himfs_sb->fs_name, sb->s_type->name);
+	himfs_sb->sbh = bh;
+	himfs_sb->hsb = (struct himfs_super_block *)bh->b_data;
+	sb->s_fs_info = himfs_sb;
+
+	err = himfs_parse_options(data, himfs_sb);
+	if (err)
+	{
+		goto failed;
+	}
+
+	err = himfs_load_super(sb, himfs_sb, silent);
+	if (err)
+	{
+		goto failed;
+	}
+
+	err = himfs_stats_init(sb);
+	if (err)
+	{
+		goto failed;
+	}
+
+	err = hash_locks_init(sb);
+	if (err)
+	{
+		goto failed;
+	}
+
+	err = himfs_journal_init(sb);
+	if (err)
+	{
+		goto failed;
+	}
+
+	err = himfs_grave_init(sb);
+	if (err)
+	{
+		goto failed;
+	}
+
+	err = himfs_balloc_init(sb);
+	if (err)
+	{
+		goto failed;
+	}
+
+	err = himfs_icount_init(sb);
+	if (err)
+	{
+		goto failed;
+	}
+
+	err = himfs_hint_init(sb);
+	if (err)
+	{
+		goto failed;
+	}
+
+	err = himfs_bcache_init(sb);
+	if (err)
+	{
+		goto failed;
+	}
+
+	err = himfs_warmup_init(sb);
+	if (err)
+	{
+		goto failed;
+	}
+
+	err = himfs_discard_init(sb);
+	if (err)
+	{
+		goto failed;
+	}
+
+	err = himfs_ioend_init(sb);
+	if (err)
+	{
+		goto failed;
+	}
 
 	printk(KERN_INFO "himfs_sb->name: %s\n", himfs_sb->fs_name);
 	sb->s_maxbytes = MAX_LFS_FILESIZE;					 /*文件大小上限*/
-	sb->s_blocksize = HIMFS_BSTORE_BLOCKSIZE;			 //以字节为单位的块大小
-	sb->s_blocksize_bits = HIMFS_BSTORE_BLOCKSIZE_BITS; //以位为单位的块大小
 	sb->s_magic = HIMFS_MAGIC;							 //可能是用来内存分配的地址
 	sb->s_op = &himfs_super_ops;						 // sb操作=
 	sb->s_time_gran = 1;								 /* 时间戳的粒度（单位为纳秒) */
-	printk(KERN_INFO "himfs: fill super\n");
+	printk(KERN_INFO "himfs: fill super, meta %u blocks, data %llu blocks\n",
+		himfs_sb->meta_blocks, himfs_sb->data_end - himfs_sb->data_start);
 
 	inode = himfs_iget(sb, S_IFDIR | 0755, 0); //分配根目录的inode,增加引用计数，对应iput;S_IFDIR表示是一个目录,后面0755是权限位:https://zhuanlan.zhihu.com/p/48529974
 	if (!inode)
-		return -ENOMEM;
+	{
+		err = -EINVAL;
+		goto failed;
+	}
 
 	inode->i_ino = HIMFS_ROOT_INO;//为根inode分配ino#，不能为0
 	printk(KERN_INFO "himfs: root inode = %lx\n", inode->i_ino);
-	
-	dir_size = i_size_read(inode);
-
-	printk("himfs_inode_page size:%lu\n", sizeof(struct himfs_meta_block));
-	sb->s_fs_info = himfs_sb;
-	//himfs_sb->s_sb_block = sb_block;
-	//kzalloc(sizeof(struct himfs_sb_info), GFP_KERNEL); // kzalloc=kalloc+memset（0），GFP_KERNEL是内存分配标志
-	printk(KERN_INFO "himfs: sb->s_fs_info init ok\n");
-	himfs_sb = HIMFS_SB(sb);
-	if (!himfs_sb)
-	{
-		iput(inode);
-		return -ENOMEM;
-	}
+	unlock_new_inode(inode);
 
 	sb->s_root = d_make_root(inode); //用来为fs的根目录（并不一定是系统全局文件系统的根“／”）分配dentry对象。它以根目录的inode对象指针为参数。函数中会将d_parent指向自身，注意，这是判断一个fs的根目录的唯一准则
 	if (!sb->s_root)
-	{ //分配结果检测，如果失败
+	{ //分配结果检测，如果失败，d_make_root 已经释放了 inode
 		printk(KERN_INFO "root node create failed\n");
-		iput(inode);
-		//kfree(himfs_sb->cuckoo);
-		//himfs_sb->cuckoo=NULL;
-		kfree(himfs_sb);
-		return -ENOMEM;
+		err = -ENOMEM;
+		goto failed;
+	}
+
+	if (!sb_rdonly(sb))
+	{
+		lock_buffer(bh);
+		himfs_sb->hsb->s_mount_time = ktime_get_real_seconds();
+		++himfs_sb->hsb->s_mount_count;
+		unlock_buffer(bh);
+		himfs_commit_super(sb, HIMFS_STATE_DIRTY);
 	}
 
-	mark_buffer_dirty(bh);
-	unlock_new_inode(inode);
-	brelse(bh);
 	/* FS-FILLIN your filesystem specific mount logic/checks here */
-	return 0;
+	himfs_icount_start(sb);
+	err = himfs_fpindex_init(sb);
+	if (!err && himfs_sb->warmup_at_mount)
+	{
+		/* 和建指纹索引同时跑，索引那边顺序读到的桶多半已经在缓冲里了 */
+		himfs_warmup_start(sb, 0, 0);
+	}
+	return err;
+
+failed:
+	himfs_warmup_exit(sb);
+	himfs_grave_exit(sb);
+	himfs_ioend_exit(sb);
+	himfs_discard_exit(sb);
+	himfs_journal_exit(sb);
+	himfs_balloc_exit(sb);
+	himfs_icount_exit(sb);
+	himfs_hint_exit(sb);
+	himfs_bcache_exit(sb);
+	hash_locks_exit(sb);
+	himfs_stats_exit(sb);
+	sb->s_fs_info = NULL;
+	brelse(bh);
+	kfree(himfs_sb);
+	return err;
 }
 /*
  * mount himfs, call kernel util mount_bdev
@@ -409,15 +939,21 @@ static void destroy_inodecache(void)
 static int __init init_himfs_fs(void) //宏定义__init表示该函数旨在初始化期间使用，模块装载后就扔掉，释放内存
 {
 	int err;
+	BUILD_BUG_ON(sizeof(struct himfs_inode) != 128);
+	BUILD_BUG_ON(sizeof(struct himfs_meta_block) != (1 << BLOCK_SHIFT));
+	BUILD_BUG_ON(sizeof(struct himfs_xblock) != (1 << BLOCK_SHIFT));
 	printk(KERN_INFO "init himfs\n");
 	err = init_inodecache();
 	if (err)
 		return err;
+	if (himfs_stats_register())
+		printk(KERN_WARNING "himfs: cannot create /proc/fs/himfs, no statistics\n");
 	err = register_filesystem(&himfs_fs_type); //内核文件系统API,将himfs添加到内核文件系统链表
 	if (err)
 		goto out;
 	return 0;
 out:
+	himfs_stats_unregister();
 	destroy_inodecache();
 	return err;	
 }
@@ -425,9 +961,11 @@ out:
 static void __exit exit_himfs_fs(void)
 {
 	unregister_filesystem(&himfs_fs_type);
+	himfs_stats_unregister();
 	destroy_inodecache();
 }
 
 module_init(init_himfs_fs); //宏：模块加载, 调用init_himfs_fs
 module_exit(exit_himfs_fs);
 MODULE_LICENSE("GPL");
+MODULE_SOFTDEP("pre: crc32c");
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * 顺序追加的元数据开销：往一个新文件里按 -b 大小一直追加到 -s，最后 fsync，
+ * 折算成每 GB 追加的设备读写和 himfs 计数。追加都是整页写，设备读几乎全是读桶；
+ * 设备写减去数据本身，剩下的是日志、桶和位图。
+ *   -B 块设备名（/sys/block 下的名字），给出时打印设备级的读写
+ *   -P 挂载的 proc 目录，给出时打印 inode_defer、inode_write、bucket_read 等计数的增量
+ * 在改动前后的模块上各跑一次对比，需要 root 读 /proc/fs/himfs：
+ *   ./test_append -B nvme0n1 -P /proc/fs/himfs/nvme0n1 -l before
+ * 编译: gcc -O2 -o test_append test_append.c
+ * 用法: ./test_append [-d dir] [-s MB] [-b KB] [-B 设备] [-P proc 目录] [-l 标签]
+ */
+
+#define NR_COUNTERS 4
+
+static const char *counters[NR_COUNTERS] = { "inode_defer", "inode_write", "bucket_read", "fsync" };
+
+struct snap {
+    unsigned long long rd_ios, rd_sec, wr_ios, wr_sec;
+    unsigned long long cnt[NR_COUNTERS];
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void snapshot(const char *dev, const char *proc, struct snap *s)
+{
+    char path[4096], name[64];
+    unsigned long long v, skip;
+    FILE *f;
+    int i;
+
+    memset(s, 0, sizeof(*s));
+    if (dev) {
+        snprintf(path, sizeof(path), "/sys/block/%s/stat", dev);
+        f = fopen(path, "r");
+        if (f) {
+            /* 读 ios、合并、扇区、毫秒，写 ios、合并、扇区 */
+            if (fscanf(f, "%llu %llu %llu %llu %llu %llu %llu", &s->rd_ios, &skip, &s->rd_sec, &skip,
+                       &s->wr_ios, &skip, &s->wr_sec) != 7)
+                fprintf(stderr, "%s: bad format\n", path);
+            fclose(f);
+        } else {
+            perror(path);
+        }
+    }
+    if (proc) {
+        snprintf(path, sizeof(path), "%s/stats", proc);
+        f = fopen(path, "r");
+        if (!f) {
+            perror(path);
+            return;
+        }
+        while (fscanf(f, "%63s %llu", name, &v) == 2)
+            for (i = 0; i < NR_COUNTERS; ++i)
+                if (!strcmp(name, counters[i]))
+                    s->cnt[i] = v;
+        fclose(f);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *root = "/mnt/bbssd", *dev = NULL, *proc = NULL, *label = "";
+    long size_mb = 1024, bs_kb = 64;
+    struct snap a, b;
+    char path[4096];
+    char *buf;
+    long long total, done;
+    double t0, t1, gb;
+    int opt, fd, i;
+
+    while ((opt = getopt(argc, argv, "d:s:b:B:P:l:")) != -1) {
+        switch (opt) {
+        case 'd':
+            root = optarg;
+            break;
+        case 's':
+            size_mb = atol(optarg);
+            break;
+        case 'b':
+            bs_kb = atol(optarg);
+            break;
+        case 'B':
+            dev = optarg;
+            break;
+        case 'P':
+            proc = optarg;
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d dir] [-s MB] [-b KB] [-B dev] [-P procdir] [-l label]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (size_mb <= 0 || bs_kb <= 0)
+        return 1;
+
+    buf = malloc(bs_kb << 10);
+    if (!buf)
+        return 1;
+    memset(buf, 'a', bs_kb << 10);
+    total = (long long)size_mb << 20;
+
+    snprintf(path, sizeof(path), "%s/append.dat", root);
+    unlink(path);
+    sync();
+    snapshot(dev, proc, &a);
+
+    t0 = now();
+    fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    for (done = 0; done < total; done += bs_kb << 10) {
+        if (write(fd, buf, bs_kb << 10) != bs_kb << 10) {
+            perror("write");
+            return 1;
+        }
+    }
+    if (fsync(fd)) {
+        perror("fsync");
+        return 1;
+    }
+    close(fd);
+    t1 = now();
+    snapshot(dev, proc, &b);
+
+    gb = total / (double)(1 << 30);
+    printf("%s%ld MB appended in %ld KB writes, %.1f MB/s\n", label, size_mb, bs_kb, size_mb / (t1 - t0));
+    if (dev)
+        printf("%sper GB: %.0f reads (%.0f KB), %.0f writes, %.0f KB written besides data\n", label,
+               (b.rd_ios - a.rd_ios) / gb, (b.rd_sec - a.rd_sec) / 2.0 / gb, (b.wr_ios - a.wr_ios) / gb,
+               ((b.wr_sec - a.wr_sec) / 2.0 - (total >> 10)) / gb);
+    if (proc)
+        for (i = 0; i < NR_COUNTERS; ++i)
+            printf("%sper GB: %-12s %.0f\n", label, counters[i], (b.cnt[i] - a.cnt[i]) / gb);
+
+    unlink(path);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "himfs_ioctl.h"
+
+/*
+ * 批量创建对比逐个 creat：同一个目录里先用 creat 循环建 N 个空文件（同 test_creat.c），
+ * 全部删掉后再用 HIMFS_IOC_BULK_CREATE 每次一批建同样的 N 个，给出两边的每秒文件数和加速比，
+ * 并用 stat 抽查 ioctl 返回的 ino。-c 时每轮前 drop_caches，桶都要从盘上读，差距最明显。
+ * 编译: gcc -O2 -o test_bulk_creat test_bulk_creat.c
+ * 用法: ./test_bulk_creat [-d dir] [-n 文件数] [-b 每批项数] [-c]
+ */
+
+static const char *root = "/mnt/bbssd";
+static long count = 100000;
+static int batch = 4096;
+static int drop;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void drop_caches(void)
+{
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    sync();
+    if (fd >= 0) {
+        if (write(fd, "3", 1) != 1)
+            perror("drop_caches");
+        close(fd);
+    }
+}
+
+static int remove_all(const char *dir)
+{
+    char name[4096 + 32];       /* 目录前缀加 /f_ 和编号 */
+    long i;
+
+    for (i = 0; i < count; ++i) {
+        snprintf(name, sizeof(name), "%s/f_%ld", dir, i);
+        if (unlink(name)) {
+            perror(name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int run_creat(const char *dir, double *rate)
+{
+    char name[4096 + 32];       /* 目录前缀加 /f_ 和编号 */
+    double t0;
+    long i;
+    int fd;
+
+    t0 = now();
+    for (i = 0; i < count; ++i) {
+        snprintf(name, sizeof(name), "%s/f_%ld", dir, i);
+        fd = creat(name, 0644);
+        if (fd < 0) {
+            perror(name);
+            return -1;
+        }
+        close(fd);
+    }
+    *rate = count / (now() - t0);
+    return 0;
+}
+
+static int run_bulk(const char *dir, double *rate)
+{
+    struct himfs_bulk_entry *ents = calloc(batch, sizeof(*ents));
+    char *names = malloc((size_t)batch * 32);
+    struct himfs_bulk_create req;
+    char path[4096 + 32];
+    struct stat st;
+    double t0;
+    long base, i;
+    int dfd, n = 0, len, err = -1;
+
+    dfd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dfd < 0 || !ents || !names) {
+        perror(dir);
+        goto out;
+    }
+
+    t0 = now();
+    for (base = 0; base < count; base += n) {
+        n = count - base < batch ? count - base : batch;
+        len = 0;
+        for (i = 0; i < n; ++i) {
+            ents[i].name_off = len;
+            ents[i].name_len = sprintf(names + len, "f_%ld", base + i);
+            ents[i].mode = S_IFREG | 0644;
+            len += ents[i].name_len;
+        }
+
+        memset(&req, 0, sizeof(req));
+        req.entries = (uintptr_t)ents;
+        req.names = (uintptr_t)names;
+        req.count = n;
+        req.names_len = len;
+        if (ioctl(dfd, HIMFS_IOC_BULK_CREATE, &req)) {
+            perror("HIMFS_IOC_BULK_CREATE");
+            goto out;
+        }
+        if (req.created != (uint32_t)n) {
+            for (i = 0; i < n && !ents[i].status; ++i)
+                ;
+            fprintf(stderr, "f_%ld: %s\n", base + i, strerror(-ents[i].status));
+            goto out;
+        }
+    }
+    *rate = count / (now() - t0);
+
+    /* 最后一批里抽查几个 ino */
+    for (i = 0; i < n; i += n / 8 + 1) {
+        snprintf(path, sizeof(path), "%s/f_%ld", dir, base - n + i);
+        if (stat(path, &st) || st.st_ino != ents[i].ino) {
+            fprintf(stderr, "%s: ino %u from ioctl does not match stat\n", path, ents[i].ino);
+            goto out;
+        }
+    }
+    err = 0;
+
+out:
+    if (dfd >= 0)
+        close(dfd);
+    free(names);
+    free(ents);
+    return err;
+}
+
+int main(int argc, char *argv[])
+{
+    char dir[4096];
+    double creat_rate, bulk_rate;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:b:c")) != -1) {
+        switch (opt) {
+        case 'd':
+            root = optarg;
+            break;
+        case 'n':
+            count = atol(optarg);
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            break;
+        case 'c':
+            drop = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d dir] [-n files] [-b batch] [-c]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (count <= 0 || batch <= 0 || batch > HIMFS_BULK_MAX)
+        return 1;
+
+    snprintf(dir, sizeof(dir), "%s/bulk", root);
+    if (mkdir(dir, 0755) && errno != EEXIST) {
+        perror(dir);
+        return 1;
+    }
+
+    if (drop)
+        drop_caches();
+    if (run_creat(dir, &creat_rate) || remove_all(dir))
+        return 1;
+    if (drop)
+        drop_caches();
+    if (run_bulk(dir, &bulk_rate) || remove_all(dir))
+        return 1;
+    rmdir(dir);
+
+    printf("%ld files, batch %d%s\n", count, batch, drop ? ", cold cache" : "");
+    printf("creat  %10.0f files/s\n", creat_rate);
+    printf("bulk   %10.0f files/s  %.2fx\n", bulk_rate, bulk_rate / creat_rate);
+    return 0;
+}
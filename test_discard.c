@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <linux/fs.h>
+
+/*
+ * 高周转下的 discard：每轮写满 N 个 S KB 的文件（每个都 fsync），再全部删掉，跑 R 轮。
+ * 记下每次 write+fsync 的延迟，给出 p50、p99，看后台 discard 会不会拖慢前台；
+ * 从 /sys/block/<设备>/stat 读设备收到的 discard 次数和扇区数。-T 在最后调一次 FITRIM，
+ * 打印 trim 掉的字节数和用时。要能 discard 的设备，例如 null_blk 或者文件上的 loop：
+ *   modprobe null_blk nr_devices=1 gb=8 memory_backed=1 discard=1
+ *   ./mkfs.himfs /dev/nullb0
+ *   mount -t himfs -o nodiscard /dev/nullb0 /mnt/bbssd && ./test_discard -B nullb0 -T -l fitrim
+ *   mount -t himfs -o discard /dev/nullb0 /mnt/bbssd && ./test_discard -B nullb0 -l online
+ * discard_mbps= 限制在线 discard 每秒下发的量。
+ * 编译: gcc -O2 -o test_discard test_discard.c
+ * 用法: ./test_discard [-d dir] [-n 文件数] [-s KB] [-r 轮数] [-B 设备] [-T] [-l 标签]
+ */
+
+struct dstat {
+    unsigned long long ios, sectors;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 第 12、14 个字段是完成的 discard 次数和扇区数，老内核没有时为 0 */
+static void discards(const char *dev, struct dstat *s)
+{
+    unsigned long long v[15];
+    char path[4096];
+    FILE *f;
+    int i;
+
+    memset(s, 0, sizeof(*s));
+    if (!dev)
+        return;
+    snprintf(path, sizeof(path), "/sys/block/%s/stat", dev);
+    f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    for (i = 0; i < 15 && fscanf(f, "%llu", &v[i]) == 1; ++i)
+        ;
+    fclose(f);
+    if (i == 15) {
+        s->ios = v[11];
+        s->sectors = v[13];
+    }
+}
+
+static int cmp_dbl(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *root = "/mnt/bbssd", *dev = NULL, *label = "";
+    long nfiles = 2000, size_kb = 1024;
+    int rounds = 5, trim = 0, opt, fd, r;
+    struct dstat a, b;
+    struct fstrim_range range;
+    char path[4096];
+    double *lat, t0, t1, t;
+    char *buf;
+    long i, k = 0;
+
+    while ((opt = getopt(argc, argv, "d:n:s:r:B:Tl:")) != -1) {
+        switch (opt) {
+        case 'd':
+            root = optarg;
+            break;
+        case 'n':
+            nfiles = atol(optarg);
+            break;
+        case 's':
+            size_kb = atol(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'B':
+            dev = optarg;
+            break;
+        case 'T':
+            trim = 1;
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d dir] [-n files] [-s KB] [-r rounds] [-B dev] [-T] [-l label]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (nfiles <= 0 || size_kb <= 0 || rounds <= 0)
+        return 1;
+
+    buf = malloc(size_kb << 10);
+    lat = calloc(nfiles * rounds, sizeof(*lat));
+    if (!buf || !lat)
+        return 1;
+    memset(buf, 'd', size_kb << 10);
+    snprintf(path, sizeof(path), "%s/dc", root);
+    if (mkdir(path, 0755) && errno != EEXIST) {
+        perror(path);
+        return 1;
+    }
+
+    sync();
+    discards(dev, &a);
+    t0 = now();
+    for (r = 0; r < rounds; ++r) {
+        for (i = 0; i < nfiles; ++i) {
+            snprintf(path, sizeof(path), "%s/dc/f%ld", root, i);
+            t = now();
+            fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+            if (fd < 0 || write(fd, buf, size_kb << 10) != size_kb << 10 || fsync(fd)) {
+                perror(path);
+                return 1;
+            }
+            close(fd);
+            lat[k++] = now() - t;
+        }
+        for (i = 0; i < nfiles; ++i) {
+            snprintf(path, sizeof(path), "%s/dc/f%ld", root, i);
+            unlink(path);
+        }
+    }
+    sync();
+    t1 = now();
+    discards(dev, &b);
+
+    qsort(lat, k, sizeof(*lat), cmp_dbl);
+    printf("%s%d rounds of %ld x %ld KB: %.1f s, write+fsync p50 %.0f us, p99 %.0f us\n", label, rounds, nfiles,
+           size_kb, t1 - t0, lat[k / 2] * 1e6, lat[(long)(k * 0.99)] * 1e6);
+    if (dev)
+        printf("%sdevice discards: %llu requests, %.1f MB\n", label, b.ios - a.ios,
+               (b.sectors - a.sectors) / 2048.0);
+
+    if (trim) {
+        snprintf(path, sizeof(path), "%s/dc", root);
+        fd = open(path, O_RDONLY | O_DIRECTORY);
+        memset(&range, 0, sizeof(range));
+        range.len = UINT64_MAX;
+        t = now();
+        if (fd < 0 || ioctl(fd, FITRIM, &range)) {
+            perror("FITRIM");
+            return 1;
+        }
+        printf("%sFITRIM: %.1f MB in %.1f ms\n", label, range.len / 1048576.0, (now() - t) * 1e3);
+        close(fd);
+    }
+
+    snprintf(path, sizeof(path), "%s/dc", root);
+    rmdir(path);
+    free(lat);
+    free(buf);
+    return 0;
+}
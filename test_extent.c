@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * 数据块分配：4 KiB 到 4 GiB 的混合文件大小，每种大小若干个文件交替并发追加写，
+ * 统计顺序写、冷读吞吐，以及 st_blocks 算出的空间效率（逻辑大小 / 实际占用）。
+ * 读之前 drop_caches 需要 root。
+ * 用法: ./test_extent [dir] [最大文件大小 MiB]
+ */
+
+#define CHUNK (1 << 20)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void drop_caches(void)
+{
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    sync();
+    if (fd >= 0) {
+        if (write(fd, "3", 1) != 1)
+            perror("drop_caches");
+        close(fd);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *root = argc > 1 ? argv[1] : "/mnt/bbssd";
+    long long max_mb = argc > 2 ? atoll(argv[2]) : 4096;
+    long long sizes[] = { 4LL << 10, 64LL << 10, 1LL << 20, 16LL << 20, 256LL << 20, 1LL << 30, 4LL << 30 };
+    int nfiles = 4;
+    char name[4096];
+    char *buf = malloc(CHUNK);
+    unsigned int i;
+    int f;
+
+    if (!buf)
+        return 1;
+    memset(buf, 0x5a, CHUNK);
+
+    printf("%12s %6s %12s %12s %10s\n", "file size", "files", "write MB/s", "read MB/s", "space eff");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        long long size = sizes[i], done, total = size * nfiles, alloc = 0;
+        int fds[4];
+        double t0, tw, tr;
+        struct stat st;
+
+        if (size > max_mb << 20)
+            break;
+
+        /* 多个文件轮流各写一块，模拟并发写入，考验分配器能否保持每个文件连续 */
+        t0 = now();
+        for (f = 0; f < nfiles; ++f) {
+            snprintf(name, sizeof(name), "%s/extent_%lld_%d", root, size, f);
+            fds[f] = open(name, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+            if (fds[f] < 0) {
+                perror(name);
+                return 1;
+            }
+        }
+        for (done = 0; done < size; done += CHUNK) {
+            size_t n = size - done < CHUNK ? size - done : CHUNK;
+            for (f = 0; f < nfiles; ++f) {
+                if (write(fds[f], buf, n) != (ssize_t)n) {
+                    perror("write");
+                    return 1;
+                }
+            }
+        }
+        for (f = 0; f < nfiles; ++f) {
+            fsync(fds[f]);
+            close(fds[f]);
+        }
+        tw = now() - t0;
+
+        drop_caches();
+        t0 = now();
+        for (f = 0; f < nfiles; ++f) {
+            int fd;
+            snprintf(name, sizeof(name), "%s/extent_%lld_%d", root, size, f);
+            fd = open(name, O_RDONLY);
+            while (fd >= 0 && read(fd, buf, CHUNK) > 0)
+                ;
+            if (fd >= 0 && fstat(fd, &st) == 0)
+                alloc += (long long)st.st_blocks * 512;
+            if (fd >= 0)
+                close(fd);
+        }
+        tr = now() - t0;
+
+        printf("%12lld %6d %12.1f %12.1f %9.1f%%\n", size, nfiles,
+               total / tw / (1 << 20), total / tr / (1 << 20),
+               alloc ? 100.0 * total / alloc : 0.0);
+
+        for (f = 0; f < nfiles; ++f) {
+            snprintf(name, sizeof(name), "%s/extent_%lld_%d", root, size, f);
+            unlink(name);
+        }
+    }
+
+    free(buf);
+    return 0;
+}
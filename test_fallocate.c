@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * 预分配对追加写的影响：往新文件里按 -b 大小顺序写到 -s，三种方式各跑一次：
+ *   extend  直接追加，每次写越过末尾都要分配块、改 extent 表
+ *   keep    先 fallocate(KEEP_SIZE) 整个大小再追加，写命中未写段，回写完成时转成已写
+ *   full    先 fallocate 到整个大小（i_size 也设好）再从头覆盖写
+ * -y N 每 N 次写做一次 fdatasync，模拟日志写者；0 表示只在最后 fsync 一次。
+ * full 在写之前先读一遍预分配的范围，确认读出来全是零（不该有设备读）。
+ *   -P 挂载的 proc 目录，给出时打印 prealloc_block、unwritten_conv 等计数的增量
+ *   mount -t himfs /dev/nvme0n1 /mnt/bbssd && ./test_fallocate -y 16 -P /proc/fs/himfs/nvme0n1
+ * 编译: gcc -O2 -o test_fallocate test_fallocate.c
+ * 用法: ./test_fallocate [-d dir] [-s MB] [-b KB] [-y N] [-m extend|keep|full] [-P proc 目录] [-l 标签]
+ */
+
+#define NR_COUNTERS 4
+
+static const char *counters[NR_COUNTERS] = { "prealloc_block", "unwritten_conv", "inode_write", "fsync" };
+
+static const char *root = "/mnt/bbssd";
+static const char *proc;
+static long size_mb = 1024, bs_kb = 64, sync_every;
+static char *buf;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void snapshot(unsigned long long *cnt)
+{
+    char path[4096], name[64];
+    unsigned long long v;
+    FILE *f;
+    int i;
+
+    memset(cnt, 0, NR_COUNTERS * sizeof(*cnt));
+    if (!proc)
+        return;
+    snprintf(path, sizeof(path), "%s/stats", proc);
+    f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    while (fscanf(f, "%63s %llu", name, &v) == 2)
+        for (i = 0; i < NR_COUNTERS; ++i)
+            if (!strcmp(name, counters[i]))
+                cnt[i] = v;
+    fclose(f);
+}
+
+/* 预分配出来还没写过的范围应当读出全零 */
+static int check_zero(int fd, long long total)
+{
+    long long off;
+    ssize_t n, i;
+
+    for (off = 0; off < total; off += n) {
+        n = pread(fd, buf, bs_kb << 10, off);
+        if (n <= 0) {
+            perror("pread");
+            return -1;
+        }
+        for (i = 0; i < n; ++i)
+            if (buf[i]) {
+                fprintf(stderr, "non-zero byte at %lld\n", off + i);
+                return -1;
+            }
+    }
+    return 0;
+}
+
+static int run(const char *mode, const char *label)
+{
+    unsigned long long a[NR_COUNTERS], b[NR_COUNTERS];
+    long long total = (long long)size_mb << 20, done;
+    char path[4096];
+    double t0, t1, tz = 0;
+    long nr = 0;
+    int fd, i;
+
+    snprintf(path, sizeof(path), "%s/falloc.dat", root);
+    unlink(path);
+    sync();
+    snapshot(a);
+
+    t0 = now();
+    fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (!strcmp(mode, "keep") && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, total)) {
+        perror("fallocate");
+        return -1;
+    }
+    if (!strcmp(mode, "full")) {
+        if (fallocate(fd, 0, 0, total)) {
+            perror("fallocate");
+            return -1;
+        }
+        tz = now();
+        if (check_zero(fd, total))
+            return -1;
+        tz = now() - tz;
+    }
+
+    memset(buf, 'a', bs_kb << 10);
+    for (done = 0; done < total; done += bs_kb << 10) {
+        if (pwrite(fd, buf, bs_kb << 10, done) != bs_kb << 10) {
+            perror("write");
+            return -1;
+        }
+        if (sync_every && ++nr % sync_every == 0 && fdatasync(fd)) {
+            perror("fdatasync");
+            return -1;
+        }
+    }
+    if (fsync(fd)) {
+        perror("fsync");
+        return -1;
+    }
+    close(fd);
+    t1 = now() - tz;
+    snapshot(b);
+
+    printf("%s%-6s %ld MB in %ld KB writes, %.1f MB/s", label, mode, size_mb, bs_kb,
+           size_mb / (t1 - t0));
+    if (tz > 0)
+        printf(", zero read %.1f MB/s", size_mb / tz);
+    printf("\n");
+    if (proc)
+        for (i = 0; i < NR_COUNTERS; ++i)
+            printf("%s%-6s %-15s %llu\n", label, mode, counters[i], b[i] - a[i]);
+
+    unlink(path);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *label = "", *mode = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:s:b:y:m:P:l:")) != -1) {
+        switch (opt) {
+        case 'd':
+            root = optarg;
+            break;
+        case 's':
+            size_mb = atol(optarg);
+            break;
+        case 'b':
+            bs_kb = atol(optarg);
+            break;
+        case 'y':
+            sync_every = atol(optarg);
+            break;
+        case 'm':
+            mode = optarg;
+            break;
+        case 'P':
+            proc = optarg;
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d dir] [-s MB] [-b KB] [-y N] [-m extend|keep|full] [-P procdir] [-l label]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (size_mb <= 0 || bs_kb <= 0 || sync_every < 0)
+        return 1;
+    if (mode && strcmp(mode, "extend") && strcmp(mode, "keep") && strcmp(mode, "full")) {
+        fprintf(stderr, "unknown mode %s\n", mode);
+        return 1;
+    }
+
+    buf = malloc(bs_kb << 10);
+    if (!buf)
+        return 1;
+
+    if (mode)
+        return run(mode, label) ? 1 : 0;
+    if (run("extend", label) || run("keep", label) || run("full", label))
+        return 1;
+    free(buf);
+    return 0;
+}
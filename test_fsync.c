@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * fsync 密集的建文件：每个线程在自己的子目录里反复 create+write+fsync，
+ * 分别用 1、8、64 个线程跑，给出每秒完成的文件数。线程越多，
+ * 一次日志提交捎带的 fsync 越多，总吞吐应该随线程数上升。
+ * 编译: gcc -O2 -o test_fsync test_fsync.c -lpthread
+ * 用法: ./test_fsync [dir] [每线程文件数] [文件大小]
+ */
+
+struct worker {
+    pthread_t tid;
+    const char *root;
+    int id;
+    long count;
+    int size;
+    int err;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *run(void *arg)
+{
+    struct worker *w = arg;
+    char name[4096], buf[4096];
+    long i;
+
+    memset(buf, 'x', w->size);
+    for (i = 0; i < w->count; ++i) {
+        int fd;
+        snprintf(name, sizeof(name), "%s/fsync_%d/f_%ld", w->root, w->id, i);
+        fd = open(name, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (fd < 0 || write(fd, buf, w->size) != w->size || fsync(fd)) {
+            perror(name);
+            w->err = 1;
+            if (fd >= 0)
+                close(fd);
+            return NULL;
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+static int round_run(const char *root, int nthreads, long count, int size)
+{
+    struct worker *w = calloc(nthreads, sizeof(*w));
+    char name[4096];
+    double t0, t;
+    long i;
+    int k, err = 0;
+
+    if (!w)
+        return 1;
+    for (k = 0; k < nthreads; ++k) {
+        snprintf(name, sizeof(name), "%s/fsync_%d", root, k);
+        if (mkdir(name, 0755) && errno != EEXIST) {
+            perror(name);
+            free(w);
+            return 1;
+        }
+    }
+
+    t0 = now();
+    for (k = 0; k < nthreads; ++k) {
+        w[k].root = root;
+        w[k].id = k;
+        w[k].count = count;
+        w[k].size = size;
+        pthread_create(&w[k].tid, NULL, run, &w[k]);
+    }
+    for (k = 0; k < nthreads; ++k) {
+        pthread_join(w[k].tid, NULL);
+        err |= w[k].err;
+    }
+    t = now() - t0;
+
+    printf("%3d threads %8.0f files/s %8.1f us/fsync\n",
+           nthreads, nthreads * count / t, t * 1e6 / count);
+
+    for (k = 0; k < nthreads; ++k) {
+        for (i = 0; i < count; ++i) {
+            snprintf(name, sizeof(name), "%s/fsync_%d/f_%ld", root, k, i);
+            unlink(name);
+        }
+        snprintf(name, sizeof(name), "%s/fsync_%d", root, k);
+        rmdir(name);
+    }
+    free(w);
+    return err;
+}
+
+int main(int argc, char *argv[])
+{
+    static const int threads[] = { 1, 8, 64 };
+    const char *root = argc > 1 ? argv[1] : "/mnt/bbssd";
+    long count = argc > 2 ? atol(argv[2]) : 1000;
+    int size = argc > 3 ? atoi(argv[3]) : 4096;
+    unsigned int i;
+
+    if (size < 0 || size > 4096 || count <= 0)
+        return 1;
+
+    printf("%ld files of %d bytes per thread\n", count, size);
+    for (i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i) {
+        if (round_run(root, threads[i], count, size))
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * 名字哈希对比：对几类常见的名字集合分别跑 murmur3、xxh64、siphash 和旧的固定种子 murmur3，
+ * 给出每次哈希的耗时，以及按内核的多选放置（HASH_PROBE_NUM 个候选桶、每桶 16 槽）
+ * 插进同一个目录后的桶负载：落在家桶的比例、探到第几个候选桶、放不下的个数，
+ * 以及家桶计数的标准差相对泊松分布的倍数（接近 1 说明分布和随机一样均匀）。
+ * 三种新算法和内核 hash.c 里的实现一致，都把父目录 ino 以小端 4 字节拼在名字前面。
+ * 编译: gcc -O2 -o test_hash test_hash.c
+ * 用法: ./test_hash [名字数] [装载率%]
+ */
+
+#define SLOTS 16
+#define PROBES 4
+
+enum { H_LEGACY, H_MURMUR3, H_XXH64, H_SIPHASH, H_NR };
+static const char *hash_names[H_NR] = { "legacy", "murmur3", "xxh64", "siphash" };
+
+enum { N_NUMERIC, N_UUID, N_PATH, N_NR };
+static const char *set_names[N_NR] = { "numeric", "uuid", "path" };
+
+static uint64_t key[2];
+static volatile uint32_t sink_out;  /* 不让编译器把计时循环优化掉 */
+
+/* 只在输出时开一次方，牛顿迭代就够了，省得链接 libm */
+static double root(double x)
+{
+    double r = x > 1 ? x : 1;
+    int i;
+
+    if (x <= 0)
+        return 0;
+    for (i = 0; i < 64; ++i)
+        r = (r + x / r) / 2;
+    return r;
+}
+
+static inline uint32_t rol32(uint32_t x, int r) { return (x << r) | (x >> (32 - r)); }
+static inline uint64_t rol64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint32_t le32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t le64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint32_t fmix32(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint32_t murmur3_body(uint32_t h1, uint32_t k1, const uint8_t *data, int len, int first)
+{
+    const uint8_t *tail = data + (len & ~3);
+    const uint32_t c1 = 0xcc9e2d51, c2 = 0x1b873593;
+
+    if (!first) {
+        if (data == tail)
+            goto tail;
+        k1 = le32(data);
+        data += 4;
+    }
+    for (;;) {
+        k1 *= c1;
+        k1 = rol32(k1, 15);
+        k1 *= c2;
+        h1 ^= k1;
+        h1 = rol32(h1, 13);
+        h1 = h1 * 5 + 0xe6546b64;
+        if (data == tail)
+            break;
+        k1 = le32(data);
+        data += 4;
+    }
+tail:
+    k1 = 0;
+    switch (len & 3) {
+    case 3: k1 ^= tail[2] << 16; /* fallthrough */
+    case 2: k1 ^= tail[1] << 8;  /* fallthrough */
+    case 1: k1 ^= tail[0];
+        k1 *= c1;
+        k1 = rol32(k1, 15);
+        k1 *= c2;
+        h1 ^= k1;
+    }
+    return h1;
+}
+
+/* 改动之前的 hash.c：固定种子 4397，父目录 ino 在最后异或进去 */
+static uint32_t hash_legacy(uint32_t dir, const char *name, int len)
+{
+    return fmix32(murmur3_body(4397, 0, (const uint8_t *)name, len, 0) ^ len) ^ dir;
+}
+
+static uint32_t hash_murmur3(uint32_t dir, const char *name, int len)
+{
+    return fmix32(murmur3_body((uint32_t)key[0], dir, (const uint8_t *)name, len, 1) ^ (len + 4));
+}
+
+#define P1 0x9E3779B185EBCA87ULL
+#define P2 0xC2B2AE3D27D4EB4FULL
+#define P3 0x165667B19E3779F9ULL
+#define P4 0x85EBCA77C2B2AE63ULL
+#define P5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t in)
+{
+    acc += in * P2;
+    acc = rol64(acc, 31);
+    return acc * P1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t v)
+{
+    acc ^= xxh64_round(0, v);
+    return acc * P1 + P4;
+}
+
+static uint64_t xxh64(const uint8_t *p, size_t len, uint64_t seed)
+{
+    const uint8_t *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        do {
+            v1 = xxh64_round(v1, le64(p));
+            v2 = xxh64_round(v2, le64(p + 8));
+            v3 = xxh64_round(v3, le64(p + 16));
+            v4 = xxh64_round(v4, le64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = rol64(v1, 1) + rol64(v2, 7) + rol64(v3, 12) + rol64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+    h += len;
+    for (; p + 8 <= end; p += 8)
+        h = rol64(h ^ xxh64_round(0, le64(p)), 27) * P1 + P4;
+    if (p + 4 <= end) {
+        h = rol64(h ^ (uint64_t)le32(p) * P1, 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = rol64(h ^ *p * P5, 11) * P1;
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+#define SIPROUND do { \
+    v0 += v1; v1 = rol64(v1, 13); v1 ^= v0; v0 = rol64(v0, 32); \
+    v2 += v3; v3 = rol64(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = rol64(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = rol64(v1, 17); v1 ^= v2; v2 = rol64(v2, 32); \
+} while (0)
+
+/* siphash-2-4，和内核 lib/siphash.c 的 siphash() 相同 */
+static uint64_t siphash(const uint8_t *p, size_t len, const uint64_t k[2])
+{
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ k[1];
+    uint64_t b = (uint64_t)len << 56, m;
+    const uint8_t *end = p + (len & ~7);
+    int left = len & 7;
+
+    for (; p != end; p += 8) {
+        m = le64(p);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    switch (left) {
+    case 7: b |= (uint64_t)p[6] << 48; /* fallthrough */
+    case 6: b |= (uint64_t)p[5] << 40; /* fallthrough */
+    case 5: b |= (uint64_t)p[4] << 32; /* fallthrough */
+    case 4: b |= (uint64_t)p[3] << 24; /* fallthrough */
+    case 3: b |= (uint64_t)p[2] << 16; /* fallthrough */
+    case 2: b |= (uint64_t)p[1] << 8;  /* fallthrough */
+    case 1: b |= (uint64_t)p[0];
+    }
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* 和内核一样把 ino 拼在名字前面一次算完 */
+static uint32_t hash_prefixed(int alg, uint32_t dir, const char *name, int len)
+{
+    uint8_t buf[4 + 256];
+    uint64_t h;
+
+    memcpy(buf, &dir, 4);
+    memcpy(buf + 4, name, len);
+    if (alg == H_XXH64)
+        h = xxh64(buf, len + 4, key[0]);
+    else
+        h = siphash(buf, len + 4, key);
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static uint32_t name_hash(int alg, uint32_t dir, const char *name, int len)
+{
+    switch (alg) {
+    case H_LEGACY:
+        return hash_legacy(dir, name, len);
+    case H_MURMUR3:
+        return hash_murmur3(dir, name, len);
+    default:
+        return hash_prefixed(alg, dir, name, len);
+    }
+}
+
+struct name {
+    char s[64];
+    int len;
+};
+
+static void gen_names(struct name *names, long n, int set)
+{
+    static const char hex[] = "0123456789abcdef";
+    long i;
+    int k;
+
+    for (i = 0; i < n; ++i) {
+        char *s = names[i].s;
+        switch (set) {
+        case N_NUMERIC:
+            names[i].len = sprintf(s, "%ld", i);
+            break;
+        case N_UUID:
+            for (k = 0; k < 36; ++k)
+                s[k] = (k == 8 || k == 13 || k == 18 || k == 23) ? '-' : hex[rand() & 15];
+            s[36] = 0;
+            names[i].len = 36;
+            break;
+        default:
+            /* 训练数据和日志常见的长公共前缀、只有尾部几位不同 */
+            names[i].len = sprintf(s, "shard-%05ld-of-01024_img_%08ld.jpg", i % 1024, i);
+            break;
+        }
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 同 hash.c 的 hash_probe_lba，桶号从 0 开始 */
+static uint32_t probe_bucket(uint32_t hash, int probe, uint32_t nr)
+{
+    uint32_t step = 1 + (((hash >> 16) | (hash << 16)) % (nr - 1));
+    return ((hash % nr) + (uint64_t)probe * step) % nr;
+}
+
+static void run(int alg, int set, struct name *names, long n, uint32_t nr_buckets)
+{
+    uint8_t *load = calloc(nr_buckets, 1);
+    uint32_t *home = calloc(nr_buckets, sizeof(uint32_t));
+    long placed[PROBES] = { 0 }, failed = 0;
+    double t0, t, mean, var = 0;
+    uint32_t sink = 0, h, b, max_home = 0;
+    long i;
+    int p, rep, reps = n < 1000000 ? 1000000 / n + 1 : 1;
+
+    if (!load || !home) {
+        perror("calloc");
+        exit(1);
+    }
+
+    t0 = now();
+    for (rep = 0; rep < reps; ++rep)
+        for (i = 0; i < n; ++i)
+            sink += name_hash(alg, 16, names[i].s, names[i].len);
+    t = now() - t0;
+    sink_out = sink;
+
+    for (i = 0; i < n; ++i) {
+        h = name_hash(alg, 16, names[i].s, names[i].len);
+        ++home[h % nr_buckets];
+        for (p = 0; p < PROBES; ++p) {
+            b = probe_bucket(h, p, nr_buckets);
+            if (load[b] < SLOTS) {
+                ++load[b];
+                ++placed[p];
+                break;
+            }
+        }
+        if (p == PROBES)
+            ++failed;
+    }
+
+    mean = (double)n / nr_buckets;
+    for (b = 0; b < nr_buckets; ++b) {
+        var += (home[b] - mean) * (home[b] - mean);
+        if (home[b] > max_home)
+            max_home = home[b];
+    }
+    var /= nr_buckets;
+
+    printf("%-8s %-8s %8.1f %8.2f%% %7.2f%% %7.2f%% %7.2f%% %8ld %8u %7.3f\n",
+           set_names[set], hash_names[alg], t * 1e9 / ((double)n * reps),
+           100.0 * placed[0] / n, 100.0 * placed[1] / n, 100.0 * placed[2] / n, 100.0 * placed[3] / n,
+           failed, max_home, root(var / mean));
+    free(load);
+    free(home);
+}
+
+int main(int argc, char *argv[])
+{
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    int load = argc > 2 ? atoi(argv[2]) : 70;
+    uint32_t nr_buckets;
+    struct name *names;
+    int set, alg;
+
+    if (n <= 0 || load < 10 || load > 100)
+        return 1;
+    nr_buckets = (n * 100 + SLOTS * load - 1) / (SLOTS * load);
+    if (nr_buckets < 2)
+        nr_buckets = 2;
+
+    srand(time(NULL));
+    key[0] = (uint64_t)rand() << 32 ^ rand();
+    key[1] = (uint64_t)rand() << 32 ^ rand();
+    names = malloc(n * sizeof(*names));
+    if (!names)
+        return 1;
+
+    printf("%ld names in one directory, %u buckets of %d slots (%d%% load)\n", n, nr_buckets, SLOTS, load);
+    printf("set      hash      ns/hash     home   probe1   probe2   probe3   failed max_home  sd/poisson\n");
+    for (set = 0; set < N_NR; ++set) {
+        gen_names(names, n, set);
+        for (alg = 0; alg < H_NR; ++alg)
+            run(alg, set, names, n, nr_buckets);
+    }
+    free(names);
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * 多线程建删：每个线程在自己的子目录里 creat N 个空文件，全部建完后再逐个 unlink，
+ * 线程数从 1 翻倍到 64，给出建、删的总吞吐和相对单线程的加速比。
+ * 同一目录的建删由 VFS 的目录锁串行，这里测的是不同目录落到同一批桶上时能否并行。
+ * 想排除设备的影响就挂在 brd 上：
+ *   modprobe brd rd_nr=1 rd_size=4194304 && ./mkfs.himfs /dev/ram0 && mount -t himfs /dev/ram0 /mnt/bbssd
+ * 编译: gcc -O2 -o test_mt_creat test_mt_creat.c -lpthread
+ * 用法: ./test_mt_creat [dir] [每线程文件数] [最大线程数]
+ */
+
+struct worker {
+    pthread_t tid;
+    const char *root;
+    int id;
+    long count;
+    int err;
+};
+
+static pthread_barrier_t barrier;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *run(void *arg)
+{
+    struct worker *w = arg;
+    char name[4096];
+    long i;
+
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < w->count; ++i) {
+        int fd;
+        snprintf(name, sizeof(name), "%s/mt_%d/f_%ld", w->root, w->id, i);
+        fd = creat(name, 0644);
+        if (fd < 0) {
+            perror(name);
+            w->err = 1;
+            break;
+        }
+        close(fd);
+    }
+
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < w->count; ++i) {
+        snprintf(name, sizeof(name), "%s/mt_%d/f_%ld", w->root, w->id, i);
+        if (unlink(name) && !w->err) {
+            perror(name);
+            w->err = 1;
+        }
+    }
+    pthread_barrier_wait(&barrier);
+    return NULL;
+}
+
+/* 主线程也参与栅栏，用来分别计时建和删两个阶段 */
+static int round_run(const char *root, int nthreads, long count, double *create_rate, double *unlink_rate)
+{
+    struct worker *w = calloc(nthreads, sizeof(*w));
+    char name[4096];
+    double t0, t1, t2;
+    int k, err = 0;
+
+    if (!w)
+        return 1;
+    for (k = 0; k < nthreads; ++k) {
+        snprintf(name, sizeof(name), "%s/mt_%d", root, k);
+        if (mkdir(name, 0755) && errno != EEXIST) {
+            perror(name);
+            free(w);
+            return 1;
+        }
+    }
+
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (k = 0; k < nthreads; ++k) {
+        w[k].root = root;
+        w[k].id = k;
+        w[k].count = count;
+        pthread_create(&w[k].tid, NULL, run, &w[k]);
+    }
+    pthread_barrier_wait(&barrier);
+    t0 = now();
+    pthread_barrier_wait(&barrier);
+    t1 = now();
+    pthread_barrier_wait(&barrier);
+    t2 = now();
+    for (k = 0; k < nthreads; ++k) {
+        pthread_join(w[k].tid, NULL);
+        err |= w[k].err;
+    }
+    pthread_barrier_destroy(&barrier);
+
+    *create_rate = nthreads * count / (t1 - t0);
+    *unlink_rate = nthreads * count / (t2 - t1);
+
+    for (k = 0; k < nthreads; ++k) {
+        snprintf(name, sizeof(name), "%s/mt_%d", root, k);
+        rmdir(name);
+    }
+    free(w);
+    return err;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *root = argc > 1 ? argv[1] : "/mnt/bbssd";
+    long count = argc > 2 ? atol(argv[2]) : 20000;
+    int max_threads = argc > 3 ? atoi(argv[3]) : 64;
+    double create_rate, unlink_rate, create_base = 0, unlink_base = 0;
+    int n;
+
+    if (count <= 0 || max_threads <= 0)
+        return 1;
+
+    printf("%ld files per thread\n", count);
+    printf("threads   creates/s  speedup   unlinks/s  speedup\n");
+    for (n = 1; n <= max_threads; n *= 2) {
+        if (round_run(root, n, count, &create_rate, &unlink_rate))
+            return 1;
+        if (n == 1) {
+            create_base = create_rate;
+            unlink_base = unlink_rate;
+        }
+        printf("%7d %11.0f %8.2f %11.0f %8.2f\n", n,
+               create_rate, create_rate / create_base,
+               unlink_rate, unlink_rate / unlink_base);
+    }
+    return 0;
+}
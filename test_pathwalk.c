@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * 冷缓存下深路径的 stat：建 T 棵互不相交的目录链 pw/t<k>/d1/.../d<D>/f，
+ * 每轮先 drop_caches，再逐个 stat 每条链末端的文件，给出每次 stat 的平均、p50、p99 延迟。
+ * 每条路径的 dentry 和桶都不在缓存里，逐级查找要读 D+2 个随机的桶；
+ * 开路径预取时第一级就能把后面几级的桶一起发出去。
+ * 分别挂载两次对比，需要 root：
+ *   mount -t himfs -o noprefetch /dev/nvme0n1 /mnt/bbssd && ./test_pathwalk -l off
+ *   mount -t himfs /dev/nvme0n1 /mnt/bbssd && ./test_pathwalk -l on
+ * 提示表只在内存里，重新挂载后第一轮会先把它建起来，所以默认跑 3 轮，看后面几轮。
+ * 编译: gcc -O2 -o test_pathwalk test_pathwalk.c
+ * 用法: ./test_pathwalk [-d dir] [-t 路径数] [-D 深度] [-r 轮数] [-k] [-l 标签]
+ *   -k  跑完不删目录树，下次直接复用（深度和路径数要一样）
+ */
+
+static const char *root = "/mnt/bbssd";
+static int ntrees = 1000;
+static int depth = 8;
+static int rounds = 3;
+static int keep;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int drop_caches(void)
+{
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+
+    sync();
+    if (fd < 0 || write(fd, "3", 1) != 1) {
+        perror("drop_caches");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+/* 第 k 棵树第 level 级的路径，level 为 depth + 1 时是末端文件 */
+static int tree_path(char *buf, size_t len, int k, int level)
+{
+    int n = snprintf(buf, len, "%s/pw/t%d", root, k);
+    int i;
+
+    for (i = 1; i <= level && i <= depth; ++i)
+        n += snprintf(buf + n, len - n, "/d%d", i);
+    if (level > depth)
+        n += snprintf(buf + n, len - n, "/f");
+    return n;
+}
+
+static int build(void)
+{
+    char path[4096];
+    int k, level, fd;
+
+    snprintf(path, sizeof(path), "%s/pw", root);
+    if (mkdir(path, 0755) && errno != EEXIST) {
+        perror(path);
+        return -1;
+    }
+    for (k = 0; k < ntrees; ++k) {
+        for (level = 0; level <= depth; ++level) {
+            tree_path(path, sizeof(path), k, level);
+            if (mkdir(path, 0755) && errno != EEXIST) {
+                perror(path);
+                return -1;
+            }
+        }
+        tree_path(path, sizeof(path), k, depth + 1);
+        fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd < 0) {
+            perror(path);
+            return -1;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+static void destroy(void)
+{
+    char path[4096];
+    int k, level;
+
+    for (k = 0; k < ntrees; ++k) {
+        tree_path(path, sizeof(path), k, depth + 1);
+        unlink(path);
+        for (level = depth; level >= 0; --level) {
+            tree_path(path, sizeof(path), k, level);
+            rmdir(path);
+        }
+    }
+    snprintf(path, sizeof(path), "%s/pw", root);
+    rmdir(path);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *label = "";
+    char path[4096];
+    struct stat st;
+    uint64_t *lat, t0, sum;
+    int opt, r, k;
+
+    while ((opt = getopt(argc, argv, "d:t:D:r:kl:")) != -1) {
+        switch (opt) {
+        case 'd':
+            root = optarg;
+            break;
+        case 't':
+            ntrees = atoi(optarg);
+            break;
+        case 'D':
+            depth = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'k':
+            keep = 1;
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d dir] [-t paths] [-D depth] [-r rounds] [-k] [-l label]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (ntrees <= 0 || depth < 0 || depth > 64 || rounds <= 0)
+        return 1;
+
+    lat = calloc(ntrees, sizeof(*lat));
+    if (!lat || build())
+        return 1;
+
+    printf("%s%d paths of depth %d\n", label, ntrees, depth + 2);
+    printf("%sround   avg(us)   p50(us)   p99(us)\n", label);
+    for (r = 0; r < rounds; ++r) {
+        if (drop_caches())
+            return 1;
+        sum = 0;
+        for (k = 0; k < ntrees; ++k) {
+            tree_path(path, sizeof(path), k, depth + 1);
+            t0 = now_ns();
+            if (stat(path, &st)) {
+                perror(path);
+                return 1;
+            }
+            lat[k] = now_ns() - t0;
+            sum += lat[k];
+        }
+        qsort(lat, ntrees, sizeof(*lat), cmp_u64);
+        printf("%s%5d %9.1f %9.1f %9.1f\n", label, r, sum / 1000.0 / ntrees,
+               lat[ntrees / 2] / 1000.0, lat[(int)(ntrees * 0.99)] / 1000.0);
+        fflush(stdout);
+    }
+
+    if (!keep)
+        destroy();
+    free(lat);
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * 用户态模拟 hash.c 的多选放置策略：按 10%..95% 的填充率逐段插入，
+ * 统计每段的创建成功率、落在家桶的比例、命中查找和未命中查找平均读多少个桶。
+ * 用法: ./test_probe [桶数] [每桶候选数] [每桶槽数]
+ * 比较新旧桶格式时保持元数据区字节数不变：8 槽用 N 个桶，16 槽用 N/2 个桶。
+ */
+
+#define SLOT_MAX 32
+#define OVERFLOW_MAX 0xFFFF
+
+struct bucket
+{
+    uint32_t used;
+    uint16_t overflow;
+    uint32_t key[SLOT_MAX];
+};
+
+static uint32_t nr_buckets = 1 << 16;
+static int probe_num = 4;
+static int slot_num = 16;
+static uint64_t home_hits;
+static struct bucket *buckets;
+
+static uint32_t murmurHash3(uint32_t key1, const char* key2, int len)
+{
+    const uint8_t *data = (const uint8_t *)key2;
+    const int nblocks = len / 4;
+    uint32_t h1 = 4397;
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
+    const uint8_t *tail;
+    uint32_t k1;
+    int i;
+
+    for (i = 0; i < nblocks; i++) {
+        memcpy(&k1, data + i * 4, 4);
+        k1 *= c1;
+        k1 = (k1 << 15) | (k1 >> (32 - 15));
+        k1 *= c2;
+        h1 ^= k1;
+        h1 = (h1 << 13) | (h1 >> (32 - 13));
+        h1 = h1 * 5 + 0xe6546b64;
+    }
+
+    tail = data + nblocks * 4;
+    k1 = 0;
+    switch (len & 3) {
+        case 3: k1 ^= tail[2] << 16;
+                /* fall through */
+        case 2: k1 ^= tail[1] << 8;
+                /* fall through */
+        case 1: k1 ^= tail[0];
+                k1 *= c1;
+                k1 = (k1 << 15) | (k1 >> (32 - 15));
+                k1 *= c2;
+                h1 ^= k1;
+    }
+
+    h1 ^= len;
+    h1 ^= h1 >> 16;
+    h1 *= 0x85ebca6b;
+    h1 ^= h1 >> 13;
+    h1 *= 0xc2b2ae35;
+    h1 ^= h1 >> 16;
+    h1 ^= key1;
+    return h1;
+}
+
+static uint32_t probe_bucket(uint32_t hash, int probe)
+{
+    uint32_t step = 1 + (((hash >> 16) | (hash << 16)) % (nr_buckets - 1));
+    return ((hash % nr_buckets) + (uint64_t)probe * step) % nr_buckets;
+}
+
+static uint32_t key_hash(uint32_t id)
+{
+    char name[16];
+    int len = sprintf(name, "%u", id);
+    return murmurHash3(8, name, len);
+}
+
+static int insert(uint32_t id)
+{
+    uint32_t hash = key_hash(id);
+    int p, i, slot;
+
+    for (p = 0; p < probe_num; ++p) {
+        struct bucket *b = &buckets[probe_bucket(hash, p)];
+        if (b->used == (uint32_t)((1ULL << slot_num) - 1))
+            continue;
+        for (slot = 0; b->used & (1U << slot); ++slot)
+            ;
+        b->used |= 1U << slot;
+        b->key[slot] = id;
+        if (p == 0)
+            home_hits++;
+        for (i = 0; i < p; ++i) {
+            struct bucket *passed = &buckets[probe_bucket(hash, i)];
+            if (passed->overflow != OVERFLOW_MAX)
+                passed->overflow++;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* 返回读了多少个桶，*found 表示是否命中 */
+static int lookup(uint32_t id, int *found)
+{
+    uint32_t hash = key_hash(id);
+    int p, slot;
+
+    *found = 0;
+    for (p = 0; p < probe_num; ++p) {
+        struct bucket *b = &buckets[probe_bucket(hash, p)];
+        for (slot = 0; slot < slot_num; ++slot) {
+            if ((b->used & (1U << slot)) && b->key[slot] == id) {
+                *found = 1;
+                return p + 1;
+            }
+        }
+        if (b->overflow == 0)
+            return p + 1;
+    }
+    return probe_num;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t capacity, target, inserted = 0;
+    uint32_t next_id = 0, miss_id = 0x80000000u;
+    int level, found, i;
+
+    if (argc > 1)
+        nr_buckets = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        probe_num = atoi(argv[2]);
+    if (argc > 3)
+        slot_num = atoi(argv[3]);
+    if (slot_num < 1 || slot_num > SLOT_MAX)
+        return 1;
+
+    buckets = calloc(nr_buckets, sizeof(*buckets));
+    if (!buckets)
+        return 1;
+    capacity = (uint64_t)nr_buckets * slot_num;
+
+    printf("buckets=%u slots=%d probes=%d\n", nr_buckets, slot_num, probe_num);
+    printf("%6s %10s %10s %10s %12s %12s\n", "fill", "attempts", "success%", "home%", "hit_reads", "miss_reads");
+
+    for (level = 10; level <= 95; level += (level < 90 ? 10 : 5)) {
+        uint64_t attempts = 0, ok = 0, hit_reads = 0, miss_reads = 0;
+        uint64_t home_before = home_hits;
+        int samples = 100000;
+
+        target = capacity * level / 100;
+        while (inserted < target) {
+            attempts++;
+            if (insert(next_id++)) {
+                ok++;
+                inserted++;
+            }
+            /* 连续失败说明已经到达极限负载 */
+            if (attempts - ok > capacity / 100)
+                break;
+        }
+
+        for (i = 0; i < samples; ++i) {
+            hit_reads += lookup((uint32_t)(((uint64_t)rand() * next_id) / ((uint64_t)RAND_MAX + 1)), &found);
+            miss_reads += lookup(miss_id++, &found);
+        }
+
+        printf("%5d%% %10llu %9.2f%% %9.2f%% %12.3f %12.3f\n", level,
+               (unsigned long long)attempts,
+               attempts ? 100.0 * ok / attempts : 100.0,
+               ok ? 100.0 * (home_hits - home_before) / ok : 100.0,
+               (double)hit_reads / samples, (double)miss_reads / samples);
+    }
+
+    free(buckets);
+    return 0;
+}
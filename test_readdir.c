@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * 目录列举耗时：在 <dir> 下建 1k/100k/1M 个文件的子目录（已存在则跳过），
+ * 每个子目录用 readdir 列两遍，分别给出冷（先 drop_caches，需要 root）和热的耗时。
+ * himfs 与 ext4 各挂一次（run.sh / ext4_mount.sh）跑同一命令即可对比。
+ * 用法: ./test_readdir [dir] [最大文件数]
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void drop_caches(void)
+{
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    sync();
+    if (fd >= 0) {
+        if (write(fd, "3", 1) != 1)
+            perror("drop_caches");
+        close(fd);
+    }
+}
+
+static int populate(const char *dir, long count)
+{
+    char name[4096 + 32];       /* 目录前缀加 /f 和编号 */
+    struct stat st;
+    long i;
+
+    if (mkdir(dir, 0755) && stat(dir, &st))
+        return -1;
+
+    for (i = 0; i < count; ++i) {
+        int fd;
+        snprintf(name, sizeof(name), "%s/f%ld", dir, i);
+        fd = open(name, O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (fd >= 0)
+            close(fd);
+    }
+    return 0;
+}
+
+static long list(const char *dir, double *secs)
+{
+    DIR *d;
+    struct dirent *de;
+    long n = 0;
+    double t0 = now();
+
+    d = opendir(dir);
+    if (!d)
+        return -1;
+    while ((de = readdir(d)) != NULL)
+        n++;
+    closedir(d);
+    *secs = now() - t0;
+    return n - 2;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *root = argc > 1 ? argv[1] : "/mnt/bbssd";
+    long max = argc > 2 ? atol(argv[2]) : 1000000;
+    long sizes[] = { 1000, 100000, 1000000 };
+    char dir[4096];
+    unsigned int i;
+
+    printf("%10s %10s %12s %12s %14s\n", "entries", "listed", "cold ms", "warm ms", "warm ns/entry");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        double cold, warm;
+        long n;
+
+        if (sizes[i] > max)
+            break;
+        snprintf(dir, sizeof(dir), "%s/readdir_%ld", root, sizes[i]);
+        if (populate(dir, sizes[i])) {
+            perror(dir);
+            return 1;
+        }
+
+        drop_caches();
+        n = list(dir, &cold);
+        list(dir, &warm);
+        printf("%10ld %10ld %12.2f %12.2f %14.1f\n", sizes[i], n, cold * 1e3, warm * 1e3,
+               n > 0 ? warm * 1e9 / n : 0.0);
+    }
+    return 0;
+}
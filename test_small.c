@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * 小文件：在 <dir> 下建 N 个 <size> 字节的文件，每个 create+write+fsync，
+ * 再 drop_caches 后逐个 open+read，给出每个文件的平均耗时和 st_blocks 占用。
+ * 内联文件的 fsync 只写一个桶，读也只需要查找时读到的那个桶。
+ * 用法: ./test_small [dir] [文件数] [文件大小]
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void drop_caches(void)
+{
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    sync();
+    if (fd >= 0) {
+        if (write(fd, "3", 1) != 1)
+            perror("drop_caches");
+        close(fd);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *root = argc > 1 ? argv[1] : "/mnt/bbssd";
+    long count = argc > 2 ? atol(argv[2]) : 10000;
+    int size = argc > 3 ? atoi(argv[3]) : 100;
+    char name[4096], buf[4096];
+    long long blocks = 0;
+    struct stat st;
+    double t0, tw, tr;
+    long i;
+
+    if (size < 0 || size > (int)sizeof(buf))
+        return 1;
+    memset(buf, 'x', size);
+
+    t0 = now();
+    for (i = 0; i < count; ++i) {
+        int fd;
+        snprintf(name, sizeof(name), "%s/small_%ld", root, i);
+        fd = open(name, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (fd < 0 || write(fd, buf, size) != size || fsync(fd)) {
+            perror(name);
+            return 1;
+        }
+        close(fd);
+    }
+    tw = now() - t0;
+
+    drop_caches();
+    t0 = now();
+    for (i = 0; i < count; ++i) {
+        int fd;
+        snprintf(name, sizeof(name), "%s/small_%ld", root, i);
+        fd = open(name, O_RDONLY);
+        if (fd < 0 || read(fd, buf, sizeof(buf)) != size) {
+            perror(name);
+            return 1;
+        }
+        if (fstat(fd, &st) == 0)
+            blocks += st.st_blocks;
+        close(fd);
+    }
+    tr = now() - t0;
+
+    printf("%ld files of %d bytes\n", count, size);
+    printf("create+write+fsync %8.1f us/file\n", tw * 1e6 / count);
+    printf("cold open+read     %8.1f us/file\n", tr * 1e6 / count);
+    printf("allocated          %8.1f KiB/file\n", blocks * 512.0 / 1024 / count);
+
+    for (i = 0; i < count; ++i) {
+        snprintf(name, sizeof(name), "%s/small_%ld", root, i);
+        unlink(name);
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "himfs_format.h"
+
+/*
+ * 满桶查找的 CPU 开销对比：
+ *   strcmp  - 旧做法，逐个已占用槽 strcmp 名字
+ *   tag     - 先用桶头 tag 数组做字宽比较选出候选槽，只比对候选槽的名字
+ * 桶布局直接用 himfs_format.h 里的 himfs_meta_block，名字放在桶尾的名字堆里，
+ * 桶数默认 16384 (64 MiB)，超出 LLC。
+ * 编译: gcc -O2 -o test_tags test_tags.c
+ * 用法: ./test_tags [桶数] [查找次数]
+ */
+
+#define SLOT_NUM HASH_SLOT_NUM
+#define TAGS_PER_WORD HASH_TAGS_PER_WORD
+
+static uint32_t name_hash(const char *name, int len)
+{
+    uint32_t h = 2166136261u;
+    while (len--)
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+    return h;
+}
+
+static uint16_t make_tag(uint32_t hash, int len)
+{
+    return (uint16_t)((((hash >> 8) & 0xff) << 8) | (len & 0xff));
+}
+
+static unsigned long tag_match(struct himfs_meta_block *mb, uint16_t tag)
+{
+    const uint64_t ones = 0x0001000100010001ULL;
+    const uint64_t highs = 0x8000800080008000ULL;
+    unsigned long mask = 0;
+    uint64_t x, z;
+    int w;
+
+    for (w = 0; w < SLOT_NUM / TAGS_PER_WORD; ++w) {
+        x = mb->tags[w] ^ (tag * ones);
+        z = (x - ones) & ~x & highs;
+        while (z) {
+            mask |= 1UL << (w * TAGS_PER_WORD + (__builtin_ctzll(z) >> 4));
+            z &= z - 1;
+        }
+    }
+    return mask;
+}
+
+/* 名字在堆里以 NUL 结尾存放，strcmp 做法才能直接比较 */
+static const char *slot_name(struct himfs_meta_block *mb, int i)
+{
+    return (const char *)mb + mb->himfs_inode[i].i_name_off;
+}
+
+struct query
+{
+    unsigned int bucket;
+    int len;
+    uint32_t hash;      /* 内核里选桶时已算出，这里预先算好不计入查找开销 */
+    char name[40];
+};
+
+static int lookup_strcmp(struct himfs_meta_block *mb, const char *name, int len, uint32_t hash)
+{
+    int i;
+    (void)len;
+    (void)hash;
+    for (i = 0; i < SLOT_NUM; ++i)
+        if ((mb->slot_bitmap[0] & (1UL << i)) && strcmp(slot_name(mb, i), name) == 0)
+            return i;
+    return -1;
+}
+
+static int lookup_tag(struct himfs_meta_block *mb, const char *name, int len, uint32_t hash)
+{
+    unsigned long cand = tag_match(mb, make_tag(hash, len)) & mb->slot_bitmap[0];
+
+    while (cand) {
+        int i = __builtin_ctzl(cand);
+        if (mb->himfs_inode[i].i_name_len == len && memcmp(slot_name(mb, i), name, len) == 0)
+            return i;
+        cand &= cand - 1;
+    }
+    return -1;
+}
+
+static void make_name(char *buf, unsigned int b, unsigned int s)
+{
+    /* 长度相近的路径式名字，让 strcmp 必须比较较长的公共前缀 */
+    sprintf(buf, "ingest-part-%08u-%02u.dat", b, s);
+}
+
+static struct query *make_queries(unsigned int nr, long ops, int hit)
+{
+    struct query *q = malloc(ops * sizeof(*q));
+    unsigned int seed = hit + 1;
+    long i;
+
+    for (i = 0; q && i < ops; ++i) {
+        q[i].bucket = rand_r(&seed) % nr;
+        make_name(q[i].name, hit ? q[i].bucket : q[i].bucket + nr, i % SLOT_NUM);
+        q[i].len = strlen(q[i].name);
+        q[i].hash = name_hash(q[i].name, q[i].len);
+    }
+    return q;
+}
+
+static double run(struct himfs_meta_block *mbs, struct query *q, long ops, int hit,
+                  int (*fn)(struct himfs_meta_block *, const char *, int, uint32_t))
+{
+    struct timespec t0, t1;
+    long found = 0, i;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < ops; ++i)
+        found += fn(&mbs[q[i].bucket], q[i].name, q[i].len, q[i].hash) >= 0;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (found != (hit ? ops : 0))
+        fprintf(stderr, "unexpected result %ld\n", found);
+    return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / ops;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int nr = 16384, b, s;
+    long ops = 4000000;
+    struct himfs_meta_block *mbs;
+    struct query *hits, *misses;
+
+    if (argc > 1)
+        nr = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        ops = strtol(argv[2], NULL, 0);
+
+    mbs = calloc(nr, sizeof(*mbs));
+    if (!mbs)
+        return 1;
+
+    for (b = 0; b < nr; ++b) {
+        struct himfs_meta_block *mb = &mbs[b];
+        int top = HIMFS_HEAP_END;
+
+        for (s = 0; s < SLOT_NUM; ++s) {
+            struct himfs_inode *di = &mb->himfs_inode[s];
+            char name[40];
+            uint16_t tag;
+            int len;
+
+            /* 和内核一样从块尾往前分配名字 */
+            make_name(name, b, s);
+            len = strlen(name);
+            top -= len + 1;
+            memcpy((char *)mb + top, name, len + 1);
+            di->i_name_off = top;
+            di->i_name_len = len;
+            tag = make_tag(name_hash(name, len), len);
+            mb->tags[s / TAGS_PER_WORD] |= (uint64_t)tag << ((s % TAGS_PER_WORD) * 16);
+            mb->slot_bitmap[0] |= 1UL << s;
+        }
+        mb->heap_low = top;
+    }
+
+    hits = make_queries(nr, ops, 1);
+    misses = make_queries(nr, ops, 0);
+    if (!hits || !misses)
+        return 1;
+
+    printf("bucket size %zu, %u full buckets, %ld lookups\n", sizeof(struct himfs_meta_block), nr, ops);
+    printf("%-8s %10s %10s\n", "method", "hit ns", "miss ns");
+    printf("%-8s %10.1f %10.1f\n", "strcmp",
+           run(mbs, hits, ops, 1, lookup_strcmp), run(mbs, misses, ops, 0, lookup_strcmp));
+    printf("%-8s %10.1f %10.1f\n", "tag",
+           run(mbs, hits, ops, 1, lookup_tag), run(mbs, misses, ops, 0, lookup_tag));
+
+    free(hits);
+    free(misses);
+    free(mbs);
+    return 0;
+}
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include "himfs_ioctl.h"
+
+/*
+ * 元数据预热的效果：建 N 个文件分在 D 个目录里，drop_caches 模拟重启后的冷缓存，
+ * 然后随机 stat M 个已有的文件，给出平均、p50、p99 延迟。-w 选预热方式：
+ *   none  不预热，每次查找都读一个冷桶
+ *   wait  先用 ioctl 启动预热并等它跑完，打印预热用时，再测查找
+ *   bg    启动预热后马上测查找，和预热并发，看服务期间的尾延迟
+ * drop_caches 会通过 shrinker 清掉桶缓存，不用重新挂载。需要 root：
+ *   mount -t himfs /dev/nvme0n1 /mnt/bbssd
+ *   ./test_warmup -w none -k; ./test_warmup -w wait -k; ./test_warmup -w bg
+ * 也可以用 -o warmup 挂载，在 /proc/fs/himfs/<设备>/warmup 里看进度。
+ * 编译: gcc -O2 -o test_warmup test_warmup.c
+ * 用法: ./test_warmup [-d dir] [-n 文件数] [-D 目录数] [-m 查找数] [-t 预热线程] [-b MB/s] [-w none|wait|bg] [-k]
+ *   -k  跑完不删文件，下次直接复用（文件数和目录数要一样）
+ */
+
+static const char *root = "/mnt/bbssd";
+static long nfiles = 1000000;
+static int ndirs = 100;
+static long nlookups = 20000;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int drop_caches(void)
+{
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+
+    sync();
+    if (fd < 0 || write(fd, "3", 1) != 1) {
+        perror("drop_caches");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+static void file_path(char *buf, size_t len, long i)
+{
+    snprintf(buf, len, "%s/wu/d%ld/f%ld", root, i % ndirs, i);
+}
+
+static int build(void)
+{
+    char path[4096];
+    struct stat st;
+    long i;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/wu", root);
+    if (mkdir(path, 0755) && errno != EEXIST) {
+        perror(path);
+        return -1;
+    }
+    for (i = 0; i < ndirs; ++i) {
+        snprintf(path, sizeof(path), "%s/wu/d%ld", root, i);
+        if (mkdir(path, 0755) && errno != EEXIST) {
+            perror(path);
+            return -1;
+        }
+    }
+    /* 最后一个文件在就认为上次 -k 留下的完整 */
+    file_path(path, sizeof(path), nfiles - 1);
+    if (stat(path, &st) == 0)
+        return 0;
+    for (i = 0; i < nfiles; ++i) {
+        file_path(path, sizeof(path), i);
+        fd = creat(path, 0644);
+        if (fd < 0) {
+            perror(path);
+            return -1;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+static void destroy(void)
+{
+    char path[4096];
+    long i;
+
+    for (i = 0; i < nfiles; ++i) {
+        file_path(path, sizeof(path), i);
+        unlink(path);
+    }
+    for (i = 0; i < ndirs; ++i) {
+        snprintf(path, sizeof(path), "%s/wu/d%ld", root, i);
+        rmdir(path);
+    }
+    snprintf(path, sizeof(path), "%s/wu", root);
+    rmdir(path);
+}
+
+static int warmup(int fd, uint32_t op, uint32_t threads, uint32_t mbps, struct himfs_warmup_ctl *ctl)
+{
+    memset(ctl, 0, sizeof(*ctl));
+    ctl->op = op;
+    ctl->threads = threads;
+    ctl->mbps = mbps;
+    if (ioctl(fd, HIMFS_IOC_WARMUP, ctl)) {
+        perror("HIMFS_IOC_WARMUP");
+        return -1;
+    }
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *mode = "none";
+    struct himfs_warmup_ctl ctl;
+    char path[4096];
+    struct stat st;
+    uint64_t *lat, t0, sum = 0;
+    unsigned int threads = 0, mbps = 0;
+    int opt, fd, keep = 0;
+    long i;
+
+    while ((opt = getopt(argc, argv, "d:n:D:m:t:b:w:k")) != -1) {
+        switch (opt) {
+        case 'd':
+            root = optarg;
+            break;
+        case 'n':
+            nfiles = atol(optarg);
+            break;
+        case 'D':
+            ndirs = atoi(optarg);
+            break;
+        case 'm':
+            nlookups = atol(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'b':
+            mbps = atoi(optarg);
+            break;
+        case 'w':
+            mode = optarg;
+            break;
+        case 'k':
+            keep = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d dir] [-n files] [-D dirs] [-m lookups] [-t threads] [-b mbps] "
+                    "[-w none|wait|bg] [-k]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (nfiles <= 0 || ndirs <= 0 || nlookups <= 0 ||
+        (strcmp(mode, "none") && strcmp(mode, "wait") && strcmp(mode, "bg")))
+        return 1;
+
+    lat = calloc(nlookups, sizeof(*lat));
+    if (!lat || build())
+        return 1;
+    fd = open(root, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        perror(root);
+        return 1;
+    }
+
+    /* 上一次跑剩的预热先停掉，再把缓存清空 */
+    if (warmup(fd, HIMFS_WARMUP_STOP, 0, 0, &ctl) || drop_caches())
+        return 1;
+
+    if (strcmp(mode, "none")) {
+        t0 = now_ns();
+        if (warmup(fd, HIMFS_WARMUP_START, threads, mbps, &ctl))
+            return 1;
+        while (!strcmp(mode, "wait") && ctl.state == HIMFS_WARMUP_RUNNING) {
+            usleep(10000);
+            if (warmup(fd, HIMFS_WARMUP_STATUS, 0, 0, &ctl))
+                return 1;
+        }
+        if (!strcmp(mode, "wait"))
+            printf("warmup: state %u, %llu/%llu buckets, %llu cached, %.1f ms (wall %.1f ms), %u threads\n",
+                   ctl.state, (unsigned long long)ctl.done, (unsigned long long)ctl.total,
+                   (unsigned long long)ctl.cached, ctl.elapsed_ns / 1e6, (now_ns() - t0) / 1e6, ctl.threads);
+    }
+
+    srandom(1);
+    for (i = 0; i < nlookups; ++i) {
+        file_path(path, sizeof(path), random() % nfiles);
+        t0 = now_ns();
+        if (stat(path, &st)) {
+            perror(path);
+            return 1;
+        }
+        lat[i] = now_ns() - t0;
+        sum += lat[i];
+    }
+    qsort(lat, nlookups, sizeof(*lat), cmp_u64);
+    printf("%-5s %ld lookups over %ld files: avg %.1f us, p50 %.1f us, p99 %.1f us\n", mode, nlookups, nfiles,
+           sum / 1000.0 / nlookups, lat[nlookups / 2] / 1000.0, lat[(long)(nlookups * 0.99)] / 1000.0);
+
+    if (!strcmp(mode, "bg")) {
+        if (warmup(fd, HIMFS_WARMUP_STATUS, 0, 0, &ctl))
+            return 1;
+        printf("warmup: state %u, %llu/%llu buckets after the lookups\n", ctl.state,
+               (unsigned long long)ctl.done, (unsigned long long)ctl.total);
+    }
+
+    close(fd);
+    if (!keep)
+        destroy();
+    free(lat);
+    return 0;
+}
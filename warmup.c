@@ -0,0 +1,395 @@
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/jiffies.h>
+#include <linux/workqueue.h>
+#include <linux/seq_file.h>
+#include <linux/proc_fs.h>
+#include <linux/blkdev.h>
+#include <linux/buffer_head.h>
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#include "himfs_ioctl.h"
+#include "hash.h"
+#include "fpindex.h"
+#include "stats.h"
+#include "bcache.h"
+#include "warmup.h"
+#endif
+
+/*
+ * 元数据预热：重启或切换之后元数据区整个是冷的，开始一段时间几乎每次查找都要付一次随机读。
+ * 这里在后台把元数据区按 HIMFS_WARMUP_CHUNK 个桶一段切开，一组工作线程从共享的游标上
+ * 各取一段，先在一个 plug 里把整段预读发出去，合成大块顺序读，再逐个桶解析进 DRAM 桶缓存；
+ * 没开桶缓存时读进来的缓冲本身就是缓存。查找缓存的是 inode 核心的副本，所以 inode 属性也一起热了。
+ *
+ * 哈希区没有记录哪些桶用过，指纹索引建好之后按它跳过空桶，没建好时只能整段都读。
+ * 放副本和查找一样在桶锁下进行，预热和正常的建删查互不影响。
+ * 读带宽按 mbps 限速，桶缓存占满预算就停，卸载或 ioctl 随时可以停下。
+ */
+
+struct warmup_worker
+{
+	struct work_struct work;
+	struct himfs_warmup *wu;
+};
+
+struct himfs_warmup
+{
+	struct super_block *sb;
+	struct workqueue_struct *wq;
+	struct mutex mutex;                 /* 串行化启动和停止 */
+	struct warmup_worker workers[HIMFS_WARMUP_THREADS_MAX];
+	atomic64_t cursor;                  /* 下一段的起始桶 */
+	atomic64_t done;                    /* 扫过的桶数 */
+	atomic64_t cached;                  /* 放进缓存的桶数 */
+	atomic_t running;                   /* 还没退出的工作线程 */
+	unsigned int threads;
+	unsigned int mbps;
+	int state;                          /* HIMFS_WARMUP_*，第一个停下的原因生效 */
+	bool stop;
+	u64 start_ns;
+	u64 end_ns;
+	wait_queue_head_t wait;             /* 限速睡眠，停止时唤醒 */
+};
+
+static const char * const warmup_states[] = {
+	[HIMFS_WARMUP_IDLE] = "idle",
+	[HIMFS_WARMUP_RUNNING] = "running",
+	[HIMFS_WARMUP_DONE] = "done",
+	[HIMFS_WARMUP_STOPPED] = "stopped",
+	[HIMFS_WARMUP_FULL] = "full",
+};
+
+/* 指纹索引说这个桶一个槽都没用、也没有溢出到后面的，就不用读 */
+static bool warmup_skip(struct super_block *sb, lba_t lba)
+{
+	return himfs_fpindex_ready(sb) &&
+		himfs_fpindex_free(sb, lba) == (1UL << HASH_SLOT_NUM) - 1 &&
+		!himfs_fpindex_overflow(sb, lba);
+}
+
+static bool warmup_used(struct super_block *sb, struct himfs_meta_block *meta_block)
+{
+	return hash_bucket_valid(sb, meta_block) &&
+		((meta_block->slot_bitmap[0] & ((1UL << HASH_SLOT_NUM) - 1)) || meta_block->overflow);
+}
+
+/* 整段先预读再逐个解析，返回放进缓存的桶数，读盘失败返回 -EIO */
+static int warmup_chunk(struct himfs_warmup *wu, lba_t start, lba_t end)
+{
+	struct super_block *sb = wu->sb;
+	bool bcache = himfs_bcache_enabled(sb);
+	struct himfs_cbucket *cb;
+	struct buffer_head *bh;
+	struct blk_plug plug;
+	int cached = 0;
+	int reads = 0;
+	lba_t lba;
+
+	blk_start_plug(&plug);
+	for (lba = start; lba < end; ++lba)
+	{
+		if (!warmup_skip(sb, lba) && !himfs_bcache_cached(sb, lba))
+		{
+			sb_breadahead(sb, lba);
+		}
+	}
+	blk_finish_plug(&plug);
+
+	for (lba = start; lba < end; ++lba)
+	{
+		if (warmup_skip(sb, lba) || himfs_bcache_cached(sb, lba))
+		{
+			continue;
+		}
+
+		bh = sb_bread(sb, lba);
+		if (unlikely(!bh))
+		{
+			printk(KERN_ERR "himfs: warmup read bucket %llu fail\n", lba);
+			return -EIO;
+		}
+		++reads;
+
+		if (!warmup_used(sb, (struct himfs_meta_block *)bh->b_data))
+		{
+			brelse(bh);
+			continue;
+		}
+
+		if (bcache)
+		{
+			/* 查找可能已经抢先放了，或者桶刚被改过，在桶锁下重新解析 */
+			hash_lock_bucket(sb, lba);
+			if (!himfs_bcache_cached(sb, lba))
+			{
+				cb = himfs_bcache_build(sb, bh);
+				if (cb)
+				{
+					himfs_bcache_insert(sb, cb);
+					++cached;
+				}
+			}
+			hash_unlock_bucket(sb, lba);
+		}
+		else
+		{
+			++cached;
+		}
+		brelse(bh);
+	}
+
+	himfs_stat_add(sb, HIMFS_STAT_WARMUP_READ, reads);
+	return cached;
+}
+
+/* 读得比 mbps 快就睡到回到限速线上，返回 true 表示睡的时候被要求停下 */
+static bool warmup_throttle(struct himfs_warmup *wu)
+{
+	u64 elapsed_ms, allowed_kb, done_kb;
+	unsigned long timeout;
+
+	if (!wu->mbps)
+	{
+		return READ_ONCE(wu->stop);
+	}
+
+	elapsed_ms = div_u64(ktime_get_ns() - wu->start_ns, NSEC_PER_MSEC);
+	allowed_kb = div_u64(elapsed_ms * wu->mbps * 1024, MSEC_PER_SEC);
+	done_kb = (u64)atomic64_read(&wu->done) << (BLOCK_SHIFT - 10);
+	if (done_kb <= allowed_kb)
+	{
+		return READ_ONCE(wu->stop);
+	}
+
+	timeout = msecs_to_jiffies(div_u64((done_kb - allowed_kb) * MSEC_PER_SEC, wu->mbps * 1024));
+	wait_event_timeout(wu->wait, READ_ONCE(wu->stop), max(timeout, 1UL));
+	return READ_ONCE(wu->stop);
+}
+
+static void warmup_finish(struct himfs_warmup *wu, int state)
+{
+	cmpxchg(&wu->state, HIMFS_WARMUP_RUNNING, state);
+	WRITE_ONCE(wu->stop, true);
+	wake_up_all(&wu->wait);
+}
+
+static void warmup_work(struct work_struct *work)
+{
+	struct himfs_warmup *wu = container_of(work, struct warmup_worker, work)->wu;
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(wu->sb);
+	lba_t start, end;
+	int cached;
+
+	while (!warmup_throttle(wu))
+	{
+		start = atomic64_fetch_add(HIMFS_WARMUP_CHUNK, &wu->cursor);
+		if (start >= himfs_sb->meta_end)
+		{
+			break;
+		}
+		end = min_t(lba_t, start + HIMFS_WARMUP_CHUNK, himfs_sb->meta_end);
+
+		cached = warmup_chunk(wu, start, end);
+		if (cached < 0)
+		{
+			warmup_finish(wu, HIMFS_WARMUP_STOPPED);
+			break;
+		}
+		atomic64_add(end - start, &wu->done);
+		atomic64_add(cached, &wu->cached);
+
+		if (himfs_bcache_full(wu->sb))
+		{
+			warmup_finish(wu, HIMFS_WARMUP_FULL);
+			break;
+		}
+		cond_resched();
+	}
+
+	if (atomic_dec_and_test(&wu->running))
+	{
+		wu->end_ns = ktime_get_ns();
+		cmpxchg(&wu->state, HIMFS_WARMUP_RUNNING,
+			READ_ONCE(wu->stop) ? HIMFS_WARMUP_STOPPED : HIMFS_WARMUP_DONE);
+		printk(KERN_INFO "himfs: warmup %s, %lld of %u buckets, %lld cached, %llu ms\n",
+			warmup_states[wu->state], atomic64_read(&wu->done), himfs_sb->meta_blocks,
+			atomic64_read(&wu->cached), div_u64(wu->end_ns - wu->start_ns, NSEC_PER_MSEC));
+	}
+}
+
+/* threads 和 mbps 为 0 时取挂载参数 */
+int himfs_warmup_start(struct super_block *sb, unsigned int threads, unsigned int mbps)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_warmup *wu = himfs_sb->warmup;
+	int i;
+
+	if (!wu)
+	{
+		return -EOPNOTSUPP;
+	}
+
+	mutex_lock(&wu->mutex);
+	if (atomic_read(&wu->running))
+	{
+		mutex_unlock(&wu->mutex);
+		return -EBUSY;
+	}
+	/* 上一次的最后一个工作线程可能还没从 warmup_work 返回 */
+	flush_workqueue(wu->wq);
+
+	wu->threads = clamp_t(unsigned int, threads ? threads : himfs_sb->warmup_threads,
+		1, HIMFS_WARMUP_THREADS_MAX);
+	wu->mbps = mbps ? mbps : himfs_sb->warmup_mbps;
+	atomic64_set(&wu->cursor, himfs_sb->meta_start);
+	atomic64_set(&wu->done, 0);
+	atomic64_set(&wu->cached, 0);
+	atomic_set(&wu->running, wu->threads);
+	WRITE_ONCE(wu->stop, false);
+	wu->state = HIMFS_WARMUP_RUNNING;
+	wu->start_ns = ktime_get_ns();
+	wu->end_ns = 0;
+
+	for (i = 0; i < wu->threads; ++i)
+	{
+		queue_work(wu->wq, &wu->workers[i].work);
+	}
+	mutex_unlock(&wu->mutex);
+
+	printk(KERN_INFO "himfs: warmup start, %u threads, %u MB/s\n", wu->threads, wu->mbps);
+	return 0;
+}
+
+/* 停下并等所有工作线程退出 */
+void himfs_warmup_stop(struct super_block *sb)
+{
+	struct himfs_warmup *wu = HIMFS_SB(sb)->warmup;
+
+	if (!wu)
+	{
+		return;
+	}
+
+	mutex_lock(&wu->mutex);
+	WRITE_ONCE(wu->stop, true);
+	wake_up_all(&wu->wait);
+	flush_workqueue(wu->wq);
+	mutex_unlock(&wu->mutex);
+}
+
+void himfs_warmup_status(struct super_block *sb, struct himfs_warmup_ctl *ctl)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_warmup *wu = himfs_sb->warmup;
+	u64 end;
+
+	ctl->total = himfs_sb->meta_blocks;
+	if (!wu)
+	{
+		ctl->state = HIMFS_WARMUP_IDLE;
+		ctl->threads = ctl->mbps = 0;
+		ctl->done = ctl->cached = ctl->elapsed_ns = 0;
+		return;
+	}
+
+	ctl->state = READ_ONCE(wu->state);
+	ctl->threads = wu->threads;
+	ctl->mbps = wu->mbps;
+	ctl->done = atomic64_read(&wu->done);
+	ctl->cached = atomic64_read(&wu->cached);
+	end = READ_ONCE(wu->end_ns);
+	if (ctl->state == HIMFS_WARMUP_IDLE)
+	{
+		ctl->elapsed_ns = 0;
+	}
+	else
+	{
+		ctl->elapsed_ns = (end ? end : ktime_get_ns()) - wu->start_ns;
+	}
+}
+
+static int warmup_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	struct himfs_warmup_ctl ctl;
+	u64 ms;
+
+	himfs_warmup_status(sb, &ctl);
+	ms = div_u64(ctl.elapsed_ns, NSEC_PER_MSEC);
+
+	seq_printf(m, "%-16s %s\n", "state", warmup_states[ctl.state]);
+	seq_printf(m, "%-16s %u\n", "threads", ctl.threads);
+	seq_printf(m, "%-16s %u\n", "mbps_limit", ctl.mbps);
+	seq_printf(m, "%-16s %llu\n", "done", ctl.done);
+	seq_printf(m, "%-16s %llu\n", "total", ctl.total);
+	seq_printf(m, "%-16s %llu\n", "percent", ctl.total ? div64_u64(ctl.done * 100, ctl.total) : 0);
+	seq_printf(m, "%-16s %llu\n", "cached", ctl.cached);
+	seq_printf(m, "%-16s %llu\n", "elapsed_ms", ms);
+	seq_printf(m, "%-16s %llu\n", "mbps", ms ? div64_u64((ctl.done << BLOCK_SHIFT) * MSEC_PER_SEC >> 20, ms) : 0);
+
+	return 0;
+}
+
+int himfs_warmup_init(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_warmup *wu;
+	int i;
+
+	wu = kzalloc(sizeof(*wu), GFP_KERNEL);
+	if (!wu)
+	{
+		return -ENOMEM;
+	}
+	wu->wq = alloc_workqueue("himfs-warmup/%s", WQ_UNBOUND, HIMFS_WARMUP_THREADS_MAX, sb->s_id);
+	if (!wu->wq)
+	{
+		kfree(wu);
+		return -ENOMEM;
+	}
+	wu->sb = sb;
+	mutex_init(&wu->mutex);
+	init_waitqueue_head(&wu->wait);
+	wu->state = HIMFS_WARMUP_IDLE;
+	wu->threads = himfs_sb->warmup_threads;
+	wu->mbps = himfs_sb->warmup_mbps;
+	for (i = 0; i < HIMFS_WARMUP_THREADS_MAX; ++i)
+	{
+		wu->workers[i].wu = wu;
+		INIT_WORK(&wu->workers[i].work, warmup_work);
+	}
+
+	if (himfs_sb->stats && himfs_sb->stats->dir)
+	{
+		proc_create_single_data("warmup", 0444, himfs_sb->stats->dir, warmup_show, sb);
+	}
+
+	himfs_sb->warmup = wu;
+	return 0;
+}
+
+void himfs_warmup_exit(struct super_block *sb)
+{
+	struct himfs_sb_info *himfs_sb = HIMFS_SB(sb);
+	struct himfs_warmup *wu = himfs_sb->warmup;
+
+	if (!wu)
+	{
+		return;
+	}
+
+	if (himfs_sb->stats && himfs_sb->stats->dir)
+	{
+		remove_proc_entry("warmup", himfs_sb->stats->dir);
+	}
+	himfs_warmup_stop(sb);
+	himfs_sb->warmup = NULL;
+	destroy_workqueue(wu->wq);
+	kfree(wu);
+}
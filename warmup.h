@@ -0,0 +1,12 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+#include "himfs_d.h"
+#endif
+
+struct himfs_warmup_ctl;
+
+int himfs_warmup_init(struct super_block *sb);
+void himfs_warmup_exit(struct super_block *sb);
+int himfs_warmup_start(struct super_block *sb, unsigned int threads, unsigned int mbps);
+void himfs_warmup_stop(struct super_block *sb);
+void himfs_warmup_status(struct super_block *sb, struct himfs_warmup_ctl *ctl);